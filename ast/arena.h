@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+namespace monkey {
+    // 区域分配器: 节点在连续的大块内存中顺序分配, 随 Arena 一起整体释放.
+    // 树内部以裸指针互相引用, 不持有所有权.
+    class Arena {
+    public:
+        static const size_t BLOCK_SIZE = 64 * 1024;
+
+        Arena() : cur(nullptr), end(nullptr) {}
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        ~Arena() {
+            clear();
+        }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            void* mem = allocate(sizeof(T), alignof(T));
+            T* obj = new (mem) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value) {
+                destructors.push_back({obj, &destroy<T>});
+            }
+            return obj;
+        }
+
+        // 复制一段文本到 arena 中, 供运行时合成的 token 引用
+        std::string_view copy(std::string_view text) {
+            char* p = static_cast<char*>(allocate(text.size(), 1));
+            text.copy(p, text.size());
+            return std::string_view(p, text.size());
+        }
+
+        // 按分配的逆序析构所有对象, 然后一次性归还所有内存块
+        void clear() {
+            for (size_t i = destructors.size(); i > 0; --i) {
+                destructors[i - 1].fn(destructors[i - 1].obj);
+            }
+            destructors.clear();
+            for (auto block : blocks) {
+                std::free(block);
+            }
+            blocks.clear();
+            cur = end = nullptr;
+            used = 0;
+        }
+
+        // 已分配的字节数
+        size_t bytesUsed() const {
+            return used;
+        }
+
+    private:
+        struct Destructor {
+            void* obj;
+            void (*fn)(void*);
+        };
+
+        template <typename T>
+        static void destroy(void* p) {
+            static_cast<T*>(p)->~T();
+        }
+
+        void* allocate(size_t size, size_t align) {
+            size_t offset = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+            if (cur == nullptr || cur + offset + size > end) {
+                size_t blockSize = size + align > BLOCK_SIZE ? size + align : BLOCK_SIZE;
+                char* block = static_cast<char*>(std::malloc(blockSize));
+                if (block == nullptr) {
+                    throw std::bad_alloc();
+                }
+                blocks.push_back(block);
+                cur = block;
+                end = block + blockSize;
+                offset = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+            }
+            char* p = cur + offset;
+            cur = p + size;
+            used += size;
+            return p;
+        }
+
+        char* cur;
+        char* end;
+        size_t used = 0;
+        std::vector<char*> blocks;
+        std::vector<Destructor> destructors;
+    };
+} // namespace monkey
@@ -4,30 +4,133 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <unordered_map>
 
 #include "../token/token.h"
+#include "../object/alloc_stats.h"
 
 namespace monkey{
+    class Object;
+
+    // 节点类别: 每个节点在构造时确定, 求值/改写时据此 switch 分派
+    enum class NodeKind {
+        PROGRAM = 0,
+        // 语句
+        LET_STATEMENT,
+        RETURN_STATEMENT,
+        EXPRESSION_STATEMENT,
+        BLOCK_STATEMENT,
+        ASSIGN_STATEMENT,
+        WHILE_STATEMENT,
+        FOR_STATEMENT,
+        // 表达式
+        IDENTIFIER,
+        BOOLEAN,
+        INTEGER_LITERAL,
+        STRING_LITERAL,
+        ARRAY_LITERAL,
+        INDEX_EXPRESSION,
+        HASH_LITERAL,
+        PREFIX_EXPRESSION,
+        INFIX_EXPRESSION,
+        IF_EXPRESSION,
+        FUNCTION_LITERAL,
+        CALL_EXPRESSION,
+        MACRO_LITERAL
+    };
+
+    const std::vector<std::string> NodeKindString = {
+        "Program",
+        "LetStatement",
+        "ReturnStatement",
+        "ExpressionStatement",
+        "BlockStatement",
+        "AssignStatement",
+        "WhileStatement",
+        "ForStatement",
+        "Identifier",
+        "Boolean",
+        "IntegerLiteral",
+        "StringLiteral",
+        "ArrayLiteral",
+        "IndexExpression",
+        "HashLiteral",
+        "PrefixExpression",
+        "InfixExpression",
+        "IfExpression",
+        "FunctionLiteral",
+        "CallExpression",
+        "MacroLiteral"
+    };
+
+    inline bool isStatementKind(NodeKind kind){
+        return kind >= NodeKind::LET_STATEMENT && kind <= NodeKind::FOR_STATEMENT;
+    }
+
+    inline bool isExpressionKind(NodeKind kind){
+        return kind >= NodeKind::IDENTIFIER;
+    }
+
+    // 作用域信息(由 Resolver 填充): 槽位下标 <-> 变量名
+    struct ScopeInfo{
+        std::vector<std::string> names;
+        std::unordered_map<std::string, int> index;
+
+        int find(const std::string& name) const{
+            auto it = index.find(name);
+            return it != index.end() ? it->second : -1;
+        }
+
+        int declare(const std::string& name){
+            int slot = find(name);
+            if(slot < 0){
+                slot = static_cast<int>(names.size());
+                names.push_back(name);
+                index[name] = slot;
+            }
+            return slot;
+        }
+    };
+
     // 基类抽象语法树节点
     struct Node{
+        const NodeKind kind;
+
+        Node(NodeKind kind) : kind(kind){
+            AllocStats::created(AllocStats::NODE, static_cast<int>(kind));
+        }
+
+        // clone() 以拷贝构造复制节点, 同样计入分配统计
+        Node(const Node& other) : kind(other.kind){
+            AllocStats::created(AllocStats::NODE, static_cast<int>(kind));
+        }
+
         virtual std::string TokenLiteral() = 0;
         virtual std::string String() = 0;
-        virtual ~Node() = default;
+        virtual ~Node(){
+            AllocStats::destroyed(AllocStats::NODE, static_cast<int>(kind));
+        }
     };
 
     // 语句节点
     struct Statement : Node{
+        Statement(NodeKind kind) : Node(kind){}
+
         virtual void statementNode() = 0;
     };
 
     // 表达式节点
     struct Expression : Node{
+        Expression(NodeKind kind) : Node(kind){}
+
         virtual void expressionNode() = 0;
     };
 
     // 程序树——根节点
     struct Program : Node{
-        std::vector<std::shared_ptr<Statement>> statements;
+        std::vector<Statement*> statements;
+
+        Program() : Node(NodeKind::PROGRAM){}
 
         std::string TokenLiteral() override{
             if(statements.size() > 0){
@@ -48,10 +151,17 @@ namespace monkey{
     /*** 基础表达式 ***/
     // 标识符
     struct Identifier : Expression{
+        enum{
+            UNRESOLVED = -1,    // 未解析, 运行时按名字查找
+            BUILTIN = -2        // 内置函数, slot 为内置函数下标
+        };
+
         Token token;
         std::string value;
+        int depth = UNRESOLVED; // 词法地址: 向外跳过的作用域层数
+        int slot = -1;          // 词法地址: 所在作用域内的槽位
 
-        Identifier(const Token& token, const std::string& value) : token(token), value(value){}
+        Identifier(const Token& token, const std::string& value) : Expression(NodeKind::IDENTIFIER), token(token), value(value){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -67,7 +177,7 @@ namespace monkey{
         Token token;
         bool value;
 
-        Boolean(const Token& token, bool value) : token(token), value(value){}
+        Boolean(const Token& token, bool value) : Expression(NodeKind::BOOLEAN), token(token), value(value){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -81,10 +191,10 @@ namespace monkey{
     // 整数
     struct IntegerLiteral : Expression{
         Token token;
-        int64_t value;
+        int64_t value = 0;
 
-        IntegerLiteral(const Token& token) : token(token) {}
-        IntegerLiteral(const Token& token, int64_t value) : token(token), value(value){}
+        IntegerLiteral(const Token& token) : Expression(NodeKind::INTEGER_LITERAL), token(token) {}
+        IntegerLiteral(const Token& token, int64_t value) : Expression(NodeKind::INTEGER_LITERAL), token(token), value(value){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -99,8 +209,9 @@ namespace monkey{
     struct StringLiteral : Expression{
         Token token;  // the '"' token
         std::string value;
+        std::shared_ptr<Object> constant;   // 优化器预先创建的运行时字符串, 为空时求值时再驻留
 
-        StringLiteral(const Token& token, const std::string& value) : token(token), value(value){}
+        StringLiteral(const Token& token, const std::string& value) : Expression(NodeKind::STRING_LITERAL), token(token), value(value){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -114,9 +225,9 @@ namespace monkey{
     // 数组
     struct ArrayLiteral : Expression{
         Token token;  // the '[' token
-        std::vector<std::shared_ptr<Expression>> elements;
+        std::vector<Expression*> elements;
 
-        ArrayLiteral(const Token& token) : token(token){}
+        ArrayLiteral(const Token& token) : Expression(NodeKind::ARRAY_LITERAL), token(token){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -125,7 +236,7 @@ namespace monkey{
         std::string String() override{
             std::string out;
             out += "[";
-            for(int i = 0; i < elements.size(); ++i){
+            for(size_t i = 0; i < elements.size(); ++i){
                 out += elements[i]->String();
                 if(i != elements.size() - 1){
                     out += ", ";
@@ -139,10 +250,10 @@ namespace monkey{
     // 索引表达式
     struct IndexExpression : Expression{
         Token token; // the '[' token
-        std::shared_ptr<Expression> left; // 被索引的对象
-        std::shared_ptr<Expression> index; // 索引
+        Expression* left = nullptr; // 被索引的对象
+        Expression* index = nullptr; // 索引
 
-        IndexExpression(const Token& token, std::shared_ptr<Expression> left) : token(token), left(left){}
+        IndexExpression(const Token& token, Expression* left) : Expression(NodeKind::INDEX_EXPRESSION), token(token), left(left){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -162,9 +273,9 @@ namespace monkey{
     // hash字面量
     struct HashLiteral : Expression{
         Token token; // the '{' token
-        std::map<std::shared_ptr<Expression>, std::shared_ptr<Expression>> pairs;
+        std::vector<std::pair<Expression*, Expression*>> pairs; // 按源码顺序
 
-        HashLiteral(const Token& token) : token(token){}
+        HashLiteral(const Token& token) : Expression(NodeKind::HASH_LITERAL), token(token){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -173,7 +284,7 @@ namespace monkey{
         std::string String() override{
             std::string out;
             out += "{";
-            int i = 0;
+            size_t i = 0;
             for(auto& pair : pairs){
                 out += pair.first->String();
                 out += ": ";
@@ -192,10 +303,10 @@ namespace monkey{
     // let 语句
     struct LetStatement : Statement{
         Token token; // the 'LET' token
-        std::shared_ptr<Identifier> name;
-        std::shared_ptr<Expression> value;
+        Identifier* name = nullptr;
+        Expression* value = nullptr;
 
-        LetStatement(const Token& token) : token(token){}
+        LetStatement(const Token& token) : Statement(NodeKind::LET_STATEMENT), token(token){}
 
         void statementNode() override{}
         std::string TokenLiteral() override{
@@ -217,9 +328,9 @@ namespace monkey{
     // return 语句
     struct ReturnStatement : Statement{
         Token token; // the 'return' token
-        std::shared_ptr<Expression> returnValue;
+        Expression* returnValue = nullptr;
 
-        ReturnStatement(const Token& token) : token(token){}
+        ReturnStatement(const Token& token) : Statement(NodeKind::RETURN_STATEMENT), token(token){}
 
         void statementNode() override{}
         std::string TokenLiteral() override{
@@ -239,9 +350,9 @@ namespace monkey{
     // 表达式语句
     struct ExpressionStatement : Statement{
         Token token; // the first token of the expression
-        std::shared_ptr<Expression> expression;
+        Expression* expression = nullptr;
 
-        ExpressionStatement(const Token& token) : token(token){}
+        ExpressionStatement(const Token& token) : Statement(NodeKind::EXPRESSION_STATEMENT), token(token){}
 
         void statementNode() override{}
         std::string TokenLiteral() override{
@@ -258,9 +369,9 @@ namespace monkey{
     // 块语句
     struct BlockStatement : Statement{
         Token token; // the '{' token
-        std::vector<std::shared_ptr<Statement>> statements;
+        std::vector<Statement*> statements;
 
-        BlockStatement(const Token& token) : token(token){}
+        BlockStatement(const Token& token) : Statement(NodeKind::BLOCK_STATEMENT), token(token){}
 
         void statementNode() override{}
         std::string TokenLiteral() override{
@@ -275,14 +386,85 @@ namespace monkey{
         }
     };
 
+    // 赋值语句: 修改已有绑定
+    struct AssignStatement : Statement{
+        Token token; // the '=' token
+        Identifier* name = nullptr;
+        Expression* value = nullptr;
+
+        AssignStatement(const Token& token) : Statement(NodeKind::ASSIGN_STATEMENT), token(token){}
+
+        void statementNode() override{}
+        std::string TokenLiteral() override{
+            return token.getLiteral();
+        }
+        std::string String() override{
+            std::string out;
+            out += name->String();
+            out += " = ";
+            if(value != nullptr){
+                out += value->String();
+            }
+            out += ";";
+            return out;
+        }
+    };
+
+    // while 循环
+    struct WhileStatement : Statement{
+        Token token; // the 'while' token
+        Expression* condition = nullptr;
+        BlockStatement* body = nullptr;
+
+        WhileStatement(const Token& token) : Statement(NodeKind::WHILE_STATEMENT), token(token){}
+
+        void statementNode() override{}
+        std::string TokenLiteral() override{
+            return token.getLiteral();
+        }
+        std::string String() override{
+            std::string out;
+            out += "while";
+            out += condition->String();
+            out += " ";
+            out += body->String();
+            return out;
+        }
+    };
+
+    // for-in 循环: 依次把数组元素绑定到循环变量
+    struct ForStatement : Statement{
+        Token token; // the 'for' token
+        Identifier* variable = nullptr;
+        Expression* iterable = nullptr;
+        BlockStatement* body = nullptr;
+
+        ForStatement(const Token& token) : Statement(NodeKind::FOR_STATEMENT), token(token){}
+
+        void statementNode() override{}
+        std::string TokenLiteral() override{
+            return token.getLiteral();
+        }
+        std::string String() override{
+            std::string out;
+            out += "for(";
+            out += variable->String();
+            out += " in ";
+            out += iterable->String();
+            out += ") ";
+            out += body->String();
+            return out;
+        }
+    };
+
     /*** 复杂表达式 ***/
     // 前缀表达式
     struct PrefixExpression : Expression{
         Token token;
         std::string op;
-        std::shared_ptr<Expression> right;
+        Expression* right = nullptr;
 
-        PrefixExpression(const Token& token, const std::string& op) : token(token), op(op){}
+        PrefixExpression(const Token& token, const std::string& op) : Expression(NodeKind::PREFIX_EXPRESSION), token(token), op(op){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -301,11 +483,11 @@ namespace monkey{
     // 中缀表达式
     struct InfixExpression : Expression{
         Token token;
-        std::shared_ptr<Expression> left;
+        Expression* left = nullptr;
         std::string op;
-        std::shared_ptr<Expression> right;
+        Expression* right = nullptr;
 
-        InfixExpression(const Token& token, const std::string& op, std::shared_ptr<Expression> left) : token(token), op(op), left(left){}
+        InfixExpression(const Token& token, const std::string& op, Expression* left) : Expression(NodeKind::INFIX_EXPRESSION), token(token), left(left), op(op){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -325,11 +507,11 @@ namespace monkey{
     // if表达式
     struct IfExpression : Expression{
         Token token; // the 'if' token
-        std::shared_ptr<Expression> condition; // if 条件
-        std::shared_ptr<BlockStatement> consequence; // if 条件为真时执行的语句
-        std::shared_ptr<BlockStatement> alternative; // if 条件为假时执行的语句(可有可无)
+        Expression* condition = nullptr; // if 条件
+        BlockStatement* consequence = nullptr; // if 条件为真时执行的语句
+        BlockStatement* alternative = nullptr; // if 条件为假时执行的语句(可有可无)
 
-        IfExpression(const Token& token) : token(token){}
+        IfExpression(const Token& token) : Expression(NodeKind::IF_EXPRESSION), token(token){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -352,10 +534,12 @@ namespace monkey{
     // 函数定义字面量
     struct FunctionLiteral : Expression{
         Token token; // the 'fn' token
-        std::vector<std::shared_ptr<Identifier>> parameters; // 参数列表
-        std::shared_ptr<BlockStatement> body; // 函数体
+        std::vector<Identifier*> parameters; // 参数列表
+        BlockStatement* body = nullptr; // 函数体
+        std::shared_ptr<ScopeInfo> scope; // 参数及局部变量的槽位(由 Resolver 填充)
+        std::string name; // 以 let 绑定时的名字, 匿名函数为空
 
-        FunctionLiteral(const Token& token) : token(token){}
+        FunctionLiteral(const Token& token) : Expression(NodeKind::FUNCTION_LITERAL), token(token){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -365,7 +549,7 @@ namespace monkey{
             std::string out;
             out += token.getLiteral();
             out += "(";
-            for(int i = 0; i < parameters.size(); ++i){
+            for(size_t i = 0; i < parameters.size(); ++i){
                 out += parameters[i]->String();
                 if(i != parameters.size() - 1){
                     out += ", ";
@@ -380,10 +564,10 @@ namespace monkey{
     // 函数调用表达式
     struct CallExpression : Expression{
         Token token; // the '(' token
-        std::shared_ptr<Expression> function; // 函数
-        std::vector<std::shared_ptr<Expression>> arguments; // 参数列表
+        Expression* function = nullptr; // 函数
+        std::vector<Expression*> arguments; // 参数列表
 
-        CallExpression(const Token& token, std::shared_ptr<Expression> function) : token(token), function(function){}
+        CallExpression(const Token& token, Expression* function) : Expression(NodeKind::CALL_EXPRESSION), token(token), function(function){}
 
         void expressionNode() override{}
         std::string TokenLiteral() override{
@@ -393,7 +577,7 @@ namespace monkey{
             std::string out;
             out += function->String();
             out += "(";
-            for(int i = 0; i < arguments.size(); ++i){
+            for(size_t i = 0; i < arguments.size(); ++i){
                 out += arguments[i]->String();
                 if(i != arguments.size() - 1){
                     out += ", ";
@@ -407,10 +591,10 @@ namespace monkey{
     // 宏定义字面量
     struct MacroLiteral : Expression {
         Token token; // the 'macro' token
-        std::vector<std::shared_ptr<Identifier>> parameters; // 参数列表
-        std::shared_ptr<BlockStatement> body; // 函数体
+        std::vector<Identifier*> parameters; // 参数列表
+        BlockStatement* body = nullptr; // 函数体
 
-        MacroLiteral(const Token& token) : token(token) {}
+        MacroLiteral(const Token& token) : Expression(NodeKind::MACRO_LITERAL), token(token) {}
 
         void expressionNode() override {}
         std::string TokenLiteral() override {
@@ -420,7 +604,7 @@ namespace monkey{
             std::string out;
             out += token.getLiteral();
             out += "(";
-            for (int i = 0; i < parameters.size(); ++i) {
+            for (size_t i = 0; i < parameters.size(); ++i) {
                 out += parameters[i]->String();
                 if (i != parameters.size() - 1) {
                     out += ", ";
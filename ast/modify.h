@@ -3,78 +3,297 @@
 #include <string>
 #include <functional>
 #include "ast.h"
+#include "arena.h"
 
 namespace monkey {
-    using modifierFunc = std::function<std::shared_ptr<Node>(std::shared_ptr<Node>)>;
+    using modifierFunc = std::function<Node*(Node*)>;
+    using keepArgumentsFunc = std::function<bool(CallExpression*)>;
 
-    std::shared_ptr<Node> modify(std::shared_ptr<Node> node, modifierFunc modifier) {
-        if (std::dynamic_pointer_cast<Program>(node)) {
-            auto program = std::dynamic_pointer_cast<Program>(node);
-            for (auto& stmt : program->statements) {
-                stmt = std::dynamic_pointer_cast<Statement>(modify(stmt, modifier));
-            }
-        } 
-        else if (std::dynamic_pointer_cast<ExpressionStatement>(node)) {
-            auto stmt = std::dynamic_pointer_cast<ExpressionStatement>(node);
-            stmt->expression = std::dynamic_pointer_cast<Expression>(modify(stmt->expression, modifier));
-        } 
-        else if (std::dynamic_pointer_cast<InfixExpression>(node)) {
-            auto expr = std::dynamic_pointer_cast<InfixExpression>(node);
-            expr->left = std::dynamic_pointer_cast<Expression>(modify(expr->left, modifier));
-            expr->right = std::dynamic_pointer_cast<Expression>(modify(expr->right, modifier));
-        } 
-        else if (std::dynamic_pointer_cast<PrefixExpression>(node)) {
-            auto expr = std::dynamic_pointer_cast<PrefixExpression>(node);
-            expr->right = std::dynamic_pointer_cast<Expression>(modify(expr->right, modifier));
-        } 
-        else if (std::dynamic_pointer_cast<IndexExpression>(node)) {
-            auto expr = std::dynamic_pointer_cast<IndexExpression>(node);
-            expr->left = std::dynamic_pointer_cast<Expression>(modify(expr->left, modifier));
-            expr->index = std::dynamic_pointer_cast<Expression>(modify(expr->index, modifier));
-        } 
-        else if (std::dynamic_pointer_cast<IfExpression>(node)) {
-            auto expr = std::dynamic_pointer_cast<IfExpression>(node);
-            expr->condition = std::dynamic_pointer_cast<Expression>(modify(expr->condition, modifier));
-            expr->consequence = std::dynamic_pointer_cast<BlockStatement>(modify(expr->consequence, modifier));
-            if (expr->alternative) {
-                expr->alternative = std::dynamic_pointer_cast<BlockStatement>(modify(expr->alternative, modifier));
-            }
-        } 
-        else if (std::dynamic_pointer_cast<BlockStatement>(node)) {
-            auto block = std::dynamic_pointer_cast<BlockStatement>(node);
-            for (auto& stmt : block->statements) {
-                stmt = std::dynamic_pointer_cast<Statement>(modify(stmt, modifier));
-            }
-        } 
-        else if (std::dynamic_pointer_cast<ReturnStatement>(node)) {
-            auto stmt = std::dynamic_pointer_cast<ReturnStatement>(node);
-            stmt->returnValue = std::dynamic_pointer_cast<Expression>(modify(stmt->returnValue, modifier));
-        } 
-        else if (std::dynamic_pointer_cast<LetStatement>(node)) {
-            auto stmt = std::dynamic_pointer_cast<LetStatement>(node);
-            stmt->value = std::dynamic_pointer_cast<Expression>(modify(stmt->value, modifier));
-        } 
-        else if (std::dynamic_pointer_cast<FunctionLiteral>(node)) {
-            auto lit = std::dynamic_pointer_cast<FunctionLiteral>(node);
-            for (auto& param : lit->parameters) {
-                param = std::dynamic_pointer_cast<Identifier>(modify(param, modifier));
-            }
-            lit->body = std::dynamic_pointer_cast<BlockStatement>(modify(lit->body, modifier));
-        } else if (std::dynamic_pointer_cast<ArrayLiteral>(node)) {
-            auto lit = std::dynamic_pointer_cast<ArrayLiteral>(node);
-            for (auto& elem : lit->elements) {
-                elem = std::dynamic_pointer_cast<Expression>(modify(elem, modifier));
-            }
-        } else if (std::dynamic_pointer_cast<HashLiteral>(node)) {
-            std::map<std::shared_ptr<Expression>, std::shared_ptr<Expression>> newPairs;
-            auto lit = std::dynamic_pointer_cast<HashLiteral>(node);
-            for (auto& pair : lit->pairs) {
-                auto newKey = std::dynamic_pointer_cast<Expression>(modify(pair.first, modifier));
-                auto newValue = std::dynamic_pointer_cast<Expression>(modify(pair.second, modifier));
-                newPairs.insert(std::make_pair(newKey, newValue));
-            }
-            lit->pairs = newPairs; 
-        }  
-        return modifier(node); 
+    // 改写结果按类别检查后再放回父节点, 类别不符时置空
+    inline Statement* toStatement(Node* node) {
+        if (node != nullptr && isStatementKind(node->kind)) {
+            return static_cast<Statement*>(node);
         }
+        return nullptr;
+    }
+
+    inline Expression* toExpression(Node* node) {
+        if (node != nullptr && isExpressionKind(node->kind)) {
+            return static_cast<Expression*>(node);
+        }
+        return nullptr;
+    }
+
+    inline BlockStatement* toBlockStatement(Node* node) {
+        if (node != nullptr && node->kind == NodeKind::BLOCK_STATEMENT) {
+            return static_cast<BlockStatement*>(node);
+        }
+        return nullptr;
+    }
+
+    inline Identifier* toIdentifier(Node* node) {
+        if (node != nullptr && node->kind == NodeKind::IDENTIFIER) {
+            return static_cast<Identifier*>(node);
+        }
+        return nullptr;
+    }
+
+    // 后序遍历改写子树: 先改写子节点, 再把节点本身交给 modifier.
+    // quote 的实参保持源码形式, 不被改写; keepArguments 对某个调用返回 true 时同样不改写它的实参(如宏调用, 实参原样交给宏)
+    Node* modify(Node* node, modifierFunc modifier, const keepArgumentsFunc& keepArguments = nullptr) {
+        if (node == nullptr) {
+            return modifier(node);
+        }
+        switch (node->kind) {
+            case NodeKind::PROGRAM: {
+                auto program = static_cast<Program*>(node);
+                for (auto& stmt : program->statements) {
+                    stmt = toStatement(modify(stmt, modifier, keepArguments));
+                }
+                break;
+            }
+            case NodeKind::EXPRESSION_STATEMENT: {
+                auto stmt = static_cast<ExpressionStatement*>(node);
+                stmt->expression = toExpression(modify(stmt->expression, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::INFIX_EXPRESSION: {
+                auto expr = static_cast<InfixExpression*>(node);
+                expr->left = toExpression(modify(expr->left, modifier, keepArguments));
+                expr->right = toExpression(modify(expr->right, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::PREFIX_EXPRESSION: {
+                auto expr = static_cast<PrefixExpression*>(node);
+                expr->right = toExpression(modify(expr->right, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::INDEX_EXPRESSION: {
+                auto expr = static_cast<IndexExpression*>(node);
+                expr->left = toExpression(modify(expr->left, modifier, keepArguments));
+                expr->index = toExpression(modify(expr->index, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::IF_EXPRESSION: {
+                auto expr = static_cast<IfExpression*>(node);
+                expr->condition = toExpression(modify(expr->condition, modifier, keepArguments));
+                expr->consequence = toBlockStatement(modify(expr->consequence, modifier, keepArguments));
+                if (expr->alternative) {
+                    expr->alternative = toBlockStatement(modify(expr->alternative, modifier, keepArguments));
+                }
+                break;
+            }
+            case NodeKind::BLOCK_STATEMENT: {
+                auto block = static_cast<BlockStatement*>(node);
+                for (auto& stmt : block->statements) {
+                    stmt = toStatement(modify(stmt, modifier, keepArguments));
+                }
+                break;
+            }
+            case NodeKind::RETURN_STATEMENT: {
+                auto stmt = static_cast<ReturnStatement*>(node);
+                stmt->returnValue = toExpression(modify(stmt->returnValue, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::LET_STATEMENT: {
+                auto stmt = static_cast<LetStatement*>(node);
+                stmt->value = toExpression(modify(stmt->value, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::ASSIGN_STATEMENT: {
+                auto stmt = static_cast<AssignStatement*>(node);
+                stmt->value = toExpression(modify(stmt->value, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::WHILE_STATEMENT: {
+                auto stmt = static_cast<WhileStatement*>(node);
+                stmt->condition = toExpression(modify(stmt->condition, modifier, keepArguments));
+                stmt->body = toBlockStatement(modify(stmt->body, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::FOR_STATEMENT: {
+                auto stmt = static_cast<ForStatement*>(node);
+                stmt->iterable = toExpression(modify(stmt->iterable, modifier, keepArguments));
+                stmt->body = toBlockStatement(modify(stmt->body, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::FUNCTION_LITERAL: {
+                auto lit = static_cast<FunctionLiteral*>(node);
+                for (auto& param : lit->parameters) {
+                    param = toIdentifier(modify(param, modifier, keepArguments));
+                }
+                lit->body = toBlockStatement(modify(lit->body, modifier, keepArguments));
+                break;
+            }
+            case NodeKind::ARRAY_LITERAL: {
+                auto lit = static_cast<ArrayLiteral*>(node);
+                for (auto& elem : lit->elements) {
+                    elem = toExpression(modify(elem, modifier, keepArguments));
+                }
+                break;
+            }
+            case NodeKind::HASH_LITERAL: {
+                auto lit = static_cast<HashLiteral*>(node);
+                for (auto& pair : lit->pairs) {
+                    pair.first = toExpression(modify(pair.first, modifier, keepArguments));
+                    pair.second = toExpression(modify(pair.second, modifier, keepArguments));
+                }
+                break;
+            }
+            case NodeKind::CALL_EXPRESSION: {
+                auto call = static_cast<CallExpression*>(node);
+                call->function = toExpression(modify(call->function, modifier, keepArguments));
+                if ((call->function != nullptr && call->function->TokenLiteral() == "quote") || (keepArguments && keepArguments(call))) {
+                    break;
+                }
+                for (auto& arg : call->arguments) {
+                    arg = toExpression(modify(arg, modifier, keepArguments));
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        return modifier(node);
+    }
+
+    template <typename T>
+    T* cloneNode(Node* node, Arena& arena) {
+        return arena.make<T>(*static_cast<T*>(node));
+    }
+
+    // 深拷贝一棵子树, 新节点分配在 arena 中. 标识符的词法地址和函数的作用域信息被清空, 需要重新解析
+    inline Node* clone(Node* node, Arena& arena) {
+        if (node == nullptr) {
+            return nullptr;
+        }
+        switch (node->kind) {
+            case NodeKind::PROGRAM: {
+                auto program = cloneNode<Program>(node, arena);
+                for (auto& stmt : program->statements) {
+                    stmt = toStatement(clone(stmt, arena));
+                }
+                return program;
+            }
+            case NodeKind::LET_STATEMENT: {
+                auto stmt = cloneNode<LetStatement>(node, arena);
+                stmt->name = toIdentifier(clone(stmt->name, arena));
+                stmt->value = toExpression(clone(stmt->value, arena));
+                return stmt;
+            }
+            case NodeKind::RETURN_STATEMENT: {
+                auto stmt = cloneNode<ReturnStatement>(node, arena);
+                stmt->returnValue = toExpression(clone(stmt->returnValue, arena));
+                return stmt;
+            }
+            case NodeKind::EXPRESSION_STATEMENT: {
+                auto stmt = cloneNode<ExpressionStatement>(node, arena);
+                stmt->expression = toExpression(clone(stmt->expression, arena));
+                return stmt;
+            }
+            case NodeKind::BLOCK_STATEMENT: {
+                auto block = cloneNode<BlockStatement>(node, arena);
+                for (auto& stmt : block->statements) {
+                    stmt = toStatement(clone(stmt, arena));
+                }
+                return block;
+            }
+            case NodeKind::ASSIGN_STATEMENT: {
+                auto stmt = cloneNode<AssignStatement>(node, arena);
+                stmt->name = toIdentifier(clone(stmt->name, arena));
+                stmt->value = toExpression(clone(stmt->value, arena));
+                return stmt;
+            }
+            case NodeKind::WHILE_STATEMENT: {
+                auto stmt = cloneNode<WhileStatement>(node, arena);
+                stmt->condition = toExpression(clone(stmt->condition, arena));
+                stmt->body = toBlockStatement(clone(stmt->body, arena));
+                return stmt;
+            }
+            case NodeKind::FOR_STATEMENT: {
+                auto stmt = cloneNode<ForStatement>(node, arena);
+                stmt->variable = toIdentifier(clone(stmt->variable, arena));
+                stmt->iterable = toExpression(clone(stmt->iterable, arena));
+                stmt->body = toBlockStatement(clone(stmt->body, arena));
+                return stmt;
+            }
+            case NodeKind::IDENTIFIER: {
+                auto ident = cloneNode<Identifier>(node, arena);
+                ident->depth = Identifier::UNRESOLVED;
+                ident->slot = -1;
+                return ident;
+            }
+            case NodeKind::BOOLEAN:
+                return cloneNode<Boolean>(node, arena);
+            case NodeKind::INTEGER_LITERAL:
+                return cloneNode<IntegerLiteral>(node, arena);
+            case NodeKind::STRING_LITERAL:
+                return cloneNode<StringLiteral>(node, arena);
+            case NodeKind::ARRAY_LITERAL: {
+                auto lit = cloneNode<ArrayLiteral>(node, arena);
+                for (auto& elem : lit->elements) {
+                    elem = toExpression(clone(elem, arena));
+                }
+                return lit;
+            }
+            case NodeKind::INDEX_EXPRESSION: {
+                auto expr = cloneNode<IndexExpression>(node, arena);
+                expr->left = toExpression(clone(expr->left, arena));
+                expr->index = toExpression(clone(expr->index, arena));
+                return expr;
+            }
+            case NodeKind::HASH_LITERAL: {
+                auto lit = cloneNode<HashLiteral>(node, arena);
+                for (auto& pair : lit->pairs) {
+                    pair.first = toExpression(clone(pair.first, arena));
+                    pair.second = toExpression(clone(pair.second, arena));
+                }
+                return lit;
+            }
+            case NodeKind::PREFIX_EXPRESSION: {
+                auto expr = cloneNode<PrefixExpression>(node, arena);
+                expr->right = toExpression(clone(expr->right, arena));
+                return expr;
+            }
+            case NodeKind::INFIX_EXPRESSION: {
+                auto expr = cloneNode<InfixExpression>(node, arena);
+                expr->left = toExpression(clone(expr->left, arena));
+                expr->right = toExpression(clone(expr->right, arena));
+                return expr;
+            }
+            case NodeKind::IF_EXPRESSION: {
+                auto expr = cloneNode<IfExpression>(node, arena);
+                expr->condition = toExpression(clone(expr->condition, arena));
+                expr->consequence = toBlockStatement(clone(expr->consequence, arena));
+                expr->alternative = toBlockStatement(clone(expr->alternative, arena));
+                return expr;
+            }
+            case NodeKind::FUNCTION_LITERAL: {
+                auto lit = cloneNode<FunctionLiteral>(node, arena);
+                for (auto& param : lit->parameters) {
+                    param = toIdentifier(clone(param, arena));
+                }
+                lit->body = toBlockStatement(clone(lit->body, arena));
+                lit->scope = nullptr;
+                return lit;
+            }
+            case NodeKind::CALL_EXPRESSION: {
+                auto call = cloneNode<CallExpression>(node, arena);
+                call->function = toExpression(clone(call->function, arena));
+                for (auto& arg : call->arguments) {
+                    arg = toExpression(clone(arg, arena));
+                }
+                return call;
+            }
+            case NodeKind::MACRO_LITERAL: {
+                auto lit = cloneNode<MacroLiteral>(node, arena);
+                for (auto& param : lit->parameters) {
+                    param = toIdentifier(clone(param, arena));
+                }
+                lit->body = toBlockStatement(clone(lit->body, arena));
+                return lit;
+            }
+        }
+        return nullptr;
+    }
 } // namespace monkey
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <ostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+
+#include "../repl.h"
+
+namespace monkey {
+    // 批量运行: 在线程池上并行执行大量互不相关的脚本. 每个脚本使用独立的 Interpreter,
+    // puts 和结果输出写入各自的缓冲区, 再按输入顺序依次写出.
+    // 指定了 prelude 时每个工作线程只加载一次, 该线程上的脚本都以它为底层.
+    class BatchRunner {
+    public:
+        // jobs 为工作线程数, 0 表示取硬件并发数
+        BatchRunner(const Options& options, size_t jobs) : options(options), jobs(jobs) {
+            if (this->jobs == 0) {
+                this->jobs = std::max(1u, std::thread::hardware_concurrency());
+            }
+            // 性能分析和追踪的记录器不是线程安全的
+            this->options.profiler = nullptr;
+            this->options.tracer = nullptr;
+            this->options.banner = false;
+        }
+
+        // 收集要运行的脚本: path 为目录时取其中所有常规文件(按文件名排序);
+        // 否则视为清单文件, 每行一个路径, 忽略空行和 # 开头的行, 相对路径相对于清单所在目录
+        static bool collect(const std::string& path, std::vector<std::string>& scripts, std::string& error) {
+            namespace fs = std::filesystem;
+            std::error_code ec;
+            if (fs::is_directory(path, ec)) {
+                for (auto& entry : fs::directory_iterator(path, ec)) {
+                    if (entry.is_regular_file()) {
+                        scripts.push_back(entry.path().string());
+                    }
+                }
+                if (ec) {
+                    error = "cannot read directory " + path + ": " + ec.message();
+                    return false;
+                }
+                std::sort(scripts.begin(), scripts.end());
+                return true;
+            }
+            std::ifstream manifest(path);
+            if (!manifest) {
+                error = "cannot open batch manifest " + path;
+                return false;
+            }
+            fs::path base = fs::path(path).parent_path();
+            std::string line;
+            while (std::getline(manifest, line)) {
+                auto begin = line.find_first_not_of(" \t\r");
+                if (begin == std::string::npos || line[begin] == '#') {
+                    continue;
+                }
+                auto end = line.find_last_not_of(" \t\r");
+                fs::path script = line.substr(begin, end - begin + 1);
+                scripts.push_back(script.is_absolute() ? script.string() : (base / script).string());
+            }
+            return true;
+        }
+
+        // 执行所有脚本, 每个脚本的输出以 "==> 路径 <==" 开头, 按输入顺序写入 out; 返回失败的脚本数
+        size_t run(const std::vector<std::string>& scripts, std::ostream& out) {
+            results.assign(scripts.size(), Result());
+            next = 0;
+            std::vector<std::thread> workers;
+            size_t n = std::min(jobs, scripts.size());
+            for (size_t i = 0; i < n; ++i) {
+                workers.emplace_back([this, &scripts] { work(scripts); });
+            }
+            // 主线程按顺序等待并写出结果, 已写出的结果立即释放
+            size_t failed = 0;
+            for (size_t i = 0; i < scripts.size(); ++i) {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&] { return results[i].done; });
+                std::string output = std::move(results[i].output);
+                bool ok = results[i].ok;
+                lock.unlock();
+                out << "==> " << scripts[i] << " <==\n" << output;
+                if (!ok) {
+                    failed++;
+                }
+            }
+            out.flush();
+            for (auto& w : workers) {
+                w.join();
+            }
+            return failed;
+        }
+
+    private:
+        struct Result {
+            std::string output;
+            bool ok = false;
+            bool done = false;
+        };
+
+        void work(const std::vector<std::string>& scripts) {
+            std::shared_ptr<Interpreter> prelude;
+            std::string preludeErrors;
+            if (!options.prelude.empty()) {
+                std::ostringstream errors;
+                prelude = Interpreter::loadPrelude(options.prelude, options, errors);
+                preludeErrors = errors.str();
+            }
+            while (true) {
+                size_t i = next.fetch_add(1);
+                if (i >= scripts.size()) {
+                    break;
+                }
+                std::ostringstream output;
+                bool ok = false;
+                if (!options.prelude.empty() && prelude == nullptr) {
+                    output << preludeErrors;
+                } else {
+                    ok = runOne(scripts[i], prelude, output);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                results[i].output = output.str();
+                results[i].ok = ok;
+                results[i].done = true;
+                finished.notify_all();
+            }
+            prelude.reset();
+            Heap::instance().collect();
+        }
+
+        bool runOne(const std::string& path, const std::shared_ptr<Interpreter>& prelude, std::ostringstream& output) {
+            auto source = Source::open(path);
+            if (source == nullptr) {
+                output << "ERROR: cannot open " << path << "\n";
+                return false;
+            }
+            if (AllocStats::isEnabled()) {
+                // memstats() 只反映本脚本的分配
+                AllocStats::reset();
+            }
+            bool ok = false;
+            {
+                auto interpreter = prelude != nullptr ? std::make_unique<Interpreter>(options, prelude) : std::make_unique<Interpreter>(options);
+                interpreter->setPrintStream(&output);
+                ok = interpreter->run(source, output);
+            }
+            // 全局环境和其中的函数互相引用, 解释器释放后由回收器打断, 不留给下一个脚本
+            Heap::instance().collect();
+            return ok;
+        }
+
+        Options options;
+        size_t jobs;
+        std::vector<Result> results;
+        std::atomic<size_t> next{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+} // namespace monkey
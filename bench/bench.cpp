@@ -0,0 +1,278 @@
+// 基准测试: 对每个负载重复执行完整流水线, 分别统计词法分析, 语法分析, 宏展开, 优化, 解析/编译和执行各阶段的
+// 耗时(中位数, p99)和堆分配次数(operator new 调用数), 以 JSON 输出到标准输出.
+// 用法: monkey_bench [--engine=eval|vm] [--iterations=N] [--filter=NAME]
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../evaluator/evaluator.h"
+#include "../evaluator/resolver.h"
+#include "../optimizer/optimizer.h"
+#include "../compiler/compiler.h"
+#include "../vm/vm.h"
+#include "workloads.h"
+
+static size_t allocationCount = 0;
+
+void* operator new(size_t size) {
+    allocationCount++;
+    void* p = std::malloc(size > 0 ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    using namespace monkey;
+
+    enum Phase {
+        PHASE_LEX = 0,
+        PHASE_PARSE,
+        PHASE_EXPAND,
+        PHASE_OPTIMIZE,
+        PHASE_PREPARE,  // eval: 变量解析; vm: 编译
+        PHASE_RUN,
+        PHASE_TOTAL,
+        PHASE_COUNT
+    };
+
+    const char* phaseName(Phase phase, bool vm) {
+        static const char* names[] = {"lex", "parse", "expand", "optimize", "resolve", "run", "total"};
+        if (phase == PHASE_PREPARE && vm) {
+            return "compile";
+        }
+        return names[phase];
+    }
+
+    struct Samples {
+        std::vector<double> ms;
+        std::vector<double> allocs;
+    };
+
+    struct Result {
+        std::string name;
+        Samples phases[PHASE_COUNT];
+        std::string error;
+    };
+
+    class PhaseTimer {
+    public:
+        PhaseTimer(Samples& samples) : samples(samples), allocs(allocationCount), start(std::chrono::steady_clock::now()) {}
+
+        ~PhaseTimer() {
+            samples.ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            samples.allocs.push_back(static_cast<double>(allocationCount - allocs));
+        }
+
+    private:
+        Samples& samples;
+        size_t allocs;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // 执行一遍完整流水线; 出错时返回错误信息
+    std::string runOnce(std::string_view text, bool vm, Samples* phases) {
+        PhaseTimer total(phases[PHASE_TOTAL]);
+        {
+            PhaseTimer t(phases[PHASE_LEX]);
+            Lexer lexer(text);
+            while (lexer.nextToken().getType() != TokenType::EOF) {
+            }
+        }
+        Arena arena;
+        Evaluator evaluator(arena);
+        Program* program = nullptr;
+        {
+            // 语法分析包含驱动词法分析器产生 token 的时间
+            PhaseTimer t(phases[PHASE_PARSE]);
+            Parser parser(std::make_shared<Lexer>(text), arena);
+            program = parser.parseProgram();
+            if (!parser.getErrors().empty()) {
+                return "parser errors: " + parser.getErrors();
+            }
+        }
+        Node* expanded = nullptr;
+        {
+            PhaseTimer t(phases[PHASE_EXPAND]);
+            auto macroEnv = std::make_shared<Environment>();
+            evaluator.defineMacros(program, macroEnv);
+            expanded = evaluator.expandMacros(program, macroEnv);
+        }
+        {
+            PhaseTimer t(phases[PHASE_OPTIMIZE]);
+            Optimizer optimizer(arena);
+            optimizer.optimize(static_cast<Program*>(expanded));
+        }
+        if (vm) {
+            Compiler compiler;
+            {
+                PhaseTimer t(phases[PHASE_PREPARE]);
+                if (!compiler.compile(expanded)) {
+                    return "compiler errors: " + compiler.getErrors();
+                }
+            }
+            PhaseTimer t(phases[PHASE_RUN]);
+            VM machine(compiler.bytecode());
+            CallerScope scope(&machine);
+            auto err = machine.run();
+            if (err != nullptr) {
+                return err->inspect();
+            }
+            return "";
+        }
+        Resolver resolver;
+        {
+            PhaseTimer t(phases[PHASE_PREPARE]);
+            resolver.resolve(static_cast<Program*>(expanded));
+        }
+        PhaseTimer t(phases[PHASE_RUN]);
+        auto env = std::make_shared<Environment>(nullptr, resolver.globalScope());
+        CallerScope scope(&evaluator);
+        auto result = evaluator.eval(expanded, env);
+        if (result.is(ObjectKind::ERROR)) {
+            return result.inspect();
+        }
+        return "";
+    }
+
+    // 最近秩法求百分位
+    double percentile(std::vector<double> values, double p) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        size_t rank = static_cast<size_t>(p * values.size() + 0.999999);
+        rank = std::max<size_t>(1, std::min(rank, values.size()));
+        return values[rank - 1];
+    }
+
+    double median(std::vector<double> values) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        size_t n = values.size();
+        return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    }
+
+    std::string jsonString(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                default: out += c; break;
+            }
+        }
+        return out + "\"";
+    }
+
+    void printJson(std::ostream& out, bool vm, int iterations, const std::vector<Result>& results) {
+        out << "{\n";
+        out << "  \"engine\": \"" << (vm ? "vm" : "eval") << "\",\n";
+        out << "  \"iterations\": " << iterations << ",\n";
+        out << "  \"workloads\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            auto& r = results[i];
+            out << "    {\n";
+            out << "      \"name\": " << jsonString(r.name) << ",\n";
+            if (!r.error.empty()) {
+                out << "      \"error\": " << jsonString(r.error) << ",\n";
+            }
+            out << "      \"phases\": {\n";
+            for (int p = 0; p < PHASE_COUNT; ++p) {
+                auto& s = r.phases[p];
+                out << "        \"" << phaseName(static_cast<Phase>(p), vm) << "\": {"
+                    << "\"median_ms\": " << median(s.ms)
+                    << ", \"p99_ms\": " << percentile(s.ms, 0.99)
+                    << ", \"allocs\": " << static_cast<size_t>(median(s.allocs)) << "}"
+                    << (p + 1 < PHASE_COUNT ? "," : "") << "\n";
+            }
+            out << "      }\n";
+            out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n";
+        out << "}" << std::endl;
+    }
+
+    bool parseInt(const std::string& arg, const std::string& prefix, int& out) {
+        if (arg.compare(0, prefix.size(), prefix) != 0) {
+            return false;
+        }
+        char* end = nullptr;
+        long n = std::strtol(arg.c_str() + prefix.size(), &end, 10);
+        if (*end != '\0' || n <= 0) {
+            return false;
+        }
+        out = static_cast<int>(n);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool vm = false;
+    int iterations = 10;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--engine=vm") {
+            vm = true;
+        } else if (arg == "--engine=eval") {
+            vm = false;
+        } else if (parseInt(arg, "--iterations=", iterations)) {
+        } else if (arg.compare(0, 9, "--filter=") == 0) {
+            filter = arg.substr(9);
+        } else {
+            std::cerr << "unknown option: " << arg << std::endl;
+            std::cerr << "usage: monkey_bench [--engine=eval|vm] [--iterations=N] [--filter=NAME]" << std::endl;
+            return 1;
+        }
+    }
+
+    // 负载中的 puts 输出丢弃, 标准输出只留给 JSON
+    std::ostringstream sink;
+    auto saved = std::cout.rdbuf(sink.rdbuf());
+
+    std::vector<Result> results;
+    for (auto& w : workloads()) {
+        if (!filter.empty() && w.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        Result result;
+        result.name = w.name;
+        // 预热一遍, 不计入统计
+        Samples warmup[PHASE_COUNT];
+        result.error = runOnce(w.source, vm, warmup);
+        for (int i = 0; i < iterations && result.error.empty(); ++i) {
+            result.error = runOnce(w.source, vm, result.phases);
+            sink.str("");
+        }
+        results.push_back(std::move(result));
+    }
+
+    std::cout.rdbuf(saved);
+    printJson(std::cout, vm, iterations, results);
+    for (auto& r : results) {
+        if (!r.error.empty()) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace monkey {
+    // 基准测试负载: 名字 + Monkey 源码. 较长的脚本在这里生成, 避免依赖运行目录下的文件
+    struct Workload {
+        std::string name;
+        std::string source;
+    };
+
+    // 递归 fib, 调用开销为主
+    inline std::string fibSource() {
+        return
+            "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };\n"
+            "fib(20);\n";
+    }
+
+    // 用 push/rest 在大数组上做 map/reduce
+    inline std::string mapReduceSource() {
+        return
+            "let mapList = fn(arr, f) {\n"
+            "    let iter = fn(arr, acc) { if (len(arr) == 0) { acc } else { iter(rest(arr), push(acc, f(first(arr)))) } };\n"
+            "    iter(arr, [])\n"
+            "};\n"
+            "let reduceList = fn(arr, init, f) {\n"
+            "    let iter = fn(arr, result) { if (len(arr) == 0) { result } else { iter(rest(arr), f(result, first(arr))) } };\n"
+            "    iter(arr, init)\n"
+            "};\n"
+            "let range = fn(i, n, acc) { if (i == n) { acc } else { range(i + 1, n, push(acc, i)) } };\n"
+            "let xs = range(0, 20000, []);\n"
+            "let squares = mapList(xs, fn(x) { x * x });\n"
+            "reduceList(squares, 0, fn(a, b) { a + b });\n";
+    }
+
+    // 大 hash 字面量上的反复查找
+    inline std::string hashLookupSource() {
+        const int n = 1000;
+        std::string hash = "let h = {";
+        std::string keys = "let keys = [";
+        for (int i = 0; i < n; ++i) {
+            std::string key = "\"k" + std::to_string(i) + "\"";
+            hash += key + ": " + std::to_string(i) + (i + 1 < n ? ", " : "");
+            keys += key + (i + 1 < n ? ", " : "");
+        }
+        hash += "};\n";
+        keys += "];\n";
+        return hash + keys +
+            "let walk = fn(ks, acc) { if (len(ks) == 0) { acc } else { walk(rest(ks), acc + h[first(ks)]) } };\n"
+            "let rep = fn(n, acc) { if (n == 0) { acc } else { rep(n - 1, acc + walk(keys, 0)) } };\n"
+            "rep(20, 0);\n";
+    }
+
+    // 循环拼接字符串
+    inline std::string stringBuildSource() {
+        return
+            "let build = fn(i, s) { if (i == 0) { s } else { build(i - 1, s + \"ab\") } };\n"
+            "let s = build(20000, \"\");\n"
+            "let same = fn(i, n) { if (i == 0) { n } else { same(i - 1, if (s == s + \"\") { n + 1 } else { n }) } };\n"
+            "len(s) + same(100, 0);\n";
+    }
+
+    // 标识符不能含数字, 用字母编号: 0 -> "a", 25 -> "z", 26 -> "ba"
+    inline std::string letterName(int i) {
+        std::string name;
+        do {
+            name.insert(name.begin(), static_cast<char>('a' + i % 26));
+            i /= 26;
+        } while (i > 0);
+        return name;
+    }
+
+    // 大量宏调用, 宏展开阶段为主
+    inline std::string macroSource() {
+        const int n = 300;
+        std::string src =
+            "let unless = macro(cond, cons, alt) { quote(if (!(unquote(cond))) { unquote(cons) } else { unquote(alt) }) };\n"
+            "let square = macro(x) { quote(unquote(x) * unquote(x)) };\n";
+        std::string total = "let total = 0";
+        for (int i = 0; i < n; ++i) {
+            std::string v = "v" + letterName(i);
+            src += "let " + v + " = unless(" + std::to_string(i) + " > " + std::to_string(n / 2) + ", square(" + std::to_string(i) + "), 0 - " + std::to_string(i) + ");\n";
+            total += " + " + v;
+        }
+        return src + total + ";\ntotal;\n";
+    }
+
+    // 深递归: 尾递归和非尾递归(非尾递归的深度受虚拟机栈大小约束)
+    inline std::string deepRecursionSource() {
+        return
+            "let count = fn(n) { if (n == 0) { 0 } else { count(n - 1) } };\n"
+            "let depth = fn(n) { if (n == 0) { 0 } else { 1 + depth(n - 1) } };\n"
+            "let rep = fn(k, acc) { if (k == 0) { acc } else { rep(k - 1, acc + depth(500)) } };\n"
+            "count(100000) + rep(40, 0);\n";
+    }
+
+    inline std::vector<Workload> workloads() {
+        return {
+            {"fib", fibSource()},
+            {"map_reduce", mapReduceSource()},
+            {"hash_lookup", hashLookupSource()},
+            {"string_build", stringBuildSource()},
+            {"macros", macroSource()},
+            {"deep_recursion", deepRecursionSource()},
+        };
+    }
+} // namespace monkey
@@ -0,0 +1,564 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "../ast/ast.h"
+#include "../ast/arena.h"
+#include "../lexer/source.h"
+
+namespace monkey {
+    // AST 缓存: 把宏展开后的 Program 序列化为紧凑的二进制文件, 以源码内容的哈希命名.
+    // 再次运行同一份源码时直接映射缓存文件重建语法树, 跳过词法分析, 语法分析和宏定义/展开.
+    // 展开结果还取决于此前定义的宏, 所以哈希以此前执行过的源码(seed)为初值.
+    //
+    // 文件格式: 头部(魔数, 版本, 源码哈希, 源码长度) + 展开后的程序 + 本段源码中的宏定义, 均为前序遍历的节点流.
+    // 每个节点以 1 字节类别开头(NULL_NODE 表示空指针), 整数用 LEB128 变长编码(有符号数先 zigzag),
+    // 字符串为 长度 + 原始字节. token 的字面量直接指向映射的缓存文件, 不做复制.
+    // 缓存只在本机使用, 格式变化时提升 VERSION 即可让旧文件失效.
+    class AstCache {
+    public:
+        static const uint32_t VERSION = 3;
+
+        AstCache(std::string dir, uint64_t seed = 0) : dir(std::move(dir)), seed(seed) {}
+
+        // 源码内容的 FNV-1a 64 位哈希, seed 非 0 时与初值混合, 可以把多段源码串联成一个哈希
+        static uint64_t hash(std::string_view text, uint64_t seed = 0) {
+            uint64_t h = 14695981039346656037ull ^ seed;
+            for (unsigned char c : text) {
+                h ^= c;
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        std::string pathFor(std::string_view text) const {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.ast", static_cast<unsigned long long>(hash(text, seed)));
+            return dir + "/" + name;
+        }
+
+        // 命中时返回重建的语法树, 宏定义语句另外放在 macros 中(需要重新注册到宏环境);
+        // 节点分配在 arena 中, 映射的缓存文件写入 keep(必须比语法树活得更久).
+        // 文件不存在, 版本或源码不符, 内容损坏时返回空
+        Program* load(std::string_view text, Arena& arena, std::shared_ptr<Source>& keep, Program*& macros) const {
+            auto file = Source::open(pathFor(text));
+            if (file == nullptr) {
+                return nullptr;
+            }
+            Reader reader(file->text(), arena);
+            if (!reader.header(hash(text, seed), text.size())) {
+                return nullptr;
+            }
+            Node* program = reader.node();
+            Node* definitions = reader.node();
+            if (!reader.finished() || program == nullptr || program->kind != NodeKind::PROGRAM ||
+                definitions == nullptr || definitions->kind != NodeKind::PROGRAM) {
+                return nullptr;
+            }
+            keep = file;
+            macros = static_cast<Program*>(definitions);
+            return static_cast<Program*>(program);
+        }
+
+        // 写入缓存: 先写临时文件再改名, 并行的批量运行写同一份缓存时不会读到半个文件. 失败时返回 false
+        bool store(std::string_view text, Program* program, Program* macros) const {
+            Writer writer;
+            writer.header(hash(text, seed), text.size());
+            writer.node(program);
+            writer.node(macros);
+
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            std::string path = pathFor(text);
+            std::string temp = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+            {
+                std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+                if (!out || !out.write(writer.data().data(), writer.data().size())) {
+                    std::remove(temp.c_str());
+                    return false;
+                }
+            }
+            if (std::rename(temp.c_str(), path.c_str()) != 0) {
+                std::remove(temp.c_str());
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        static constexpr char MAGIC[4] = {'M', 'K', 'A', 'S'};
+        static const uint8_t NULL_NODE = 0xff;
+
+        class Writer {
+        public:
+            const std::string& data() const {
+                return out;
+            }
+
+            void header(uint64_t sourceHash, uint64_t sourceSize) {
+                out.append(MAGIC, sizeof(MAGIC));
+                varint(VERSION);
+                varint(sourceHash);
+                varint(sourceSize);
+            }
+
+            void node(Node* node) {
+                if (node == nullptr) {
+                    out.push_back(static_cast<char>(NULL_NODE));
+                    return;
+                }
+                out.push_back(static_cast<char>(node->kind));
+                switch (node->kind) {
+                    case NodeKind::PROGRAM: {
+                        auto program = static_cast<Program*>(node);
+                        list(program->statements);
+                        break;
+                    }
+                    case NodeKind::LET_STATEMENT: {
+                        auto stmt = static_cast<LetStatement*>(node);
+                        token(stmt->token);
+                        this->node(stmt->name);
+                        this->node(stmt->value);
+                        break;
+                    }
+                    case NodeKind::RETURN_STATEMENT: {
+                        auto stmt = static_cast<ReturnStatement*>(node);
+                        token(stmt->token);
+                        this->node(stmt->returnValue);
+                        break;
+                    }
+                    case NodeKind::EXPRESSION_STATEMENT: {
+                        auto stmt = static_cast<ExpressionStatement*>(node);
+                        token(stmt->token);
+                        this->node(stmt->expression);
+                        break;
+                    }
+                    case NodeKind::BLOCK_STATEMENT: {
+                        auto block = static_cast<BlockStatement*>(node);
+                        token(block->token);
+                        list(block->statements);
+                        break;
+                    }
+                    case NodeKind::ASSIGN_STATEMENT: {
+                        auto stmt = static_cast<AssignStatement*>(node);
+                        token(stmt->token);
+                        this->node(stmt->name);
+                        this->node(stmt->value);
+                        break;
+                    }
+                    case NodeKind::WHILE_STATEMENT: {
+                        auto stmt = static_cast<WhileStatement*>(node);
+                        token(stmt->token);
+                        this->node(stmt->condition);
+                        this->node(stmt->body);
+                        break;
+                    }
+                    case NodeKind::FOR_STATEMENT: {
+                        auto stmt = static_cast<ForStatement*>(node);
+                        token(stmt->token);
+                        this->node(stmt->variable);
+                        this->node(stmt->iterable);
+                        this->node(stmt->body);
+                        break;
+                    }
+                    case NodeKind::IDENTIFIER: {
+                        auto ident = static_cast<Identifier*>(node);
+                        token(ident->token);
+                        string(ident->value);
+                        break;
+                    }
+                    case NodeKind::BOOLEAN: {
+                        auto boolean = static_cast<Boolean*>(node);
+                        token(boolean->token);
+                        out.push_back(boolean->value ? 1 : 0);
+                        break;
+                    }
+                    case NodeKind::INTEGER_LITERAL: {
+                        auto integer = static_cast<IntegerLiteral*>(node);
+                        token(integer->token);
+                        uint64_t v = static_cast<uint64_t>(integer->value);
+                        varint((v << 1) ^ (integer->value < 0 ? ~uint64_t(0) : 0));
+                        break;
+                    }
+                    case NodeKind::STRING_LITERAL: {
+                        auto str = static_cast<StringLiteral*>(node);
+                        token(str->token);
+                        string(str->value);
+                        break;
+                    }
+                    case NodeKind::ARRAY_LITERAL: {
+                        auto array = static_cast<ArrayLiteral*>(node);
+                        token(array->token);
+                        list(array->elements);
+                        break;
+                    }
+                    case NodeKind::INDEX_EXPRESSION: {
+                        auto expr = static_cast<IndexExpression*>(node);
+                        token(expr->token);
+                        this->node(expr->left);
+                        this->node(expr->index);
+                        break;
+                    }
+                    case NodeKind::HASH_LITERAL: {
+                        auto hash = static_cast<HashLiteral*>(node);
+                        token(hash->token);
+                        varint(hash->pairs.size());
+                        for (auto& pair : hash->pairs) {
+                            this->node(pair.first);
+                            this->node(pair.second);
+                        }
+                        break;
+                    }
+                    case NodeKind::PREFIX_EXPRESSION: {
+                        auto expr = static_cast<PrefixExpression*>(node);
+                        token(expr->token);
+                        string(expr->op);
+                        this->node(expr->right);
+                        break;
+                    }
+                    case NodeKind::INFIX_EXPRESSION: {
+                        auto expr = static_cast<InfixExpression*>(node);
+                        token(expr->token);
+                        string(expr->op);
+                        this->node(expr->left);
+                        this->node(expr->right);
+                        break;
+                    }
+                    case NodeKind::IF_EXPRESSION: {
+                        auto expr = static_cast<IfExpression*>(node);
+                        token(expr->token);
+                        this->node(expr->condition);
+                        this->node(expr->consequence);
+                        this->node(expr->alternative);
+                        break;
+                    }
+                    case NodeKind::FUNCTION_LITERAL: {
+                        auto fn = static_cast<FunctionLiteral*>(node);
+                        token(fn->token);
+                        string(fn->name);
+                        list(fn->parameters);
+                        this->node(fn->body);
+                        break;
+                    }
+                    case NodeKind::CALL_EXPRESSION: {
+                        auto call = static_cast<CallExpression*>(node);
+                        token(call->token);
+                        this->node(call->function);
+                        list(call->arguments);
+                        break;
+                    }
+                    case NodeKind::MACRO_LITERAL: {
+                        auto macro = static_cast<MacroLiteral*>(node);
+                        token(macro->token);
+                        list(macro->parameters);
+                        this->node(macro->body);
+                        break;
+                    }
+                }
+            }
+
+        private:
+            template <typename T>
+            void list(const std::vector<T*>& nodes) {
+                varint(nodes.size());
+                for (auto n : nodes) {
+                    node(n);
+                }
+            }
+
+            void token(Token& tok) {
+                out.push_back(static_cast<char>(tok.getType()));
+                varint(static_cast<uint64_t>(tok.getLine()));
+                varint(static_cast<uint64_t>(tok.getColumn()));
+                string(tok.getLiteralView());
+            }
+
+            void string(std::string_view s) {
+                varint(s.size());
+                out.append(s.data(), s.size());
+            }
+
+            void varint(uint64_t v) {
+                while (v >= 0x80) {
+                    out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+                    v >>= 7;
+                }
+                out.push_back(static_cast<char>(v));
+            }
+
+            std::string out;
+        };
+
+        // 读取时逐项检查边界和节点类别, 任何不一致都使整个文件作废(ok 置 false), 调用方按未命中处理
+        class Reader {
+        public:
+            Reader(std::string_view in, Arena& arena) : in(in), arena(arena) {}
+
+            bool header(uint64_t sourceHash, uint64_t sourceSize) {
+                if (in.size() < sizeof(MAGIC) || in.compare(0, sizeof(MAGIC), std::string_view(MAGIC, sizeof(MAGIC))) != 0) {
+                    return false;
+                }
+                pos = sizeof(MAGIC);
+                return varint() == VERSION && varint() == sourceHash && varint() == sourceSize && ok;
+            }
+
+            bool finished() const {
+                return ok && pos == in.size();
+            }
+
+            Node* node() {
+                uint8_t tag = byte();
+                if (!ok || tag == NULL_NODE) {
+                    return nullptr;
+                }
+                if (tag > static_cast<uint8_t>(NodeKind::MACRO_LITERAL)) {
+                    ok = false;
+                    return nullptr;
+                }
+                switch (static_cast<NodeKind>(tag)) {
+                    case NodeKind::PROGRAM: {
+                        auto program = arena.make<Program>();
+                        list(program->statements, &AstCache::Reader::statement);
+                        return program;
+                    }
+                    case NodeKind::LET_STATEMENT: {
+                        auto stmt = arena.make<LetStatement>(token());
+                        stmt->name = identifier();
+                        stmt->value = expression();
+                        return stmt;
+                    }
+                    case NodeKind::RETURN_STATEMENT: {
+                        auto stmt = arena.make<ReturnStatement>(token());
+                        stmt->returnValue = expression();
+                        return stmt;
+                    }
+                    case NodeKind::EXPRESSION_STATEMENT: {
+                        auto stmt = arena.make<ExpressionStatement>(token());
+                        stmt->expression = expression();
+                        return stmt;
+                    }
+                    case NodeKind::BLOCK_STATEMENT: {
+                        auto block = arena.make<BlockStatement>(token());
+                        list(block->statements, &AstCache::Reader::statement);
+                        return block;
+                    }
+                    case NodeKind::ASSIGN_STATEMENT: {
+                        auto stmt = arena.make<AssignStatement>(token());
+                        stmt->name = identifier();
+                        stmt->value = expression();
+                        return stmt;
+                    }
+                    case NodeKind::WHILE_STATEMENT: {
+                        auto stmt = arena.make<WhileStatement>(token());
+                        stmt->condition = expression();
+                        stmt->body = block();
+                        return stmt;
+                    }
+                    case NodeKind::FOR_STATEMENT: {
+                        auto stmt = arena.make<ForStatement>(token());
+                        stmt->variable = identifier();
+                        stmt->iterable = expression();
+                        stmt->body = block();
+                        return stmt;
+                    }
+                    case NodeKind::IDENTIFIER: {
+                        Token tok = token();
+                        return arena.make<Identifier>(tok, std::string(string()));
+                    }
+                    case NodeKind::BOOLEAN: {
+                        Token tok = token();
+                        return arena.make<Boolean>(tok, byte() != 0);
+                    }
+                    case NodeKind::INTEGER_LITERAL: {
+                        Token tok = token();
+                        uint64_t v = varint();
+                        return arena.make<IntegerLiteral>(tok, static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1)));
+                    }
+                    case NodeKind::STRING_LITERAL: {
+                        Token tok = token();
+                        return arena.make<StringLiteral>(tok, std::string(string()));
+                    }
+                    case NodeKind::ARRAY_LITERAL: {
+                        auto array = arena.make<ArrayLiteral>(token());
+                        list(array->elements, &AstCache::Reader::expression);
+                        return array;
+                    }
+                    case NodeKind::INDEX_EXPRESSION: {
+                        Token tok = token();
+                        auto expr = arena.make<IndexExpression>(tok, expression());
+                        expr->index = expression();
+                        return expr;
+                    }
+                    case NodeKind::HASH_LITERAL: {
+                        auto hash = arena.make<HashLiteral>(token());
+                        uint64_t count = length();
+                        for (uint64_t i = 0; i < count && ok; ++i) {
+                            Expression* key = expression();
+                            Expression* value = expression();
+                            hash->pairs.emplace_back(key, value);
+                        }
+                        return hash;
+                    }
+                    case NodeKind::PREFIX_EXPRESSION: {
+                        Token tok = token();
+                        auto expr = arena.make<PrefixExpression>(tok, std::string(string()));
+                        expr->right = expression();
+                        return expr;
+                    }
+                    case NodeKind::INFIX_EXPRESSION: {
+                        Token tok = token();
+                        std::string op(string());
+                        auto expr = arena.make<InfixExpression>(tok, op, expression());
+                        expr->right = expression();
+                        return expr;
+                    }
+                    case NodeKind::IF_EXPRESSION: {
+                        auto expr = arena.make<IfExpression>(token());
+                        expr->condition = expression();
+                        expr->consequence = block();
+                        expr->alternative = block();
+                        return expr;
+                    }
+                    case NodeKind::FUNCTION_LITERAL: {
+                        auto fn = arena.make<FunctionLiteral>(token());
+                        fn->name = std::string(string());
+                        list(fn->parameters, &AstCache::Reader::identifier);
+                        fn->body = block();
+                        return fn;
+                    }
+                    case NodeKind::CALL_EXPRESSION: {
+                        Token tok = token();
+                        auto call = arena.make<CallExpression>(tok, expression());
+                        list(call->arguments, &AstCache::Reader::expression);
+                        return call;
+                    }
+                    case NodeKind::MACRO_LITERAL: {
+                        auto macro = arena.make<MacroLiteral>(token());
+                        list(macro->parameters, &AstCache::Reader::identifier);
+                        macro->body = block();
+                        return macro;
+                    }
+                }
+                ok = false;
+                return nullptr;
+            }
+
+        private:
+            Statement* statement() {
+                Node* n = node();
+                if (n != nullptr && !isStatementKind(n->kind)) {
+                    ok = false;
+                    return nullptr;
+                }
+                return static_cast<Statement*>(n);
+            }
+
+            Expression* expression() {
+                Node* n = node();
+                if (n != nullptr && !isExpressionKind(n->kind)) {
+                    ok = false;
+                    return nullptr;
+                }
+                return static_cast<Expression*>(n);
+            }
+
+            BlockStatement* block() {
+                Node* n = node();
+                if (n != nullptr && n->kind != NodeKind::BLOCK_STATEMENT) {
+                    ok = false;
+                    return nullptr;
+                }
+                return static_cast<BlockStatement*>(n);
+            }
+
+            Identifier* identifier() {
+                Node* n = node();
+                if (n != nullptr && n->kind != NodeKind::IDENTIFIER) {
+                    ok = false;
+                    return nullptr;
+                }
+                return static_cast<Identifier*>(n);
+            }
+
+            template <typename T>
+            void list(std::vector<T*>& nodes, T* (AstCache::Reader::*read)()) {
+                uint64_t count = length();
+                nodes.reserve(count);
+                for (uint64_t i = 0; i < count && ok; ++i) {
+                    nodes.push_back((this->*read)());
+                }
+            }
+
+            Token token() {
+                uint8_t type = byte();
+                int line = static_cast<int>(varint());
+                int column = static_cast<int>(varint());
+                std::string_view literal = string();
+                if (type > static_cast<uint8_t>(TokenType::IN)) {
+                    ok = false;
+                }
+                return Token(static_cast<TokenType>(type), literal, line, column);
+            }
+
+            std::string_view string() {
+                uint64_t size = length();
+                if (!ok) {
+                    return std::string_view();
+                }
+                std::string_view s = in.substr(pos, size);
+                pos += size;
+                return s;
+            }
+
+            // 元素个数或字节数不可能超过剩余的输入, 借此挡住损坏文件中的超大长度
+            uint64_t length() {
+                uint64_t n = varint();
+                if (n > in.size() - pos) {
+                    ok = false;
+                    return 0;
+                }
+                return n;
+            }
+
+            uint8_t byte() {
+                if (pos >= in.size()) {
+                    ok = false;
+                    return NULL_NODE;
+                }
+                return static_cast<uint8_t>(in[pos++]);
+            }
+
+            uint64_t varint() {
+                uint64_t v = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    uint8_t b = byte();
+                    if (!ok) {
+                        return 0;
+                    }
+                    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+                    if ((b & 0x80) == 0) {
+                        return v;
+                    }
+                }
+                ok = false;
+                return 0;
+            }
+
+            std::string_view in;
+            Arena& arena;
+            size_t pos = 0;
+            bool ok = true;
+        };
+
+        std::string dir;
+        uint64_t seed;
+    };
+} // namespace monkey
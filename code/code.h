@@ -0,0 +1,178 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstdio>
+
+namespace monkey {
+    // 字节码指令序列
+    using Instructions = std::vector<uint8_t>;
+
+    // 操作码
+    enum Opcode : uint8_t {
+        OpConstant = 0,     // 将常量池中的常量压栈
+        OpPop,              // 弹出栈顶元素
+
+        OpAdd,              // +
+        OpSub,              // -
+        OpMul,              // *
+        OpDiv,              // /
+
+        OpTrue,             // 压入 true
+        OpFalse,            // 压入 false
+        OpNull,             // 压入 null
+
+        OpEqual,            // ==
+        OpNotEqual,         // !=
+        OpGreaterThan,      // >
+        OpLessThan,         // <
+
+        OpMinus,            // 前缀 -
+        OpBang,             // 前缀 !
+
+        OpJumpNotTruthy,    // 条件跳转
+        OpJump,             // 无条件跳转
+        OpIterNext,         // for-in: 弹出数组和下标, 压入下一个元素; 遍历结束时跳转
+
+        OpGetGlobal,        // 读取全局变量
+        OpSetGlobal,        // 设置全局变量
+        OpGetLocal,         // 读取局部变量
+        OpSetLocal,         // 设置局部变量
+        OpGetBuiltin,       // 读取内置函数
+        OpGetFree,          // 读取闭包捕获的自由变量
+        OpCurrentClosure,   // 压入当前正在执行的闭包(用于递归)
+        OpMakeCell,         // 把局部变量的值装进新的 cell
+        OpGetCell,          // 弹出 cell, 压入其中的值
+        OpSetCell,          // 弹出 cell 和值, 把值写入 cell
+
+        OpArray,            // 构造数组
+        OpHash,             // 构造 hash
+        OpIndex,            // 索引运算
+
+        OpCall,             // 函数调用
+        OpTailCall,         // 尾调用: 复用当前调用帧
+        OpReturnValue,      // 带返回值返回
+        OpReturn,           // 无返回值返回(返回 null)
+        OpClosure           // 构造闭包
+    };
+
+    // 操作码定义: 名称 + 各操作数所占字节数
+    struct Definition {
+        std::string name;
+        std::vector<int> operandWidths;
+    };
+
+    const std::map<Opcode, Definition> definitions = {
+        {OpConstant, {"OpConstant", {2}}},
+        {OpPop, {"OpPop", {}}},
+        {OpAdd, {"OpAdd", {}}},
+        {OpSub, {"OpSub", {}}},
+        {OpMul, {"OpMul", {}}},
+        {OpDiv, {"OpDiv", {}}},
+        {OpTrue, {"OpTrue", {}}},
+        {OpFalse, {"OpFalse", {}}},
+        {OpNull, {"OpNull", {}}},
+        {OpEqual, {"OpEqual", {}}},
+        {OpNotEqual, {"OpNotEqual", {}}},
+        {OpGreaterThan, {"OpGreaterThan", {}}},
+        {OpLessThan, {"OpLessThan", {}}},
+        {OpMinus, {"OpMinus", {}}},
+        {OpBang, {"OpBang", {}}},
+        {OpJumpNotTruthy, {"OpJumpNotTruthy", {2}}},
+        {OpJump, {"OpJump", {2}}},
+        {OpIterNext, {"OpIterNext", {2}}},
+        {OpGetGlobal, {"OpGetGlobal", {2}}},
+        {OpSetGlobal, {"OpSetGlobal", {2}}},
+        {OpGetLocal, {"OpGetLocal", {1}}},
+        {OpSetLocal, {"OpSetLocal", {1}}},
+        {OpGetBuiltin, {"OpGetBuiltin", {1}}},
+        {OpGetFree, {"OpGetFree", {1}}},
+        {OpCurrentClosure, {"OpCurrentClosure", {}}},
+        {OpMakeCell, {"OpMakeCell", {1}}},
+        {OpGetCell, {"OpGetCell", {}}},
+        {OpSetCell, {"OpSetCell", {}}},
+        {OpArray, {"OpArray", {2}}},
+        {OpHash, {"OpHash", {2}}},
+        {OpIndex, {"OpIndex", {}}},
+        {OpCall, {"OpCall", {1}}},
+        {OpTailCall, {"OpTailCall", {1}}},
+        {OpReturnValue, {"OpReturnValue", {}}},
+        {OpReturn, {"OpReturn", {}}},
+        {OpClosure, {"OpClosure", {2, 1}}}
+    };
+
+    // 生成一条指令: 操作数按大端序编码
+    Instructions make(Opcode op, std::vector<int> operands = {}) {
+        auto it = definitions.find(op);
+        if (it == definitions.end()) {
+            return Instructions();
+        }
+        Instructions instruction;
+        instruction.push_back(op);
+        for (size_t i = 0; i < operands.size() && i < it->second.operandWidths.size(); ++i) {
+            switch (it->second.operandWidths[i]) {
+                case 2:
+                    instruction.push_back(static_cast<uint8_t>((operands[i] >> 8) & 0xFF));
+                    instruction.push_back(static_cast<uint8_t>(operands[i] & 0xFF));
+                    break;
+                case 1:
+                    instruction.push_back(static_cast<uint8_t>(operands[i] & 0xFF));
+                    break;
+            }
+        }
+        return instruction;
+    }
+
+    uint16_t readUint16(const Instructions& ins, int offset) {
+        return static_cast<uint16_t>((ins[offset] << 8) | ins[offset + 1]);
+    }
+
+    uint8_t readUint8(const Instructions& ins, int offset) {
+        return ins[offset];
+    }
+
+    // 解码操作数, 返回操作数列表以及读取的字节数
+    std::vector<int> readOperands(const Definition& def, const Instructions& ins, int offset, int& bytesRead) {
+        std::vector<int> operands;
+        bytesRead = 0;
+        for (auto width : def.operandWidths) {
+            switch (width) {
+                case 2:
+                    operands.push_back(readUint16(ins, offset + bytesRead));
+                    break;
+                case 1:
+                    operands.push_back(readUint8(ins, offset + bytesRead));
+                    break;
+            }
+            bytesRead += width;
+        }
+        return operands;
+    }
+
+    // 反汇编, 便于调试
+    std::string instructionsString(const Instructions& ins) {
+        std::string out;
+        int i = 0;
+        while (static_cast<size_t>(i) < ins.size()) {
+            auto it = definitions.find(static_cast<Opcode>(ins[i]));
+            if (it == definitions.end()) {
+                out += "ERROR: undefined opcode " + std::to_string(ins[i]) + "\n";
+                ++i;
+                continue;
+            }
+            int bytesRead = 0;
+            auto operands = readOperands(it->second, ins, i + 1, bytesRead);
+            char offset[8];
+            snprintf(offset, sizeof(offset), "%04d", i);
+            out += std::string(offset) + " " + it->second.name;
+            for (auto operand : operands) {
+                out += " " + std::to_string(operand);
+            }
+            out += "\n";
+            i += 1 + bytesRead;
+        }
+        return out;
+    }
+} // namespace monkey
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+
+#include "../ast/ast.h"
+
+namespace monkey {
+    // 找出函数中需要放进 cell 的局部变量: 被内层函数引用, 且定义之后还会被写入
+    // (赋值, 同一函数内再次 let, 循环中的 let, for-in 循环变量).
+    // 虚拟机的闭包按值捕获自由变量; 这些变量改为捕获 cell, 与求值器中闭包共享绑定的语义一致.
+    // 按名字分析, 结果可能偏多(内层函数引用的其实是更外层的同名变量), 只多一次间接访问, 不影响结果
+    class CellAnalysis {
+    public:
+        explicit CellAnalysis(FunctionLiteral* fn) {
+            for (auto& param : fn->parameters) {
+                define(param->value, 1);
+            }
+            visit(fn->body);
+        }
+
+        std::set<std::string> cells() const {
+            std::set<std::string> result;
+            for (auto& name : innerReferenced) {
+                auto it = writes.find(name);
+                if (it != writes.end() && (it->second > 1 || assigned.count(name) > 0)) {
+                    result.insert(name);
+                }
+            }
+            return result;
+        }
+
+        // 函数体(包括内层函数)是否给没有在函数内定义的 name 赋值
+        bool assignsFree(const std::string& name) const {
+            return assigned.count(name) > 0 && writes.count(name) == 0;
+        }
+
+    private:
+        // 局部变量: 名字 -> 写入次数, 循环中的写入按两次计
+        void define(const std::string& name, int times) {
+            writes[name] += times;
+        }
+
+        void visit(Node* node) {
+            if (node == nullptr) {
+                return;
+            }
+            switch (node->kind) {
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(node);
+                    visit(let->value);
+                    define(let->name->value, loops > 0 ? 2 : 1);
+                    break;
+                }
+                case NodeKind::ASSIGN_STATEMENT: {
+                    auto assign = static_cast<AssignStatement*>(node);
+                    visit(assign->value);
+                    referenced.insert(assign->name->value);
+                    assigned.insert(assign->name->value);
+                    break;
+                }
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(node);
+                    visit(loop->condition);
+                    loops++;
+                    visit(loop->body);
+                    loops--;
+                    break;
+                }
+                case NodeKind::FOR_STATEMENT: {
+                    auto loop = static_cast<ForStatement*>(node);
+                    visit(loop->iterable);
+                    define(loop->variable->value, 2);
+                    loops++;
+                    visit(loop->body);
+                    loops--;
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT:
+                    visit(static_cast<ReturnStatement*>(node)->returnValue);
+                    break;
+                case NodeKind::EXPRESSION_STATEMENT:
+                    visit(static_cast<ExpressionStatement*>(node)->expression);
+                    break;
+                case NodeKind::BLOCK_STATEMENT:
+                    for (auto& stmt : static_cast<BlockStatement*>(node)->statements) {
+                        visit(stmt);
+                    }
+                    break;
+                case NodeKind::IDENTIFIER:
+                    referenced.insert(static_cast<Identifier*>(node)->value);
+                    break;
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    visit(ie->condition);
+                    visit(ie->consequence);
+                    visit(ie->alternative);
+                    break;
+                }
+                case NodeKind::PREFIX_EXPRESSION:
+                    visit(static_cast<PrefixExpression*>(node)->right);
+                    break;
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    visit(infix->left);
+                    visit(infix->right);
+                    break;
+                }
+                case NodeKind::FUNCTION_LITERAL: {
+                    // 内层函数中没有在其内部定义的名字即是它捕获的(或全局的)变量
+                    CellAnalysis inner(static_cast<FunctionLiteral*>(node));
+                    for (auto& name : inner.referenced) {
+                        if (inner.writes.count(name) == 0) {
+                            referenced.insert(name);
+                            innerReferenced.insert(name);
+                        }
+                    }
+                    for (auto& name : inner.assigned) {
+                        if (inner.writes.count(name) == 0) {
+                            assigned.insert(name);
+                        }
+                    }
+                    break;
+                }
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    visit(call->function);
+                    for (auto& arg : call->arguments) {
+                        visit(arg);
+                    }
+                    break;
+                }
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        visit(elem);
+                    }
+                    break;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    visit(index->left);
+                    visit(index->index);
+                    break;
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        visit(pair.first);
+                        visit(pair.second);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        std::map<std::string, int> writes;      // 本函数的局部变量(参数, let, for-in 循环变量)
+        std::set<std::string> referenced;       // 本函数及内层函数引用的名字
+        std::set<std::string> assigned;         // 本函数及内层函数赋值的名字
+        std::set<std::string> innerReferenced;  // 内层函数引用的自由名字
+        int loops = 0;
+    };
+} // namespace monkey
@@ -0,0 +1,598 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "../ast/ast.h"
+#include "../code/code.h"
+#include "../object/object.h"
+#include "../evaluator/builtins.h"
+#include "symbol_table.h"
+#include "cells.h"
+
+namespace monkey {
+    // 编译结果: 指令序列 + 常量池
+    struct Bytecode {
+        Instructions instructions;
+        std::vector<Value> constants;
+    };
+
+    // 常量池中整数和字符串常量的下标, 相同的常量只存一份.
+    // 与常量池一起在多次编译之间保留(REPL, --stream), 重复出现的字面量不会让常量池一直增长
+    struct ConstantIndex {
+        std::unordered_map<int64_t, int> integers;
+        std::unordered_map<std::string, int> strings;
+    };
+
+    struct EmittedInstruction {
+        Opcode opcode;
+        int position;
+    };
+
+    // 编译作用域: 每个函数体一个
+    struct CompilationScope {
+        Instructions instructions;
+        EmittedInstruction lastInstruction{OpPop, -1};
+        EmittedInstruction previousInstruction{OpPop, -1};
+    };
+
+    // 将 AST 编译为字节码
+    class Compiler {
+    public:
+        Compiler() : symbolTable(std::make_shared<SymbolTable>()) {
+            scopes.emplace_back();
+        }
+
+        // 沿用已有的符号表和常量池(多次编译共享全局状态)
+        Compiler(std::shared_ptr<SymbolTable> symbolTable, std::vector<Value> constants, ConstantIndex constantIndex = ConstantIndex())
+            : symbolTable(symbolTable), constants(std::move(constants)), constantIndex(std::move(constantIndex)) {
+            scopes.emplace_back();
+        }
+
+        bool compile(Node* node) {
+            if (node == nullptr) {
+                errors.emplace_back("cannot compile an empty node");
+                return false;
+            }
+            switch (node->kind) {
+                case NodeKind::PROGRAM: {
+                    auto program = static_cast<Program*>(node);
+                    // 预先声明所有顶层 let 和循环变量, 使函数体可以引用之后定义的全局变量
+                    for (auto& stmt : program->statements) {
+                        if (stmt->kind == NodeKind::LET_STATEMENT) {
+                            symbolTable->define(static_cast<LetStatement*>(stmt)->name->value);
+                        } else if (stmt->kind == NodeKind::FOR_STATEMENT) {
+                            symbolTable->define(static_cast<ForStatement*>(stmt)->variable->value);
+                        }
+                    }
+                    for (auto& stmt : program->statements) {
+                        if (!compile(stmt)) {
+                            return false;
+                        }
+                    }
+                    // emit 遇到放不下的操作数时只记录错误
+                    return errors.empty();
+                }
+                case NodeKind::EXPRESSION_STATEMENT: {
+                    if (!compile(static_cast<ExpressionStatement*>(node)->expression)) {
+                        return false;
+                    }
+                    emit(OpPop);
+                    return true;
+                }
+                case NodeKind::BLOCK_STATEMENT: {
+                    for (auto& stmt : static_cast<BlockStatement*>(node)->statements) {
+                        if (!compile(stmt)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(node);
+                    // 先编译右值再定义, `let x = x + 1` 中的 x 仍指向外层绑定;
+                    // 只有给自己的名字赋值的函数(见 compileFunction)需要先定义, 函数体才能引用这个绑定
+                    if (let->value != nullptr && let->value->kind == NodeKind::FUNCTION_LITERAL
+                            && CellAnalysis(static_cast<FunctionLiteral*>(let->value)).assignsFree(let->name->value)) {
+                        symbolTable->define(let->name->value);
+                    }
+                    if (!compileValue(let->value, let->name->value)) {
+                        return false;
+                    }
+                    // 重复 let 或循环中的 let 会再次写入同一个槽位
+                    storeSymbol(symbolTable->define(let->name->value));
+                    return true;
+                }
+                case NodeKind::ASSIGN_STATEMENT: {
+                    auto assign = static_cast<AssignStatement*>(node);
+                    const std::string& name = assign->name->value;
+                    Symbol symbol;
+                    bool bound = symbolTable->resolve(name, symbol);
+                    if (builtinIndex(name) >= 0 && !(bound && builtinShadowable(name))) {
+                        errors.emplace_back("cannot assign to builtin: " + name);
+                        return false;
+                    }
+                    if (!compile(assign->value)) {
+                        return false;
+                    }
+                    if (!bound) {
+                        errors.emplace_back("identifier not found: " + name);
+                        return false;
+                    }
+                    // 被赋值的自由变量都放在 cell 中(见 CellAnalysis), 按值捕获的修改不到定义处的绑定
+                    if (symbol.scope == FUNCTION_SCOPE || (symbol.scope == FREE_SCOPE && !symbol.cell)) {
+                        errors.emplace_back("cannot assign to captured variable: " + name);
+                        return false;
+                    }
+                    if (symbolTable->isBaseGlobal(symbol)) {
+                        errors.emplace_back("cannot assign to read-only binding: " + name);
+                        return false;
+                    }
+                    storeSymbol(symbol);
+                    return true;
+                }
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(node);
+                    int start = static_cast<int>(currentInstructions().size());
+                    if (!compile(loop->condition)) {
+                        return false;
+                    }
+                    int exitPos = emit(OpJumpNotTruthy, {9999});
+                    if (!compile(loop->body)) {
+                        return false;
+                    }
+                    emit(OpJump, {start});
+                    changeOperand(exitPos, currentInstructions().size());
+                    return true;
+                }
+                case NodeKind::FOR_STATEMENT:
+                    return compileFor(static_cast<ForStatement*>(node));
+                case NodeKind::RETURN_STATEMENT: {
+                    if (!compile(static_cast<ReturnStatement*>(node)->returnValue)) {
+                        return false;
+                    }
+                    emit(OpReturnValue);
+                    return true;
+                }
+                case NodeKind::IDENTIFIER: {
+                    auto ident = static_cast<Identifier*>(node);
+                    // 与解释器保持一致: 最初的内置函数优先于同名变量, 之后加入的可被遮蔽
+                    int builtin = builtinIndex(ident->value);
+                    if (builtin >= 0 && !builtinShadowable(ident->value)) {
+                        emit(OpGetBuiltin, {builtin});
+                        return true;
+                    }
+                    Symbol symbol;
+                    if (!symbolTable->resolve(ident->value, symbol)) {
+                        if (builtin >= 0) {
+                            emit(OpGetBuiltin, {builtin});
+                            return true;
+                        }
+                        errors.emplace_back("identifier not found: " + ident->value);
+                        return false;
+                    }
+                    loadSymbol(symbol);
+                    return true;
+                }
+                case NodeKind::INTEGER_LITERAL:
+                    emit(OpConstant, {integerConstant(static_cast<IntegerLiteral*>(node)->value)});
+                    return true;
+                case NodeKind::STRING_LITERAL:
+                    emit(OpConstant, {stringConstant(static_cast<StringLiteral*>(node)->value)});
+                    return true;
+                case NodeKind::BOOLEAN:
+                    emit(static_cast<Boolean*>(node)->value ? OpTrue : OpFalse);
+                    return true;
+                case NodeKind::PREFIX_EXPRESSION: {
+                    auto prefix = static_cast<PrefixExpression*>(node);
+                    if (!compile(prefix->right)) {
+                        return false;
+                    }
+                    if (prefix->op == "!") {
+                        emit(OpBang);
+                    } else if (prefix->op == "-") {
+                        emit(OpMinus);
+                    } else {
+                        errors.emplace_back("unknown operator: " + prefix->op);
+                        return false;
+                    }
+                    return true;
+                }
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    if (!compile(infix->left) || !compile(infix->right)) {
+                        return false;
+                    }
+                    if (infix->op == "+") {
+                        emit(OpAdd);
+                    } else if (infix->op == "-") {
+                        emit(OpSub);
+                    } else if (infix->op == "*") {
+                        emit(OpMul);
+                    } else if (infix->op == "/") {
+                        emit(OpDiv);
+                    } else if (infix->op == ">") {
+                        emit(OpGreaterThan);
+                    } else if (infix->op == "<") {
+                        emit(OpLessThan);
+                    } else if (infix->op == "==") {
+                        emit(OpEqual);
+                    } else if (infix->op == "!=") {
+                        emit(OpNotEqual);
+                    } else {
+                        errors.emplace_back("unknown operator: " + infix->op);
+                        return false;
+                    }
+                    return true;
+                }
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    if (!compile(ie->condition)) {
+                        return false;
+                    }
+                    int jumpNotTruthyPos = emit(OpJumpNotTruthy, {9999});
+                    if (!compile(ie->consequence)) {
+                        return false;
+                    }
+                    finishBlock();
+                    int jumpPos = emit(OpJump, {9999});
+                    changeOperand(jumpNotTruthyPos, currentInstructions().size());
+                    if (ie->alternative == nullptr) {
+                        emit(OpNull);
+                    } else {
+                        if (!compile(ie->alternative)) {
+                            return false;
+                        }
+                        finishBlock();
+                    }
+                    changeOperand(jumpPos, currentInstructions().size());
+                    return true;
+                }
+                case NodeKind::FUNCTION_LITERAL:
+                    return compileFunction(static_cast<FunctionLiteral*>(node), "");
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    if (call->function->TokenLiteral() == "quote") {
+                        errors.emplace_back("quote is not supported by the vm engine");
+                        return false;
+                    }
+                    if (!compile(call->function)) {
+                        return false;
+                    }
+                    for (auto& arg : call->arguments) {
+                        if (!compile(arg)) {
+                            return false;
+                        }
+                    }
+                    emit(OpCall, {static_cast<int>(call->arguments.size())});
+                    return true;
+                }
+                case NodeKind::ARRAY_LITERAL: {
+                    auto array = static_cast<ArrayLiteral*>(node);
+                    for (auto& elem : array->elements) {
+                        if (!compile(elem)) {
+                            return false;
+                        }
+                    }
+                    emit(OpArray, {static_cast<int>(array->elements.size())});
+                    return true;
+                }
+                case NodeKind::HASH_LITERAL: {
+                    auto hash = static_cast<HashLiteral*>(node);
+                    for (auto& pair : hash->pairs) {
+                        if (!compile(pair.first) || !compile(pair.second)) {
+                            return false;
+                        }
+                    }
+                    emit(OpHash, {static_cast<int>(hash->pairs.size() * 2)});
+                    return true;
+                }
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    if (!compile(index->left) || !compile(index->index)) {
+                        return false;
+                    }
+                    emit(OpIndex);
+                    return true;
+                }
+                case NodeKind::MACRO_LITERAL:
+                    errors.emplace_back("macro literal must be expanded before compiling");
+                    return false;
+                default:
+                    errors.emplace_back("unknown node: " + NodeKindString[static_cast<int>(node->kind)]);
+                    return false;
+            }
+        }
+
+        Bytecode bytecode() {
+            return Bytecode{currentInstructions(), constants};
+        }
+
+        // 同 bytecode(), 但把常量池移出而不复制; 之后不能再继续编译
+        Bytecode takeBytecode() {
+            return Bytecode{currentInstructions(), std::move(constants)};
+        }
+
+        // 与 takeBytecode() 一起取走常量下标, 留给下一次编译
+        ConstantIndex takeConstantIndex() {
+            return std::move(constantIndex);
+        }
+
+        std::shared_ptr<SymbolTable> getSymbolTable() {
+            return symbolTable;
+        }
+
+        std::string getErrors() {
+            std::string error_out;
+            for (auto& e : errors) {
+                error_out += e + "\n";
+            }
+            return error_out;
+        }
+
+    private:
+        // 编译 let 的右值, 函数字面量需要知道自己的名字以支持递归
+        bool compileValue(Expression* value, const std::string& name) {
+            if (value != nullptr && value->kind == NodeKind::FUNCTION_LITERAL) {
+                return compileFunction(static_cast<FunctionLiteral*>(value), name);
+            }
+            return compile(value);
+        }
+
+        // for-in 用两个隐藏变量保存数组和下标(名字含空格, 不会与源码中的标识符冲突),
+        // 每轮由 OpIterNext 取出下一个元素写入循环变量
+        bool compileFor(ForStatement* loop) {
+            if (!compile(loop->iterable)) {
+                return false;
+            }
+            std::string suffix = std::to_string(loops++);
+            Symbol array = symbolTable->define("for array " + suffix);
+            Symbol index = symbolTable->define("for index " + suffix);
+            storeSymbol(array);
+            emit(OpConstant, {integerConstant(0)});
+            storeSymbol(index);
+            int start = static_cast<int>(currentInstructions().size());
+            loadSymbol(array);
+            loadSymbol(index);
+            int exitPos = emit(OpIterNext, {9999});
+            storeSymbol(symbolTable->define(loop->variable->value));
+            loadSymbol(index);
+            emit(OpConstant, {integerConstant(1)});
+            emit(OpAdd);
+            storeSymbol(index);
+            bool compiled = compile(loop->body);
+            loops--;
+            if (!compiled) {
+                return false;
+            }
+            emit(OpJump, {start});
+            changeOperand(exitPos, currentInstructions().size());
+            // 不再持有遍历完的数组
+            emit(OpNull);
+            storeSymbol(array);
+            return true;
+        }
+
+        bool compileFunction(FunctionLiteral* fn, const std::string& name) {
+            enterScope();
+            CellAnalysis analysis(fn);
+            symbolTable->cells = analysis.cells();
+            // 函数体给自己的名字赋值时, 这个名字指向定义处的绑定, 而不是正在执行的闭包
+            if (!name.empty() && !analysis.assignsFree(name)) {
+                symbolTable->defineFunctionName(name);
+            }
+            for (auto& param : fn->parameters) {
+                symbolTable->define(param->value);
+            }
+            // cell 在函数开头创建, 循环中的 let 每轮写入同一个 cell; 参数的 cell 装入实参
+            for (auto& cell : symbolTable->cells) {
+                int index = symbolTable->isDefined(cell) ? symbolTable->define(cell).index : symbolTable->reserve(cell);
+                emit(OpMakeCell, {index});
+            }
+            if (!compile(fn->body)) {
+                leaveScope();
+                return false;
+            }
+            // 函数体最后一个表达式作为隐式返回值
+            if (lastInstructionIs(OpPop)) {
+                replaceLastPopWithReturn();
+            }
+            if (!lastInstructionIs(OpReturnValue)) {
+                emit(OpReturn);
+            }
+            markTailCalls();
+            auto freeSymbols = symbolTable->freeSymbols;
+            int numLocals = symbolTable->numDefinitions;
+            auto instructions = leaveScope();
+            for (auto& s : freeSymbols) {
+                loadBinding(s);
+            }
+            auto compiled = std::make_shared<CompiledFunction>(instructions, numLocals, static_cast<int>(fn->parameters.size()));
+            emit(OpClosure, {addConstant(compiled), static_cast<int>(freeSymbols.size())});
+            return true;
+        }
+
+        // 紧跟(或经由 OpJump 跳转到) OpReturnValue 的 OpCall 处于尾位置, 改写为 OpTailCall.
+        // 两者操作数宽度相同, 跳转目标不受影响
+        void markTailCalls() {
+            auto& ins = currentInstructions();
+            size_t i = 0;
+            while (i < ins.size()) {
+                auto op = static_cast<Opcode>(ins[i]);
+                size_t width = 1;
+                for (auto w : definitions.at(op).operandWidths) {
+                    width += w;
+                }
+                if (op == OpCall) {
+                    size_t next = i + width;
+                    while (next < ins.size() && ins[next] == OpJump) {
+                        next = readUint16(ins, next + 1);
+                    }
+                    if (next < ins.size() && ins[next] == OpReturnValue) {
+                        ins[i] = OpTailCall;
+                    }
+                }
+                i += width;
+            }
+        }
+
+        // if 分支的值留在栈上, 去掉块末尾的 OpPop; 空块或以 let 结尾的块产生 null
+        void finishBlock() {
+            if (lastInstructionIs(OpPop)) {
+                removeLastPop();
+            } else if (!lastInstructionIs(OpReturnValue)) {
+                emit(OpNull);
+            }
+        }
+
+        // 读取变量的值; 放在 cell 中的变量先取出 cell 再读出其中的值
+        void loadSymbol(const Symbol& s) {
+            loadBinding(s);
+            if (s.cell) {
+                emit(OpGetCell);
+            }
+        }
+
+        // 压入变量的绑定: 普通变量为其值, cell 变量为 cell 本身(闭包捕获的就是它)
+        void loadBinding(const Symbol& s) {
+            switch (s.scope) {
+                case GLOBAL_SCOPE:
+                    emit(OpGetGlobal, {s.index});
+                    break;
+                case LOCAL_SCOPE:
+                    emit(OpGetLocal, {s.index});
+                    break;
+                case FREE_SCOPE:
+                    emit(OpGetFree, {s.index});
+                    break;
+                case FUNCTION_SCOPE:
+                    emit(OpCurrentClosure);
+                    break;
+            }
+        }
+
+        void storeSymbol(const Symbol& s) {
+            if (s.cell) {
+                loadBinding(s);
+                emit(OpSetCell);
+            } else if (s.scope == GLOBAL_SCOPE) {
+                emit(OpSetGlobal, {s.index});
+            } else {
+                emit(OpSetLocal, {s.index});
+            }
+        }
+
+        int addConstant(Value obj) {
+            constants.push_back(obj);
+            return static_cast<int>(constants.size() - 1);
+        }
+
+        int integerConstant(int64_t value) {
+            auto it = constantIndex.integers.find(value);
+            if (it != constantIndex.integers.end()) {
+                return it->second;
+            }
+            int index = addConstant(Value::fromInt(value));
+            constantIndex.integers.emplace(value, index);
+            return index;
+        }
+
+        int stringConstant(const std::string& value) {
+            auto it = constantIndex.strings.find(value);
+            if (it != constantIndex.strings.end()) {
+                return it->second;
+            }
+            int index = addConstant(intern(value));
+            constantIndex.strings.emplace(value, index);
+            return index;
+        }
+
+        // 操作数超出编码宽度时记录错误(只记第一处), 编译结果不会被执行
+        bool checkOperands(Opcode op, const std::vector<int>& operands) {
+            auto& def = definitions.at(op);
+            for (size_t i = 0; i < operands.size() && i < def.operandWidths.size(); ++i) {
+                int64_t limit = int64_t(1) << (8 * def.operandWidths[i]);
+                if (operands[i] < 0 || operands[i] >= limit) {
+                    if (!operandOverflow) {
+                        operandOverflow = true;
+                        errors.emplace_back("operand of " + def.name + " out of range: " + std::to_string(operands[i]) + " (limit " + std::to_string(limit - 1) + ")");
+                    }
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        int emit(Opcode op, std::vector<int> operands = {}) {
+            checkOperands(op, operands);
+            auto ins = make(op, operands);
+            int pos = addInstruction(ins);
+            auto& scope = scopes.back();
+            scope.previousInstruction = scope.lastInstruction;
+            scope.lastInstruction = EmittedInstruction{op, pos};
+            return pos;
+        }
+
+        int addInstruction(const Instructions& ins) {
+            auto& current = scopes.back().instructions;
+            int pos = static_cast<int>(current.size());
+            current.insert(current.end(), ins.begin(), ins.end());
+            return pos;
+        }
+
+        Instructions& currentInstructions() {
+            return scopes.back().instructions;
+        }
+
+        bool lastInstructionIs(Opcode op) {
+            if (currentInstructions().empty()) {
+                return false;
+            }
+            return scopes.back().lastInstruction.opcode == op;
+        }
+
+        void removeLastPop() {
+            auto& scope = scopes.back();
+            scope.instructions.resize(scope.lastInstruction.position);
+            scope.lastInstruction = scope.previousInstruction;
+        }
+
+        void replaceLastPopWithReturn() {
+            auto& scope = scopes.back();
+            scope.instructions[scope.lastInstruction.position] = OpReturnValue;
+            scope.lastInstruction.opcode = OpReturnValue;
+        }
+
+        void changeOperand(int opPos, int operand) {
+            auto op = static_cast<Opcode>(currentInstructions()[opPos]);
+            checkOperands(op, {operand});
+            auto ins = make(op, {operand});
+            for (size_t i = 0; i < ins.size(); ++i) {
+                currentInstructions()[opPos + i] = ins[i];
+            }
+        }
+
+        void enterScope() {
+            scopes.emplace_back();
+            symbolTable = std::make_shared<SymbolTable>(symbolTable);
+        }
+
+        Instructions leaveScope() {
+            auto instructions = currentInstructions();
+            scopes.pop_back();
+            symbolTable = symbolTable->outer;
+            return instructions;
+        }
+
+    private:
+        std::vector<CompilationScope> scopes;
+        std::shared_ptr<SymbolTable> symbolTable;
+        std::vector<Value> constants;
+        ConstantIndex constantIndex;
+        std::vector<std::string> errors;
+        bool operandOverflow = false;
+        int loops = 0;      // 正在编译的 for-in 嵌套层数
+    };
+} // namespace monkey
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <set>
+
+namespace monkey {
+    // 符号作用域
+    enum SymbolScope {
+        GLOBAL_SCOPE = 0,
+        LOCAL_SCOPE,
+        FREE_SCOPE,
+        FUNCTION_SCOPE
+    };
+
+    struct Symbol {
+        std::string name;
+        SymbolScope scope;
+        int index;
+        bool cell;  // 值存放在 cell 中(见 CellAnalysis)
+    };
+
+    // 符号表: 编译期将标识符解析为(作用域, 下标)
+    class SymbolTable {
+    public:
+        std::shared_ptr<SymbolTable> outer;
+        std::shared_ptr<SymbolTable> base; // 全局作用域的下层(如 prelude), 本层定义的同名全局变量遮蔽它而不复用其下标
+        std::vector<Symbol> freeSymbols;   // 当前函数捕获的自由变量(按捕获顺序)
+        std::set<std::string> cells;       // 放进 cell 的局部变量
+        int numDefinitions = 0;
+
+        SymbolTable() = default;
+        SymbolTable(std::shared_ptr<SymbolTable> outer) : outer(outer) {}
+
+        // 叠在 base 之上的全局作用域: 新的全局变量从 base 已用的下标之后分配
+        static std::shared_ptr<SymbolTable> layered(std::shared_ptr<SymbolTable> base) {
+            auto table = std::make_shared<SymbolTable>();
+            table->numDefinitions = base->numDefinitions;
+            table->base = std::move(base);
+            return table;
+        }
+
+        // name 是否已在本作用域定义(再次 let 会复用它的槽位)
+        bool isDefined(const std::string& name) const {
+            auto it = store.find(name);
+            return it != store.end() && (it->second.scope == GLOBAL_SCOPE || it->second.scope == LOCAL_SCOPE);
+        }
+
+        Symbol define(const std::string& name) {
+            // 同一作用域内重复 let 复用原来的槽位
+            if (isDefined(name)) {
+                return store.at(name);
+            }
+            auto it = reserved.find(name);
+            int index = it != reserved.end() ? it->second : numDefinitions++;
+            Symbol symbol{name, outer == nullptr ? GLOBAL_SCOPE : LOCAL_SCOPE, index, cells.count(name) > 0};
+            store[name] = symbol;
+            return symbol;
+        }
+
+        // 预留局部变量的槽位: 函数开头就要为它创建 cell, 名字要到 define 时才可见
+        int reserve(const std::string& name) {
+            auto it = reserved.find(name);
+            if (it != reserved.end()) {
+                return it->second;
+            }
+            return reserved[name] = numDefinitions++;
+        }
+
+        // 当前函数自身的名字, 用于在函数体内递归引用
+        Symbol defineFunctionName(const std::string& name) {
+            Symbol symbol{name, FUNCTION_SCOPE, 0, false};
+            store[name] = symbol;
+            return symbol;
+        }
+
+        // symbol 是否为下层(prelude)定义的全局变量, 本层只能读取
+        bool isBaseGlobal(const Symbol& symbol) const {
+            if (outer != nullptr) {
+                return outer->isBaseGlobal(symbol);
+            }
+            return symbol.scope == GLOBAL_SCOPE && base != nullptr && symbol.index < base->numDefinitions;
+        }
+
+        bool resolve(const std::string& name, Symbol& symbol) {
+            auto it = store.find(name);
+            if (it != store.end()) {
+                symbol = it->second;
+                return true;
+            }
+            if (outer == nullptr) {
+                return base != nullptr && base->resolve(name, symbol);
+            }
+            if (!outer->resolve(name, symbol)) {
+                return false;
+            }
+            if (symbol.scope == GLOBAL_SCOPE) {
+                return true;
+            }
+            symbol = defineFree(symbol);
+            return true;
+        }
+
+    private:
+        Symbol defineFree(const Symbol& original) {
+            freeSymbols.push_back(original);
+            Symbol symbol{original.name, FREE_SCOPE, static_cast<int>(freeSymbols.size() - 1), original.cell};
+            store[original.name] = symbol;
+            return symbol;
+        }
+
+        std::map<std::string, Symbol> store;
+        std::map<std::string, int> reserved;
+    };
+} // namespace monkey
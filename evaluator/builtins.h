@@ -3,110 +3,159 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
 
 #include "../object/object.h"
+#include "../object/memstats.h"
+#include "context.h"
+#include "higher_order.h"
 
 namespace monkey{
     // len
-    std::shared_ptr<Object> len(std::vector<std::shared_ptr<Object>> args){
+    Value len(ValueSpan args){
         if(args.size() != 1){
             return std::make_shared<Error>("wrong number of arguments in builtin function(len). got=" + std::to_string(args.size()) + ", want=1");
-        } else if(args[0]->type() == "STRING"){
-            return std::make_shared<Integer>(static_cast<int64_t>(std::dynamic_pointer_cast<Strin>(args[0])->value.size()));
-        } else if(args[0]->type() == "ARRAY"){
-            return std::make_shared<Integer>(static_cast<int64_t>(std::dynamic_pointer_cast<Array>(args[0])->elements.size()));
+        } else if(args[0].is(ObjectKind::STRING)){
+            return Value::fromInt(static_cast<int64_t>(args[0].as<Strin>()->size()));
+        } else if(args[0].is(ObjectKind::ARRAY)){
+            return Value::fromInt(static_cast<int64_t>(args[0].as<Array>()->size()));
         } else {
-            return std::make_shared<Error>("argument to `len` not supported, got " + args[0]->type());
+            return std::make_shared<Error>("argument to `len` not supported, got " + args[0].type());
         }
     }
 
     // first
-    std::shared_ptr<Object> first(std::vector<std::shared_ptr<Object>> args){
+    Value first(ValueSpan args){
         if(args.size() != 1){
             return std::make_shared<Error>("wrong number of arguments in builtin function(first). got=" + std::to_string(args.size()) + ", want=1");
-        } else if(args[0]->type() != "ARRAY"){
-            return std::make_shared<Error>("argument to `first` must be ARRAY, got " + args[0]->type());
+        } else if(!args[0].is(ObjectKind::ARRAY)){
+            return std::make_shared<Error>("argument to `first` must be ARRAY, got " + args[0].type());
         } else {
-            auto arr = std::dynamic_pointer_cast<Array>(args[0]);
-            if(arr->elements.size() > 0){
-                return arr->elements[0];
+            auto arr = args[0].as<Array>();
+            if(arr->size() > 0){
+                return (*arr)[0];
             } else {
-                return nullptr;
+                return Value::null();
             }
         }
     }
 
     // last
-    std::shared_ptr<Object> last(std::vector<std::shared_ptr<Object>> args){
+    Value last(ValueSpan args){
         if(args.size() != 1){
             return std::make_shared<Error>("wrong number of arguments in builtin function(last). got=" + std::to_string(args.size()) + ", want=1");
-        } else if(args[0]->type() != "ARRAY"){
-            return std::make_shared<Error>("argument to `last` must be ARRAY, got " + args[0]->type());
+        } else if(!args[0].is(ObjectKind::ARRAY)){
+            return std::make_shared<Error>("argument to `last` must be ARRAY, got " + args[0].type());
         } else {
-            auto arr = std::dynamic_pointer_cast<Array>(args[0]);
-            if(arr->elements.size() > 0){
-                return arr->elements[arr->elements.size() - 1];
+            auto arr = args[0].as<Array>();
+            if(arr->size() > 0){
+                return (*arr)[arr->size() - 1];
             } else {
-                return nullptr;
+                return Value::null();
             }
         }
     }
 
-    // rest 接受一个数组，返回一个新数组，新数组包含原数组除第一个元素外的所有元素
-    std::shared_ptr<Object> rest(std::vector<std::shared_ptr<Object>> args){
+    // rest 接受一个数组，返回一个新数组，新数组包含原数组除第一个元素外的所有元素(与原数组共享存储)
+    Value rest(ValueSpan args){
         if(args.size() != 1){
             return std::make_shared<Error>("wrong number of arguments in builtin function(rest). got=" + std::to_string(args.size()) + ", want=1");
-        } else if(args[0]->type() != "ARRAY"){
-            return std::make_shared<Error>("argument to `rest` must be ARRAY, got " + args[0]->type());
+        } else if(!args[0].is(ObjectKind::ARRAY)){
+            return std::make_shared<Error>("argument to `rest` must be ARRAY, got " + args[0].type());
         } else {
-            auto arr = std::dynamic_pointer_cast<Array>(args[0]);
-            if(arr->elements.size() > 0){
-                std::vector<std::shared_ptr<Object>> newElements;
-                for(int i = 1; i < arr->elements.size(); ++i){
-                    newElements.push_back(arr->elements[i]);
-                }
-                return std::make_shared<Array>(newElements);
+            auto arr = args[0].as<Array>();
+            if(arr->size() > 0){
+                return arr->rest();
             } else {
-                return nullptr;
+                return Value::null();
             }
         }
     }
 
-    // push 接受一个数组和一个元素，返回一个新数组，新数组包含原数组的所有元素和新元素
-    std::shared_ptr<Object> push(std::vector<std::shared_ptr<Object>> args){
+    // push 接受一个数组和一个元素，返回一个新数组，新数组包含原数组的所有元素和新元素(尽量与原数组共享存储)
+    Value push(ValueSpan args){
         if(args.size() != 2){
             return std::make_shared<Error>("wrong number of arguments in builtin function(push). got=" + std::to_string(args.size()) + ", want=2");
-        } else if(args[0]->type() != "ARRAY"){
-            return std::make_shared<Error>("argument to `push` must be ARRAY, got " + args[0]->type());
+        } else if(!args[0].is(ObjectKind::ARRAY)){
+            return std::make_shared<Error>("argument to `push` must be ARRAY, got " + args[0].type());
         } else {
-            auto arr = std::dynamic_pointer_cast<Array>(args[0]);
-            std::vector<std::shared_ptr<Object>> newElements;
-            for(int i = 0; i < arr->elements.size(); ++i){
-                newElements.push_back(arr->elements[i]);
-            }
-            newElements.push_back(args[1]);
-            return std::make_shared<Array>(newElements);
+            return args[0].as<Array>()->append(args[1]);
         }
     }
 
     // puts 
-    std::shared_ptr<Object> puts(std::vector<std::shared_ptr<Object>> args){
+    Value puts(ValueSpan args){
+        std::ostream& out = *printStream();
         for(auto& arg : args){
-            std::cout << arg->inspect() << std::endl;
+            out << arg.inspect() << std::endl;
+        }
+        return Value();
+    }
+
+    // memstats 返回按类型统计的分配计数, 需以 --alloc-stats 运行
+    Value memstats(ValueSpan args){
+        if(args.size() != 0){
+            return std::make_shared<Error>("wrong number of arguments in builtin function(memstats). got=" + std::to_string(args.size()) + ", want=0");
+        } else if(!AllocStats::isEnabled()){
+            return std::make_shared<Error>("memstats is unavailable: allocation tracking is off (run with --alloc-stats)");
         }
-        return nullptr;
+        return allocStatsTable();
     }
 
-    static std::map<std::string, std::shared_ptr<Builtin>> builtins = {
+    // 内置函数表在初始化后只读, 可被多个线程上的解释器共享
+    static const std::map<std::string, std::shared_ptr<Builtin>> builtins = {
         {"len", std::make_shared<Builtin>(len)},
         {"first", std::make_shared<Builtin>(first)},
         {"last", std::make_shared<Builtin>(last)},
         {"rest", std::make_shared<Builtin>(rest)},
         {"push", std::make_shared<Builtin>(push)},
-        {"puts", std::make_shared<Builtin>(puts)}
+        {"puts", std::make_shared<Builtin>(puts)},
+        {"memstats", std::make_shared<Builtin>(memstats)},
+        {"map", std::make_shared<Builtin>(map)},
+        {"filter", std::make_shared<Builtin>(filter)},
+        {"reduce", std::make_shared<Builtin>(reduce)},
+        {"sort", std::make_shared<Builtin>(sort)},
+        {"pmap", std::make_shared<Builtin>(pmap)},
+        {"pfilter", std::make_shared<Builtin>(pfilter)},
+        {"preduce", std::make_shared<Builtin>(preduce)},
+        {"psort", std::make_shared<Builtin>(psort)}
     };
 
     std::shared_ptr<Builtin> getBuiltin(const std::string& name) {
-        return builtins[name];
+        auto it = builtins.find(name);
+        return it != builtins.end() ? it->second : nullptr;
+    }
+
+    // 内置函数按名字排序后的列表, 字节码编译器和虚拟机通过下标引用
+    static const std::vector<std::string> builtinNames = [] {
+        std::vector<std::string> names;
+        for (auto& b : builtins) {
+            names.push_back(b.first);
+        }
+        return names;
+    }();
+
+    static const std::vector<std::shared_ptr<Builtin>> builtinList = [] {
+        std::vector<std::shared_ptr<Builtin>> list;
+        for (auto& b : builtins) {
+            list.push_back(b.second);
+        }
+        return list;
+    }();
+
+    int builtinIndex(const std::string& name) {
+        for (size_t i = 0; i < builtinNames.size(); ++i) {
+            if (builtinNames[i] == name) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // 最初的六个内置函数优先于同名变量; 之后加入的内置函数可被用户绑定遮蔽,
+    // 以免新加的名字改变已有脚本的含义
+    bool builtinShadowable(const std::string& name) {
+        static const std::set<std::string> core = {"len", "first", "last", "rest", "push", "puts"};
+        return builtins.count(name) != 0 && core.count(name) == 0;
     }
 };
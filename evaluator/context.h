@@ -0,0 +1,59 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+
+#include "../object/object.h"
+#include "../object/transfer.h"
+
+namespace monkey {
+    // 执行引擎(解释器或虚拟机)提供给内置函数的接口: 回调 Monkey 函数, 以及为工作线程创建副本
+    class Caller {
+    public:
+        // 以 args 调用 fn(用户函数, 闭包或内置函数)
+        virtual Value call(const Value& fn, ValueSpan args) = 0;
+
+        // 在当前(工作)线程上创建一个能执行同一程序中函数的引擎, 所需的全局状态经 transfer 拷贝;
+        // 调用期间原引擎所在的线程须停下等待. 不支持时返回空
+        virtual std::unique_ptr<Caller> fork(Transfer& transfer) = 0;
+
+        virtual ~Caller() = default;
+    };
+
+    // 当前线程上正在执行的引擎, 内置函数经由它回调用户函数
+    inline Caller*& currentCaller() {
+        static thread_local Caller* caller = nullptr;
+        return caller;
+    }
+
+    // 作用域守卫: 在作用域内把 caller 设为当前引擎
+    class CallerScope {
+    public:
+        explicit CallerScope(Caller* caller) : saved(currentCaller()) {
+            currentCaller() = caller;
+        }
+
+        ~CallerScope() {
+            currentCaller() = saved;
+        }
+
+        CallerScope(const CallerScope&) = delete;
+        CallerScope& operator=(const CallerScope&) = delete;
+
+    private:
+        Caller* saved;
+    };
+
+    // 工作线程上的回调是否写入了从原线程拷贝来的绑定. 这样的写入不会反映到原来的绑定上,
+    // 引擎在写入处报错停止, 并行内置函数据此改为在原线程上顺序执行
+    inline bool& wroteCopiedBinding() {
+        static thread_local bool wrote = false;
+        return wrote;
+    }
+
+    // puts 的输出目标: 每个线程各自一个, 默认为标准输出, 解释器运行时可将其重定向
+    inline std::ostream*& printStream() {
+        static thread_local std::ostream* out = &std::cout;
+        return out;
+    }
+} // namespace monkey
@@ -2,141 +2,311 @@
 
 #include "../ast/ast.h"
 #include "../ast/modify.h"
+#include "../ast/arena.h"
 #include "../object/object.h"
 #include "builtins.h"
+#include "profiler.h"
+#include "../trace/trace.h"
 
 namespace monkey{
-    static const std::shared_ptr<Null> NULL_OBJ = std::make_shared<Null>();
-    static const std::shared_ptr<Boolea> TRUE_OBJ = std::make_shared<Boolea>(true);
-    static const std::shared_ptr<Boolea> FALSE_OBJ = std::make_shared<Boolea>(false);
+    class Evaluator : public Caller{
+    public:
+        static const int MAX_MACRO_DEPTH = 64;  // 宏展开结果中再次展开宏的层数上限
 
+        // 宏展开时由值转换出的新节点分配在 arena 中
+        Evaluator(Arena& arena) : arena(arena) {}
 
-    class Evaluator{
-    public:
-        std::shared_ptr<Object> eval(std::shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-            if (std::dynamic_pointer_cast<Program>(node)) {
-                return evalProgram(std::dynamic_pointer_cast<Program>(node), env);
-            } 
-            else if (std::dynamic_pointer_cast<BlockStatement>(node)) {
-                return evalBlockStatement(std::dynamic_pointer_cast<BlockStatement>(node), env);
-            } 
-            else if (std::dynamic_pointer_cast<ExpressionStatement>(node)) {
-                return eval(std::dynamic_pointer_cast<ExpressionStatement>(node)->expression, env);
-            } 
-            else if (std::dynamic_pointer_cast<ReturnStatement>(node)) {
-                std::shared_ptr<Object> val = eval(std::dynamic_pointer_cast<ReturnStatement>(node)->returnValue, env);
-                if (isError(val)) {
-                    return val;
+        // 设置后每次用户函数调用都记录到分析器中; 为空(默认)时调用路径上只多一次指针判断
+        void setProfiler(Profiler* p) {
+            profiler = p;
+        }
+
+        // 设置后每条顶层语句和每次宏展开都记录为追踪事件
+        void setTracer(Tracer* t) {
+            tracer = t;
+        }
+
+        // 是否使用优化器预先放在 AST 中的字符串常量; 它们属于执行优化的线程, 其它线程上的解释器须自己驻留
+        void setUseConstants(bool use) {
+            useConstants = use;
+        }
+
+        // 内置函数(如 map)回调用户函数的入口
+        Value call(const Value& fn, ValueSpan args) override {
+            return applyFunction(fn, args);
+        }
+
+        // 函数的环境随函数一起拷贝, 副本不需要其它全局状态
+        std::unique_ptr<Caller> fork(Transfer& transfer) override;
+
+        // 按节点类别 switch 分派; 子节点以裸指针传递, 避免引用计数开销
+        Value eval(Node* node, const std::shared_ptr<Environment>& env) {
+            if (node == nullptr) {
+                return Value();
+            }
+            switch (node->kind) {
+                case NodeKind::PROGRAM:
+                    return evalProgram(static_cast<Program*>(node), env);
+                case NodeKind::BLOCK_STATEMENT:
+                    return evalBlockStatement(static_cast<BlockStatement*>(node), env);
+                case NodeKind::EXPRESSION_STATEMENT:
+                    return eval(static_cast<ExpressionStatement*>(node)->expression, env);
+                case NodeKind::RETURN_STATEMENT: {
+                    // return 的值总处于尾位置
+                    Value val = evalTail(static_cast<ReturnStatement*>(node)->returnValue, env);
+                    if (isError(val)) {
+                        return val;
+                    }
+                    return std::make_shared<ReturnValue>(val);
                 }
-                return std::make_shared<ReturnValue>(val);
-            } 
-            else if (std::dynamic_pointer_cast<LetStatement>(node)) {
-                std::shared_ptr<Object> val = eval(std::dynamic_pointer_cast<LetStatement>(node)->value, env);
-                if (isError(val)) {
-                    return val;
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(node);
+                    Value val = eval(let->value, env);
+                    if (isError(val)) {
+                        return val;
+                    }
+                    if (let->name->depth == 0) {
+                        env->setAt(let->name->slot, val);
+                    } else {
+                        env->set(let->name->value, val);
+                    }
+                    return Value();
+                }
+                case NodeKind::ASSIGN_STATEMENT:
+                    return evalAssignStatement(static_cast<AssignStatement*>(node), env);
+                case NodeKind::WHILE_STATEMENT:
+                    return evalWhileStatement(static_cast<WhileStatement*>(node), env);
+                case NodeKind::FOR_STATEMENT:
+                    return evalForStatement(static_cast<ForStatement*>(node), env);
+                case NodeKind::INTEGER_LITERAL:
+                    return Value::fromInt(static_cast<IntegerLiteral*>(node)->value);
+                case NodeKind::BOOLEAN:
+                    return Value::fromBool(static_cast<Boolean*>(node)->value);
+                case NodeKind::STRING_LITERAL: {
+                    auto lit = static_cast<StringLiteral*>(node);
+                    if (lit->constant != nullptr && useConstants) {
+                        return lit->constant;
+                    }
+                    return intern(lit->value);
                 }
-                env->set(std::dynamic_pointer_cast<LetStatement>(node)->name->value, val);
-            }
-            else if (std::dynamic_pointer_cast<IntegerLiteral>(node)) {
-                return std::make_shared<Integer>(std::dynamic_pointer_cast<IntegerLiteral>(node)->value);
-            } 
-            else if (std::dynamic_pointer_cast<Boolea>(node)) {
-                return nativeBoolToBooleaObject(std::dynamic_pointer_cast<Boolea>(node)->value);
-            } 
-            else if (std::dynamic_pointer_cast<StringLiteral>(node)) {
-                return std::make_shared<Strin>(std::dynamic_pointer_cast<StringLiteral>(node)->value);
-            }
-            else if (std::dynamic_pointer_cast<PrefixExpression>(node)) {
-                auto right = eval(std::dynamic_pointer_cast<PrefixExpression>(node)->right, env);
-                if (isError(right)) {
-                    return right;
-                }
-                return evalPrefixExpression(std::dynamic_pointer_cast<PrefixExpression>(node)->op, right);
-            } else if (std::dynamic_pointer_cast<InfixExpression>(node)) {
-                auto left = eval(std::dynamic_pointer_cast<InfixExpression>(node)->left, env);
-                if (isError(left)) {
-                    return left;
-                }
-                auto right = eval(std::dynamic_pointer_cast<InfixExpression>(node)->right, env);
-                if (isError(right)) {
-                    return right;
-                }
-                return evalInfixExpression(std::dynamic_pointer_cast<InfixExpression>(node)->op, left, right);
-            } 
-            else if (std::dynamic_pointer_cast<IfExpression>(node)) {
-                return evalIfExpression(std::dynamic_pointer_cast<IfExpression>(node), env);
-            } 
-            else if (std::dynamic_pointer_cast<Identifier>(node)) {
-                return evalIdentifier(std::dynamic_pointer_cast<Identifier>(node), env);
-            }
-            else if (std::dynamic_pointer_cast<FunctionLiteral>(node)) {
-                auto params = std::dynamic_pointer_cast<FunctionLiteral>(node)->parameters;
-                auto body = std::dynamic_pointer_cast<FunctionLiteral>(node)->body;
-                return std::make_shared<Function>(params, body, env);
-            } 
-            else if (std::dynamic_pointer_cast<CallExpression>(node)) {
-                auto cnode = std::dynamic_pointer_cast<CallExpression>(node);
-                if (cnode->function->TokenLiteral() == "quote") {
-                    if (cnode->arguments.size() != 1) {
-                        return std::make_shared<Error>("wrong number of arguments in quote. got=" + std::to_string(cnode->arguments.size()) + ", want=1");
+                case NodeKind::PREFIX_EXPRESSION: {
+                    auto prefix = static_cast<PrefixExpression*>(node);
+                    auto right = eval(prefix->right, env);
+                    if (isError(right)) {
+                        return right;
                     }
-                    return quote(cnode->arguments[0], env);
+                    return evalPrefixExpression(prefix->op, right);
                 }
-                auto function = eval(cnode->function, env);
-                if (isError(function)) {
-                    return function;
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    auto left = eval(infix->left, env);
+                    if (isError(left)) {
+                        return left;
+                    }
+                    auto right = eval(infix->right, env);
+                    if (isError(right)) {
+                        return right;
+                    }
+                    return evalInfixExpression(infix->op, left, right);
                 }
-                auto args = evalExpressions(cnode->arguments, env);
-                if (args.size() == 1 && isError(args[0])) {
-                    return args[0];
+                case NodeKind::IF_EXPRESSION:
+                    return evalIfExpression(static_cast<IfExpression*>(node), env);
+                case NodeKind::IDENTIFIER:
+                    return evalIdentifier(static_cast<Identifier*>(node), env);
+                case NodeKind::FUNCTION_LITERAL: {
+                    auto lit = static_cast<FunctionLiteral*>(node);
+                    return std::make_shared<Function>(lit->parameters, lit->body, env, lit->scope, lit);
                 }
-                return applyFunction(function, args);
-            }
-            else if (std::dynamic_pointer_cast<ArrayLiteral>(node)) {
-                auto elements = evalExpressions(std::dynamic_pointer_cast<ArrayLiteral>(node)->elements, env);
-                if (elements.size() == 1 && isError(elements[0])) {
-                    return elements[0];
+                case NodeKind::CALL_EXPRESSION: {
+                    auto cnode = static_cast<CallExpression*>(node);
+                    if (isCallTo(cnode, "quote")) {
+                        if (cnode->arguments.size() != 1) {
+                            return std::make_shared<Error>("wrong number of arguments in quote. got=" + std::to_string(cnode->arguments.size()) + ", want=1");
+                        }
+                        return quote(cnode->arguments[0], env);
+                    }
+                    auto function = eval(cnode->function, env);
+                    if (isError(function)) {
+                        return function;
+                    }
+                    Arguments args;
+                    evalExpressions(cnode->arguments, env, args);
+                    if (args.size() == 1 && isError(args[0])) {
+                        return args[0];
+                    }
+                    return applyFunction(function, args);
+                }
+                case NodeKind::ARRAY_LITERAL: {
+                    std::vector<Value> elements;
+                    evalExpressions(static_cast<ArrayLiteral*>(node)->elements, env, elements);
+                    if (elements.size() == 1 && isError(elements[0])) {
+                        return elements[0];
+                    }
+                    return std::make_shared<Array>(std::move(elements));
+                }
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index_node = static_cast<IndexExpression*>(node);
+                    auto left = eval(index_node->left, env);
+                    if (isError(left)) {
+                        return left;
+                    }
+                    auto index = eval(index_node->index, env);
+                    if (isError(index)) {
+                        return index;
+                    }
+                    return evalIndexExpression(left, index);
+                }
+                case NodeKind::HASH_LITERAL:
+                    return evalHashLiteral(static_cast<HashLiteral*>(node), env);
+                default:
+                    return Value();
+            }
+        }
+
+        /*** 尾调用 ***/
+        // 求值处于尾位置的节点: 对用户函数的调用只求出函数和实参, 以 TailCall 返回
+        Value evalTail(Node* node, const std::shared_ptr<Environment>& env) {
+            if (node == nullptr) {
+                return Value();
+            }
+            switch (node->kind) {
+                case NodeKind::EXPRESSION_STATEMENT:
+                    return evalTail(static_cast<ExpressionStatement*>(node)->expression, env);
+                case NodeKind::BLOCK_STATEMENT:
+                    return evalTailBlockStatement(static_cast<BlockStatement*>(node), env);
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    auto condition = eval(ie->condition, env);
+                    if (isError(condition)) {
+                        return condition;
+                    }
+                    if (isTruthy(condition)) {
+                        return evalTailBlockStatement(ie->consequence, env);
+                    } else if (ie->alternative != nullptr) {
+                        return evalTailBlockStatement(ie->alternative, env);
+                    }
+                    return Value::null();
+                }
+                case NodeKind::CALL_EXPRESSION: {
+                    auto cnode = static_cast<CallExpression*>(node);
+                    if (isCallTo(cnode, "quote")) {
+                        return eval(node, env);
+                    }
+                    auto function = eval(cnode->function, env);
+                    if (isError(function)) {
+                        return function;
+                    }
+                    Arguments args;
+                    evalExpressions(cnode->arguments, env, args);
+                    if (args.size() == 1 && isError(args[0])) {
+                        return args[0];
+                    }
+                    // 内置函数不会递归, 直接调用
+                    if (!function.is(ObjectKind::FUNCTION)) {
+                        return applyFunction(function, args);
+                    }
+                    return makePooled<TailCall>(std::move(function), std::move(args));
                 }
-                return std::make_shared<Array>(elements);
+                default:
+                    return eval(node, env);
             }
-            else if (std::dynamic_pointer_cast<IndexExpression>(node)) {
-                auto index_node = std::dynamic_pointer_cast<IndexExpression>(node);
-                auto left = eval(index_node->left, env);
-                if (isError(left)) {
-                    return left;
+        }
+
+        // 块中最后一条语句处于尾位置
+        Value evalTailBlockStatement(BlockStatement* block, const std::shared_ptr<Environment>& env) {
+            Value result;
+            auto& statements = block->statements;
+            for (size_t i = 0; i < statements.size(); ++i) {
+                if (i == statements.size() - 1) {
+                    return evalTail(statements[i], env);
                 }
-                auto index = eval(index_node->index, env);
-                if (isError(index)) {
-                    return index;
+                result = eval(statements[i], env);
+                if (result.isObject()) {
+                    auto kind = result.obj()->kind;
+                    if (kind == ObjectKind::RETURN_VALUE || kind == ObjectKind::ERROR) {
+                        return result;
+                    }
                 }
-                return evalIndexExpression(left, index);
             }
-            else if (std::dynamic_pointer_cast<HashLiteral>(node)) {
-                return evalHashLiteral(std::dynamic_pointer_cast<HashLiteral>(node), env);
+            return result;
+        }
+
+        // 执行可能残留的尾调用(例如顶层的 return f(x))
+        Value resolveTailCall(Value obj) {
+            if (obj.is(ObjectKind::TAIL_CALL)) {
+                auto call = obj.as<TailCall>();
+                return applyFunction(call->fn, call->args);
             }
-            return nullptr;
+            return obj;
         }
 
-        std::shared_ptr<Object> evalProgram(std::shared_ptr<Program> program, std::shared_ptr<Environment> env) {
-            std::shared_ptr<Object> result;
+        // returned 非空时记录是否执行到了顶层 return(流式执行据此结束整个输入)
+        Value evalProgram(Program* program, const std::shared_ptr<Environment>& env, bool* returned = nullptr) {
+            Value result;
             for (auto& statement : program->statements) {
-                result = eval(statement, env);
-                if (std::dynamic_pointer_cast<ReturnValue>(result)) {
-                    return std::dynamic_pointer_cast<ReturnValue>(result)->value;
-                } else if (std::dynamic_pointer_cast<Error>(result)) {
+                result = tracer != nullptr ? evalTracedStatement(statement, env) : eval(statement, env);
+                if (!result.isObject()) {
+                    continue;
+                }
+                auto kind = result.obj()->kind;
+                if (kind == ObjectKind::RETURN_VALUE) {
+                    if (returned != nullptr) {
+                        *returned = true;
+                    }
+                    return resolveTailCall(result.as<ReturnValue>()->value);
+                } else if (kind == ObjectKind::ERROR) {
                     return result;
                 }
             }
             return result;
         }
 
-        std::shared_ptr<Object> evalBlockStatement(std::shared_ptr<BlockStatement> block, std::shared_ptr<Environment> env) {
-            std::shared_ptr<Object> result;
+        // 顶层语句以 "let 名字" 或语句类别命名, 附带语句起始位置
+        Value evalTracedStatement(Statement* statement, const std::shared_ptr<Environment>& env) {
+            std::string name = NodeKindString[static_cast<int>(statement->kind)];
+            Token token;
+            switch (statement->kind) {
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(statement);
+                    name = "let " + let->name->value;
+                    token = let->token;
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT:
+                    token = static_cast<ReturnStatement*>(statement)->token;
+                    break;
+                case NodeKind::ASSIGN_STATEMENT: {
+                    auto assign = static_cast<AssignStatement*>(statement);
+                    name = assign->name->value + " =";
+                    token = assign->name->token;
+                    break;
+                }
+                case NodeKind::WHILE_STATEMENT:
+                    token = static_cast<WhileStatement*>(statement)->token;
+                    break;
+                case NodeKind::FOR_STATEMENT: {
+                    auto loop = static_cast<ForStatement*>(statement);
+                    name = "for " + loop->variable->value;
+                    token = loop->token;
+                    break;
+                }
+                case NodeKind::EXPRESSION_STATEMENT:
+                    token = static_cast<ExpressionStatement*>(statement)->token;
+                    break;
+                default:
+                    break;
+            }
+            TraceSpan span(tracer, "statement", name, token.getLine(), token.getColumn());
+            return eval(statement, env);
+        }
+
+        Value evalBlockStatement(BlockStatement* block, const std::shared_ptr<Environment>& env) {
+            Value result;
             for (auto& statement : block->statements) {
                 result = eval(statement, env);
-                if (result != nullptr) {
-                    auto type = result->type();
-                    if (type == "RETURN_VALUE" || type == "ERROR") {
+                if (result.isObject()) {
+                    auto kind = result.obj()->kind;
+                    if (kind == ObjectKind::RETURN_VALUE || kind == ObjectKind::ERROR) {
                         return result;
                     }
                 }
@@ -144,105 +314,174 @@ namespace monkey{
             return result;
         }
 
-        std::shared_ptr<Object> nativeBoolToBooleaObject(bool input) {
-            if (input) {
-                return TRUE_OBJ;
+        /*** 循环与赋值 ***/
+        // 赋值只修改已有的绑定, 写回绑定所在的环境; 不引入新变量
+        Value evalAssignStatement(AssignStatement* node, const std::shared_ptr<Environment>& env) {
+            auto name = node->name;
+            if (name->depth == Identifier::BUILTIN || (name->depth == Identifier::UNRESOLVED && builtins.count(name->value) > 0
+                    && !(builtinShadowable(name->value) && !env->get(name->value).isEmpty()))) {
+                return std::make_shared<Error>("cannot assign to builtin: " + name->value);
+            }
+            Value val = eval(node->value, env);
+            if (isError(val)) {
+                return val;
+            }
+            bool bySlot = name->depth >= 0 && !env->getAt(name->depth, name->slot).isEmpty();
+            // 与 evalIdentifier 相同, 槽位尚未赋值时按名字查找
+            Environment* target = bySlot ? env->ancestor(name->depth) : env->owner(name->value);
+            if (target == nullptr) {
+                return std::make_shared<Error>("identifier not found: " + name->value);
+            }
+            if (target->isFrozen()) {
+                return std::make_shared<Error>("cannot assign to read-only binding: " + name->value);
+            }
+            if (target->isCopy()) {
+                wroteCopiedBinding() = true;
+                return std::make_shared<Error>("cannot assign to outer binding in a parallel callback: " + name->value);
+            }
+            if (bySlot) {
+                target->setAt(name->slot, std::move(val));
+            } else {
+                target->assign(name->value, std::move(val));
+            }
+            return Value();
+        }
+
+        // 循环体与所在函数共享环境, 每轮迭代不分配新环境, 也不增加调用栈深度
+        Value evalWhileStatement(WhileStatement* node, const std::shared_ptr<Environment>& env) {
+            while (true) {
+                auto condition = eval(node->condition, env);
+                if (isError(condition)) {
+                    return condition;
+                }
+                if (!isTruthy(condition)) {
+                    return Value();
+                }
+                auto result = evalBlockStatement(node->body, env);
+                if (result.isObject()) {
+                    auto kind = result.obj()->kind;
+                    if (kind == ObjectKind::RETURN_VALUE || kind == ObjectKind::ERROR) {
+                        return result;
+                    }
+                }
+            }
+        }
+
+        // 数组不可变, 持有求值结果即可按下标遍历, 循环变量与 let 一样写入所在环境
+        Value evalForStatement(ForStatement* node, const std::shared_ptr<Environment>& env) {
+            auto iterable = eval(node->iterable, env);
+            if (isError(iterable)) {
+                return iterable;
+            }
+            if (!iterable.is(ObjectKind::ARRAY)) {
+                return std::make_shared<Error>("cannot iterate over " + iterable.type());
+            }
+            auto array = iterable.as<Array>();
+            auto variable = node->variable;
+            for (size_t i = 0; i < array->size(); ++i) {
+                if (variable->depth == 0) {
+                    env->setAt(variable->slot, (*array)[i]);
+                } else {
+                    env->set(variable->value, (*array)[i]);
+                }
+                auto result = evalBlockStatement(node->body, env);
+                if (result.isObject()) {
+                    auto kind = result.obj()->kind;
+                    if (kind == ObjectKind::RETURN_VALUE || kind == ObjectKind::ERROR) {
+                        return result;
+                    }
+                }
             }
-            return FALSE_OBJ;
+            return Value();
         }
 
-        std::shared_ptr<Object> evalPrefixExpression(const std::string& op, std::shared_ptr<Object> right) {
+        Value evalPrefixExpression(const std::string& op, const Value& right) {
             if (op == "!") {
                 return evalBangOperatorExpression(right);
             } else if (op == "-") {
                 return evalMinusPrefixOperatorExpression(right);
             } else {
-                std::string msg = "unknown operator: " + op + right->type();
+                std::string msg = "unknown operator: " + op + right.type();
                 return std::make_shared<Error>(msg);
             }
         }
 
-        std::shared_ptr<Object> evalInfixExpression (const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right) {
-            if (left->type() == "INTEGER" && right->type() == "INTEGER") {
+        Value evalInfixExpression (const std::string& op, const Value& left, const Value& right) {
+            if (left.isInt() && right.isInt()) {
                 return evalIntegerInfixExpression(op, left, right);
-            } else if (left->type() == "STRING" && right->type() == "STRING") {
+            } else if (left.is(ObjectKind::STRING) && right.is(ObjectKind::STRING)) {
                 return evalStringInfixExpression(op, left, right);
             } else if (op == "==") {
-                return nativeBoolToBooleaObject(left == right);
+                return Value::fromBool(left.identical(right));
             } else if (op == "!=") {
-                return nativeBoolToBooleaObject(left != right);
-            } else if (left->type() != right->type()) {
-                std::string msg = "type mismatch: " + left->type() + " " + op + " " + right->type();
+                return Value::fromBool(!left.identical(right));
+            } else if (left.kind() != right.kind()) {
+                std::string msg = "type mismatch: " + left.type() + " " + op + " " + right.type();
                 return std::make_shared<Error>(msg);
             } else {
-                std::string msg = "unknown operator: " + left->type() + " " + op + " " + right->type();
+                std::string msg = "unknown operator: " + left.type() + " " + op + " " + right.type();
                 return std::make_shared<Error>(msg);
             }
         }
 
-        std::shared_ptr<Object> evalBangOperatorExpression(std::shared_ptr<Object> right) {
-            if (right == TRUE_OBJ) {
-                return FALSE_OBJ;
-            } else if (right == FALSE_OBJ) {
-                return TRUE_OBJ;
-            } else if (right == NULL_OBJ) {
-                return TRUE_OBJ;
-            } else {
-                return FALSE_OBJ;
-            }
+        Value evalBangOperatorExpression(const Value& right) {
+            return Value::fromBool(!isTruthy(right));
         }
 
-        std::shared_ptr<Object> evalMinusPrefixOperatorExpression(std::shared_ptr<Object> right) {
-            if (right->type() != "INTEGER") {
-                std::string msg = "unknown operator: -" + right->type();
+        Value evalMinusPrefixOperatorExpression(const Value& right) {
+            if (!right.isInt()) {
+                std::string msg = "unknown operator: -" + right.type();
                 return std::make_shared<Error>(msg);
             }
-            auto value = std::dynamic_pointer_cast<Integer>(right)->value;
-            return std::make_shared<Integer>(-value);
+            return Value::fromInt(wrappingNeg(right.asInt()));
         }
 
-        std::shared_ptr<Object> evalIntegerInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right) {
-            auto leftVal = std::dynamic_pointer_cast<Integer>(left)->value;
-            auto rightVal = std::dynamic_pointer_cast<Integer>(right)->value;
+        Value evalIntegerInfixExpression(const std::string& op, const Value& left, const Value& right) {
+            auto leftVal = left.asInt();
+            auto rightVal = right.asInt();
             if (op == "+") {
-                return std::make_shared<Integer>(leftVal + rightVal);
+                return Value::fromInt(wrappingAdd(leftVal, rightVal));
             } else if (op == "-") {
-                return std::make_shared<Integer>(leftVal - rightVal);
+                return Value::fromInt(wrappingSub(leftVal, rightVal));
             } else if (op == "*") {
-                return std::make_shared<Integer>(leftVal * rightVal);
+                return Value::fromInt(wrappingMul(leftVal, rightVal));
             } else if (op == "/") {
-                return std::make_shared<Integer>(leftVal / rightVal);
+                std::string error = divisionError(leftVal, rightVal);
+                if (!error.empty()) {
+                    return std::make_shared<Error>(error);
+                }
+                return Value::fromInt(leftVal / rightVal);
             } else if (op == "<") {
-                return nativeBoolToBooleaObject(leftVal < rightVal);
+                return Value::fromBool(leftVal < rightVal);
             } else if (op == ">") {
-                return nativeBoolToBooleaObject(leftVal > rightVal);
+                return Value::fromBool(leftVal > rightVal);
             } else if (op == "==") {
-                return nativeBoolToBooleaObject(leftVal == rightVal);
+                return Value::fromBool(leftVal == rightVal);
             } else if (op == "!=") {
-                return nativeBoolToBooleaObject(leftVal != rightVal);
+                return Value::fromBool(leftVal != rightVal);
             } else {
-                std::string msg = "unknown operator: " + left->type() + " " + op + " " + right->type();
+                std::string msg = "unknown operator: " + left.type() + " " + op + " " + right.type();
                 return std::make_shared<Error>(msg);
             }
         }
 
-        std::shared_ptr<Object> evalStringInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right) {
-            auto leftVal = std::dynamic_pointer_cast<Strin>(left)->value;
-            auto rightVal = std::dynamic_pointer_cast<Strin>(right)->value;
+        Value evalStringInfixExpression(const std::string& op, const Value& left, const Value& right) {
+            auto leftVal = left.as<Strin>();
+            auto rightVal = right.as<Strin>();
             if (op == "+") {
-                return std::make_shared<Strin>(leftVal + rightVal);
+                return Strin::concat(*leftVal, *rightVal);
             } else if (op == "==") {
-                return nativeBoolToBooleaObject(leftVal == rightVal);
+                return Value::fromBool(leftVal->equals(rightVal));
             } else if (op == "!=") {
-                return nativeBoolToBooleaObject(leftVal != rightVal);
+                return Value::fromBool(!leftVal->equals(rightVal));
             } else {
-                std::string msg = "unknown operator: " + left->type() + " " + op + " " + right->type();
+                std::string msg = "unknown operator: " + left.type() + " " + op + " " + right.type();
                 return std::make_shared<Error>(msg);
             }
         }
 
 
-        std::shared_ptr<Object> evalIfExpression(std::shared_ptr<IfExpression> ie, std::shared_ptr<Environment> env) {
+        Value evalIfExpression(IfExpression* ie, const std::shared_ptr<Environment>& env) {
             auto condition = eval(ie->condition, env);
             if (isError(condition)) {
                 return condition;
@@ -252,194 +491,247 @@ namespace monkey{
             } else if (ie->alternative != nullptr) {
                 return eval(ie->alternative, env);
             } else {
-                return NULL_OBJ;
+                return Value::null();
             }
         }
 
-        std::shared_ptr<Object> evalIdentifier(std::shared_ptr<Identifier> node, std::shared_ptr<Environment> env) {
-            if (getBuiltin(node->value) != nullptr) {
-                return getBuiltin(node->value);
-            } else if (env->get(node->value) != nullptr) {
-                auto val = env->get(node->value);
+        Value evalIdentifier(Identifier* node, const std::shared_ptr<Environment>& env) {
+            if (node->depth == Identifier::BUILTIN) {
+                return builtinList[node->slot];
+            } else if (node->depth >= 0) {
+                auto& val = env->getAt(node->depth, node->slot);
+                if (!val.isEmpty()) {
+                    return val;
+                }
+                // 槽位尚未赋值(例如先使用后定义), 退回按名字查找外层
+            } else {
+                auto builtin = builtins.find(node->value);
+                if (builtin != builtins.end() && !builtinShadowable(node->value)) {
+                    return builtin->second;
+                }
+            }
+            auto val = env->get(node->value);
+            if (!val.isEmpty()) {
                 return val;
             }
+            if (node->depth == Identifier::UNRESOLVED && builtinShadowable(node->value)) {
+                return getBuiltin(node->value);
+            }
             std::string msg = "identifier not found: " + node->value;
             return std::make_shared<Error>(msg);
         }
 
-        bool isTruthy(std::shared_ptr<Object> obj) {
-            if (obj == NULL_OBJ) {
-                return false;
-            } else if (obj == TRUE_OBJ) {
-                return true;
-            } else if (obj == FALSE_OBJ) {
+        bool isTruthy(const Value& obj) {
+            if (obj.isNull()) {
                 return false;
+            } else if (obj.isBool()) {
+                return obj.asBool();
             } else {
                 return true;
             }
         }
 
-        bool isError(std::shared_ptr<Object> obj) {
-            if (obj != nullptr) {
-                return obj->type() == "ERROR";
-            }
-            return false;
+        bool isError(const Value& obj) {
+            return obj.is(ObjectKind::ERROR);
         }
 
-        std::vector<std::shared_ptr<Object>> evalExpressions(std::vector<std::shared_ptr<Expression>> exps, std::shared_ptr<Environment> env) {
-            std::vector<std::shared_ptr<Object>> result;
+        // 结果写入调用方提供的容器; 出错时容器中只留下这个错误
+        template <typename Container>
+        void evalExpressions(const std::vector<Expression*>& exps, const std::shared_ptr<Environment>& env, Container& result) {
+            result.reserve(exps.size());
             for (auto& e : exps) {
                 auto evaluated = eval(e, env);
                 if (isError(evaluated)) {
-                    return {evaluated};
+                    result.clear();
+                    result.push_back(std::move(evaluated));
+                    return;
                 }
-                result.push_back(evaluated);
+                result.push_back(std::move(evaluated));
             }
-            return result;
         }
 
-        std::shared_ptr<Object> evalIndexExpression(std::shared_ptr<Object> left, std::shared_ptr<Object> index) {
-            if (left->type() == "ARRAY" && index->type() == "INTEGER") {
+        Value evalIndexExpression(const Value& left, const Value& index) {
+            if (left.is(ObjectKind::ARRAY) && index.isInt()) {
                 return evalArrayIndexExpression(left, index);
-            } else if (left->type() == "HASH_TABLE") {
+            } else if (left.is(ObjectKind::HASH_TABLE)) {
                 return evalHashIndexExpression(left, index);
             } else {
-                std::string msg = "index operator not supported: " + left->type();
+                std::string msg = "index operator not supported: " + left.type();
                 return std::make_shared<Error>(msg);
             }
         }
     
-        std::shared_ptr<Object> evalArrayIndexExpression(std::shared_ptr<Object> left, std::shared_ptr<Object> index) {
-            auto array = std::dynamic_pointer_cast<Array>(left);
-            auto idx = std::dynamic_pointer_cast<Integer>(index)->value;
-            auto max = static_cast<int64_t>(array->elements.size() - 1);
+        Value evalArrayIndexExpression(const Value& left, const Value& index) {
+            auto array = left.as<Array>();
+            auto idx = index.asInt();
+            auto max = static_cast<int64_t>(array->size() - 1);
             if (idx < 0 || idx > max) {
-                return NULL_OBJ;
+                return Value::null();
             }
-            return array->elements[idx];
+            return (*array)[idx];
         }
 
-        std::shared_ptr<Object> evalHashLiteral(std::shared_ptr<HashLiteral> node, std::shared_ptr<Environment> env) {
-            std::map<std::string, std::shared_ptr<HashPair>> pairs;
+        Value evalHashLiteral(HashLiteral* node, const std::shared_ptr<Environment>& env) {
+            auto hash = std::make_shared<HashTable>();
             for (auto& pair : node->pairs) {
                 auto key = eval(pair.first, env);
                 if (isError(key)) {
                     return key;
                 }
-                if (!std::dynamic_pointer_cast<Hashable>(key)) {
-                    return std::make_shared<Error>("unusable as hash key: " + key->type());
-                }
                 auto value = eval(pair.second, env);
                 if (isError(value)) {
                     return value;
                 }
-                auto hashed = std::dynamic_pointer_cast<Hashable>(key)->hashKey();
-                pairs[hashed->inspect()] = std::make_shared<HashPair>(key, value);
+                if (!hash->set(key, value)) {
+                    return std::make_shared<Error>("unusable as hash key: " + key.type());
+                }
             }
-            return std::make_shared<HashTable>(pairs);
+            return hash;
         }
 
-        std::shared_ptr<Object> evalHashIndexExpression(std::shared_ptr<Object> left, std::shared_ptr<Object> index) {
-            auto hash = std::dynamic_pointer_cast<HashTable>(left);
-            if (!std::dynamic_pointer_cast<Hashable>(index)) {
-                return std::make_shared<Error>("unusable as hash key: " + index->type());
+        Value evalHashIndexExpression(const Value& left, const Value& index) {
+            bool hashable;
+            auto value = left.as<HashTable>()->get(index, hashable);
+            if (!hashable) {
+                return std::make_shared<Error>("unusable as hash key: " + index.type());
             }
-            auto key = std::dynamic_pointer_cast<Hashable>(index)->hashKey();
-            if (hash->pairs.find(key->inspect()) == hash->pairs.end()) {
-                return NULL_OBJ;
-                // return std::make_shared<Error>("key not found: " + key->inspect() + "\n" + hash->inspect());
+            if (value == nullptr) {
+                return Value::null();
             }
-            return hash->pairs[key->inspect()]->value;
+            return *value;
         }
 
-        std::shared_ptr<Object> applyFunction(std::shared_ptr<Object> fn, std::vector<std::shared_ptr<Object>>& args) {
-            if (std::dynamic_pointer_cast<Function>(fn)) {
-                auto f = std::dynamic_pointer_cast<Function>(fn);
+        Value applyFunction(const Value& fn, ValueSpan args) {
+            // 安全点: 求值过程中的中间对象都由 C++ 栈上的 shared_ptr 持有, 会被当作根
+            auto& heap = Heap::instance();
+            if (!heap.collectIfNeeded()) {
+                return std::make_shared<Error>("heap limit exceeded: live=" + std::to_string(heap.getStats().live) + ", limit=" + std::to_string(heap.getLimit()));
+            }
+            if (fn.is(ObjectKind::FUNCTION)) {
+                // 蹦床: 函数体在尾位置发起的调用以 TailCall 返回并在此循环执行, 递归深度不再占用 C++ 栈
+                auto f = std::static_pointer_cast<Function>(fn.obj());
+                if (f->parameters.size() != args.size()) {
+                    return wrongArgumentCount(*f, args);
+                }
                 auto extendedEnv = extendFunctionEnv(f, args);
-                auto evaluated = eval(f->body, extendedEnv);
-                return unwrapReturnValue(evaluated);
-            } else if (std::dynamic_pointer_cast<Builtin>(fn)) {
-                auto f = std::dynamic_pointer_cast<Builtin>(fn);
-                return f->fn(args);
+                ProfileScope scope(profiler, f->literal);
+                while (true) {
+                    auto evaluated = unwrapReturnValue(evalTailBlockStatement(f->body, extendedEnv));
+                    if (!evaluated.is(ObjectKind::TAIL_CALL)) {
+                        return evaluated;
+                    }
+                    auto call = std::static_pointer_cast<TailCall>(evaluated.obj());
+                    if (!call->fn.is(ObjectKind::FUNCTION)) {
+                        return applyFunction(call->fn, call->args);
+                    }
+                    f = std::static_pointer_cast<Function>(call->fn.obj());
+                    if (f->parameters.size() != call->args.size()) {
+                        return wrongArgumentCount(*f, call->args);
+                    }
+                    extendedEnv = extendFunctionEnv(f, call->args);
+                    if (profiler != nullptr) {
+                        profiler->tailCall(f->literal);
+                    }
+                }
+            } else if (fn.is(ObjectKind::BUILTIN)) {
+                return fn.as<Builtin>()->fn(args);
             } else {
-                std::string msg = "not a function: " + fn->type();
+                std::string msg = "not a function: " + fn.type();
                 return std::make_shared<Error>(msg);
             }
         }
 
-        std::shared_ptr<Environment> extendFunctionEnv(std::shared_ptr<Function> fn, std::vector<std::shared_ptr<Object>>& args) {
-            auto env = Environment(fn->env);
-            for (int i = 0; i < fn->parameters.size(); ++i) {
-                env.set(fn->parameters[i]->value, args[i]);
+        // 与虚拟机的报错一致
+        Value wrongArgumentCount(const Function& fn, ValueSpan args) {
+            return std::make_shared<Error>("wrong number of arguments: want=" + std::to_string(fn.parameters.size()) + ", got=" + std::to_string(args.size()));
+        }
+
+        // 调用方保证实参个数与形参一致
+        std::shared_ptr<Environment> extendFunctionEnv(const std::shared_ptr<Function>& fn, ValueSpan args) {
+            if (fn->scope != nullptr) {
+                // 参数依次占据前面的槽位
+                auto env = makePooled<Environment>(fn->env, fn->scope);
+                for (size_t i = 0; i < fn->parameters.size(); ++i) {
+                    env->setAt(i, args[i]);
+                }
+                return env;
+            }
+            auto env = std::make_shared<Environment>(fn->env);
+            for (size_t i = 0; i < fn->parameters.size(); ++i) {
+                env->set(fn->parameters[i]->value, args[i]);
             }
-            return std::make_shared<Environment>(env);
+            return env;
         }
 
-        std::shared_ptr<Object> unwrapReturnValue(std::shared_ptr<Object> obj) {
-            if (std::dynamic_pointer_cast<ReturnValue>(obj)) {
-                return std::dynamic_pointer_cast<ReturnValue>(obj)->value;
+        Value unwrapReturnValue(Value obj) {
+            if (obj.is(ObjectKind::RETURN_VALUE)) {
+                return obj.as<ReturnValue>()->value;
             }
             return obj;
         }
 
         /*** quote_unquote ***/
-        std::shared_ptr<Object> quote(std::shared_ptr<Node> node, std::shared_ptr<Environment> env) {
+        Value quote(Node* node, std::shared_ptr<Environment> env) {
             return std::make_shared<Quote>(evalUnquoteCalls(node, env));
         }
 
-        bool isUnquoteCall(std::shared_ptr<Node> node) {
-            if (!std::dynamic_pointer_cast<CallExpression>(node)) {
+        // 直接以名字调用的函数, 如 quote(x)
+        bool isCallTo(CallExpression* call, std::string_view name) {
+            return call->function->kind == NodeKind::IDENTIFIER && static_cast<Identifier*>(call->function)->value == name;
+        }
+
+        bool isUnquoteCall(Node* node) {
+            if (node == nullptr || node->kind != NodeKind::CALL_EXPRESSION) {
                 return false;
             }
-            auto call = std::dynamic_pointer_cast<CallExpression>(node);
-            return call->function->TokenLiteral() == "unquote";
+            auto call = static_cast<CallExpression*>(node);
+            return isCallTo(call, "unquote");
         }
 
-        std::shared_ptr<Node> evalUnquoteCalls(std::shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-            return modify(node, [&](std::shared_ptr<Node> node) {
+        // 在副本上替换 unquote 调用: quote 的参数是宏体(或函数体)中的节点, 原地修改会让之后的每次展开都看到第一次的实参
+        Node* evalUnquoteCalls(Node* node, std::shared_ptr<Environment> env) {
+            return modify(clone(node, arena), [&](Node* node) {
                 if (!isUnquoteCall(node)) {
                     return node;
                 }
-                if (!std::dynamic_pointer_cast<CallExpression>(node)) {
-                    return node;
-                };
-                auto call = std::dynamic_pointer_cast<CallExpression>(node);
+                auto call = static_cast<CallExpression*>(node);
                 if (call->arguments.size() != 1) {
                     return node;
                 }
                 auto unquoted = eval(call->arguments[0], env);
                 return convertObjectToNode(unquoted);
+            }, [](CallExpression*) {
+                // 与引入内联之前一致: 只替换不在调用实参中的 unquote
+                return true;
             });
         }
 
-        std::shared_ptr<Node> convertObjectToNode(std::shared_ptr<Object> obj) {
-            if (std::dynamic_pointer_cast<Integer>(obj)) {
-                auto i = std::dynamic_pointer_cast<Integer>(obj);
-                Token token(INT, std::to_string(i->value));
-                return std::make_shared<IntegerLiteral>(token, i->value);
-            } else if (std::dynamic_pointer_cast<Boolea>(obj)) {
-                auto b = std::dynamic_pointer_cast<Boolea>(obj);
+        Node* convertObjectToNode(const Value& obj) {
+            if (obj.isInt()) {
+                Token token(INT, arena.copy(std::to_string(obj.asInt())));
+                return arena.make<IntegerLiteral>(token, obj.asInt());
+            } else if (obj.isBool()) {
                 Token token;
-                if (b->value) {
+                if (obj.asBool()) {
                     token = Token(TRUE, "true");
                 } else {
                     token = Token(FALSE, "false");
                 }
-                return std::make_shared<Boolean>(token, b->value);
-            } else if (std::dynamic_pointer_cast<Strin>(obj)) {
-                auto s = std::dynamic_pointer_cast<Strin>(obj);
-                Token token = Token(STRING, s->value);
-                return std::make_shared<StringLiteral>(token, s->value);
-            } else if (std::dynamic_pointer_cast<Quote>(obj)) {
-                return std::dynamic_pointer_cast<Quote>(obj)->node;
+                return arena.make<Boolean>(token, obj.asBool());
+            } else if (obj.is(ObjectKind::STRING)) {
+                auto value = obj.as<Strin>()->str();
+                Token token = Token(STRING, arena.copy(value));
+                return arena.make<StringLiteral>(token, value);
+            } else if (obj.is(ObjectKind::QUOTE)) {
+                return obj.as<Quote>()->node;
             } else  {
                 return nullptr;
             }
         }
 
-        void defineMacros(std::shared_ptr<Program> program, std::shared_ptr<Environment> env) {
+        void defineMacros(Program* program, std::shared_ptr<Environment> env) {
             std::vector<int> definitions;
-            for (int i = 0; i < program->statements.size(); ++i) {
+            for (int i = 0; i < static_cast<int>(program->statements.size()); ++i) {
                 auto statement = program->statements[i];
                 if (isMacroDefinition(statement)) {
                     addMacro(statement, env);
@@ -452,68 +744,111 @@ namespace monkey{
             }
         }
 
-        bool isMacroDefinition(std::shared_ptr<Node> node) {
-            if (!std::dynamic_pointer_cast<LetStatement>(node)) {
+        bool isMacroDefinition(Node* node) {
+            if (node == nullptr || node->kind != NodeKind::LET_STATEMENT) {
                 return false;
             }
-            auto letStatement = std::dynamic_pointer_cast<LetStatement>(node);
-            if (!std::dynamic_pointer_cast<MacroLiteral>(letStatement->value)) {
-                return false;
-            }
-            return true;
+            auto letStatement = static_cast<LetStatement*>(node);
+            return letStatement->value != nullptr && letStatement->value->kind == NodeKind::MACRO_LITERAL;
         }
 
-        void addMacro(std::shared_ptr<Node> statement, std::shared_ptr<Environment> env) {
-            auto letStatement = std::dynamic_pointer_cast<LetStatement>(statement);
-            auto macroLiteral = std::dynamic_pointer_cast<MacroLiteral>(letStatement->value);
+        void addMacro(Node* statement, std::shared_ptr<Environment> env) {
+            auto letStatement = static_cast<LetStatement*>(statement);
+            auto macroLiteral = static_cast<MacroLiteral*>(letStatement->value);
             auto macro = std::make_shared<Macro>(macroLiteral->parameters, macroLiteral->body, env);
             env->set(letStatement->name->value, macro);
         }
 
-        std::shared_ptr<Node> expandMacros(std::shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-            return modify(node, [&](std::shared_ptr<Node> node) {
-                if (!std::dynamic_pointer_cast<CallExpression>(node)) {
+        Node* expandMacros(Node* node, std::shared_ptr<Environment> env) {
+            return modify(node, [&](Node* node) {
+                if (node == nullptr || node->kind != NodeKind::CALL_EXPRESSION) {
                     return node;
                 }
-                auto callExpression = std::dynamic_pointer_cast<CallExpression>(node);
+                auto callExpression = static_cast<CallExpression*>(node);
                 auto macro = MacroCall(callExpression, env);
                 if (macro == nullptr) {
                     return node;
                 }
                 auto args = quoteArgs(callExpression);
                 auto evalEnv = extendMacroEnv(macro, args);
+                auto name = static_cast<Identifier*>(callExpression->function);
+                TraceSpan span(tracer, "macro", name->value, name->token.getLine(), name->token.getColumn());
                 auto evaluated = eval(macro->body, evalEnv);
-                if (!std::dynamic_pointer_cast<Quote>(evaluated)) {
+                if (!evaluated.is(ObjectKind::QUOTE)) {
                     return node;
                 }
-                auto quote = std::dynamic_pointer_cast<Quote>(evaluated);
-                return quote->node;
+                // 实参原样交给宏, 展开结果中还可能有宏调用(如作为实参传入的宏调用), 继续展开.
+                // 超过层数上限(宏递归展开自身)时保留这些调用
+                Node* result = evaluated.as<Quote>()->node;
+                if (macroDepth >= MAX_MACRO_DEPTH) {
+                    return result;
+                }
+                macroDepth++;
+                result = expandMacros(result, env);
+                macroDepth--;
+                return result;
+            }, [&](CallExpression* call) {
+                return MacroCall(call, env) != nullptr;
             });
         }
 
-        std::shared_ptr<Macro> MacroCall(std::shared_ptr<CallExpression> node, std::shared_ptr<Environment> env) {
-            if (!std::dynamic_pointer_cast<Identifier>(node->function)) {
+        std::shared_ptr<Macro> MacroCall(CallExpression* node, std::shared_ptr<Environment> env) {
+            if (node->function == nullptr || node->function->kind != NodeKind::IDENTIFIER) {
                 return nullptr;
             }
-            auto identifier = std::dynamic_pointer_cast<Identifier>(node->function);
+            auto identifier = static_cast<Identifier*>(node->function);
             auto obj = env->get(identifier->value);
-            return std::dynamic_pointer_cast<Macro>(obj) != nullptr ? std::dynamic_pointer_cast<Macro>(obj) : nullptr;
+            if (!obj.is(ObjectKind::MACRO)) {
+                return nullptr;
+            }
+            return std::static_pointer_cast<Macro>(obj.obj());
         }
 
-        std::vector<std::shared_ptr<Quote>> quoteArgs(std::shared_ptr<CallExpression> exp) {
+        std::vector<std::shared_ptr<Quote>> quoteArgs(CallExpression* exp) {
             std::vector<std::shared_ptr<Quote>> args;
             for (auto& a : exp->arguments) {
-                args.push_back(std::dynamic_pointer_cast<Quote>(a));
+                args.push_back(std::make_shared<Quote>(a));
             }
             return args;
         }
 
         std::shared_ptr<Environment> extendMacroEnv(std::shared_ptr<Macro> macro, std::vector<std::shared_ptr<Quote>>& args) {
-            auto extended = Environment(macro->env);
-            for (int i = 0; i < macro->parameters.size(); ++i) {
-                extended.set(macro->parameters[i]->value, args[i]);
+            auto extended = std::make_shared<Environment>(macro->env);
+            for (size_t i = 0; i < macro->parameters.size(); ++i) {
+                extended->set(macro->parameters[i]->value, args[i]);
             }
-            return std::make_shared<Environment>(extended);
+            return extended;
         }
+
+    private:
+        Arena& arena;
+        Profiler* profiler = nullptr;
+        Tracer* tracer = nullptr;
+        bool useConstants = true;
+        int macroDepth = 0;
     }; // class Evaluator
+
+    // 工作线程上的解释器: 自带 arena, 不记录性能分析和追踪
+    class EvaluatorFork : public Caller{
+    public:
+        EvaluatorFork() : evaluator(arena) {
+            evaluator.setUseConstants(false);
+        }
+
+        Value call(const Value& fn, ValueSpan args) override {
+            return evaluator.call(fn, args);
+        }
+
+        std::unique_ptr<Caller> fork(Transfer& transfer) override {
+            return evaluator.fork(transfer);
+        }
+
+    private:
+        Arena arena;
+        Evaluator evaluator;
+    };
+
+    inline std::unique_ptr<Caller> Evaluator::fork(Transfer&) {
+        return std::make_unique<EvaluatorFork>();
+    }
 } // namespace monkey
@@ -0,0 +1,558 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
+
+#include "../object/object.h"
+#include "../object/transfer.h"
+#include "../parallel/pool.h"
+#include "context.h"
+
+namespace monkey {
+    // 高阶内置函数 map/filter/reduce/sort 及其并行版本 pmap/pfilter/preduce/psort.
+    // 回调经当前线程上的引擎执行. 并行版本把数组分段交给工作窃取线程池: 每段在工作线程上使用引擎的副本,
+    // 回调和元素都先拷贝过去, 结果以 Portable 带回. 各段中 puts 的输出先缓存, 之后按段的顺序写出,
+    // 出错时只保留第一个出错的段及其之前的输出, 与顺序执行的结果相同.
+    // 数组较短, 线程池只有一个线程, 已经在工作线程上, 或回调/结果无法在线程之间传递(如返回函数)时顺序执行.
+
+    // 数组长度达到该值才并行执行
+    const size_t PARALLEL_MIN_SIZE = 512;
+    // 每段的最少元素数
+    const size_t PARALLEL_MIN_CHUNK = 64;
+
+    inline bool isCallable(const Value& v) {
+        auto kind = v.kind();
+        return kind == ObjectKind::FUNCTION || kind == ObjectKind::CLOSURE || kind == ObjectKind::BUILTIN;
+    }
+
+    inline bool isTruthyValue(const Value& v) {
+        return !v.isNull() && !(v.isBool() && !v.asBool());
+    }
+
+    // 调用回调, 没有返回值时视作 null(与虚拟机一致)
+    inline Value callback(const Value& fn, ValueSpan args) {
+        Caller* caller = currentCaller();
+        if (caller == nullptr) {
+            return std::make_shared<Error>("cannot call " + fn.type() + " outside of a running program");
+        }
+        Value result = caller->call(fn, args);
+        if (result.isEmpty()) {
+            return Value::null();
+        }
+        return result;
+    }
+
+    // 检查参数个数, 第一个参数为数组, 下标为 fnIndex 的参数为函数; 出错时返回 Error
+    inline Value checkHigherOrderArgs(const std::string& name, ValueSpan args, size_t want, size_t fnIndex) {
+        if (args.size() != want) {
+            return std::make_shared<Error>("wrong number of arguments in builtin function(" + name + "). got=" + std::to_string(args.size()) + ", want=" + std::to_string(want));
+        } else if (!args[0].is(ObjectKind::ARRAY)) {
+            return std::make_shared<Error>("argument to `" + name + "` must be ARRAY, got " + args[0].type());
+        } else if (!isCallable(args[fnIndex])) {
+            return std::make_shared<Error>("argument to `" + name + "` must be FUNCTION, got " + args[fnIndex].type());
+        }
+        return Value();
+    }
+
+    // sort 的参数: 数组和可选的比较函数 less(a, b); 没有比较函数时元素须全为整数或全为字符串
+    inline Value checkSortArgs(const std::string& name, ValueSpan args) {
+        if (args.size() != 1 && args.size() != 2) {
+            return std::make_shared<Error>("wrong number of arguments in builtin function(" + name + "). got=" + std::to_string(args.size()) + ", want=1 or 2");
+        } else if (!args[0].is(ObjectKind::ARRAY)) {
+            return std::make_shared<Error>("argument to `" + name + "` must be ARRAY, got " + args[0].type());
+        } else if (args.size() == 2) {
+            if (!isCallable(args[1])) {
+                return std::make_shared<Error>("argument to `" + name + "` must be FUNCTION, got " + args[1].type());
+            }
+            return Value();
+        }
+        auto array = args[0].as<Array>();
+        for (size_t i = 0; i < array->size(); ++i) {
+            auto& v = (*array)[i];
+            if ((!v.isInt() && !v.is(ObjectKind::STRING)) || v.kind() != (*array)[0].kind()) {
+                return std::make_shared<Error>("`" + name + "` without a comparison function needs all INTEGER or all STRING elements, got " + (*array)[0].type() + " and " + v.type());
+            }
+        }
+        return Value();
+    }
+
+    /*** 顺序执行 ***/
+    // 回调中的 push 可能使数组的共享缓冲区重新分配, 因此按下标逐个取出元素, 不持有对缓冲区的引用
+
+    inline Value mapSequential(const Array& array, const Value& fn) {
+        std::vector<Value> out;
+        out.reserve(array.size());
+        for (size_t i = 0; i < array.size(); ++i) {
+            Value element = array[i];
+            Value result = callback(fn, ValueSpan(&element, 1));
+            if (result.is(ObjectKind::ERROR)) {
+                return result;
+            }
+            out.push_back(std::move(result));
+        }
+        return std::make_shared<Array>(std::move(out));
+    }
+
+    inline Value filterSequential(const Array& array, const Value& fn) {
+        std::vector<Value> out;
+        for (size_t i = 0; i < array.size(); ++i) {
+            Value element = array[i];
+            Value keep = callback(fn, ValueSpan(&element, 1));
+            if (keep.is(ObjectKind::ERROR)) {
+                return keep;
+            }
+            if (isTruthyValue(keep)) {
+                out.push_back(std::move(element));
+            }
+        }
+        return std::make_shared<Array>(std::move(out));
+    }
+
+    inline Value reduceSequential(const Array& array, Value acc, const Value& fn) {
+        for (size_t i = 0; i < array.size(); ++i) {
+            Value pair[2] = {std::move(acc), array[i]};
+            acc = callback(fn, ValueSpan(pair, 2));
+            if (acc.is(ObjectKind::ERROR)) {
+                return acc;
+            }
+        }
+        return acc;
+    }
+
+    // 排序的比较: fn 为空时按自然顺序(整数大小或字符串的字节序), 否则 fn(a, b) 为真表示 a 排在 b 之前.
+    // 返回 1/0, 出错时返回 -1 并把错误记在 error 中
+    struct SortLess {
+        const std::vector<Value>& elements;
+        const Value& fn;
+        Value error;
+
+        int operator()(size_t a, size_t b) {
+            const Value& x = elements[a];
+            const Value& y = elements[b];
+            if (fn.isEmpty()) {
+                if (x.isInt()) {
+                    return x.asInt() < y.asInt();
+                }
+                auto s = x.as<Strin>();
+                auto t = y.as<Strin>();
+                return std::string_view(s->data(), s->size()) < std::string_view(t->data(), t->size());
+            }
+            Value pair[2] = {x, y};
+            Value result = callback(fn, ValueSpan(pair, 2));
+            if (result.is(ObjectKind::ERROR)) {
+                error = result;
+                return -1;
+            }
+            return isTruthyValue(result);
+        }
+    };
+
+    // 把 order 中已排好序的 [lo, mid) 和 [mid, hi) 稳定地合并, 比较出错时返回 false
+    template <typename Less>
+    bool mergeRuns(std::vector<size_t>& order, std::vector<size_t>& tmp, size_t lo, size_t mid, size_t hi, Less& less) {
+        size_t i = lo, j = mid, k = lo;
+        while (i < mid && j < hi) {
+            int c = less(order[j], order[i]);
+            if (c < 0) {
+                return false;
+            }
+            tmp[k++] = c ? order[j++] : order[i++];
+        }
+        while (i < mid) {
+            tmp[k++] = order[i++];
+        }
+        while (j < hi) {
+            tmp[k++] = order[j++];
+        }
+        std::copy(tmp.begin() + lo, tmp.begin() + hi, order.begin() + lo);
+        return true;
+    }
+
+    // 自底向上的归并排序: 稳定, 比较次数为 O(n log n); 用户的比较函数不满足严格弱序时顺序不确定, 但不会越界
+    template <typename Less>
+    bool mergeSort(std::vector<size_t>& order, Less& less) {
+        size_t n = order.size();
+        std::vector<size_t> tmp(n);
+        for (size_t width = 1; width < n; width *= 2) {
+            for (size_t lo = 0; lo + width < n; lo += 2 * width) {
+                if (!mergeRuns(order, tmp, lo, lo + width, std::min(lo + 2 * width, n), less)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    inline Value sortSequential(const Array& array, const Value& fn) {
+        std::vector<Value> elements;
+        elements.reserve(array.size());
+        for (size_t i = 0; i < array.size(); ++i) {
+            elements.push_back(array[i]);
+        }
+        std::vector<size_t> order(elements.size());
+        std::iota(order.begin(), order.end(), 0);
+        SortLess less{elements, fn, Value()};
+        if (!mergeSort(order, less)) {
+            return less.error;
+        }
+        std::vector<Value> out;
+        out.reserve(order.size());
+        for (size_t i : order) {
+            out.push_back(std::move(elements[i]));
+        }
+        return std::make_shared<Array>(std::move(out));
+    }
+
+    /*** 并行执行 ***/
+    // 数组的一段, 以及工作线程在这一段上得到的结果
+    struct Chunk {
+        size_t begin = 0;
+        size_t mid = 0;                 // psort 合并时前一半的结尾; 等于 begin 表示整段排序
+        size_t end = 0;
+        bool portable = true;           // 回调, 元素和结果都能在线程之间传递
+        bool failed = false;            // 回调返回了错误, 这一段在出错处停止
+        Portable error;
+        std::string output;             // 这一段中 puts 的输出
+        std::vector<Portable> results;  // pmap 的结果
+        std::vector<char> keep;         // pfilter 的结果
+        Portable partial;               // preduce 的部分结果
+        std::vector<size_t> order;      // psort 排好序的下标
+    };
+
+    inline bool shouldRunParallel(size_t n) {
+        return n >= PARALLEL_MIN_SIZE && currentCaller() != nullptr && !WorkStealingPool::inWorker() && WorkStealingPool::instance().size() > 1;
+    }
+
+    // 分成的段数是线程数的几倍, 执行时间不均时留给空闲线程窃取
+    inline std::vector<Chunk> splitChunks(size_t n) {
+        size_t count = std::min(WorkStealingPool::instance().size() * 4, n / PARALLEL_MIN_CHUNK);
+        count = std::max<size_t>(count, 1);
+        std::vector<Chunk> chunks(count);
+        for (size_t c = 0; c < count; ++c) {
+            chunks[c].begin = chunks[c].mid = n * c / count;
+            chunks[c].end = n * (c + 1) / count;
+        }
+        return chunks;
+    }
+
+    // 在线程池上执行 body(chunk, fn, transfer), 当前线程等待全部完成. 工作线程上的 fn 是回调的副本,
+    // 源数组中的元素也要经 transfer 拷贝后使用; fn 为空时不创建引擎副本, body 只能读取源数组.
+    // 段内在工作线程上创建的对象都在该段结束前释放
+    template <typename Body>
+    void runChunks(std::vector<Chunk>& chunks, const Value& fn, Body body) {
+        Caller* caller = currentCaller();
+        WorkStealingPool::instance().run(chunks.size(), [&](size_t c) {
+            Chunk& chunk = chunks[c];
+            std::ostringstream output;
+            std::ostream* savedPrint = printStream();
+            printStream() = &output;
+            wroteCopiedBinding() = false;
+            {
+                Transfer transfer;
+                std::unique_ptr<Caller> engine;
+                Value f;
+                if (!fn.isEmpty()) {
+                    engine = caller->fork(transfer);
+                    f = transfer.copy(fn);
+                }
+                if (!fn.isEmpty() && (engine == nullptr || transfer.failed())) {
+                    chunk.portable = false;
+                } else {
+                    CallerScope scope(engine.get());
+                    body(chunk, f, transfer);
+                    // 回调修改外层绑定时各线程只改到自己的副本, 整批改为顺序执行
+                    if (transfer.failed() || wroteCopiedBinding()) {
+                        chunk.portable = false;
+                    }
+                }
+            }
+            // 副本中的函数和环境互相引用, 在这里打断, 不留给之后的任务
+            Heap::instance().collect();
+            printStream() = savedPrint;
+            chunk.output = output.str();
+        });
+    }
+
+    inline bool allPortable(const std::vector<Chunk>& chunks) {
+        for (auto& chunk : chunks) {
+            if (!chunk.portable) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 按顺序写出各段的输出, 直到第一个出错的段; 返回该错误, 没有出错时返回 EMPTY
+    inline Value finishChunks(const std::vector<Chunk>& chunks) {
+        std::ostream& out = *printStream();
+        for (auto& chunk : chunks) {
+            out << chunk.output;
+            if (chunk.failed) {
+                out.flush();
+                return chunk.error.restore();
+            }
+        }
+        out.flush();
+        return Value();
+    }
+
+    // 工作线程上回调出错: 记录错误并停止这一段
+    inline void failChunk(Chunk& chunk, const Value& error) {
+        chunk.failed = true;
+        chunk.error.assign(error);
+    }
+
+    /*** 内置函数 ***/
+    // map(arr, f): 依次对每个元素调用 f, 返回结果组成的新数组
+    Value map(ValueSpan args) {
+        Value error = checkHigherOrderArgs("map", args, 2, 1);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        return mapSequential(*args[0].as<Array>(), args[1]);
+    }
+
+    // filter(arr, f): 返回 f 为真的元素组成的新数组
+    Value filter(ValueSpan args) {
+        Value error = checkHigherOrderArgs("filter", args, 2, 1);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        return filterSequential(*args[0].as<Array>(), args[1]);
+    }
+
+    // reduce(arr, initial, f): 从 initial 开始依次计算 acc = f(acc, x)
+    Value reduce(ValueSpan args) {
+        Value error = checkHigherOrderArgs("reduce", args, 3, 2);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        return reduceSequential(*args[0].as<Array>(), args[1], args[2]);
+    }
+
+    // sort(arr) / sort(arr, less): 返回稳定排序后的新数组
+    Value sort(ValueSpan args) {
+        Value error = checkSortArgs("sort", args);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        return sortSequential(*args[0].as<Array>(), args.size() == 2 ? args[1] : Value());
+    }
+
+    // pmap(arr, f): 并行的 map, 结果与 map 相同
+    Value pmap(ValueSpan args) {
+        Value error = checkHigherOrderArgs("pmap", args, 2, 1);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        auto& array = *args[0].as<Array>();
+        if (!shouldRunParallel(array.size())) {
+            return mapSequential(array, args[1]);
+        }
+        auto chunks = splitChunks(array.size());
+        runChunks(chunks, args[1], [&](Chunk& chunk, const Value& fn, Transfer& transfer) {
+            chunk.results.resize(chunk.end - chunk.begin);
+            for (size_t i = chunk.begin; i < chunk.end; ++i) {
+                Value element = transfer.copy(array[i]);
+                Value result = callback(fn, ValueSpan(&element, 1));
+                if (result.is(ObjectKind::ERROR)) {
+                    failChunk(chunk, result);
+                    return;
+                }
+                if (!chunk.results[i - chunk.begin].assign(result)) {
+                    chunk.portable = false;
+                    return;
+                }
+            }
+        });
+        if (!allPortable(chunks)) {
+            return mapSequential(array, args[1]);
+        }
+        error = finishChunks(chunks);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        std::vector<Value> out;
+        out.reserve(array.size());
+        for (auto& chunk : chunks) {
+            for (auto& result : chunk.results) {
+                out.push_back(result.restore());
+            }
+        }
+        return std::make_shared<Array>(std::move(out));
+    }
+
+    // pfilter(arr, f): 并行的 filter, 只有 f 的结果在线程之间传递, 保留的仍是原数组中的元素
+    Value pfilter(ValueSpan args) {
+        Value error = checkHigherOrderArgs("pfilter", args, 2, 1);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        auto& array = *args[0].as<Array>();
+        if (!shouldRunParallel(array.size())) {
+            return filterSequential(array, args[1]);
+        }
+        auto chunks = splitChunks(array.size());
+        runChunks(chunks, args[1], [&](Chunk& chunk, const Value& fn, Transfer& transfer) {
+            chunk.keep.resize(chunk.end - chunk.begin);
+            for (size_t i = chunk.begin; i < chunk.end; ++i) {
+                Value element = transfer.copy(array[i]);
+                Value keep = callback(fn, ValueSpan(&element, 1));
+                if (keep.is(ObjectKind::ERROR)) {
+                    failChunk(chunk, keep);
+                    return;
+                }
+                chunk.keep[i - chunk.begin] = isTruthyValue(keep);
+            }
+        });
+        if (!allPortable(chunks)) {
+            return filterSequential(array, args[1]);
+        }
+        error = finishChunks(chunks);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        std::vector<Value> out;
+        for (auto& chunk : chunks) {
+            for (size_t i = chunk.begin; i < chunk.end; ++i) {
+                if (chunk.keep[i - chunk.begin]) {
+                    out.push_back(array[i]);
+                }
+            }
+        }
+        return std::make_shared<Array>(std::move(out));
+    }
+
+    // preduce(arr, initial, f): 并行的 reduce, 要求 f 满足结合律.
+    // 第一段从 initial 开始, 其余各段从段内第一个元素开始归约, 最后在当前线程上按顺序合并各段的结果
+    Value preduce(ValueSpan args) {
+        Value error = checkHigherOrderArgs("preduce", args, 3, 2);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        auto& array = *args[0].as<Array>();
+        if (!shouldRunParallel(array.size())) {
+            return reduceSequential(array, args[1], args[2]);
+        }
+        auto chunks = splitChunks(array.size());
+        const Value& initial = args[1];
+        runChunks(chunks, args[2], [&](Chunk& chunk, const Value& fn, Transfer& transfer) {
+            size_t i = chunk.begin;
+            Value acc = transfer.copy(chunk.begin == 0 ? initial : array[i++]);
+            for (; i < chunk.end; ++i) {
+                Value pair[2] = {std::move(acc), transfer.copy(array[i])};
+                acc = callback(fn, ValueSpan(pair, 2));
+                if (acc.is(ObjectKind::ERROR)) {
+                    failChunk(chunk, acc);
+                    return;
+                }
+            }
+            if (!chunk.partial.assign(acc)) {
+                chunk.portable = false;
+            }
+        });
+        if (!allPortable(chunks)) {
+            return reduceSequential(array, args[1], args[2]);
+        }
+        error = finishChunks(chunks);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        Value acc = chunks[0].partial.restore();
+        for (size_t c = 1; c < chunks.size(); ++c) {
+            Value pair[2] = {std::move(acc), chunks[c].partial.restore()};
+            acc = callback(args[2], ValueSpan(pair, 2));
+            if (acc.is(ObjectKind::ERROR)) {
+                return acc;
+            }
+        }
+        return acc;
+    }
+
+    // psort(arr) / psort(arr, less): 并行的 sort. 各段先分别排序, 再逐轮两两合并, 每轮的合并也并行执行
+    Value psort(ValueSpan args) {
+        Value error = checkSortArgs("psort", args);
+        if (!error.isEmpty()) {
+            return error;
+        }
+        auto& array = *args[0].as<Array>();
+        Value less = args.size() == 2 ? args[1] : Value();
+        if (!shouldRunParallel(array.size())) {
+            return sortSequential(array, less);
+        }
+        std::vector<size_t> order(array.size());
+        std::iota(order.begin(), order.end(), 0);
+        // 按 order 中的位置取出这一段的元素, 排序或合并后写回 chunk.order
+        auto sortChunk = [&](Chunk& chunk, const Value& fn, Transfer& transfer) {
+            size_t m = chunk.end - chunk.begin;
+            std::vector<Value> elements;
+            elements.reserve(m);
+            for (size_t j = 0; j < m; ++j) {
+                // 没有比较函数时只读取整数和字符串, 不需要拷贝
+                auto& element = array[order[chunk.begin + j]];
+                elements.push_back(fn.isEmpty() ? element : transfer.copy(element));
+            }
+            std::vector<size_t> local(m);
+            std::iota(local.begin(), local.end(), 0);
+            SortLess cmp{elements, fn, Value()};
+            std::vector<size_t> tmp(m);
+            bool ok = chunk.mid == chunk.begin ? mergeSort(local, cmp) : mergeRuns(local, tmp, 0, chunk.mid - chunk.begin, m, cmp);
+            if (!ok) {
+                failChunk(chunk, cmp.error);
+                return;
+            }
+            chunk.order.resize(m);
+            for (size_t j = 0; j < m; ++j) {
+                chunk.order[j] = order[chunk.begin + local[j]];
+            }
+        };
+        auto chunks = splitChunks(array.size());
+        runChunks(chunks, less, sortChunk);
+        if (!allPortable(chunks)) {
+            return sortSequential(array, less);
+        }
+        while (true) {
+            error = finishChunks(chunks);
+            if (!error.isEmpty()) {
+                return error;
+            }
+            for (auto& chunk : chunks) {
+                std::copy(chunk.order.begin(), chunk.order.end(), order.begin() + chunk.begin);
+            }
+            if (chunks.size() == 1) {
+                break;
+            }
+            // 相邻两段合并成一段, 落单的最后一段原样留到下一轮
+            std::vector<Chunk> merged;
+            for (size_t c = 0; c + 1 < chunks.size(); c += 2) {
+                Chunk chunk;
+                chunk.begin = chunks[c].begin;
+                chunk.mid = chunks[c].end;
+                chunk.end = chunks[c + 1].end;
+                merged.push_back(std::move(chunk));
+            }
+            runChunks(merged, less, sortChunk);
+            if (!allPortable(merged)) {
+                return sortSequential(array, less);
+            }
+            if (chunks.size() % 2 == 1) {
+                Chunk last;
+                last.begin = last.mid = chunks.back().begin;
+                last.end = chunks.back().end;
+                last.order.assign(order.begin() + last.begin, order.begin() + last.end);
+                merged.push_back(std::move(last));
+            }
+            chunks = std::move(merged);
+        }
+        std::vector<Value> out;
+        out.reserve(order.size());
+        for (size_t i : order) {
+            out.push_back(array[i]);
+        }
+        return std::make_shared<Array>(std::move(out));
+    }
+} // namespace monkey
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <ostream>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#include "../ast/ast.h"
+
+namespace monkey {
+    // 按函数统计的插桩式性能分析器: 记录每个 Monkey 函数的调用次数, 包含时间(含被调用者)和独占时间,
+    // 并维护调用树, 可输出 flamegraph 工具使用的折叠栈格式. 只有解释器设置了分析器时才会调用这里的接口.
+    // 函数以定义处的 FunctionLiteral 区分, 名字取自 let 绑定, 附带源码位置.
+    class Profiler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        Profiler() : root(nullptr) {}
+
+        // 进入函数 fn; fn 为空表示顶层程序
+        void enter(const FunctionLiteral* fn) {
+            auto& stats = statsFor(fn);
+            stats.calls++;
+            stats.active++;
+            CallNode* parent = frames.empty() ? &root : frames.back().node;
+            frames.push_back(Frame{&stats, parent->child(fn), Clock::now(), Clock::duration::zero()});
+        }
+
+        void exit() {
+            if (frames.empty()) {
+                return;
+            }
+            Frame frame = frames.back();
+            frames.pop_back();
+            auto elapsed = Clock::now() - frame.start;
+            auto exclusive = elapsed - frame.children;
+            frame.stats->exclusive += exclusive;
+            frame.node->self += exclusive;
+            // 递归调用只在最外层计入包含时间, 避免重复累加
+            if (--frame.stats->active == 0) {
+                frame.stats->inclusive += elapsed;
+            }
+            if (!frames.empty()) {
+                frames.back().children += elapsed;
+            }
+        }
+
+        // 尾调用: 当前帧被被调函数替换, 调用栈深度不变
+        void tailCall(const FunctionLiteral* fn) {
+            exit();
+            enter(fn);
+        }
+
+        // 按独占时间降序输出各函数的统计
+        void printReport(std::ostream& out) const {
+            std::vector<const FunctionStats*> sorted;
+            for (auto& entry : stats) {
+                sorted.push_back(entry.second.get());
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const FunctionStats* a, const FunctionStats* b) {
+                return a->exclusive > b->exclusive;
+            });
+            char line[256];
+            std::snprintf(line, sizeof(line), "%12s %14s %14s  %s\n", "calls", "inclusive(ms)", "exclusive(ms)", "function");
+            out << line;
+            for (auto s : sorted) {
+                std::snprintf(line, sizeof(line), "%12llu %14.3f %14.3f  ", static_cast<unsigned long long>(s->calls), toMillis(s->inclusive), toMillis(s->exclusive));
+                out << line << s->label << "\n";
+            }
+            out.flush();
+        }
+
+        // 折叠栈格式: 每行为 "外层;...;内层 独占微秒数"
+        void writeCollapsed(std::ostream& out) const {
+            std::string path;
+            for (auto& child : root.children) {
+                writeCollapsed(out, child.get(), path);
+            }
+            out.flush();
+        }
+
+    private:
+        struct FunctionStats {
+            std::string label;
+            uint64_t calls = 0;
+            int active = 0;     // 当前在调用栈中的次数
+            Clock::duration inclusive = Clock::duration::zero();
+            Clock::duration exclusive = Clock::duration::zero();
+        };
+
+        // 调用树节点: 从根到该节点的路径即调用栈
+        struct CallNode {
+            const FunctionLiteral* fn;
+            Clock::duration self = Clock::duration::zero();
+            std::vector<std::unique_ptr<CallNode>> children;
+
+            CallNode(const FunctionLiteral* fn) : fn(fn) {}
+
+            // 子节点一般很少, 线性查找即可
+            CallNode* child(const FunctionLiteral* f) {
+                for (auto& c : children) {
+                    if (c->fn == f) {
+                        return c.get();
+                    }
+                }
+                children.push_back(std::make_unique<CallNode>(f));
+                return children.back().get();
+            }
+        };
+
+        struct Frame {
+            FunctionStats* stats;
+            CallNode* node;
+            Clock::time_point start;
+            Clock::duration children;   // 被调用者占用的时间
+        };
+
+        FunctionStats& statsFor(const FunctionLiteral* fn) {
+            auto& entry = stats[fn];
+            if (entry == nullptr) {
+                entry = std::make_unique<FunctionStats>();
+                entry->label = labelOf(fn);
+            }
+            return *entry;
+        }
+
+        static std::string labelOf(const FunctionLiteral* fn) {
+            if (fn == nullptr) {
+                return "<program>";
+            }
+            std::string label = fn->name.empty() ? "<anonymous>" : fn->name;
+            if (fn->token.getLine() > 0) {
+                label += "@" + std::to_string(fn->token.getLine()) + ":" + std::to_string(fn->token.getColumn());
+            }
+            return label;
+        }
+
+        static double toMillis(Clock::duration d) {
+            return std::chrono::duration<double, std::milli>(d).count();
+        }
+
+        void writeCollapsed(std::ostream& out, const CallNode* node, std::string& path) const {
+            size_t length = path.size();
+            if (!path.empty()) {
+                path += ";";
+            }
+            path += stats.at(node->fn)->label;
+            auto micros = std::chrono::duration_cast<std::chrono::microseconds>(node->self).count();
+            if (micros > 0) {
+                out << path << " " << micros << "\n";
+            }
+            for (auto& child : node->children) {
+                writeCollapsed(out, child.get(), path);
+            }
+            path.resize(length);
+        }
+
+        std::unordered_map<const FunctionLiteral*, std::unique_ptr<FunctionStats>> stats;
+        CallNode root;
+        std::vector<Frame> frames;
+    };
+
+    // 作用域守卫: 分析器为空时什么也不做
+    class ProfileScope {
+    public:
+        ProfileScope(Profiler* profiler, const FunctionLiteral* fn) : profiler(profiler) {
+            if (profiler != nullptr) {
+                profiler->enter(fn);
+            }
+        }
+
+        ~ProfileScope() {
+            if (profiler != nullptr) {
+                profiler->exit();
+            }
+        }
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+
+    private:
+        Profiler* profiler;
+    };
+} // namespace monkey
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "../ast/ast.h"
+#include "builtins.h"
+
+namespace monkey {
+    // 词法地址解析: 求值前遍历 AST, 为每个 Identifier 标注 (depth, slot).
+    // 与解释器的作用域规则一致: 只有函数体引入新作用域, 块语句与所在函数共享作用域;
+    // 内置函数优先于同名变量.
+    class Resolver {
+    public:
+        Resolver() : globals(std::make_shared<ScopeInfo>()) {}
+
+        // 全局作用域在多次解析之间保持, 与 repl 中持久的全局环境对应
+        std::shared_ptr<ScopeInfo> globalScope() {
+            return globals;
+        }
+
+        // 全局环境之外还有一层只读的 prelude 环境时, 其中的变量解析为深度 +1 的词法地址
+        void setOuterScope(std::shared_ptr<ScopeInfo> scope) {
+            outer = scope;
+        }
+
+        void resolve(Program* program) {
+            scopes.clear();
+            if (outer != nullptr) {
+                scopes.push_back(outer.get());
+            }
+            scopes.push_back(globals.get());
+            // 先声明所有顶层 let, 函数体可以引用之后才定义的全局变量
+            for (auto& stmt : program->statements) {
+                declareLets(stmt, *globals);
+            }
+            for (auto& stmt : program->statements) {
+                resolveNode(stmt);
+            }
+        }
+
+    private:
+        // 收集当前作用域内的 let 声明, 不进入嵌套函数
+        void declareLets(Node* node, ScopeInfo& scope) {
+            if (node == nullptr) {
+                return;
+            }
+            switch (node->kind) {
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(node);
+                    scope.declare(let->name->value);
+                    declareLets(let->value, scope);
+                    break;
+                }
+                case NodeKind::ASSIGN_STATEMENT:
+                    declareLets(static_cast<AssignStatement*>(node)->value, scope);
+                    break;
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(node);
+                    declareLets(loop->condition, scope);
+                    declareLets(loop->body, scope);
+                    break;
+                }
+                case NodeKind::FOR_STATEMENT: {
+                    // 循环变量与 let 一样属于所在函数的作用域
+                    auto loop = static_cast<ForStatement*>(node);
+                    scope.declare(loop->variable->value);
+                    declareLets(loop->iterable, scope);
+                    declareLets(loop->body, scope);
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT:
+                    declareLets(static_cast<ReturnStatement*>(node)->returnValue, scope);
+                    break;
+                case NodeKind::EXPRESSION_STATEMENT:
+                    declareLets(static_cast<ExpressionStatement*>(node)->expression, scope);
+                    break;
+                case NodeKind::BLOCK_STATEMENT:
+                    for (auto& stmt : static_cast<BlockStatement*>(node)->statements) {
+                        declareLets(stmt, scope);
+                    }
+                    break;
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    declareLets(ie->condition, scope);
+                    declareLets(ie->consequence, scope);
+                    declareLets(ie->alternative, scope);
+                    break;
+                }
+                case NodeKind::PREFIX_EXPRESSION:
+                    declareLets(static_cast<PrefixExpression*>(node)->right, scope);
+                    break;
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    declareLets(infix->left, scope);
+                    declareLets(infix->right, scope);
+                    break;
+                }
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    if (call->function->TokenLiteral() == "quote") {
+                        break;
+                    }
+                    declareLets(call->function, scope);
+                    for (auto& arg : call->arguments) {
+                        declareLets(arg, scope);
+                    }
+                    break;
+                }
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        declareLets(elem, scope);
+                    }
+                    break;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    declareLets(index->left, scope);
+                    declareLets(index->index, scope);
+                    break;
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        declareLets(pair.first, scope);
+                        declareLets(pair.second, scope);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void resolveNode(Node* node) {
+            if (node == nullptr) {
+                return;
+            }
+            switch (node->kind) {
+                case NodeKind::PROGRAM:
+                    for (auto& stmt : static_cast<Program*>(node)->statements) {
+                        resolveNode(stmt);
+                    }
+                    break;
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(node);
+                    resolveNode(let->value);
+                    let->name->depth = 0;
+                    let->name->slot = scopes.back()->find(let->name->value);
+                    break;
+                }
+                case NodeKind::ASSIGN_STATEMENT: {
+                    auto assign = static_cast<AssignStatement*>(node);
+                    resolveNode(assign->value);
+                    resolveIdentifier(assign->name);
+                    break;
+                }
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(node);
+                    resolveNode(loop->condition);
+                    resolveNode(loop->body);
+                    break;
+                }
+                case NodeKind::FOR_STATEMENT: {
+                    auto loop = static_cast<ForStatement*>(node);
+                    resolveNode(loop->iterable);
+                    loop->variable->depth = 0;
+                    loop->variable->slot = scopes.back()->find(loop->variable->value);
+                    resolveNode(loop->body);
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT:
+                    resolveNode(static_cast<ReturnStatement*>(node)->returnValue);
+                    break;
+                case NodeKind::EXPRESSION_STATEMENT:
+                    resolveNode(static_cast<ExpressionStatement*>(node)->expression);
+                    break;
+                case NodeKind::BLOCK_STATEMENT:
+                    for (auto& stmt : static_cast<BlockStatement*>(node)->statements) {
+                        resolveNode(stmt);
+                    }
+                    break;
+                case NodeKind::IDENTIFIER:
+                    resolveIdentifier(static_cast<Identifier*>(node));
+                    break;
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    resolveNode(ie->condition);
+                    resolveNode(ie->consequence);
+                    resolveNode(ie->alternative);
+                    break;
+                }
+                case NodeKind::PREFIX_EXPRESSION:
+                    resolveNode(static_cast<PrefixExpression*>(node)->right);
+                    break;
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    resolveNode(infix->left);
+                    resolveNode(infix->right);
+                    break;
+                }
+                case NodeKind::FUNCTION_LITERAL:
+                    resolveFunction(static_cast<FunctionLiteral*>(node));
+                    break;
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    // quote 的参数不求值, 只有其中 unquote 的参数在当前作用域求值
+                    if (call->function->TokenLiteral() == "quote") {
+                        for (auto& arg : call->arguments) {
+                            resolveUnquoteCalls(arg);
+                        }
+                        break;
+                    }
+                    resolveNode(call->function);
+                    for (auto& arg : call->arguments) {
+                        resolveNode(arg);
+                    }
+                    break;
+                }
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        resolveNode(elem);
+                    }
+                    break;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    resolveNode(index->left);
+                    resolveNode(index->index);
+                    break;
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        resolveNode(pair.first);
+                        resolveNode(pair.second);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void resolveIdentifier(Identifier* ident) {
+            int builtin = builtinIndex(ident->value);
+            if (builtin >= 0 && !builtinShadowable(ident->value)) {
+                ident->depth = Identifier::BUILTIN;
+                ident->slot = builtin;
+                return;
+            }
+            for (size_t depth = 0; depth < scopes.size(); ++depth) {
+                int slot = scopes[scopes.size() - 1 - depth]->find(ident->value);
+                if (slot >= 0) {
+                    ident->depth = depth;
+                    ident->slot = slot;
+                    return;
+                }
+            }
+            if (builtin >= 0) {
+                ident->depth = Identifier::BUILTIN;
+                ident->slot = builtin;
+                return;
+            }
+            ident->depth = Identifier::UNRESOLVED;
+            ident->slot = -1;
+        }
+
+        void resolveFunction(FunctionLiteral* fn) {
+            auto scope = std::make_shared<ScopeInfo>();
+            // 参数占据前面的槽位
+            for (auto& param : fn->parameters) {
+                param->depth = 0;
+                param->slot = scope->declare(param->value);
+            }
+            declareLets(fn->body, *scope);
+            fn->scope = scope;
+            scopes.push_back(scope.get());
+            resolveNode(fn->body);
+            scopes.pop_back();
+        }
+
+        // 在被 quote 的子树中查找 unquote 调用
+        void resolveUnquoteCalls(Node* node) {
+            if (node == nullptr) {
+                return;
+            }
+            switch (node->kind) {
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    if (call->function->TokenLiteral() == "unquote") {
+                        for (auto& arg : call->arguments) {
+                            resolveNode(arg);
+                        }
+                        return;
+                    }
+                    resolveUnquoteCalls(call->function);
+                    for (auto& arg : call->arguments) {
+                        resolveUnquoteCalls(arg);
+                    }
+                    break;
+                }
+                case NodeKind::LET_STATEMENT:
+                    resolveUnquoteCalls(static_cast<LetStatement*>(node)->value);
+                    break;
+                case NodeKind::ASSIGN_STATEMENT:
+                    resolveUnquoteCalls(static_cast<AssignStatement*>(node)->value);
+                    break;
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(node);
+                    resolveUnquoteCalls(loop->condition);
+                    resolveUnquoteCalls(loop->body);
+                    break;
+                }
+                case NodeKind::FOR_STATEMENT: {
+                    auto loop = static_cast<ForStatement*>(node);
+                    resolveUnquoteCalls(loop->iterable);
+                    resolveUnquoteCalls(loop->body);
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT:
+                    resolveUnquoteCalls(static_cast<ReturnStatement*>(node)->returnValue);
+                    break;
+                case NodeKind::EXPRESSION_STATEMENT:
+                    resolveUnquoteCalls(static_cast<ExpressionStatement*>(node)->expression);
+                    break;
+                case NodeKind::BLOCK_STATEMENT:
+                    for (auto& stmt : static_cast<BlockStatement*>(node)->statements) {
+                        resolveUnquoteCalls(stmt);
+                    }
+                    break;
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    resolveUnquoteCalls(ie->condition);
+                    resolveUnquoteCalls(ie->consequence);
+                    resolveUnquoteCalls(ie->alternative);
+                    break;
+                }
+                case NodeKind::PREFIX_EXPRESSION:
+                    resolveUnquoteCalls(static_cast<PrefixExpression*>(node)->right);
+                    break;
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    resolveUnquoteCalls(infix->left);
+                    resolveUnquoteCalls(infix->right);
+                    break;
+                }
+                case NodeKind::FUNCTION_LITERAL:
+                    resolveUnquoteCalls(static_cast<FunctionLiteral*>(node)->body);
+                    break;
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        resolveUnquoteCalls(elem);
+                    }
+                    break;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    resolveUnquoteCalls(index->left);
+                    resolveUnquoteCalls(index->index);
+                    break;
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        resolveUnquoteCalls(pair.first);
+                        resolveUnquoteCalls(pair.second);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+    private:
+        std::shared_ptr<ScopeInfo> globals;
+        std::shared_ptr<ScopeInfo> outer;
+        std::vector<ScopeInfo*> scopes;     // 当前嵌套的作用域, back() 为最内层
+    };
+} // namespace monkey
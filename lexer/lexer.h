@@ -1,82 +1,97 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include "../token/token.h"
 
 namespace monkey {
+    // 词法分析器: 不复制输入, token 的字面量是指向输入缓冲区的片段, 调用方须保证缓冲区比 token 活得更久
     class Lexer{
     public:
-        Lexer(std::string input) : input(input) {
+        Lexer(std::string_view input) : input(input) {
             readPosition = 0;
             readChar();
         }
 
+        // input 是更大的源码中从 (line, column) 开始的一段, token 的行列号按整个源码计算
+        Lexer(std::string_view input, int line, int column) : input(input), line(line), lineStart(1 - column) {
+            readPosition = 0;
+            readChar();
+        }
+
+        // 下一个 token, 带上它在源码中的行列号
         Token nextToken() {
-            Token token;
             skipWhitespace();
+            int tokenLine = line;
+            int tokenColumn = position - lineStart + 1;
+            Token token = readToken();
+            return Token(token.getType(), token.getLiteralView(), tokenLine, tokenColumn);
+        }
+
+    private:
+        Token readToken() {
+            Token token;
             switch(ch) {
                 case '=':
                     if (peekChar() == '=') {
-                        char curChar = ch;
                         readChar();
-                        token = Token(TokenType::EQ, std::string(1, curChar) + std::string(1, ch));
+                        token = Token(TokenType::EQ, span(position - 1, 2));
                     } else {
-                        token = Token(TokenType::ASSIGN, std::string(1, ch));
+                        token = Token(TokenType::ASSIGN, span(position, 1));
                     }
                     break;
                 case '+':
-                    token = Token(TokenType::PLUS, std::string(1, ch));
+                    token = Token(TokenType::PLUS, span(position, 1));
                     break;
                 case '-':
-                    token = Token(TokenType::MINUS, std::string(1, ch));
+                    token = Token(TokenType::MINUS, span(position, 1));
                     break;
                 case '!':
                     if (peekChar() == '=') {
-                        char curChar = ch;
                         readChar();
-                        token = Token(TokenType::NOT_EQ, std::string(1, curChar) + std::string(1, ch));
+                        token = Token(TokenType::NOT_EQ, span(position - 1, 2));
                     } else {
-                        token = Token(TokenType::BANG, std::string(1, ch));
+                        token = Token(TokenType::BANG, span(position, 1));
                     }
                     break;
                 case '/':
-                    token = Token(TokenType::SLASH, std::string(1, ch));
+                    token = Token(TokenType::SLASH, span(position, 1));
                     break;  
                 case '*':
-                    token = Token(TokenType::ASTERISK, std::string(1, ch));
+                    token = Token(TokenType::ASTERISK, span(position, 1));
                     break;
                 case '<':
-                    token = Token(TokenType::LT, std::string(1, ch));
+                    token = Token(TokenType::LT, span(position, 1));
                     break;
                 case '>':
-                    token = Token(TokenType::GT, std::string(1, ch));
+                    token = Token(TokenType::GT, span(position, 1));
                     break;
                 case ';':
-                    token = Token(TokenType::SEMICOLON, std::string(1, ch));
+                    token = Token(TokenType::SEMICOLON, span(position, 1));
                     break;
                 case ',':
-                    token = Token(TokenType::COMMA, std::string(1, ch));
+                    token = Token(TokenType::COMMA, span(position, 1));
                     break;
                 case ':':
-                    token = Token(TokenType::COLON, std::string(1, ch));
+                    token = Token(TokenType::COLON, span(position, 1));
                     break;
                 case '(':
-                    token = Token(TokenType::LPAREN, std::string(1, ch));
+                    token = Token(TokenType::LPAREN, span(position, 1));
                     break;
                 case ')':
-                    token = Token(TokenType::RPAREN, std::string(1, ch));
+                    token = Token(TokenType::RPAREN, span(position, 1));
                     break;
                 case '[':
-                    token = Token(TokenType::LBRACKET, std::string(1, ch));
+                    token = Token(TokenType::LBRACKET, span(position, 1));
                     break;
                 case ']':
-                    token = Token(TokenType::RBRACKET, std::string(1, ch));
+                    token = Token(TokenType::RBRACKET, span(position, 1));
                     break;
                 case '{':
-                    token = Token(TokenType::LBRACE, std::string(1, ch));
+                    token = Token(TokenType::LBRACE, span(position, 1));
                     break;
                 case '}':
-                    token = Token(TokenType::RBRACE, std::string(1, ch));
+                    token = Token(TokenType::RBRACE, span(position, 1));
                     break;
                 case '"':
                     token = Token(TokenType::STRING, readString());
@@ -86,27 +101,30 @@ namespace monkey {
                     break;
                 default:
                     if (isLetter(ch)) {    // 变量
-                        std::string literal = readIdentifier();
+                        std::string_view literal = readIdentifier();
                         TokenType type = lookupIdent(literal);
                         token = Token(type, literal);
                         return token;
                     } else if (isDigit(ch)) {   // 数字
-                        std::string literal = readNumber();
+                        std::string_view literal = readNumber();
                         token = Token(TokenType::INT, literal);
                         return token;
                     } else {    // 未知字符
-                        token = Token(TokenType::ILLEGAL, std::string(1, ch));
+                        token = Token(TokenType::ILLEGAL, span(position, 1));
                     }
             }
             readChar();
             return token;
         }
 
-    private:
         // helper functions
-        // 读取字符, 并更新position和readPosition
+        // 读取字符, 并更新position和readPosition; 越过换行时行号加一
         void readChar() {
-            if (readPosition >= input.length()) {
+            if (ch == '\n') {
+                ++line;
+                lineStart = readPosition;
+            }
+            if (static_cast<size_t>(readPosition) >= input.length()) {
                 ch = 0;
             } else {
                 ch = input[readPosition];
@@ -123,7 +141,7 @@ namespace monkey {
         }
 
         char peekChar() {
-            if (readPosition >= input.length()) {
+            if (static_cast<size_t>(readPosition) >= input.length()) {
                 return 0;
             } else {
                 return input[readPosition];
@@ -131,25 +149,25 @@ namespace monkey {
         }
 
         // 读取完整的变量名
-        std::string readIdentifier() {
+        std::string_view readIdentifier() {
             int pos = position;
             while (isLetter(ch)) {
                 readChar();
             }
-            return input.substr(pos, position - pos);
+            return span(pos, position - pos);
         }
 
         // 读取完整的数字
-        std::string readNumber() {
+        std::string_view readNumber() {
             int pos = position;
             while (isDigit(ch)) {
                 readChar();
             }
-            return input.substr(pos, position - pos);
+            return span(pos, position - pos);
         }
 
         // 读取字符串
-        std::string readString() {
+        std::string_view readString() {
             int pos = position + 1;
             while (true) {
                 readChar();
@@ -157,7 +175,12 @@ namespace monkey {
                     break;
                 }
             }
-            return input.substr(pos, position - pos);
+            return span(pos, position - pos);
+        }
+
+        // 输入中 [pos, pos + len) 的片段, 不复制
+        std::string_view span(int pos, int len) {
+            return input.substr(pos, len);
         }
 
         // 判断是否为字符
@@ -171,10 +194,12 @@ namespace monkey {
         }
 
     private:
-        std::string input;
+        std::string_view input;
         int position; // current position in input (points to current char)
         int readPosition; // current reading position in input (after current char)
-        char ch; // current char under examination
+        char ch = 0; // current char under examination
+        int line = 1; // line of the current char, starting from 1
+        int lineStart = 0; // position of the first char of the current line
     };
     
 }; // namespace monkey
\ No newline at end of file
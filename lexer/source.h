@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include <memory>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MONKEY_HAVE_MMAP 1
+#endif
+
+namespace monkey {
+    // 源码缓冲区: 优先以只读方式映射整个文件, 否则一次性读入内存.
+    // Lexer 产生的 token 和 AST 中的字面量都指向这块内存, 它必须比 AST 活得更久.
+    class Source {
+    public:
+        Source(const Source&) = delete;
+        Source& operator=(const Source&) = delete;
+
+        ~Source() {
+#ifdef MONKEY_HAVE_MMAP
+            if (mapped != nullptr) {
+                munmap(mapped, mappedSize);
+            }
+#endif
+        }
+
+        // 打开文件失败时返回空
+        static std::shared_ptr<Source> open(const std::string& path) {
+            std::shared_ptr<Source> source(new Source());
+#ifdef MONKEY_HAVE_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                struct stat st;
+                if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (p != MAP_FAILED) {
+                        source->mapped = p;
+                        source->mappedSize = st.st_size;
+                        source->view = std::string_view(static_cast<const char*>(p), st.st_size);
+                        ::close(fd);
+                        return source;
+                    }
+                }
+                ::close(fd);
+            }
+#endif
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                return nullptr;
+            }
+            std::ostringstream buffer;
+            buffer << in.rdbuf();
+            return fromString(buffer.str());
+        }
+
+        static std::shared_ptr<Source> fromString(std::string text) {
+            std::shared_ptr<Source> source(new Source());
+            source->owned = std::move(text);
+            source->view = source->owned;
+            return source;
+        }
+
+        std::string_view text() const {
+            return view;
+        }
+
+    private:
+        Source() = default;
+
+        std::string owned;
+        std::string_view view;
+        void* mapped = nullptr;
+        size_t mappedSize = 0;
+    };
+} // namespace monkey
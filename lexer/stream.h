@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <istream>
+
+namespace monkey {
+    // 分段读取源码: 每次从输入流读入一块, 切出下一条以顶层 ';' 结尾的语句交给 Lexer/Parser,
+    // 内存中只保留尚未切出的部分. 括号和字符串内的 ';' 不切分, 与语法分析器的语句边界一致;
+    // 没有 ';' 结尾的相邻语句会落在同一段中一起执行.
+    class StatementReader {
+    public:
+        static const size_t CHUNK_SIZE = 64 * 1024;
+
+        // 一段源码在整个输入中的起始位置(从 1 开始)
+        struct Position {
+            int line = 1;
+            int column = 1;
+        };
+
+        explicit StatementReader(std::istream& in) : in(in) {}
+
+        // 取下一段源码, 输入结束时剩余的非空白部分作为最后一段; 没有更多输入时返回 false
+        bool next(std::string& text, Position& at) {
+            while (true) {
+                while (scan < buffer.size()) {
+                    char c = buffer[scan++];
+                    advance(c);
+                    if (c == '\0') {
+                        // 与 Lexer 一致: NUL 视为输入结束
+                        buffer.resize(scan - 1);
+                        scan = buffer.size();
+                        eof = true;
+                        break;
+                    }
+                    if (inString) {
+                        inString = c != '"';
+                        continue;
+                    }
+                    switch (c) {
+                        case '"':
+                            inString = true;
+                            break;
+                        case '(': case '[': case '{':
+                            ++depth;
+                            break;
+                        case ')': case ']': case '}':
+                            --depth;
+                            break;
+                        case ';':
+                            if (depth <= 0) {
+                                depth = 0;
+                                return take(scan, text, at);
+                            }
+                            break;
+                    }
+                }
+                if (eof || !fill()) {
+                    if (buffer.find_first_not_of(" \t\r\n", start) == std::string::npos) {
+                        return false;
+                    }
+                    return take(buffer.size(), text, at);
+                }
+            }
+        }
+
+    private:
+        // 读入下一块, 先丢弃已经切出的部分
+        bool fill() {
+            buffer.erase(0, start);
+            scan -= start;
+            start = 0;
+            size_t size = buffer.size();
+            buffer.resize(size + CHUNK_SIZE);
+            in.read(&buffer[size], CHUNK_SIZE);
+            buffer.resize(size + static_cast<size_t>(in.gcount()));
+            if (in.gcount() == 0) {
+                eof = true;
+                return false;
+            }
+            return true;
+        }
+
+        bool take(size_t end, std::string& text, Position& at) {
+            text.assign(buffer, start, end - start);
+            at = begin;
+            start = end;
+            begin = current;
+            return true;
+        }
+
+        // 维护扫描位置的行列号, 用作下一段的起始位置
+        void advance(char c) {
+            if (c == '\n') {
+                ++current.line;
+                current.column = 1;
+            } else {
+                ++current.column;
+            }
+        }
+
+        std::istream& in;
+        std::string buffer;
+        size_t start = 0;   // 当前段在 buffer 中的起点
+        size_t scan = 0;    // 已扫描到的位置
+        int depth = 0;      // 括号嵌套深度
+        bool inString = false;
+        bool eof = false;
+        Position begin;     // 当前段的起始行列号
+        Position current;   // scan 处的行列号
+    };
+} // namespace monkey
@@ -1,17 +1,158 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstdlib>
 
 #include "timer.h"
 #include "repl.h"
+#include "batch/batch.h"
+
+// 解析形如 --name=N 的非负整数选项
+static bool parseCount(const std::string& arg, const std::string& prefix, size_t& out) {
+    if (arg.compare(0, prefix.size(), prefix) != 0 || arg.size() == prefix.size()) {
+        return false;
+    }
+    char* end = nullptr;
+    unsigned long long n = std::strtoull(arg.c_str() + prefix.size(), &end, 10);
+    if (*end != '\0' || arg[prefix.size()] == '-') {
+        return false;
+    }
+    out = static_cast<size_t>(n);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // --engine=eval (默认, 树遍历解释器) | --engine=vm (字节码虚拟机)
+    // --no-optimize 关闭 AST 优化 | --inline-budget=N 可内联函数体的最大节点数(0 关闭内联) | --dump-ast 输出优化后的 AST
+    // --gc-threshold=N 每分配 N 个容器对象检查一次环 | --heap-limit=N 存活对象上限 | --gc-stats 结束时输出回收统计
+    // --profile[=FILE] 统计每个函数的耗时, 结束时输出到标准错误, 折叠栈写入 FILE(默认 profile.folded)
+    // --trace=FILE 把各阶段的耗时以 Chrome trace-event 格式写入 FILE
+    // --alloc-stats 按类型统计对象, AST 节点和环境的分配, 结束时输出到标准错误, 脚本中可用 memstats() 查询
+    // --batch=DIR|MANIFEST 并行执行目录中或清单中列出的所有脚本, 结果按输入顺序写到标准输出 | --jobs=N 工作线程数
+    // --ast-cache=DIR 把宏展开后的 AST 以二进制形式缓存到 DIR, 源码不变时再次运行跳过词法/语法分析和宏展开
+    // --prelude=FILE 先执行 FILE 并冻结其全局环境, 脚本在其上新建一层环境运行, 批量模式下每个工作线程只加载一次
+    // --stream 分段读取 input.txt, 逐条解析和执行顶层语句, 执行完即释放其 AST(宏须先定义后使用)
+    // --threads=N pmap/pfilter/preduce/psort 使用的线程数(默认取硬件并发数)
+    monkey::Options options;
+    bool gcStats = false;
+    monkey::Profiler profiler;
+    std::string profilePath;
+    monkey::Tracer tracer;
+    std::string tracePath;
+    std::string batchPath;
+    size_t jobs = 0;
+    bool stream = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t n = 0;
+        if (arg == "--engine=vm") {
+            options.engine = monkey::ENGINE_VM;
+        } else if (arg == "--engine=eval") {
+            options.engine = monkey::ENGINE_EVAL;
+        } else if (arg == "--no-optimize") {
+            options.optimize = false;
+        } else if (parseCount(arg, "--inline-budget=", n)) {
+            options.inlineBudget = n;
+        } else if (arg == "--dump-ast") {
+            options.dumpAst = true;
+        } else if (parseCount(arg, "--gc-threshold=", n)) {
+            monkey::Heap::instance().setThreshold(n);
+        } else if (parseCount(arg, "--heap-limit=", n)) {
+            monkey::Heap::instance().setLimit(n);
+        } else if (arg == "--gc-stats") {
+            gcStats = true;
+        } else if (arg == "--profile") {
+            profilePath = "profile.folded";
+        } else if (arg.compare(0, 10, "--profile=") == 0 && arg.size() > 10) {
+            profilePath = arg.substr(10);
+        } else if (arg.compare(0, 8, "--batch=") == 0 && arg.size() > 8) {
+            batchPath = arg.substr(8);
+        } else if (parseCount(arg, "--jobs=", n)) {
+            jobs = n;
+        } else if (parseCount(arg, "--threads=", n)) {
+            monkey::WorkStealingPool::setThreads(n);
+        } else if (arg.compare(0, 12, "--ast-cache=") == 0 && arg.size() > 12) {
+            options.astCacheDir = arg.substr(12);
+        } else if (arg.compare(0, 10, "--prelude=") == 0 && arg.size() > 10) {
+            options.prelude = arg.substr(10);
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--alloc-stats") {
+            monkey::AllocStats::enable();
+        } else if (arg.compare(0, 8, "--trace=") == 0 && arg.size() > 8) {
+            tracePath = arg.substr(8);
+            options.tracer = &tracer;
+        } else {
+            std::cerr << "unknown option: " << arg << std::endl;
+            std::cerr << "usage: monkey [--engine=eval|vm] [--no-optimize] [--inline-budget=N] [--dump-ast] [--gc-threshold=N] [--heap-limit=N] [--gc-stats] [--profile[=FILE]] [--trace=FILE] [--alloc-stats] [--batch=DIR|MANIFEST] [--jobs=N] [--threads=N] [--ast-cache=DIR] [--prelude=FILE] [--stream]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!batchPath.empty()) {
+        if (!profilePath.empty() || !tracePath.empty() || gcStats || stream) {
+            std::cerr << "warning: --profile, --trace, --gc-stats and --stream are ignored in batch mode" << std::endl;
+        }
+        std::vector<std::string> scripts;
+        std::string error;
+        if (!monkey::BatchRunner::collect(batchPath, scripts, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        Timer timer;
+        monkey::BatchRunner runner(options, jobs);
+        size_t failed = runner.run(scripts, std::cout);
+        std::cerr << "batch: " << scripts.size() << " scripts, " << failed << " failed, " << timer.elapsed() << "s" << std::endl;
+        return failed == 0 ? 0 : 1;
+    }
+
+    if (!profilePath.empty()) {
+        if (options.engine == monkey::ENGINE_VM) {
+            std::cerr << "warning: --profile is only supported by the eval engine" << std::endl;
+        } else {
+            options.profiler = &profiler;
+        }
+    }
 
-int main() {
     Timer timer;
-    std::ifstream input("input.txt");
+    std::shared_ptr<monkey::Interpreter> prelude;
+    if (!options.prelude.empty()) {
+        monkey::TraceSpan span(options.tracer, "phase", "prelude");
+        prelude = monkey::Interpreter::loadPrelude(options.prelude, options, std::cerr);
+        if (prelude == nullptr) {
+            return 1;
+        }
+    }
     std::ofstream output("output.txt");
-    monkey::start(input, output);
-    input.close();
+    if (stream) {
+        std::ifstream input("input.txt", std::ios::binary);
+        monkey::TraceSpan span(options.tracer, "phase", "start");
+        monkey::startStream(input, output, options, prelude);
+    } else {
+        auto source = monkey::Source::open("input.txt");
+        if (source == nullptr) {
+            source = monkey::Source::fromString("");
+        }
+        monkey::TraceSpan span(options.tracer, "phase", "start");
+        monkey::start(source, output, options, prelude);
+    }
+    prelude.reset();
     output.close();
     std::cout << "Elapsed time: " << timer.elapsed() << "s" << std::endl;
+    if (gcStats) {
+        monkey::Heap::instance().printStats(std::cerr);
+    }
+    if (options.profiler != nullptr) {
+        profiler.printReport(std::cerr);
+        std::ofstream folded(profilePath);
+        profiler.writeCollapsed(folded);
+    }
+    if (options.tracer != nullptr) {
+        std::ofstream traceFile(tracePath);
+        tracer.write(traceFile);
+    }
+    if (monkey::AllocStats::isEnabled()) {
+        monkey::printAllocStats(std::cerr);
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+namespace monkey {
+    // 某一类型的分配计数
+    struct AllocCount {
+        uint64_t allocated = 0;     // 累计创建数
+        uint64_t live = 0;          // 当前存活数
+        uint64_t peak = 0;          // 存活数峰值
+    };
+
+    // 分配统计: 按类别(运行时对象, AST 节点, 环境)和类型记录创建总数, 存活数和存活峰值.
+    // 由基类的构造/析构函数上报, 只在打开后(--alloc-stats)计数, 关闭时只多一次布尔判断.
+    // 计数按线程分开, 开关须在启动工作线程之前设置
+    class AllocStats {
+    public:
+        enum Category {
+            OBJECT = 0,
+            NODE,
+            ENVIRONMENT,
+            CATEGORY_COUNT
+        };
+
+        static const int MAX_KINDS = 32;
+
+        static void enable() {
+            enabled = true;
+        }
+
+        static bool isEnabled() {
+            return enabled;
+        }
+
+        static void created(Category category, int kind) {
+            if (!enabled) {
+                return;
+            }
+            auto& count = counts[category][kind];
+            count.allocated++;
+            if (++count.live > count.peak) {
+                count.peak = count.live;
+            }
+        }
+
+        static void destroyed(Category category, int kind) {
+            if (!enabled) {
+                return;
+            }
+            // 打开统计之前创建的对象不计入
+            auto& count = counts[category][kind];
+            if (count.live > 0) {
+                count.live--;
+            }
+        }
+
+        static const AllocCount& get(Category category, int kind) {
+            return counts[category][kind];
+        }
+
+        // 清零当前线程的计数, 批量运行时每个脚本开始前调用
+        static void reset() {
+            for (auto& category : counts) {
+                for (auto& count : category) {
+                    count = AllocCount();
+                }
+            }
+        }
+
+    private:
+        inline static bool enabled = false;
+        inline static thread_local AllocCount counts[CATEGORY_COUNT][MAX_KINDS];
+    };
+} // namespace monkey
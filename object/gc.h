@@ -0,0 +1,233 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+
+namespace monkey {
+    class Traceable;
+
+    // 遍历一个容器对象直接引用的其它容器对象
+    struct TraceVisitor {
+        virtual void visit(Traceable* child) = 0;
+        virtual ~TraceVisitor() = default;
+    };
+
+    // 可能参与引用环的运行时对象(环境, 函数, 闭包, 数组, hash).
+    // 所有权仍由 shared_ptr 管理, 构造时挂入 Heap 的侵入式链表, 析构时摘除.
+    class Traceable : public std::enable_shared_from_this<Traceable> {
+    public:
+        Traceable();
+        Traceable(const Traceable&);
+        Traceable& operator=(const Traceable&) { return *this; }
+        virtual ~Traceable();
+
+        // 访问所有直接持有的 Traceable
+        virtual void trace(TraceVisitor& visitor) = 0;
+        // 释放所有持有的引用, 用于打断不可达的引用环
+        virtual void clearReferences() = 0;
+
+    private:
+        friend class Heap;
+        Traceable* prev = nullptr;
+        Traceable* next = nullptr;
+        long gcRefs = 0;
+        bool marked = false;
+    };
+
+    struct GcStats {
+        size_t collections = 0;     // 回收次数
+        size_t live = 0;            // 当前存活的容器对象数
+        size_t peakLive = 0;        // 存活数峰值
+        size_t allocated = 0;       // 累计分配数
+        size_t freed = 0;           // 累计由回收器释放(打断引用环)的对象数
+        double totalPauseMs = 0;    // 累计停顿
+        double maxPauseMs = 0;      // 最长一次停顿
+    };
+
+    // 环回收器: 引用计数负责绝大多数对象, 分配达到阈值时做一次标记-清除, 回收引用计数无法释放的环.
+    // 算法: 以 use_count 减去容器之间的内部引用数, 余数大于 0 的对象被外部(C++ 栈, VM 栈, 全局表)持有,
+    // 作为根标记; 未标记的对象只被垃圾引用, 清空其引用后由 shared_ptr 自然释放.
+    // 每个线程有自己的堆: 容器对象在哪个线程创建就挂在哪个线程的链表上, 不能跨线程共享.
+    class Heap {
+    public:
+        static Heap& instance() {
+            static thread_local Heap heap;
+            return heap;
+        }
+
+        // 自上次回收以来分配多少个容器对象后触发回收; 下一次阈值至少为存活数 * growthFactor.
+        // 同时作为之后新建线程的堆的默认值
+        void setThreshold(size_t n) {
+            threshold = n > 0 ? n : 1;
+            nextCollection = threshold;
+            defaultThreshold() = threshold;
+        }
+
+        // 回收后存活对象数的上限, 0 表示不限制. 同时作为之后新建线程的堆的默认值
+        void setLimit(size_t n) {
+            limit = n;
+            defaultLimit() = n;
+        }
+
+        size_t getLimit() const {
+            return limit;
+        }
+
+        const GcStats& getStats() const {
+            return stats;
+        }
+
+        // 安全点: 只在解释器/虚拟机不持有未被 shared_ptr 管理的对象时调用.
+        // 需要时执行回收, 超过堆上限时返回 false
+        bool collectIfNeeded() {
+            if (sinceCollection < nextCollection) {
+                return true;
+            }
+            collect();
+            return limit == 0 || stats.live <= limit;
+        }
+
+        // 返回本次释放的对象数
+        size_t collect() {
+            auto startTime = std::chrono::steady_clock::now();
+
+            // 1. 初始计数为强引用数; 未被 shared_ptr 管理的对象(use_count 为 0)一律视为根
+            for (Traceable* t = head; t != nullptr; t = t->next) {
+                long count = t->weak_from_this().use_count();
+                t->gcRefs = count > 0 ? count : 1;
+                t->marked = false;
+            }
+            // 2. 减去容器之间的内部引用
+            struct Decrement : TraceVisitor {
+                void visit(Traceable* child) override {
+                    --child->gcRefs;
+                }
+            } decrement;
+            for (Traceable* t = head; t != nullptr; t = t->next) {
+                t->trace(decrement);
+            }
+            // 3. 从外部可达的对象出发标记
+            struct Mark : TraceVisitor {
+                std::vector<Traceable*> pending;
+                void visit(Traceable* child) override {
+                    if (!child->marked) {
+                        child->marked = true;
+                        pending.push_back(child);
+                    }
+                }
+            } mark;
+            for (Traceable* t = head; t != nullptr; t = t->next) {
+                if (t->gcRefs > 0 && !t->marked) {
+                    t->marked = true;
+                    mark.pending.push_back(t);
+                }
+            }
+            while (!mark.pending.empty()) {
+                Traceable* t = mark.pending.back();
+                mark.pending.pop_back();
+                t->trace(mark);
+            }
+            // 4. 打断未标记对象之间的引用, 持有它们直到全部清空, 避免清空过程中链表被修改
+            std::vector<std::shared_ptr<Traceable>> garbage;
+            for (Traceable* t = head; t != nullptr; t = t->next) {
+                if (!t->marked) {
+                    garbage.push_back(t->shared_from_this());
+                }
+            }
+            for (auto& g : garbage) {
+                g->clearReferences();
+            }
+            size_t freed = garbage.size();
+            garbage.clear();
+
+            stats.collections++;
+            stats.freed += freed;
+            sinceCollection = 0;
+            size_t grown = static_cast<size_t>(stats.live * growthFactor);
+            nextCollection = grown > threshold ? grown : threshold;
+
+            double pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+            stats.totalPauseMs += pause;
+            if (pause > stats.maxPauseMs) {
+                stats.maxPauseMs = pause;
+            }
+            return freed;
+        }
+
+        void printStats(std::ostream& out) const {
+            out << "gc: collections=" << stats.collections
+                << " allocated=" << stats.allocated
+                << " freed_by_gc=" << stats.freed
+                << " live=" << stats.live
+                << " peak_live=" << stats.peakLive
+                << " total_pause_ms=" << stats.totalPauseMs
+                << " max_pause_ms=" << stats.maxPauseMs << std::endl;
+        }
+
+    private:
+        friend class Traceable;
+
+        Heap() : threshold(defaultThreshold()), nextCollection(defaultThreshold()), limit(defaultLimit()) {}
+
+        // 命令行设置的参数, 须在启动工作线程之前设置
+        static size_t& defaultThreshold() {
+            static size_t n = 10000;
+            return n;
+        }
+
+        static size_t& defaultLimit() {
+            static size_t n = 0;
+            return n;
+        }
+
+        void track(Traceable* t) {
+            t->prev = nullptr;
+            t->next = head;
+            if (head != nullptr) {
+                head->prev = t;
+            }
+            head = t;
+            stats.allocated++;
+            stats.live++;
+            if (stats.live > stats.peakLive) {
+                stats.peakLive = stats.live;
+            }
+            sinceCollection++;
+        }
+
+        void untrack(Traceable* t) {
+            if (t->prev != nullptr) {
+                t->prev->next = t->next;
+            } else {
+                head = t->next;
+            }
+            if (t->next != nullptr) {
+                t->next->prev = t->prev;
+            }
+            stats.live--;
+        }
+
+        Traceable* head = nullptr;
+        size_t threshold;
+        size_t nextCollection;
+        size_t sinceCollection = 0;
+        size_t limit;
+        double growthFactor = 1.0;
+        GcStats stats;
+    };
+
+    inline Traceable::Traceable() {
+        Heap::instance().track(this);
+    }
+
+    inline Traceable::Traceable(const Traceable&) : std::enable_shared_from_this<Traceable>() {
+        Heap::instance().track(this);
+    }
+
+    inline Traceable::~Traceable() {
+        Heap::instance().untrack(this);
+    }
+} // namespace monkey
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace monkey {
+    // 整数的加减乘和取负按补码回绕. 经由 uint64_t 计算, 避免有符号溢出这一未定义行为;
+    // 两种引擎和优化器的常量折叠共用这些函数, 结果一致
+    inline int64_t wrappingAdd(int64_t l, int64_t r) {
+        return static_cast<int64_t>(static_cast<uint64_t>(l) + static_cast<uint64_t>(r));
+    }
+
+    inline int64_t wrappingSub(int64_t l, int64_t r) {
+        return static_cast<int64_t>(static_cast<uint64_t>(l) - static_cast<uint64_t>(r));
+    }
+
+    inline int64_t wrappingMul(int64_t l, int64_t r) {
+        return static_cast<int64_t>(static_cast<uint64_t>(l) * static_cast<uint64_t>(r));
+    }
+
+    inline int64_t wrappingNeg(int64_t value) {
+        return static_cast<int64_t>(0 - static_cast<uint64_t>(value));
+    }
+
+    // 除法的结果无定义(除数为 0, INT64_MIN / -1)时返回错误信息, 否则返回空串
+    inline std::string divisionError(int64_t l, int64_t r) {
+        if (r == 0) {
+            return "division by zero";
+        }
+        if (l == INT64_MIN && r == -1) {
+            return "integer overflow: " + std::to_string(l) + " / " + std::to_string(r);
+        }
+        return "";
+    }
+} // namespace monkey
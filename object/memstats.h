@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdio>
+
+#include "alloc_stats.h"
+#include "object.h"
+
+namespace monkey {
+    // 各类型对象本身的字节数(不含字符串内容, 数组缓冲区等间接持有的内存)
+    inline size_t objectSize(ObjectKind kind) {
+        switch (kind) {
+            case ObjectKind::STRING: return sizeof(Strin);
+            case ObjectKind::RETURN_VALUE: return sizeof(ReturnValue);
+            case ObjectKind::TAIL_CALL: return sizeof(TailCall);
+            case ObjectKind::ERROR: return sizeof(Error);
+            case ObjectKind::FUNCTION: return sizeof(Function);
+            case ObjectKind::BUILTIN: return sizeof(Builtin);
+            case ObjectKind::ARRAY: return sizeof(Array);
+            case ObjectKind::HASH_TABLE: return sizeof(HashTable);
+            case ObjectKind::QUOTE: return sizeof(Quote);
+            case ObjectKind::MACRO: return sizeof(Macro);
+            case ObjectKind::COMPILED_FUNCTION: return sizeof(CompiledFunction);
+            case ObjectKind::CLOSURE: return sizeof(Closure);
+            case ObjectKind::CELL: return sizeof(Cell);
+            default: return 0;
+        }
+    }
+
+    inline size_t nodeSize(NodeKind kind) {
+        switch (kind) {
+            case NodeKind::PROGRAM: return sizeof(Program);
+            case NodeKind::LET_STATEMENT: return sizeof(LetStatement);
+            case NodeKind::RETURN_STATEMENT: return sizeof(ReturnStatement);
+            case NodeKind::EXPRESSION_STATEMENT: return sizeof(ExpressionStatement);
+            case NodeKind::BLOCK_STATEMENT: return sizeof(BlockStatement);
+            case NodeKind::ASSIGN_STATEMENT: return sizeof(AssignStatement);
+            case NodeKind::WHILE_STATEMENT: return sizeof(WhileStatement);
+            case NodeKind::FOR_STATEMENT: return sizeof(ForStatement);
+            case NodeKind::IDENTIFIER: return sizeof(Identifier);
+            case NodeKind::BOOLEAN: return sizeof(Boolean);
+            case NodeKind::INTEGER_LITERAL: return sizeof(IntegerLiteral);
+            case NodeKind::STRING_LITERAL: return sizeof(StringLiteral);
+            case NodeKind::ARRAY_LITERAL: return sizeof(ArrayLiteral);
+            case NodeKind::INDEX_EXPRESSION: return sizeof(IndexExpression);
+            case NodeKind::HASH_LITERAL: return sizeof(HashLiteral);
+            case NodeKind::PREFIX_EXPRESSION: return sizeof(PrefixExpression);
+            case NodeKind::INFIX_EXPRESSION: return sizeof(InfixExpression);
+            case NodeKind::IF_EXPRESSION: return sizeof(IfExpression);
+            case NodeKind::FUNCTION_LITERAL: return sizeof(FunctionLiteral);
+            case NodeKind::CALL_EXPRESSION: return sizeof(CallExpression);
+            case NodeKind::MACRO_LITERAL: return sizeof(MacroLiteral);
+            default: return 0;
+        }
+    }
+
+    // 遍历所有分配过的类型: f(类别名, 类型名, 计数, 单个对象字节数)
+    template <typename F>
+    void forEachAllocCount(F f) {
+        for (int k = 0; k <= static_cast<int>(ObjectKind::CELL); ++k) {
+            auto& count = AllocStats::get(AllocStats::OBJECT, k);
+            if (count.allocated > 0) {
+                f("object", kindName(static_cast<ObjectKind>(k)), count, objectSize(static_cast<ObjectKind>(k)));
+            }
+        }
+        for (int k = 0; k <= static_cast<int>(NodeKind::MACRO_LITERAL); ++k) {
+            auto& count = AllocStats::get(AllocStats::NODE, k);
+            if (count.allocated > 0) {
+                f("node", NodeKindString[k].c_str(), count, nodeSize(static_cast<NodeKind>(k)));
+            }
+        }
+        auto& count = AllocStats::get(AllocStats::ENVIRONMENT, 0);
+        if (count.allocated > 0) {
+            f("environment", "Environment", count, sizeof(Environment));
+        }
+    }
+
+    // 结束时的统计表: 累计创建数, 最终存活数/字节数, 存活峰值/字节数
+    inline void printAllocStats(std::ostream& out) {
+        char line[256];
+        std::snprintf(line, sizeof(line), "%-12s %-20s %12s %10s %12s %10s %12s\n", "category", "type", "allocated", "live", "live bytes", "peak", "peak bytes");
+        out << line;
+        forEachAllocCount([&](const char* category, const char* type, const AllocCount& count, size_t size) {
+            std::snprintf(line, sizeof(line), "%-12s %-20s %12llu %10llu %12llu %10llu %12llu\n", category, type,
+                static_cast<unsigned long long>(count.allocated),
+                static_cast<unsigned long long>(count.live), static_cast<unsigned long long>(count.live * size),
+                static_cast<unsigned long long>(count.peak), static_cast<unsigned long long>(count.peak * size));
+            out << line;
+        });
+        out.flush();
+    }
+
+    // memstats() 的返回值: {"object": {"STRING": {"allocated": .., "live": .., "peak": .., "bytes": ..}, ..}, "node": {..}, "environment": {..}},
+    // bytes 为当前存活对象本身的字节数
+    inline Value allocStatsTable() {
+        auto result = std::make_shared<HashTable>();
+        std::shared_ptr<HashTable> group;
+        std::string groupName;
+        forEachAllocCount([&](const char* category, const char* type, const AllocCount& count, size_t size) {
+            if (group == nullptr || groupName != category) {
+                group = std::make_shared<HashTable>();
+                groupName = category;
+                result->set(intern(groupName), group);
+            }
+            auto entry = std::make_shared<HashTable>();
+            entry->set(intern("allocated"), Value::fromInt(static_cast<int64_t>(count.allocated)));
+            entry->set(intern("live"), Value::fromInt(static_cast<int64_t>(count.live)));
+            entry->set(intern("peak"), Value::fromInt(static_cast<int64_t>(count.peak)));
+            entry->set(intern("bytes"), Value::fromInt(static_cast<int64_t>(count.live * size)));
+            group->set(intern(type), entry);
+        });
+        return result;
+    }
+} // namespace monkey
@@ -5,118 +5,349 @@
 #include <map>
 #include <unordered_map>
 #include <functional>
+#include <typeinfo>
 
 #include "../ast/ast.h"
+#include "../code/code.h"
+#include "gc.h"
+#include "integer.h"
+#include "small_vector.h"
+#include "pool.h"
 
 namespace monkey{
     /*** 定义对象系统 ***/
     // 前置声明
     class Environment;
-    class HashKey;
+    // 对象类型标签: 类型判断直接比较枚举, 名字只用于错误信息和输出
+    enum class ObjectKind : uint8_t {
+        EMPTY,
+        NULL_OBJ,
+        BOOLEAN,
+        INTEGER,
+        STRING,
+        RETURN_VALUE,
+        TAIL_CALL,
+        ERROR,
+        FUNCTION,
+        BUILTIN,
+        ARRAY,
+        HASH_TABLE,
+        QUOTE,
+        MACRO,
+        COMPILED_FUNCTION,
+        CLOSURE,
+        CELL
+    };
+
+    inline const char* kindName(ObjectKind kind){
+        switch(kind){
+            case ObjectKind::NULL_OBJ: return "NULL";
+            case ObjectKind::BOOLEAN: return "BOOLEAN";
+            case ObjectKind::INTEGER: return "INTEGER";
+            case ObjectKind::STRING: return "STRING";
+            case ObjectKind::RETURN_VALUE: return "RETURN_VALUE";
+            case ObjectKind::TAIL_CALL: return "TAIL_CALL";
+            case ObjectKind::ERROR: return "ERROR";
+            case ObjectKind::FUNCTION: return "FUNCTION";
+            case ObjectKind::BUILTIN: return "BUILTIN";
+            case ObjectKind::ARRAY: return "ARRAY";
+            case ObjectKind::HASH_TABLE: return "HASH_TABLE";
+            case ObjectKind::QUOTE: return "QUOTE";
+            case ObjectKind::MACRO: return "MACRO";
+            case ObjectKind::COMPILED_FUNCTION: return "COMPILED_FUNCTION";
+            case ObjectKind::CLOSURE: return "CLOSURE";
+            case ObjectKind::CELL: return "CELL";
+            default: return "EMPTY";
+        }
+    }
+
     // 抽象对象类型基类
     class Object{
     public:
-        virtual std::string type() = 0;
-        virtual std::string inspect() = 0;
+        const ObjectKind kind;
 
-        virtual ~Object() = default;
-    };
+        explicit Object(ObjectKind kind) : kind(kind){
+            AllocStats::created(AllocStats::OBJECT, static_cast<int>(kind));
+        }
 
-    // 可哈希对象
-    class Hashable : public Object{
-    public:
-        virtual std::shared_ptr<HashKey> hashKey() = 0;
+        std::string type() const{
+            return kindName(kind);
+        }
+
+        virtual std::string inspect() = 0;
+        // 可能参与引用环的对象返回自身, 供回收器遍历
+        virtual Traceable* traceable() { return nullptr; }
+
+        virtual ~Object(){
+            AllocStats::destroyed(AllocStats::OBJECT, static_cast<int>(kind));
+        }
     };
 
-    // 整数对象
-    class Integer : public Hashable{
+    // 运行时值: 整数, 布尔值和 null 直接存放在值内, 不分配堆内存;
+    // 字符串, 数组, hash, 函数等才是堆上的 Object.
+    // EMPTY 表示"没有值"(如 let 语句的结果), 与 null 不同.
+    class Value{
     public:
-        int64_t value;
+        enum Tag : uint8_t {
+            EMPTY = 0,
+            NIL,
+            BOOLEAN,
+            INTEGER,
+            OBJECT
+        };
+
+        Value() : tag(EMPTY), integer(0){}
+
+        template <typename T>
+        Value(std::shared_ptr<T> obj) : tag(obj != nullptr ? OBJECT : EMPTY), integer(0), object(std::move(obj)){}
+
+        static Value fromInt(int64_t value){
+            Value v;
+            v.tag = INTEGER;
+            v.integer = value;
+            return v;
+        }
+
+        static Value fromBool(bool value){
+            Value v;
+            v.tag = BOOLEAN;
+            v.boolean = value;
+            return v;
+        }
+
+        static Value null(){
+            Value v;
+            v.tag = NIL;
+            return v;
+        }
+
+        Tag getTag() const { return tag; }
+        bool isEmpty() const { return tag == EMPTY; }
+        bool isNull() const { return tag == NIL; }
+        bool isBool() const { return tag == BOOLEAN; }
+        bool isInt() const { return tag == INTEGER; }
+        bool isObject() const { return tag == OBJECT; }
+
+        int64_t asInt() const { return integer; }
+        bool asBool() const { return boolean; }
+        const std::shared_ptr<Object>& obj() const { return object; }
+
+        // 按类型取出堆对象, 调用方需保证类型匹配
+        template <typename T>
+        T* as() const { return static_cast<T*>(object.get()); }
+
+        ObjectKind kind() const{
+            switch(tag){
+                case NIL: return ObjectKind::NULL_OBJ;
+                case BOOLEAN: return ObjectKind::BOOLEAN;
+                case INTEGER: return ObjectKind::INTEGER;
+                case OBJECT: return object->kind;
+                default: return ObjectKind::EMPTY;
+            }
+        }
 
-        Integer(int value) : value(value){}
+        bool is(ObjectKind k) const{
+            return tag == OBJECT && object->kind == k;
+        }
 
-        std::string type() override{
-            return "INTEGER";
+        std::string type() const{
+            return kindName(kind());
         }
 
-        std::string inspect() override{
-            return std::to_string(value);
+        std::string inspect() const{
+            switch(tag){
+                case NIL: return "null";
+                case BOOLEAN: return boolean ? "true" : "false";
+                case INTEGER: return std::to_string(integer);
+                case OBJECT: return object->inspect();
+                default: return "";
+            }
         }
 
-        std::shared_ptr<HashKey> hashKey() override{
-            return std::make_shared<HashKey>(type(), value);
+        // 同一性比较: 立即数比较值, 堆对象比较地址
+        bool identical(const Value& other) const{
+            if(tag != other.tag){
+                return false;
+            }
+            switch(tag){
+                case BOOLEAN: return boolean == other.boolean;
+                case INTEGER: return integer == other.integer;
+                case OBJECT: return object == other.object;
+                default: return true;
+            }
         }
+
+    private:
+        Tag tag;
+        union {
+            int64_t integer;
+            bool boolean;
+        };
+        std::shared_ptr<Object> object;
     };
 
-    // 布尔对象
-    class Boolea : public Hashable{
+    // 参数视图: 指向调用方持有的一段连续的值, 不复制也不拥有它们
+    class ValueSpan{
     public:
-        bool value;
+        ValueSpan() : ptr(nullptr), count(0){}
+        ValueSpan(const Value* ptr, size_t count) : ptr(ptr), count(count){}
 
-        Boolea(bool value) : value(value){}
+        template <typename Container>
+        ValueSpan(const Container& values) : ptr(values.data()), count(values.size()){}
 
-        std::string type() override{
-            return "BOOLEAN";
-        }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const Value& operator[](size_t i) const { return ptr[i]; }
+        const Value* begin() const { return ptr; }
+        const Value* end() const { return ptr + count; }
 
-        std::string inspect() override{
-            return value ? "true" : "false";
-        }
+    private:
+        const Value* ptr;
+        size_t count;
+    };
+
+    // 函数调用的实参, 常见的短参数列表存放在对象内部
+    using Arguments = SmallVector<Value, 4>;
 
-        std::shared_ptr<HashKey> hashKey() override{
-            return std::make_shared<HashKey>(type(), value ? 1 : 0);
+    inline void traceValue(const Value& value, TraceVisitor& visitor){
+        if(value.isObject()){
+            Traceable* t = value.obj()->traceable();
+            if(t != nullptr){
+                visitor.visit(t);
+            }
         }
+    }
+
+    // 可哈希对象: 相等的对象必须有相同的 hashCode
+    class Hashable : public Object{
+    public:
+        explicit Hashable(ObjectKind kind) : Object(kind){}
+
+        virtual uint64_t hashCode() = 0;
+        virtual bool equals(Hashable* other) = 0;
     };
 
-    // 字符串对象
+    // 字符串对象: 创建后不可变. 内容是共享缓冲区 buffer 的前 length 个字符,
+    // 拼接时若左操作数恰好占满缓冲区, 则直接在缓冲区末尾追加并共享它, 循环累加字符串的总开销为线性.
     class Strin : public Hashable{
     public:
-        std::string value;
+        Strin(const std::string& value) : Hashable(ObjectKind::STRING), buffer(std::make_shared<std::string>(value)), length(value.size()){}
+        Strin(std::string&& value) : Hashable(ObjectKind::STRING), length(value.size()){
+            buffer = std::make_shared<std::string>(std::move(value));
+        }
+
+        std::string inspect() override{
+            return str();
+        }
 
-        Strin(const std::string& value) : value(value){}
+        const char* data() const{
+            return buffer->data();
+        }
 
-        std::string type() override{
-            return "STRING";
+        size_t size() const{
+            return length;
         }
 
-        std::string inspect() override{
-            return value;
+        std::string str() const{
+            return std::string(buffer->data(), length);
         }
 
-        std::shared_ptr<HashKey> hashKey() override{
-            u_int64_t hash = 0;
-            for (auto& c : value) {
-                hash += c;
+        // FNV-1a, 首次使用时计算并缓存
+        uint64_t hashCode() override{
+            if(!hashed){
+                uint64_t h = 14695981039346656037ULL;
+                const char* p = data();
+                for(size_t i = 0; i < length; ++i){
+                    h ^= static_cast<unsigned char>(p[i]);
+                    h *= 1099511628211ULL;
+                }
+                hash = h;
+                hashed = true;
             }
-            return std::make_shared<HashKey>(type(), hash);
+            return hash;
         }
-    };
 
-    // 空对象
-    class Null : public Object{
-    public:
-        std::string type() override{
-            return "NULL";
+        bool equals(Hashable* other) override{
+            return equals(static_cast<Strin*>(other));
         }
 
-        std::string inspect() override{
-            return "null";
+        bool equals(Strin* other){
+            if(this == other){
+                return true;
+            }
+            // 内容相同的驻留字符串是同一个对象
+            if((interned && other->interned) || length != other->length){
+                return false;
+            }
+            if(hashed && other->hashed && hash != other->hash){
+                return false;
+            }
+            return std::char_traits<char>::compare(data(), other->data(), length) == 0;
+        }
+
+        static std::shared_ptr<Strin> concat(const Strin& left, const Strin& right){
+            if(right.length == 0){
+                return std::make_shared<Strin>(left.buffer, left.length);
+            }
+            if(left.length == left.buffer->size()){
+                left.buffer->append(right.data(), right.length);
+                return std::make_shared<Strin>(left.buffer, left.length + right.length);
+            }
+            std::string out;
+            out.reserve(left.length + right.length);
+            out.append(left.data(), left.length);
+            out.append(right.data(), right.length);
+            return std::make_shared<Strin>(std::move(out));
         }
+
+        Strin(std::shared_ptr<std::string> buffer, size_t length) : Hashable(ObjectKind::STRING), buffer(std::move(buffer)), length(length){}
+
+    private:
+        friend std::shared_ptr<Strin> intern(const std::string& value);
+
+        std::shared_ptr<std::string> buffer;
+        size_t length;
+        uint64_t hash = 0;
+        bool hashed = false;
+        bool interned = false;
     };
 
+    // 字符串驻留: 字面量在程序中只对应一个对象, 比较时退化为指针比较. 驻留表每个线程一份
+    std::shared_ptr<Strin> intern(const std::string& value){
+        static thread_local std::unordered_map<std::string, std::shared_ptr<Strin>> table;
+        auto it = table.find(value);
+        if(it != table.end()){
+            return it->second;
+        }
+        auto str = std::make_shared<Strin>(value);
+        str->interned = true;
+        str->hashCode();
+        table.emplace(value, str);
+        return str;
+    }
+
     // 返回值对象
     class ReturnValue : public Object{
     public:
-        std::shared_ptr<Object> value;
+        Value value;
 
-        ReturnValue(std::shared_ptr<Object> value) : value(value){}
+        ReturnValue(Value value) : Object(ObjectKind::RETURN_VALUE), value(std::move(value)){}
 
-        std::string type() override{
-            return "RETURN_VALUE";
+        std::string inspect() override{
+            return value.inspect();
         }
+    };
+
+    // 尾调用对象: 尾位置上的函数调用不在原地展开, 而是交给 applyFunction 的蹦床循环执行
+    class TailCall : public Object{
+    public:
+        Value fn;
+        Arguments args;
+
+        TailCall(Value fn, Arguments args) : Object(ObjectKind::TAIL_CALL), fn(std::move(fn)), args(std::move(args)){}
 
         std::string inspect() override{
-            return value->inspect();
+            return "tail call";
         }
     };
 
@@ -125,11 +356,7 @@ namespace monkey{
     public:
         std::string message;
 
-        Error(const std::string& message) : message(message){}
-
-        std::string type() override{
-            return "ERROR";
-        }
+        Error(const std::string& message) : Object(ObjectKind::ERROR), message(message){}
 
         std::string inspect() override{
             return "ERROR: " + message;
@@ -137,17 +364,15 @@ namespace monkey{
     };
 
     // 函数对象
-    class Function : public Object{
+    class Function : public Object, public Traceable{
     public:
-        std::vector<std::shared_ptr<Identifier>> parameters;
-        std::shared_ptr<BlockStatement> body;
+        std::vector<Identifier*> parameters;
+        BlockStatement* body;
         std::shared_ptr<Environment> env;
+        std::shared_ptr<ScopeInfo> scope;   // 为空表示函数体未经解析, 按名字绑定参数
+        FunctionLiteral* literal;           // 定义处的字面量(名字与源码位置), 供性能分析使用
 
-        Function(std::vector<std::shared_ptr<Identifier>> parameters, std::shared_ptr<BlockStatement> body, std::shared_ptr<Environment> env) : parameters(parameters), body(body), env(env){}
-
-        std::string type() override{
-            return "FUNCTION";
-        }
+        Function(std::vector<Identifier*> parameters, BlockStatement* body, std::shared_ptr<Environment> env, std::shared_ptr<ScopeInfo> scope = nullptr, FunctionLiteral* literal = nullptr) : Object(ObjectKind::FUNCTION), parameters(parameters), body(body), env(env), scope(scope), literal(literal){}
 
         std::string inspect() override{
             std::string out = "";
@@ -161,140 +386,301 @@ namespace monkey{
             out += "\n}";
             return out;
         }
+
+        Traceable* traceable() override{ return this; }
+        void trace(TraceVisitor& visitor) override;
+        void clearReferences() override;
     }; 
 
     // 内置函数对象
     class Builtin : public Object{
     public:
-        using builtin_function = std::function<std::shared_ptr<Object>(std::vector<std::shared_ptr<Object>>)>;
+        using builtin_function = std::function<Value(ValueSpan)>;
         builtin_function fn;
 
-        Builtin(builtin_function fn) : fn(fn){}
-
-        std::string type() override{
-            return "BUILTIN";
-        }
+        Builtin(builtin_function fn) : Object(ObjectKind::BUILTIN), fn(fn){}
 
         std::string inspect() override{
             return "builtin function";
         }
     };
 
-    // 数组对象
-    class Array : public Object{
+    // 数组的元素缓冲区, 可被多个数组(push/rest 的结果)共享.
+    // 回收器以缓冲区为单位计数和遍历元素: 每个数组只引用一次缓冲区, 缓冲区中的每个元素也只被遍历一次
+    class ArrayBuffer : public Traceable{
+    public:
+        explicit ArrayBuffer(std::vector<Value> values) : values(std::move(values)){}
+
+        void trace(TraceVisitor& visitor) override{
+            for (auto& v : values) {
+                traceValue(v, visitor);
+            }
+        }
+
+        void clearReferences() override{
+            values.clear();
+        }
+
+        std::vector<Value> values;
+    };
+
+    // 数组对象: 创建后不可变. 元素是共享缓冲区 buffer 中从 offset 开始的 length 个值,
+    // push 时若数组恰好延伸到缓冲区末尾, 则直接追加并共享它; rest 只移动起点. 递归地用 push/rest 构造和消费数组为线性开销.
+    class Array : public Object, public Traceable{
     public:
-        std::vector<std::shared_ptr<Object>> elements;
+        Array(std::vector<Value> elements) : Object(ObjectKind::ARRAY), offset(0), length(elements.size()){
+            buffer = std::make_shared<ArrayBuffer>(std::move(elements));
+        }
+
+        Array(std::shared_ptr<ArrayBuffer> buffer, size_t offset, size_t length) : Object(ObjectKind::ARRAY), buffer(std::move(buffer)), offset(offset), length(length){}
+
+        size_t size() const{
+            return length;
+        }
+
+        // 追加可能使缓冲区重新分配, 不要在求值期间持有返回的引用
+        const Value& operator[](size_t i) const{
+            return buffer->values[offset + i];
+        }
 
-        Array(std::vector<std::shared_ptr<Object>> elements) : elements(elements){}
+        // 返回末尾追加 value 后的新数组
+        std::shared_ptr<Array> append(const Value& value) const{
+            auto& values = buffer->values;
+            if(offset + length == values.size()){
+                values.push_back(value);
+                return std::make_shared<Array>(buffer, offset, length + 1);
+            }
+            std::vector<Value> out;
+            out.reserve(length + 1);
+            out.insert(out.end(), values.begin() + offset, values.begin() + offset + length);
+            out.push_back(value);
+            return std::make_shared<Array>(std::move(out));
+        }
 
-        std::string type() override{
-            return "ARRAY";
+        // 返回去掉第一个元素的新数组, 调用方保证数组非空
+        std::shared_ptr<Array> rest() const{
+            return std::make_shared<Array>(buffer, offset + 1, length - 1);
         }
 
         std::string inspect() override{
             std::string out = "";
             out += "[";
-            for (auto& elem : elements) {
-                out += elem->inspect();
-                if (elem != elements.back()) {
+            for (size_t i = 0; i < length; ++i) {
+                out += (*this)[i].inspect();
+                if (i != length - 1) {
                     out += ", ";
                 }
             }
             out += "]";
             return out;
         }
-    };
-
-    // hash 键
-    class HashKey : public Object{
-    public: 
-        std::string objectType;
-        u_int64_t value;
 
-        HashKey(std::string objectType, u_int64_t value) : objectType(objectType), value(value){}
+        Traceable* traceable() override{ return this; }
 
-        std::string type() override{
-            return "HASH_KEY";
-        }
-        std::string inspect() override{
-            return objectType + "_" + std::to_string(value);
+        // 元素由共享的缓冲区负责遍历
+        void trace(TraceVisitor& visitor) override{
+            if (buffer != nullptr) {
+                visitor.visit(buffer.get());
+            }
         }
 
-        bool operator==(const HashKey& other) const {
-            return objectType == other.objectType && value == other.value;
+        // 缓冲区可能仍被存活的数组共享, 只放弃对它的引用
+        void clearReferences() override{
+            buffer.reset();
+            offset = 0;
+            length = 0;
         }
-    };
-
-    // 键值对对象
-    class HashPair : public Object{
-    public:
-        std::shared_ptr<Object> key;
-        std::shared_ptr<Object> value;
 
-        HashPair(std::shared_ptr<Object> key, std::shared_ptr<Object> value) : key(key), value(value){}
+    private:
+        std::shared_ptr<ArrayBuffer> buffer;
+        size_t offset;
+        size_t length;
+    };
 
-        std::string type() override{
-            return "HASH_PAIR";
+    // 整数混合函数(splitmix64 的收尾步骤), 使相邻整数分散到不同的桶
+    inline uint64_t mixHash(uint64_t x){
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // 计算 hash 值, 不可哈希时返回 false
+    bool hashOf(const Value& key, uint64_t& out){
+        switch(key.getTag()){
+            case Value::INTEGER:
+                out = mixHash(static_cast<uint64_t>(key.asInt()));
+                return true;
+            case Value::BOOLEAN:
+                out = mixHash(key.asBool() ? 1 : 0) ^ 0x9e3779b97f4a7c15ULL;
+                return true;
+            case Value::OBJECT: {
+                auto hashable = dynamic_cast<Hashable*>(key.obj().get());
+                if(hashable == nullptr){
+                    return false;
+                }
+                out = hashable->hashCode();
+                return true;
+            }
+            default:
+                return false;
         }
+    }
 
-        std::string inspect() override{
-            return key->inspect() + " : " + value->inspect();
+    // 键相等: 立即数比较值, 可哈希对象比较内容
+    bool keyEquals(const Value& a, const Value& b){
+        if(a.getTag() != b.getTag()){
+            return false;
+        }
+        if(!a.isObject()){
+            return a.identical(b);
+        }
+        if(a.obj() == b.obj()){
+            return true;
+        }
+        if(typeid(*a.obj()) != typeid(*b.obj())){
+            return false;
         }
+        return static_cast<Hashable*>(a.obj().get())->equals(static_cast<Hashable*>(b.obj().get()));
+    }
+
+    // 键值对
+    struct HashPair{
+        Value key;
+        Value value;
+        uint64_t hash;
     };
 
-    // 哈希对象
-    class HashTable : public Object{
+    // 哈希对象: 键值对按插入顺序存放在 entries 中, index 为线性探测的开放寻址表, 存放 entries 的下标
+    class HashTable : public Object, public Traceable{
     public:
-        std::map<std::string, std::shared_ptr<HashPair>> pairs;
-
-        HashTable(std::map<std::string, std::shared_ptr<HashPair>> pairs) : pairs(pairs){}
-
-        std::string type() override{
-            return "HASH_TABLE";
-        }
+        HashTable() : Object(ObjectKind::HASH_TABLE){}
 
         std::string inspect() override{
             std::string out = "";
             out += "{";
-            int i = 0;
-            for (auto& pair : pairs) {
-                out += pair.second->inspect();
-                if (i != pairs.size() - 1) {
+            for (size_t i = 0; i < entries.size(); ++i) {
+                out += entries[i].key.inspect() + " : " + entries[i].value.inspect();
+                if (i != entries.size() - 1) {
                     out += ", ";
                 }
-                ++i;
             }
             out += "}";
             return out;
         }
+
+        size_t size() const{
+            return entries.size();
+        }
+
+        const std::vector<HashPair>& pairs() const{
+            return entries;
+        }
+
+        Traceable* traceable() override{ return this; }
+
+        void trace(TraceVisitor& visitor) override{
+            for (auto& e : entries) {
+                traceValue(e.key, visitor);
+                traceValue(e.value, visitor);
+            }
+        }
+
+        void clearReferences() override{
+            entries.clear();
+            index.clear();
+        }
+
+        // 插入或覆盖, 键不可哈希时返回 false
+        bool set(const Value& key, Value value){
+            uint64_t hash;
+            if(!hashOf(key, hash)){
+                return false;
+            }
+            int slot = findSlot(key, hash);
+            if(slot >= 0 && index[slot] != EMPTY_SLOT){
+                entries[index[slot]].value = std::move(value);
+                return true;
+            }
+            if((entries.size() + 1) * 2 > index.size()){
+                grow();
+                slot = findSlot(key, hash);
+            }
+            index[slot] = static_cast<int32_t>(entries.size());
+            entries.push_back(HashPair{key, std::move(value), hash});
+            return true;
+        }
+
+        // 查找键, 不存在时返回空指针; 键不可哈希时 hashable 置为 false
+        const Value* get(const Value& key, bool& hashable) const{
+            uint64_t hash;
+            hashable = hashOf(key, hash);
+            if(!hashable || entries.empty()){
+                return nullptr;
+            }
+            int slot = findSlot(key, hash);
+            if(index[slot] == EMPTY_SLOT){
+                return nullptr;
+            }
+            return &entries[index[slot]].value;
+        }
+
+    private:
+        enum : int32_t { EMPTY_SLOT = -1 };
+
+        // 返回键所在的槽位, 键不存在时返回应插入的空槽位; 表为空时返回 -1
+        int findSlot(const Value& key, uint64_t hash) const{
+            if(index.empty()){
+                return -1;
+            }
+            size_t mask = index.size() - 1;
+            size_t i = hash & mask;
+            while(true){
+                int32_t e = index[i];
+                if(e == EMPTY_SLOT || (entries[e].hash == hash && keyEquals(entries[e].key, key))){
+                    return static_cast<int>(i);
+                }
+                i = (i + 1) & mask;
+            }
+        }
+
+        void grow(){
+            size_t capacity = index.empty() ? 8 : index.size() * 2;
+            index.assign(capacity, EMPTY_SLOT);
+            size_t mask = capacity - 1;
+            for(int32_t e = 0; e < static_cast<int32_t>(entries.size()); ++e){
+                size_t i = entries[e].hash & mask;
+                while(index[i] != EMPTY_SLOT){
+                    i = (i + 1) & mask;
+                }
+                index[i] = e;
+            }
+        }
+
+        std::vector<HashPair> entries;
+        std::vector<int32_t> index;     // 容量为 2 的幂, 装载因子不超过 1/2
     };
 
     class Quote : public Object{
     public:
-        std::shared_ptr<Node> node;
+        Node* node;
 
-        Quote(std::shared_ptr<Node> node) : node(node){}
-
-        std::string type() override{
-            return "QUOTE";
-        }
+        Quote(Node* node) : Object(ObjectKind::QUOTE), node(node){}
 
         std::string inspect() override{
             return "QUOTE(" + node->String() + ")";
         }
     };
 
-    class Macro : public Object{
+    class Macro : public Object, public Traceable{
     public:
-        std::vector<std::shared_ptr<Identifier>> parameters;
-        std::shared_ptr<BlockStatement> body;
+        std::vector<Identifier*> parameters;
+        BlockStatement* body;
         std::shared_ptr<Environment> env;
 
-        Macro(std::vector<std::shared_ptr<Identifier>> parameters, std::shared_ptr<BlockStatement> body, std::shared_ptr<Environment> env) : parameters(parameters), body(body), env(env){}
-
-        std::string type() override{
-            return "MACRO";
-        }
+        Macro(std::vector<Identifier*> parameters, BlockStatement* body, std::shared_ptr<Environment> env) : Object(ObjectKind::MACRO), parameters(parameters), body(body), env(env){}
 
         std::string inspect() override{
             std::string out = "";
@@ -308,30 +694,233 @@ namespace monkey{
             out += "\n}";
             return out;
         }
+
+        Traceable* traceable() override{ return this; }
+        void trace(TraceVisitor& visitor) override;
+        void clearReferences() override;
+    };
+
+    // 编译后的函数对象(字节码虚拟机使用)
+    class CompiledFunction : public Object{
+    public:
+        Instructions instructions;
+        int numLocals;      // 局部变量个数(含参数)
+        int numParameters;  // 参数个数
+
+        CompiledFunction(Instructions instructions, int numLocals, int numParameters) : Object(ObjectKind::COMPILED_FUNCTION), instructions(instructions), numLocals(numLocals), numParameters(numParameters){}
+
+        std::string inspect() override{
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%p", static_cast<void*>(this));
+            return "CompiledFunction[" + std::string(buf) + "]";
+        }
+    };
+
+    // 闭包对象: 编译后的函数 + 捕获的自由变量
+    class Closure : public Object, public Traceable{
+    public:
+        std::shared_ptr<CompiledFunction> fn;
+        std::vector<Value> free;
+
+        Closure(std::shared_ptr<CompiledFunction> fn, std::vector<Value> free) : Object(ObjectKind::CLOSURE), fn(fn), free(std::move(free)){}
+
+        std::string inspect() override{
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%p", static_cast<void*>(this));
+            return "Closure[" + std::string(buf) + "]";
+        }
+
+        Traceable* traceable() override{ return this; }
+
+        void trace(TraceVisitor& visitor) override{
+            for (auto& v : free) {
+                traceValue(v, visitor);
+            }
+        }
+
+        void clearReferences() override{
+            free.clear();
+        }
+    };
+
+    // 虚拟机中被闭包捕获且之后还会被写入的局部变量存放在 cell 中, 闭包捕获 cell 本身, 与定义处共享绑定
+    class Cell : public Object, public Traceable{
+    public:
+        Value value;
+        bool copied = false;    // 由 Transfer 拷贝到工作线程的副本, 写入不会回到原来的绑定
+
+        explicit Cell(Value value) : Object(ObjectKind::CELL), value(std::move(value)){}
+
+        std::string inspect() override{
+            return "Cell(" + (value.isEmpty() ? std::string() : value.inspect()) + ")";
+        }
+
+        Traceable* traceable() override{ return this; }
+
+        void trace(TraceVisitor& visitor) override{
+            traceValue(value, visitor);
+        }
+
+        void clearReferences() override{
+            value = Value();
+        }
     };
 
-    class Environment{
+    // 环境: 经 Resolver 解析的变量存放在按下标访问的 slots 中, 未解析的(如宏展开期间)按名字存放在 store 中
+    class Environment : public Traceable{
     public:
-        Environment() = default;
-        Environment(std::shared_ptr<Environment> outer) : outer(outer){}
+        Environment(){
+            AllocStats::created(AllocStats::ENVIRONMENT, 0);
+        }
+        Environment(std::shared_ptr<Environment> outer) : outer(outer){
+            AllocStats::created(AllocStats::ENVIRONMENT, 0);
+        }
+        Environment(std::shared_ptr<Environment> outer, std::shared_ptr<ScopeInfo> scope) : outer(outer), scope(scope), slots(scope->names.size()){
+            AllocStats::created(AllocStats::ENVIRONMENT, 0);
+        }
+        ~Environment(){
+            AllocStats::destroyed(AllocStats::ENVIRONMENT, 0);
+        }
 
-        std::shared_ptr<Object> get(const std::string& name){
+        Value get(const std::string& name){
             auto it = store.find(name);
             if(it != store.end()) {
                 return it->second;
-            } else if(outer != nullptr) {
+            }
+            if(scope != nullptr) {
+                int slot = scope->find(name);
+                if(slot >= 0 && static_cast<size_t>(slot) < slots.size() && !slots[slot].isEmpty()) {
+                    return slots[slot];
+                }
+            }
+            if(outer != nullptr) {
                 return outer->get(name);
             }
-            return nullptr;
+            return Value();
         }
 
-        std::shared_ptr<Object> set(const std::string& name, std::shared_ptr<Object> value){
+        Value set(const std::string& name, Value value){
             store[name] = value;
             return value;
         }
 
+        // 按词法地址读取: 向外跳过 depth 层后按下标取值, 未赋值时返回 EMPTY
+        const Value& getAt(int depth, int slot){
+            static const Value empty;
+            Environment* env = this;
+            while(depth-- > 0) {
+                env = env->outer.get();
+            }
+            if(static_cast<size_t>(slot) < env->slots.size()) {
+                return env->slots[slot];
+            }
+            return empty;
+        }
+
+        void setAt(int slot, Value value){
+            // 全局作用域会随后续程序继续增长
+            if(static_cast<size_t>(slot) >= slots.size()) {
+                slots.resize(slot + 1);
+            }
+            slots[slot] = std::move(value);
+        }
+
+        // 向外跳过 depth 层后的环境
+        Environment* ancestor(int depth){
+            Environment* env = this;
+            while(depth-- > 0) {
+                env = env->outer.get();
+            }
+            return env;
+        }
+
+        // 按名字查找已有绑定所在的环境(查找顺序与 get 相同), 找不到时返回空
+        Environment* owner(const std::string& name){
+            if(store.count(name) > 0) {
+                return this;
+            }
+            if(scope != nullptr) {
+                int slot = scope->find(name);
+                if(slot >= 0 && static_cast<size_t>(slot) < slots.size() && !slots[slot].isEmpty()) {
+                    return this;
+                }
+            }
+            if(outer != nullptr) {
+                return outer->owner(name);
+            }
+            return nullptr;
+        }
+
+        // 修改本环境中已有的绑定, 写回 get 读取的位置
+        void assign(const std::string& name, Value value){
+            auto it = store.find(name);
+            if(it != store.end()) {
+                it->second = std::move(value);
+                return;
+            }
+            setAt(scope->find(name), std::move(value));
+        }
+
+        // 冻结后不再允许赋值修改(如多个脚本共享的 prelude 环境)
+        void freeze(){
+            frozen = true;
+        }
+
+        bool isFrozen() const{
+            return frozen;
+        }
+
+        // 由 Transfer 拷贝到工作线程的副本, 写入它对原来的绑定不可见
+        bool isCopy() const{
+            return copied;
+        }
+
+        void trace(TraceVisitor& visitor) override{
+            for (auto& entry : store) {
+                traceValue(entry.second, visitor);
+            }
+            for (auto& v : slots) {
+                traceValue(v, visitor);
+            }
+            if(outer != nullptr) {
+                visitor.visit(outer.get());
+            }
+        }
+
+        void clearReferences() override{
+            store.clear();
+            slots.clear();
+            outer.reset();
+        }
+
     private:
-        std::unordered_map<std::string, std::shared_ptr<Object>> store;
+        friend class Transfer;
+
+        std::unordered_map<std::string, Value> store;
         std::shared_ptr<Environment> outer;   // 外部作用域
+        std::shared_ptr<ScopeInfo> scope;     // 槽位对应的变量名, 供按名字回退查找
+        SmallVector<Value, 4> slots;
+        bool frozen = false;
+        bool copied = false;
     };
+
+    inline void Function::trace(TraceVisitor& visitor){
+        if(env != nullptr){
+            visitor.visit(env.get());
+        }
+    }
+
+    inline void Function::clearReferences(){
+        env.reset();
+    }
+
+    inline void Macro::trace(TraceVisitor& visitor){
+        if(env != nullptr){
+            visitor.visit(env.get());
+        }
+    }
+
+    inline void Macro::clearReferences(){
+        env.reset();
+    }
 } // namespace monkey
\ No newline at end of file
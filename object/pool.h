@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace monkey {
+    // 定长内存块的空闲链表: 释放的块留在本线程的链表中, 供下一次同样大小的分配复用.
+    // 只含平凡成员, 线程退出或程序结束时链表中的块直接交还给系统.
+    template <size_t Size>
+    class FreeList {
+    public:
+        static const size_t MAX_FREE = 4096;
+
+        static void* allocate() {
+            Block*& head = freeHead();
+            if (head != nullptr) {
+                Block* b = head;
+                head = b->next;
+                --freeCount();
+                return b;
+            }
+            return ::operator new(Size < sizeof(Block) ? sizeof(Block) : Size);
+        }
+
+        static void deallocate(void* p) {
+            if (freeCount() >= MAX_FREE) {
+                ::operator delete(p);
+                return;
+            }
+            Block* b = static_cast<Block*>(p);
+            b->next = freeHead();
+            freeHead() = b;
+            ++freeCount();
+        }
+
+    private:
+        struct Block {
+            Block* next;
+        };
+
+        static Block*& freeHead() {
+            static thread_local Block* head = nullptr;
+            return head;
+        }
+
+        static size_t& freeCount() {
+            static thread_local size_t n = 0;
+            return n;
+        }
+    };
+
+    // 供 allocate_shared 使用的分配器: 对象和引用计数块一起从空闲链表分配
+    template <typename T>
+    class PoolAllocator {
+    public:
+        using value_type = T;
+
+        PoolAllocator() = default;
+
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            if (n != 1) {
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+            }
+            return static_cast<T*>(FreeList<sizeof(T)>::allocate());
+        }
+
+        void deallocate(T* p, size_t n) {
+            if (n != 1) {
+                ::operator delete(p);
+                return;
+            }
+            FreeList<sizeof(T)>::deallocate(p);
+        }
+
+        template <typename U>
+        bool operator==(const PoolAllocator<U>&) const { return true; }
+
+        template <typename U>
+        bool operator!=(const PoolAllocator<U>&) const { return false; }
+    };
+
+    // 频繁创建和销毁的对象(调用帧环境, 尾调用)使用池化分配
+    template <typename T, typename... Args>
+    std::shared_ptr<T> makePooled(Args&&... args) {
+        return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+    }
+} // namespace monkey
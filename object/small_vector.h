@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <initializer_list>
+
+namespace monkey {
+    // 小向量: 前 N 个元素存放在对象内部, 超出后才转移到堆上.
+    // 用于函数参数和局部变量槽位, 常见的短参数列表不需要任何堆分配.
+    template <typename T, size_t N>
+    class SmallVector {
+    public:
+        SmallVector() : ptr(inlineData()), count(0), cap(N) {}
+
+        explicit SmallVector(size_t n) : SmallVector() {
+            resize(n);
+        }
+
+        SmallVector(std::initializer_list<T> init) : SmallVector() {
+            reserve(init.size());
+            for (auto& v : init) {
+                push_back(v);
+            }
+        }
+
+        SmallVector(const SmallVector& other) : SmallVector() {
+            reserve(other.count);
+            for (size_t i = 0; i < other.count; ++i) {
+                new (ptr + i) T(other.ptr[i]);
+            }
+            count = other.count;
+        }
+
+        SmallVector(SmallVector&& other) noexcept : SmallVector() {
+            moveFrom(other);
+        }
+
+        SmallVector& operator=(const SmallVector& other) {
+            if (this != &other) {
+                clear();
+                reserve(other.count);
+                for (size_t i = 0; i < other.count; ++i) {
+                    new (ptr + i) T(other.ptr[i]);
+                }
+                count = other.count;
+            }
+            return *this;
+        }
+
+        SmallVector& operator=(SmallVector&& other) noexcept {
+            if (this != &other) {
+                clear();
+                release();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        ~SmallVector() {
+            clear();
+            release();
+        }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        T* data() { return ptr; }
+        const T* data() const { return ptr; }
+        T* begin() { return ptr; }
+        T* end() { return ptr + count; }
+        const T* begin() const { return ptr; }
+        const T* end() const { return ptr + count; }
+        T& operator[](size_t i) { return ptr[i]; }
+        const T& operator[](size_t i) const { return ptr[i]; }
+        T& back() { return ptr[count - 1]; }
+
+        void push_back(const T& value) {
+            if (count == cap) {
+                T copy(value);
+                reserve(count + 1);
+                new (ptr + count) T(std::move(copy));
+            } else {
+                new (ptr + count) T(value);
+            }
+            ++count;
+        }
+
+        void push_back(T&& value) {
+            if (count == cap) {
+                T moved(std::move(value));
+                reserve(count + 1);
+                new (ptr + count) T(std::move(moved));
+            } else {
+                new (ptr + count) T(std::move(value));
+            }
+            ++count;
+        }
+
+        // 容量按倍数增长, 逐个追加(如不断定义新的全局变量)时均摊 O(1)
+        void reserve(size_t n) {
+            if (n > cap) {
+                grow(std::max(n, cap * 2));
+            }
+        }
+
+        // 新增的元素值初始化
+        void resize(size_t n) {
+            if (n > count) {
+                reserve(n);
+                for (size_t i = count; i < n; ++i) {
+                    new (ptr + i) T();
+                }
+            } else {
+                for (size_t i = n; i < count; ++i) {
+                    ptr[i].~T();
+                }
+            }
+            count = n;
+        }
+
+        void clear() {
+            for (size_t i = 0; i < count; ++i) {
+                ptr[i].~T();
+            }
+            count = 0;
+        }
+
+    private:
+        T* inlineData() {
+            return reinterpret_cast<T*>(storage);
+        }
+
+        bool isInline() const {
+            return ptr == reinterpret_cast<const T*>(storage);
+        }
+
+        void grow(size_t newCap) {
+            T* p = static_cast<T*>(::operator new(newCap * sizeof(T)));
+            for (size_t i = 0; i < count; ++i) {
+                new (p + i) T(std::move(ptr[i]));
+                ptr[i].~T();
+            }
+            release();
+            ptr = p;
+            cap = newCap;
+        }
+
+        // 归还堆上的存储, 元素需已析构或已移走
+        void release() {
+            if (!isInline()) {
+                ::operator delete(ptr);
+            }
+            ptr = inlineData();
+            cap = N;
+        }
+
+        void moveFrom(SmallVector& other) {
+            if (other.isInline()) {
+                for (size_t i = 0; i < other.count; ++i) {
+                    new (ptr + i) T(std::move(other.ptr[i]));
+                }
+                count = other.count;
+                other.clear();
+            } else {
+                ptr = other.ptr;
+                cap = other.cap;
+                count = other.count;
+                other.ptr = other.inlineData();
+                other.cap = N;
+                other.count = 0;
+            }
+        }
+
+        alignas(T) unsigned char storage[N * sizeof(T)];
+        T* ptr;
+        size_t count;
+        size_t cap;
+    };
+} // namespace monkey
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "object.h"
+
+namespace monkey {
+    // 把其它线程创建的值深拷贝到当前线程. 容器对象挂在创建它的线程的堆上, 不能跨线程共享,
+    // 工作线程因此只使用自己的副本. 拷贝期间源对象所在的线程必须停下来等待, 保证源对象不被修改.
+    // 同一个 Transfer 中拷贝的对象之间的共享关系(包括函数与环境之间的引用环)保持不变.
+    // 不可变且不参与引用环的对象(内置函数, 编译后的函数)直接共享
+    class Transfer {
+    public:
+        Value copy(const Value& value) {
+            if (!value.isObject()) {
+                return value;
+            }
+            Object* source = value.obj().get();
+            auto it = objects.find(source);
+            if (it != objects.end()) {
+                return it->second;
+            }
+            switch (source->kind) {
+                case ObjectKind::STRING:
+                    return objects[source] = std::make_shared<Strin>(value.as<Strin>()->str());
+                case ObjectKind::BUILTIN:
+                case ObjectKind::COMPILED_FUNCTION:
+                    return value;
+                case ObjectKind::QUOTE:
+                    // 被引用的节点属于主线程的 arena, 只读
+                    return objects[source] = std::make_shared<Quote>(value.as<Quote>()->node);
+                case ObjectKind::ARRAY: {
+                    auto array = value.as<Array>();
+                    std::vector<Value> elements;
+                    elements.reserve(array->size());
+                    for (size_t i = 0; i < array->size(); ++i) {
+                        elements.push_back(copy((*array)[i]));
+                    }
+                    return objects[source] = std::make_shared<Array>(std::move(elements));
+                }
+                case ObjectKind::HASH_TABLE: {
+                    auto hash = std::make_shared<HashTable>();
+                    objects[source] = hash;
+                    for (auto& pair : value.as<HashTable>()->pairs()) {
+                        hash->set(copy(pair.key), copy(pair.value));
+                    }
+                    return hash;
+                }
+                case ObjectKind::FUNCTION: {
+                    auto fn = value.as<Function>();
+                    auto result = std::make_shared<Function>(fn->parameters, fn->body, nullptr, fn->scope, fn->literal);
+                    // 先登记再拷贝环境: 环境中可能保存着这个函数自己
+                    objects[source] = result;
+                    result->env = copy(fn->env);
+                    return result;
+                }
+                case ObjectKind::CLOSURE: {
+                    auto cl = value.as<Closure>();
+                    auto result = std::make_shared<Closure>(cl->fn, std::vector<Value>());
+                    objects[source] = result;
+                    for (auto& v : cl->free) {
+                        result->free.push_back(copy(v));
+                    }
+                    return result;
+                }
+                case ObjectKind::CELL: {
+                    auto result = std::make_shared<Cell>(Value());
+                    objects[source] = result;
+                    result->value = copy(value.as<Cell>()->value);
+                    result->copied = true;
+                    return result;
+                }
+                default:
+                    // 宏, 错误等只在求值过程中短暂存在的对象不会被传递
+                    ok = false;
+                    return Value::null();
+            }
+        }
+
+        std::shared_ptr<Environment> copy(const std::shared_ptr<Environment>& env) {
+            if (env == nullptr) {
+                return nullptr;
+            }
+            auto it = environments.find(env.get());
+            if (it != environments.end()) {
+                return it->second;
+            }
+            auto result = std::make_shared<Environment>();
+            environments[env.get()] = result;
+            result->scope = env->scope;
+            result->outer = copy(env->outer);
+            for (auto& entry : env->store) {
+                result->store[entry.first] = copy(entry.second);
+            }
+            result->slots.reserve(env->slots.size());
+            for (auto& v : env->slots) {
+                result->slots.push_back(copy(v));
+            }
+            result->frozen = env->frozen;
+            result->copied = true;
+            return result;
+        }
+
+        // 是否遇到了无法拷贝的值
+        bool failed() const {
+            return !ok;
+        }
+
+    private:
+        std::unordered_map<const Object*, Value> objects;
+        std::unordered_map<const Environment*, std::shared_ptr<Environment>> environments;
+        bool ok = true;
+    };
+
+    // 与线程无关的值: 只含普通的 C++ 数据, 在工作线程上由结果生成, 再在提交任务的线程上还原成对象.
+    // 函数, 闭包等带环境的值无法表示
+    class Portable {
+    public:
+        // 不能表示时返回 false
+        bool assign(const Value& value) {
+            kind = value.kind();
+            switch (kind) {
+                case ObjectKind::EMPTY:
+                case ObjectKind::NULL_OBJ:
+                case ObjectKind::BOOLEAN:
+                case ObjectKind::INTEGER:
+                    scalar = value;
+                    return true;
+                case ObjectKind::BUILTIN:
+                    // 内置函数表中的对象全局共享且不可变
+                    scalar = value;
+                    return true;
+                case ObjectKind::STRING:
+                    text = value.as<Strin>()->str();
+                    return true;
+                case ObjectKind::ERROR:
+                    text = value.as<Error>()->message;
+                    return true;
+                case ObjectKind::ARRAY: {
+                    auto array = value.as<Array>();
+                    items.resize(array->size());
+                    for (size_t i = 0; i < array->size(); ++i) {
+                        if (!items[i].assign((*array)[i])) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                case ObjectKind::HASH_TABLE: {
+                    auto& pairs = value.as<HashTable>()->pairs();
+                    items.resize(pairs.size() * 2);
+                    for (size_t i = 0; i < pairs.size(); ++i) {
+                        if (!items[2 * i].assign(pairs[i].key) || !items[2 * i + 1].assign(pairs[i].value)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        Value restore() const {
+            switch (kind) {
+                case ObjectKind::STRING:
+                    return std::make_shared<Strin>(text);
+                case ObjectKind::ERROR:
+                    return std::make_shared<Error>(text);
+                case ObjectKind::ARRAY: {
+                    std::vector<Value> elements;
+                    elements.reserve(items.size());
+                    for (auto& item : items) {
+                        elements.push_back(item.restore());
+                    }
+                    return std::make_shared<Array>(std::move(elements));
+                }
+                case ObjectKind::HASH_TABLE: {
+                    auto hash = std::make_shared<HashTable>();
+                    for (size_t i = 0; i + 1 < items.size(); i += 2) {
+                        hash->set(items[i].restore(), items[i + 1].restore());
+                    }
+                    return hash;
+                }
+                default:
+                    return scalar;
+            }
+        }
+
+    private:
+        ObjectKind kind = ObjectKind::EMPTY;
+        Value scalar;               // 立即数和内置函数
+        std::string text;           // 字符串内容或错误信息
+        std::vector<Portable> items;    // 数组元素, 或 hash 的键值依次排列
+    };
+} // namespace monkey
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../ast/ast.h"
+#include "../ast/arena.h"
+#include "../ast/modify.h"
+#include "../evaluator/builtins.h"
+
+namespace monkey {
+    // 内联: 把顶层 let 绑定的小函数的函数体直接替换到之后的调用点上.
+    // 可内联的函数体只有一个表达式语句, 其中只引用参数和内置函数(因而不会递归, 也不依赖定义处的环境),
+    // 不含函数字面量, let, return 和 quote, 节点数不超过预算. 函数名在整个程序中只能被绑定一次,
+    // 这样任何作用域中的同名引用都指向这个函数. 原定义保留, 未被内联的调用照常执行.
+    class Inliner {
+    public:
+        static const int MAX_DEPTH = 4;    // 内联结果中再次内联的层数上限
+
+        Inliner(Arena& arena, size_t budget) : arena(arena), budget(budget) {}
+
+        // 统计程序中每个名字被绑定的次数
+        void collectBindings(Program* program) {
+            bindings.clear();
+            for (auto& stmt : program->statements) {
+                countBindings(stmt);
+            }
+        }
+
+        // 在顶层语句处理完后调用, 之后的语句中才能内联它定义的函数
+        void consider(Statement* stmt) {
+            if (budget == 0 || stmt->kind != NodeKind::LET_STATEMENT) {
+                return;
+            }
+            auto let = static_cast<LetStatement*>(stmt);
+            if (let->value == nullptr || let->value->kind != NodeKind::FUNCTION_LITERAL) {
+                return;
+            }
+            auto fn = static_cast<FunctionLiteral*>(let->value);
+            const std::string& name = let->name->value;
+            if (bindings[name] != 1 || builtinIndex(name) >= 0) {
+                return;
+            }
+            if (fn->body == nullptr || fn->body->statements.size() != 1 || fn->body->statements[0]->kind != NodeKind::EXPRESSION_STATEMENT) {
+                return;
+            }
+            Candidate cand;
+            cand.fn = fn;
+            cand.body = static_cast<ExpressionStatement*>(fn->body->statements[0])->expression;
+            if (cand.body == nullptr) {
+                return;
+            }
+            for (auto& param : fn->parameters) {
+                if (builtinIndex(param->value) >= 0 || cand.paramIndex.count(param->value) != 0) {
+                    return;
+                }
+                cand.paramIndex[param->value] = static_cast<int>(cand.paramIndex.size());
+            }
+            cand.uses.assign(fn->parameters.size(), 0);
+            cand.conditional.assign(fn->parameters.size(), false);
+            size_t size = 0;
+            if (!scan(cand, cand.body, false, size) || size > budget) {
+                return;
+            }
+            candidates[name] = std::move(cand);
+        }
+
+        // 调用点可以内联时返回替换后的表达式, 否则返回空
+        Expression* tryInline(CallExpression* call, int depth) {
+            if (depth >= MAX_DEPTH || call->function->kind != NodeKind::IDENTIFIER) {
+                return nullptr;
+            }
+            auto it = candidates.find(static_cast<Identifier*>(call->function)->value);
+            if (it == candidates.end()) {
+                return nullptr;
+            }
+            Candidate& cand = it->second;
+            if (call->arguments.size() != cand.fn->parameters.size()) {
+                return nullptr;
+            }
+            if (!argumentsSafe(cand, call->arguments)) {
+                return nullptr;
+            }
+            // 函数体的副本中把参数替换为实参的副本
+            Node* body = clone(cand.body, arena);
+            body = modify(body, [&](Node* node) -> Node* {
+                if (node == nullptr || node->kind != NodeKind::IDENTIFIER) {
+                    return node;
+                }
+                auto p = cand.paramIndex.find(static_cast<Identifier*>(node)->value);
+                if (p == cand.paramIndex.end()) {
+                    return node;
+                }
+                return clone(call->arguments[p->second], arena);
+            });
+            inlined++;
+            return toExpression(body);
+        }
+
+        size_t inlinedCount() const {
+            return inlined;
+        }
+
+    private:
+        struct Candidate {
+            FunctionLiteral* fn = nullptr;
+            Expression* body = nullptr;
+            std::unordered_map<std::string, int> paramIndex;
+            std::vector<int> uses;          // 每个参数出现的次数
+            std::vector<bool> conditional;  // 参数是否出现在 if 分支中(不一定被求值)
+            std::vector<int> order;         // 无条件求值的参数出现, 按求值顺序
+            bool impureCall = false;        // 函数体中是否调用了可能有副作用的函数
+        };
+
+        void countBindings(Node* node) {
+            if (node == nullptr) {
+                return;
+            }
+            switch (node->kind) {
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(node);
+                    bindings[let->name->value]++;
+                    countBindings(let->value);
+                    break;
+                }
+                // 赋值和循环变量同样算作绑定, 被重新赋值的函数名不能内联
+                case NodeKind::ASSIGN_STATEMENT: {
+                    auto assign = static_cast<AssignStatement*>(node);
+                    bindings[assign->name->value]++;
+                    countBindings(assign->value);
+                    break;
+                }
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(node);
+                    countBindings(loop->condition);
+                    countBindings(loop->body);
+                    break;
+                }
+                case NodeKind::FOR_STATEMENT: {
+                    auto loop = static_cast<ForStatement*>(node);
+                    bindings[loop->variable->value]++;
+                    countBindings(loop->iterable);
+                    countBindings(loop->body);
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT:
+                    countBindings(static_cast<ReturnStatement*>(node)->returnValue);
+                    break;
+                case NodeKind::EXPRESSION_STATEMENT:
+                    countBindings(static_cast<ExpressionStatement*>(node)->expression);
+                    break;
+                case NodeKind::BLOCK_STATEMENT:
+                    for (auto& stmt : static_cast<BlockStatement*>(node)->statements) {
+                        countBindings(stmt);
+                    }
+                    break;
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    countBindings(ie->condition);
+                    countBindings(ie->consequence);
+                    countBindings(ie->alternative);
+                    break;
+                }
+                case NodeKind::PREFIX_EXPRESSION:
+                    countBindings(static_cast<PrefixExpression*>(node)->right);
+                    break;
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    countBindings(infix->left);
+                    countBindings(infix->right);
+                    break;
+                }
+                case NodeKind::FUNCTION_LITERAL: {
+                    auto fn = static_cast<FunctionLiteral*>(node);
+                    for (auto& param : fn->parameters) {
+                        bindings[param->value]++;
+                    }
+                    countBindings(fn->body);
+                    break;
+                }
+                case NodeKind::MACRO_LITERAL: {
+                    auto macro = static_cast<MacroLiteral*>(node);
+                    for (auto& param : macro->parameters) {
+                        bindings[param->value]++;
+                    }
+                    countBindings(macro->body);
+                    break;
+                }
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    countBindings(call->function);
+                    for (auto& arg : call->arguments) {
+                        countBindings(arg);
+                    }
+                    break;
+                }
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        countBindings(elem);
+                    }
+                    break;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    countBindings(index->left);
+                    countBindings(index->index);
+                    break;
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        countBindings(pair.first);
+                        countBindings(pair.second);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // 按求值顺序遍历函数体, 检查是否可内联并记录参数的使用情况
+        bool scan(Candidate& cand, Node* node, bool conditional, size_t& size) {
+            if (node == nullptr) {
+                return true;
+            }
+            if (++size > budget) {
+                return false;
+            }
+            switch (node->kind) {
+                case NodeKind::IDENTIFIER: {
+                    auto ident = static_cast<Identifier*>(node);
+                    auto it = cand.paramIndex.find(ident->value);
+                    if (it == cand.paramIndex.end()) {
+                        // 内置函数名不能在程序中被重新绑定, 否则两种引擎对它的解析可能不同
+                        return builtinIndex(ident->value) >= 0 && bindings[ident->value] == 0;
+                    }
+                    cand.uses[it->second]++;
+                    if (conditional) {
+                        cand.conditional[it->second] = true;
+                    } else {
+                        cand.order.push_back(it->second);
+                    }
+                    return true;
+                }
+                case NodeKind::BOOLEAN:
+                case NodeKind::INTEGER_LITERAL:
+                case NodeKind::STRING_LITERAL:
+                    return true;
+                case NodeKind::PREFIX_EXPRESSION:
+                    return scan(cand, static_cast<PrefixExpression*>(node)->right, conditional, size);
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    return scan(cand, infix->left, conditional, size) && scan(cand, infix->right, conditional, size);
+                }
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    return scan(cand, ie->condition, conditional, size)
+                        && scanBranch(cand, ie->consequence, size)
+                        && scanBranch(cand, ie->alternative, size);
+                }
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    if (!isPureCall(cand, call)) {
+                        cand.impureCall = true;
+                    }
+                    if (!scan(cand, call->function, conditional, size)) {
+                        return false;
+                    }
+                    for (auto& arg : call->arguments) {
+                        if (!scan(cand, arg, conditional, size)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        if (!scan(cand, elem, conditional, size)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    return scan(cand, index->left, conditional, size) && scan(cand, index->index, conditional, size);
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        if (!scan(cand, pair.first, conditional, size) || !scan(cand, pair.second, conditional, size)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                default:
+                    // 函数/宏字面量以及语句
+                    return false;
+            }
+        }
+
+        // if 的分支只允许由表达式语句组成, return 和 let 内联后会改变含义
+        bool scanBranch(Candidate& cand, BlockStatement* block, size_t& size) {
+            if (block == nullptr) {
+                return true;
+            }
+            for (auto& stmt : block->statements) {
+                if (stmt->kind != NodeKind::EXPRESSION_STATEMENT) {
+                    return false;
+                }
+                if (!scan(cand, static_cast<ExpressionStatement*>(stmt)->expression, true, size)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // 没有副作用的内置函数
+        static bool isPureCall(Candidate& cand, CallExpression* call) {
+            if (call->function->kind != NodeKind::IDENTIFIER) {
+                return false;
+            }
+            const std::string& name = static_cast<Identifier*>(call->function)->value;
+            if (cand.paramIndex.count(name) != 0) {
+                return false;
+            }
+            return name == "len" || name == "first" || name == "last" || name == "rest" || name == "push";
+        }
+
+        // 函数体中的调用可能通过赋值修改变量, 这时标识符实参也必须在调用前求值
+        static bool isSimple(const Candidate& cand, Expression* arg) {
+            switch (arg->kind) {
+                case NodeKind::IDENTIFIER:
+                    return !cand.impureCall;
+                case NodeKind::BOOLEAN:
+                case NodeKind::INTEGER_LITERAL:
+                case NodeKind::STRING_LITERAL:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // 字面量(以及函数体没有副作用时的标识符)可以任意复制或丢弃; 其它实参必须在函数体中恰好无条件求值一次,
+        // 且彼此之间保持原来的求值顺序, 函数体中也不能有副作用先于它们发生
+        bool argumentsSafe(const Candidate& cand, const std::vector<Expression*>& args) {
+            bool complex = false;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (isSimple(cand, args[i])) {
+                    continue;
+                }
+                complex = true;
+                if (cand.uses[i] != 1 || cand.conditional[i]) {
+                    return false;
+                }
+            }
+            if (!complex) {
+                return true;
+            }
+            if (cand.impureCall) {
+                return false;
+            }
+            int last = -1;
+            for (int k : cand.order) {
+                if (isSimple(cand, args[k])) {
+                    continue;
+                }
+                if (k < last) {
+                    return false;
+                }
+                last = k;
+            }
+            return true;
+        }
+
+        Arena& arena;
+        size_t budget;
+        size_t inlined = 0;
+        std::unordered_map<std::string, int> bindings;
+        std::unordered_map<std::string, Candidate> candidates;
+    };
+} // namespace monkey
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "../ast/ast.h"
+#include "../ast/arena.h"
+#include "../object/object.h"
+#include "inliner.h"
+
+namespace monkey {
+    // AST 优化: 在宏展开之后, 变量解析和求值/编译之前执行, 两种引擎共用.
+    // 内联小函数, 折叠常量的算术, 比较和字符串拼接, 剪除条件为常量的 if 分支, 并为字符串字面量预先创建驻留的运行时对象.
+    // 折叠结果与运行时求值完全一致; 会在运行时报错的表达式(如除以 0, 类型不匹配)保持原样.
+    // quote 的参数不做改写, 宏和 quote 看到的仍是源码形式.
+    class Optimizer {
+    public:
+        static const size_t DEFAULT_INLINE_BUDGET = 32;
+
+        // inlineBudget 为可内联函数体的最大节点数, 0 表示不内联
+        Optimizer(Arena& arena, size_t inlineBudget = DEFAULT_INLINE_BUDGET) : arena(arena), inliner(arena, inlineBudget) {}
+
+        void optimize(Program* program) {
+            inliner.collectBindings(program);
+            for (auto& stmt : program->statements) {
+                optimizeStatement(stmt);
+                inliner.consider(stmt);
+            }
+        }
+
+        size_t inlinedCount() const {
+            return inliner.inlinedCount();
+        }
+
+        // 本次优化折叠的表达式数与剪除的分支数
+        size_t foldedCount() const {
+            return folded;
+        }
+
+        size_t prunedCount() const {
+            return pruned;
+        }
+
+    private:
+        void optimizeStatement(Statement* stmt) {
+            if (stmt == nullptr) {
+                return;
+            }
+            switch (stmt->kind) {
+                case NodeKind::LET_STATEMENT: {
+                    auto let = static_cast<LetStatement*>(stmt);
+                    let->value = optimizeExpression(let->value);
+                    break;
+                }
+                case NodeKind::RETURN_STATEMENT: {
+                    auto ret = static_cast<ReturnStatement*>(stmt);
+                    ret->returnValue = optimizeExpression(ret->returnValue);
+                    break;
+                }
+                case NodeKind::EXPRESSION_STATEMENT: {
+                    auto es = static_cast<ExpressionStatement*>(stmt);
+                    es->expression = optimizeExpression(es->expression);
+                    break;
+                }
+                case NodeKind::BLOCK_STATEMENT:
+                    optimizeBlock(static_cast<BlockStatement*>(stmt));
+                    break;
+                case NodeKind::ASSIGN_STATEMENT: {
+                    auto assign = static_cast<AssignStatement*>(stmt);
+                    assign->value = optimizeExpression(assign->value);
+                    break;
+                }
+                case NodeKind::WHILE_STATEMENT: {
+                    auto loop = static_cast<WhileStatement*>(stmt);
+                    loop->condition = optimizeExpression(loop->condition);
+                    optimizeBlock(loop->body);
+                    break;
+                }
+                case NodeKind::FOR_STATEMENT: {
+                    auto loop = static_cast<ForStatement*>(stmt);
+                    loop->iterable = optimizeExpression(loop->iterable);
+                    optimizeBlock(loop->body);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        void optimizeBlock(BlockStatement* block) {
+            if (block == nullptr) {
+                return;
+            }
+            for (auto& stmt : block->statements) {
+                optimizeStatement(stmt);
+            }
+        }
+
+        // 返回替换后的表达式, 不能优化时返回原节点
+        Expression* optimizeExpression(Expression* node) {
+            if (node == nullptr) {
+                return nullptr;
+            }
+            switch (node->kind) {
+                case NodeKind::STRING_LITERAL: {
+                    auto lit = static_cast<StringLiteral*>(node);
+                    if (lit->constant == nullptr) {
+                        lit->constant = intern(lit->value);
+                    }
+                    return node;
+                }
+                case NodeKind::PREFIX_EXPRESSION: {
+                    auto prefix = static_cast<PrefixExpression*>(node);
+                    prefix->right = optimizeExpression(prefix->right);
+                    return foldPrefix(prefix);
+                }
+                case NodeKind::INFIX_EXPRESSION: {
+                    auto infix = static_cast<InfixExpression*>(node);
+                    infix->left = optimizeExpression(infix->left);
+                    infix->right = optimizeExpression(infix->right);
+                    return foldInfix(infix);
+                }
+                case NodeKind::IF_EXPRESSION: {
+                    auto ie = static_cast<IfExpression*>(node);
+                    ie->condition = optimizeExpression(ie->condition);
+                    optimizeBlock(ie->consequence);
+                    optimizeBlock(ie->alternative);
+                    return pruneIf(ie);
+                }
+                case NodeKind::FUNCTION_LITERAL:
+                    optimizeBlock(static_cast<FunctionLiteral*>(node)->body);
+                    return node;
+                case NodeKind::CALL_EXPRESSION: {
+                    auto call = static_cast<CallExpression*>(node);
+                    if (call->function->kind == NodeKind::IDENTIFIER && static_cast<Identifier*>(call->function)->value == "quote") {
+                        return node;
+                    }
+                    call->function = optimizeExpression(call->function);
+                    for (auto& arg : call->arguments) {
+                        arg = optimizeExpression(arg);
+                    }
+                    if (auto body = inliner.tryInline(call, inlineDepth)) {
+                        // 代入实参后可能出现新的常量
+                        inlineDepth++;
+                        auto result = optimizeExpression(body);
+                        inlineDepth--;
+                        return result;
+                    }
+                    return node;
+                }
+                case NodeKind::ARRAY_LITERAL:
+                    for (auto& elem : static_cast<ArrayLiteral*>(node)->elements) {
+                        elem = optimizeExpression(elem);
+                    }
+                    return node;
+                case NodeKind::INDEX_EXPRESSION: {
+                    auto index = static_cast<IndexExpression*>(node);
+                    index->left = optimizeExpression(index->left);
+                    index->index = optimizeExpression(index->index);
+                    return node;
+                }
+                case NodeKind::HASH_LITERAL:
+                    for (auto& pair : static_cast<HashLiteral*>(node)->pairs) {
+                        pair.first = optimizeExpression(pair.first);
+                        pair.second = optimizeExpression(pair.second);
+                    }
+                    return node;
+                default:
+                    return node;
+            }
+        }
+
+        static bool isConstant(Expression* node) {
+            return node->kind == NodeKind::INTEGER_LITERAL || node->kind == NodeKind::BOOLEAN || node->kind == NodeKind::STRING_LITERAL;
+        }
+
+        // 与 Evaluator::isTruthy 一致: 字面量中只有 false 为假
+        static bool isTruthyConstant(Expression* node) {
+            if (node->kind == NodeKind::BOOLEAN) {
+                return static_cast<Boolean*>(node)->value;
+            }
+            return true;
+        }
+
+        Expression* foldPrefix(PrefixExpression* prefix) {
+            Expression* right = prefix->right;
+            if (!isConstant(right)) {
+                return prefix;
+            }
+            if (prefix->op == "!") {
+                return makeBoolean(!isTruthyConstant(right));
+            }
+            if (prefix->op == "-" && right->kind == NodeKind::INTEGER_LITERAL) {
+                auto value = static_cast<IntegerLiteral*>(right)->value;
+                return makeInteger(wrappingNeg(value));
+            }
+            return prefix;
+        }
+
+        Expression* foldInfix(InfixExpression* infix) {
+            Expression* left = infix->left;
+            Expression* right = infix->right;
+            if (!isConstant(left) || !isConstant(right)) {
+                return infix;
+            }
+            const std::string& op = infix->op;
+            if (left->kind == NodeKind::INTEGER_LITERAL && right->kind == NodeKind::INTEGER_LITERAL) {
+                return foldInteger(infix, op, static_cast<IntegerLiteral*>(left)->value, static_cast<IntegerLiteral*>(right)->value);
+            }
+            if (left->kind == NodeKind::STRING_LITERAL && right->kind == NodeKind::STRING_LITERAL) {
+                auto& l = static_cast<StringLiteral*>(left)->value;
+                auto& r = static_cast<StringLiteral*>(right)->value;
+                if (op == "+") {
+                    return makeString(l + r);
+                } else if (op == "==") {
+                    return makeBoolean(l == r);
+                } else if (op == "!=") {
+                    return makeBoolean(l != r);
+                }
+                return infix;
+            }
+            // 其余组合只有 == 和 != 有定义: 同为布尔值时比较值, 类型不同时必然不相等
+            if (op == "==" || op == "!=") {
+                bool equal = false;
+                if (left->kind == NodeKind::BOOLEAN && right->kind == NodeKind::BOOLEAN) {
+                    equal = static_cast<Boolean*>(left)->value == static_cast<Boolean*>(right)->value;
+                }
+                return makeBoolean(op == "==" ? equal : !equal);
+            }
+            return infix;
+        }
+
+        // 与运行时共用 integer.h 中的运算, 加减乘按补码回绕; 除以 0 和 INT64_MIN / -1 不折叠, 留给运行时报错
+        Expression* foldInteger(InfixExpression* infix, const std::string& op, int64_t l, int64_t r) {
+            if (op == "+") {
+                return makeInteger(wrappingAdd(l, r));
+            } else if (op == "-") {
+                return makeInteger(wrappingSub(l, r));
+            } else if (op == "*") {
+                return makeInteger(wrappingMul(l, r));
+            } else if (op == "/") {
+                if (!divisionError(l, r).empty()) {
+                    return infix;
+                }
+                return makeInteger(l / r);
+            } else if (op == "<") {
+                return makeBoolean(l < r);
+            } else if (op == ">") {
+                return makeBoolean(l > r);
+            } else if (op == "==") {
+                return makeBoolean(l == r);
+            } else if (op == "!=") {
+                return makeBoolean(l != r);
+            }
+            return infix;
+        }
+
+        // 条件为常量时只保留会执行的分支; 该分支只有一个表达式语句时直接以该表达式替换整个 if
+        Expression* pruneIf(IfExpression* ie) {
+            if (!isConstant(ie->condition)) {
+                return ie;
+            }
+            BlockStatement* taken = isTruthyConstant(ie->condition) ? ie->consequence : ie->alternative;
+            if (taken == nullptr) {
+                // 条件恒假且没有 else, 结果为 null
+                if (ie->consequence != nullptr && !ie->consequence->statements.empty()) {
+                    ie->consequence->statements.clear();
+                    pruned++;
+                }
+                return ie;
+            }
+            pruned++;
+            if (taken->statements.size() == 1 && taken->statements[0]->kind == NodeKind::EXPRESSION_STATEMENT) {
+                auto expr = static_cast<ExpressionStatement*>(taken->statements[0])->expression;
+                if (expr != nullptr) {
+                    return expr;
+                }
+            }
+            if (taken == ie->alternative) {
+                ie->condition = makeBoolean(true);
+                ie->consequence = taken;
+            }
+            ie->alternative = nullptr;
+            return ie;
+        }
+
+        Expression* makeInteger(int64_t value) {
+            folded++;
+            auto text = arena.copy(std::to_string(value));
+            return arena.make<IntegerLiteral>(Token(TokenType::INT, text), value);
+        }
+
+        Expression* makeBoolean(bool value) {
+            folded++;
+            return arena.make<Boolean>(Token(value ? TokenType::TRUE : TokenType::FALSE, value ? "true" : "false"), value);
+        }
+
+        Expression* makeString(const std::string& value) {
+            folded++;
+            auto lit = arena.make<StringLiteral>(Token(TokenType::STRING, arena.copy(value)), value);
+            lit->constant = intern(value);
+            return lit;
+        }
+
+        Arena& arena;
+        Inliner inliner;
+        int inlineDepth = 0;
+        size_t folded = 0;
+        size_t pruned = 0;
+    };
+} // namespace monkey
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+
+namespace monkey {
+    // 工作窃取线程池: 每个工作线程有自己的任务队列, 从队尾取自己的任务, 队列空了就从其它线程的队头窃取.
+    // 提交的一批任务先均匀分到各个队列, 执行时间不均时由窃取重新平衡. 多个线程可以同时提交任务.
+    class WorkStealingPool {
+    public:
+        // 首次使用时按默认线程数启动, 进程结束时停止
+        static WorkStealingPool& instance() {
+            static WorkStealingPool pool(defaultThreads());
+            return pool;
+        }
+
+        // 线程数, 0 表示取硬件并发数; 须在首次使用之前设置
+        static void setThreads(size_t n) {
+            defaultThreads() = n;
+        }
+
+        // 当前线程是否为池中的工作线程; 工作线程上的任务不能再向池提交并等待
+        static bool inWorker() {
+            return workerIndex() >= 0;
+        }
+
+        size_t size() const {
+            return queues.size();
+        }
+
+        // 执行 task(0) ... task(count - 1), 阻塞直到全部完成
+        void run(size_t count, const std::function<void(size_t)>& task) {
+            if (count == 0) {
+                return;
+            }
+            Job job(&task, count);
+            size_t start = next++;
+            for (size_t i = 0; i < count; ++i) {
+                Queue& q = *queues[(start + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                q.tasks.push_back(Task{&job, i});
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                queued += count;
+            }
+            wake.notify_all();
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.done.wait(lock, [&] { return job.remaining == 0; });
+        }
+
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& t : threads) {
+                t.join();
+            }
+        }
+
+    private:
+        struct Job {
+            const std::function<void(size_t)>* task;
+            size_t remaining;
+            std::mutex mutex;
+            std::condition_variable done;
+
+            Job(const std::function<void(size_t)>* task, size_t remaining) : task(task), remaining(remaining) {}
+        };
+
+        struct Task {
+            Job* job;
+            size_t index;
+        };
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        explicit WorkStealingPool(size_t n) {
+            if (n == 0) {
+                n = std::max(1u, std::thread::hardware_concurrency());
+            }
+            for (size_t i = 0; i < n; ++i) {
+                queues.push_back(std::make_unique<Queue>());
+            }
+            for (size_t i = 0; i < n; ++i) {
+                threads.emplace_back([this, i] { work(i); });
+            }
+        }
+
+        static size_t& defaultThreads() {
+            static size_t n = 0;
+            return n;
+        }
+
+        static int& workerIndex() {
+            static thread_local int index = -1;
+            return index;
+        }
+
+        void work(size_t id) {
+            workerIndex() = static_cast<int>(id);
+            while (true) {
+                Task task;
+                if (take(id, task)) {
+                    (*task.job->task)(task.index);
+                    // 持有锁时通知: 提交者只有在拿到锁之后才会返回并销毁 job
+                    std::lock_guard<std::mutex> lock(task.job->mutex);
+                    if (--task.job->remaining == 0) {
+                        task.job->done.notify_all();
+                    }
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [&] { return stopping || queued > 0; });
+                if (stopping && queued == 0) {
+                    return;
+                }
+            }
+        }
+
+        // 先取自己队尾的任务, 再依次从其它队列的队头窃取
+        bool take(size_t id, Task& out) {
+            for (size_t k = 0; k < queues.size(); ++k) {
+                Queue& q = *queues[(id + k) % queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.tasks.empty()) {
+                    continue;
+                }
+                if (k == 0) {
+                    out = q.tasks.back();
+                    q.tasks.pop_back();
+                } else {
+                    out = q.tasks.front();
+                    q.tasks.pop_front();
+                }
+                std::lock_guard<std::mutex> sleepLock(sleepMutex);
+                queued--;
+                return true;
+            }
+            return false;
+        }
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        size_t queued = 0;      // 所有队列中尚未取走的任务数
+        std::atomic<size_t> next{0};    // 下一批任务从哪个队列开始分配
+        bool stopping = false;
+    };
+} // namespace monkey
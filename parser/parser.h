@@ -4,8 +4,10 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <charconv>
 
 #include "../ast/ast.h"
+#include "../ast/arena.h"
 #include "../lexer/lexer.h"
 #include "../token/token.h"
 
@@ -21,7 +23,7 @@ namespace monkey{
         INDEX           // array[index]
     };
 
-    std::map<TokenType, prec> precedences = {
+    const std::map<TokenType, prec> precedences = {
         {TokenType::EQ, prec::EQUALS},
         {TokenType::NOT_EQ, prec::EQUALS},
         {TokenType::LT, prec::LESSGREATER},
@@ -37,14 +39,15 @@ namespace monkey{
     class Parser{
     public:
         // 前缀解析函数
-        typedef std::shared_ptr<Expression> (Parser::*prefixParseFn)();
+        typedef Expression* (Parser::*prefixParseFn)();
         // 中缀解析函数
-        typedef std::shared_ptr<Expression> (Parser::*infixParseFn)(std::shared_ptr<Expression>);
+        typedef Expression* (Parser::*infixParseFn)(Expression*);
 
         std::map<TokenType, prefixParseFn> prefixParseFns;
         std::map<TokenType, infixParseFn> infixParseFns;
 
-        Parser(std::shared_ptr<Lexer> l) : lexer(l) {
+        // 节点分配在 arena 中, 其生命周期须覆盖解析结果的全部使用者
+        Parser(std::shared_ptr<Lexer> l, Arena& arena) : lexer(l), arena(arena) {
             // 注册前缀解析函数
             registerPrefix(TokenType::IDENT, &Parser::parseIdentifier);
             registerPrefix(TokenType::INT, &Parser::parseIntegerLiteral);
@@ -143,10 +146,10 @@ namespace monkey{
     public:
         // 解析函数
         // 解析主程序
-        std::shared_ptr<Program> parseProgram(){
-            std::shared_ptr<Program> program = std::make_shared<Program>();
+        Program* parseProgram(){
+            Program* program = arena.make<Program>();
             while (curToken.getType() != TokenType::EOF){
-                std::shared_ptr<Statement> stmt = parseStatement();
+                Statement* stmt = parseStatement();
                 if (stmt != nullptr){
                     program->statements.push_back(stmt);
                 }
@@ -155,29 +158,41 @@ namespace monkey{
             return program;
         }
         // 解析语句
-        std::shared_ptr<Statement> parseStatement(){
+        Statement* parseStatement(){
             switch(curToken.getType()){
                 case TokenType::LET:
                     return parseLetStatement();
                 case TokenType::RETURN:
                     return parseReturnStatement();
+                case TokenType::WHILE:
+                    return parseWhileStatement();
+                case TokenType::FOR:
+                    return parseForStatement();
+                case TokenType::IDENT:
+                    if (peekTokenIs(TokenType::ASSIGN)){
+                        return parseAssignStatement();
+                    }
+                    return parseExpressionStatement();
                 default:
                     return parseExpressionStatement();
             }
         }
 
         // 解析 let 语句
-        std::shared_ptr<LetStatement> parseLetStatement(){
-            std::shared_ptr<LetStatement> stmt = std::make_shared<LetStatement>(curToken);
+        LetStatement* parseLetStatement(){
+            LetStatement* stmt = arena.make<LetStatement>(curToken);
             if (!expectPeek(TokenType::IDENT)){
                 return nullptr;
             }
-            stmt->name = std::make_shared<Identifier>(curToken, curToken.getLiteral());
+            stmt->name = arena.make<Identifier>(curToken, curToken.getLiteral());
             if (!expectPeek(TokenType::ASSIGN)){
                 return nullptr;
             }
             nextToken();
             stmt->value = parseExpression(prec::LOWEST);
+            if (stmt->value != nullptr && stmt->value->kind == NodeKind::FUNCTION_LITERAL){
+                static_cast<FunctionLiteral*>(stmt->value)->name = stmt->name->value;
+            }
             if (peekTokenIs(TokenType::SEMICOLON)){
                 nextToken();
             }
@@ -185,8 +200,8 @@ namespace monkey{
         }
 
         // 解析 return 语句
-        std::shared_ptr<ReturnStatement> parseReturnStatement(){
-            std::shared_ptr<ReturnStatement> stmt = std::make_shared<ReturnStatement>(curToken);
+        ReturnStatement* parseReturnStatement(){
+            ReturnStatement* stmt = arena.make<ReturnStatement>(curToken);
             nextToken();
             stmt->returnValue = parseExpression(prec::LOWEST);
             if (peekTokenIs(TokenType::SEMICOLON)){
@@ -195,9 +210,72 @@ namespace monkey{
             return stmt;
         }
 
+        // 解析赋值语句 `x = value`
+        AssignStatement* parseAssignStatement(){
+            Identifier* name = arena.make<Identifier>(curToken, curToken.getLiteral());
+            nextToken();
+            AssignStatement* stmt = arena.make<AssignStatement>(curToken);
+            stmt->name = name;
+            nextToken();
+            stmt->value = parseExpression(prec::LOWEST);
+            if (peekTokenIs(TokenType::SEMICOLON)){
+                nextToken();
+            }
+            return stmt;
+        }
+
+        // 解析 while 语句 `while (cond) { ... }`
+        WhileStatement* parseWhileStatement(){
+            WhileStatement* stmt = arena.make<WhileStatement>(curToken);
+            if (!expectPeek(TokenType::LPAREN)){
+                return nullptr;
+            }
+            nextToken();
+            stmt->condition = parseExpression(prec::LOWEST);
+            if (!expectPeek(TokenType::RPAREN)){
+                return nullptr;
+            }
+            if (!expectPeek(TokenType::LBRACE)){
+                return nullptr;
+            }
+            stmt->body = parseBlockStatement();
+            if (peekTokenIs(TokenType::SEMICOLON)){
+                nextToken();
+            }
+            return stmt;
+        }
+
+        // 解析 for 语句 `for (x in arr) { ... }`
+        ForStatement* parseForStatement(){
+            ForStatement* stmt = arena.make<ForStatement>(curToken);
+            if (!expectPeek(TokenType::LPAREN)){
+                return nullptr;
+            }
+            if (!expectPeek(TokenType::IDENT)){
+                return nullptr;
+            }
+            stmt->variable = arena.make<Identifier>(curToken, curToken.getLiteral());
+            if (!expectPeek(TokenType::IN)){
+                return nullptr;
+            }
+            nextToken();
+            stmt->iterable = parseExpression(prec::LOWEST);
+            if (!expectPeek(TokenType::RPAREN)){
+                return nullptr;
+            }
+            if (!expectPeek(TokenType::LBRACE)){
+                return nullptr;
+            }
+            stmt->body = parseBlockStatement();
+            if (peekTokenIs(TokenType::SEMICOLON)){
+                nextToken();
+            }
+            return stmt;
+        }
+
         // 解析表达式语句
-        std::shared_ptr<ExpressionStatement> parseExpressionStatement(){
-            std::shared_ptr<ExpressionStatement> stmt = std::make_shared<ExpressionStatement>(curToken);
+        ExpressionStatement* parseExpressionStatement(){
+            ExpressionStatement* stmt = arena.make<ExpressionStatement>(curToken);
             stmt->expression = parseExpression(prec::LOWEST);
             if (peekTokenIs(TokenType::SEMICOLON)){
                 nextToken();
@@ -206,13 +284,13 @@ namespace monkey{
         }
 
         // 解析表达式
-        std::shared_ptr<Expression> parseExpression(prec precedence){
+        Expression* parseExpression(prec precedence){
             auto prefix = prefixParseFns[curToken.getType()];
             if (prefix == nullptr){
                 noPrefixParseFnError(curToken.getType());
                 return nullptr;
             }
-            std::shared_ptr<Expression> leftExp = (this->*prefix)();
+            Expression* leftExp = (this->*prefix)();
             while (!peekTokenIs(TokenType::SEMICOLON) && precedence < peekPrecedence()){
                 auto infix = infixParseFns[peekToken.getType()];
                 if (infix == nullptr){
@@ -225,15 +303,17 @@ namespace monkey{
         }
 
         // 解析标识符
-        std::shared_ptr<Expression> parseIdentifier(){
-            return std::make_shared<Identifier>(curToken, curToken.getLiteral());
+        Expression* parseIdentifier(){
+            return arena.make<Identifier>(curToken, curToken.getLiteral());
         }
 
         // 解析整型字面量
-        std::shared_ptr<Expression> parseIntegerLiteral(){
-            std::shared_ptr<IntegerLiteral> lit = std::make_shared<IntegerLiteral>(curToken);
-            int value = std::stoi(curToken.getLiteral());
-            if (value == 0 && (curToken.getLiteral() != "0")) {
+        Expression* parseIntegerLiteral(){
+            IntegerLiteral* lit = arena.make<IntegerLiteral>(curToken);
+            auto literal = curToken.getLiteralView();
+            int64_t value = 0;
+            auto result = std::from_chars(literal.data(), literal.data() + literal.size(), value);
+            if (result.ec != std::errc() || result.ptr != literal.data() + literal.size()) {
                 std::string msg = "could not parse " + curToken.getLiteral() + " as integer";
                 errors.emplace_back(msg);
             }
@@ -242,20 +322,20 @@ namespace monkey{
         }
 
         // 解析字符串字面量
-        std::shared_ptr<Expression> parseStringLiteral(){
-            return std::make_shared<StringLiteral>(curToken, curToken.getLiteral());
+        Expression* parseStringLiteral(){
+            return arena.make<StringLiteral>(curToken, curToken.getLiteral());
         }
 
         // 解析数组字面量
-        std::shared_ptr<Expression> parseArrayLiteral(){
-            std::shared_ptr<ArrayLiteral> array = std::make_shared<ArrayLiteral>(curToken);
+        Expression* parseArrayLiteral(){
+            ArrayLiteral* array = arena.make<ArrayLiteral>(curToken);
             array->elements = parseExpressionList(TokenType::RBRACKET);
             return array;
         }
 
         // 解析表达式列表
-        std::vector<std::shared_ptr<Expression>> parseExpressionList(TokenType end){
-            std::vector<std::shared_ptr<Expression>> list;
+        std::vector<Expression*> parseExpressionList(TokenType end){
+            std::vector<Expression*> list;
             if (peekTokenIs(end)){
                 nextToken();
                 return list;
@@ -268,14 +348,14 @@ namespace monkey{
                 list.push_back(parseExpression(prec::LOWEST));
             }
             if (!expectPeek(end)){
-                return std::vector<std::shared_ptr<Expression>>();
+                return std::vector<Expression*>();
             }
             return list;
         }
 
         // 解析索引表达式
-        std::shared_ptr<Expression> parseIndexExpression(std::shared_ptr<Expression> left){
-            std::shared_ptr<IndexExpression> exp = std::make_shared<IndexExpression>(curToken, left);
+        Expression* parseIndexExpression(Expression* left){
+            IndexExpression* exp = arena.make<IndexExpression>(curToken, left);
             nextToken();
             exp->index = parseExpression(prec::LOWEST);
             if (!expectPeek(TokenType::RBRACKET)){
@@ -285,17 +365,17 @@ namespace monkey{
         }
 
         // 解析 hash 字面量
-        std::shared_ptr<Expression> parseHashLiteral(){
-            std::shared_ptr<HashLiteral> hash = std::make_shared<HashLiteral>(curToken);
+        Expression* parseHashLiteral(){
+            HashLiteral* hash = arena.make<HashLiteral>(curToken);
             while (!peekTokenIs(TokenType::RBRACE)){
                 nextToken();
-                std::shared_ptr<Expression> key = parseExpression(prec::LOWEST);
+                Expression* key = parseExpression(prec::LOWEST);
                 if (!expectPeek(TokenType::COLON)){
                     return nullptr;
                 }
                 nextToken();
-                std::shared_ptr<Expression> value = parseExpression(prec::LOWEST);
-                hash->pairs[key] = value;
+                Expression* value = parseExpression(prec::LOWEST);
+                hash->pairs.emplace_back(key, value);
                 if (!peekTokenIs(TokenType::RBRACE) && !expectPeek(TokenType::COMMA)){
                     return nullptr;
                 }
@@ -307,8 +387,8 @@ namespace monkey{
         }
 
         // 解析宏字面量
-        std::shared_ptr<Expression> parseMacroLiteral(){
-            std::shared_ptr<MacroLiteral> macro = std::make_shared<MacroLiteral>(curToken);
+        Expression* parseMacroLiteral(){
+            MacroLiteral* macro = arena.make<MacroLiteral>(curToken);
             if (!expectPeek(TokenType::LPAREN)){
                 return nullptr;
             }
@@ -321,16 +401,16 @@ namespace monkey{
         }
 
         // 解析前缀表达式
-        std::shared_ptr<Expression> parsePrefixExpression(){
-            std::shared_ptr<PrefixExpression> exp = std::make_shared<PrefixExpression>(curToken, curToken.getLiteral());
+        Expression* parsePrefixExpression(){
+            PrefixExpression* exp = arena.make<PrefixExpression>(curToken, curToken.getLiteral());
             nextToken();
             exp->right = parseExpression(prec::PREFIX);
             return exp;
         }
 
         // 解析中缀表达式
-        std::shared_ptr<Expression> parseInfixExpression(std::shared_ptr<Expression> left){
-            std::shared_ptr<InfixExpression> exp = std::make_shared<InfixExpression>(curToken, curToken.getLiteral(), left);
+        Expression* parseInfixExpression(Expression* left){
+            InfixExpression* exp = arena.make<InfixExpression>(curToken, curToken.getLiteral(), left);
             prec precedence = curPrecedence();
             nextToken();
             exp->right = parseExpression(precedence);
@@ -338,14 +418,14 @@ namespace monkey{
         }
 
         // 解析布尔值
-        std::shared_ptr<Expression> parseBoolean(){
-            return std::make_shared<Boolean>(curToken, curTokenIs(TokenType::TRUE));
+        Expression* parseBoolean(){
+            return arena.make<Boolean>(curToken, curTokenIs(TokenType::TRUE));
         }
 
         // 解析分组表达式
-        std::shared_ptr<Expression> parseGroupedExpression(){
+        Expression* parseGroupedExpression(){
             nextToken();
-            std::shared_ptr<Expression> exp = parseExpression(prec::LOWEST);
+            Expression* exp = parseExpression(prec::LOWEST);
             if (!expectPeek(TokenType::RPAREN)){
                 return nullptr;
             }
@@ -353,8 +433,8 @@ namespace monkey{
         }
 
         // 解析 if 表达式
-        std::shared_ptr<Expression> parseIfExpression(){
-            std::shared_ptr<IfExpression> exp = std::make_shared<IfExpression>(curToken);
+        Expression* parseIfExpression(){
+            IfExpression* exp = arena.make<IfExpression>(curToken);
             if (!expectPeek(TokenType::LPAREN)){
                 return nullptr;
             }
@@ -378,11 +458,11 @@ namespace monkey{
         }
 
         // 解析块语句
-        std::shared_ptr<BlockStatement> parseBlockStatement(){
-            std::shared_ptr<BlockStatement> block = std::make_shared<BlockStatement>(curToken);
+        BlockStatement* parseBlockStatement(){
+            BlockStatement* block = arena.make<BlockStatement>(curToken);
             nextToken();
             while (!curTokenIs(TokenType::RBRACE) && !curTokenIs(TokenType::EOF)){
-                std::shared_ptr<Statement> stmt = parseStatement();
+                Statement* stmt = parseStatement();
                 if (stmt != nullptr){
                     block->statements.push_back(stmt);
                 }
@@ -392,8 +472,8 @@ namespace monkey{
         }
 
         // 解析函数字面量
-        std::shared_ptr<Expression> parseFunctionLiteral(){
-            std::shared_ptr<FunctionLiteral> lit = std::make_shared<FunctionLiteral>(curToken);
+        Expression* parseFunctionLiteral(){
+            FunctionLiteral* lit = arena.make<FunctionLiteral>(curToken);
             if (!expectPeek(TokenType::LPAREN)){
                 return nullptr;
             }
@@ -406,36 +486,36 @@ namespace monkey{
         }
 
         // 解析函数形式参数
-        std::vector<std::shared_ptr<Identifier>> parseFunctionParameters() {
-            std::vector<std::shared_ptr<Identifier>> identifiers;
+        std::vector<Identifier*> parseFunctionParameters() {
+            std::vector<Identifier*> identifiers;
             if (peekTokenIs(TokenType::RPAREN)){
                 nextToken();
                 return identifiers;
             }
             nextToken();
-            std::shared_ptr<Identifier> ident = std::make_shared<Identifier>(curToken, curToken.getLiteral());
+            Identifier* ident = arena.make<Identifier>(curToken, curToken.getLiteral());
             identifiers.push_back(ident);
             while (peekTokenIs(TokenType::COMMA)){
                 nextToken();
                 nextToken();
-                ident = std::make_shared<Identifier>(curToken, curToken.getLiteral());
+                ident = arena.make<Identifier>(curToken, curToken.getLiteral());
                 identifiers.push_back(ident);
             }
             if (!expectPeek(TokenType::RPAREN)){
-                return std::vector<std::shared_ptr<Identifier>>();
+                return std::vector<Identifier*>();
             }
             return identifiers;
         }
 
         // 解析函数调用
-        std::shared_ptr<Expression> parseCallExpression(std::shared_ptr<Expression> function){
-            std::shared_ptr<CallExpression> exp = std::make_shared<CallExpression>(curToken, function);
+        Expression* parseCallExpression(Expression* function){
+            CallExpression* exp = arena.make<CallExpression>(curToken, function);
             exp->arguments = parseCallArguments();
             return exp;
         }
 
         // 解析函数调用实参
-        std::vector<std::shared_ptr<Expression>> parseCallArguments(){
+        std::vector<Expression*> parseCallArguments(){
             return parseExpressionList(TokenType::RPAREN);
         }
 
@@ -450,6 +530,7 @@ namespace monkey{
 
     private:
         std::shared_ptr<Lexer> lexer;
+        Arena& arena;
         std::vector<std::string> errors;
         Token curToken;
         Token peekToken;
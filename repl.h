@@ -4,15 +4,45 @@
 #include <fstream>
 #include <string>
 #include <memory>
+#include <sstream>
+#include <algorithm>
 
 #include "lexer/lexer.h"
+#include "lexer/source.h"
+#include "lexer/stream.h"
 #include "token/token.h"
 #include "parser/parser.h"
 #include "evaluator/evaluator.h"
+#include "evaluator/resolver.h"
+#include "optimizer/optimizer.h"
+#include "compiler/compiler.h"
+#include "vm/vm.h"
+#include "trace/trace.h"
+#include "cache/ast_cache.h"
 
 namespace monkey{
     const std::string PROMPT = ">> ";
 
+    // 执行引擎: 树遍历解释器 或 字节码虚拟机.
+    // 虚拟机不支持宏展开之后剩下的 quote 调用(运行时构造 AST), 编译时报错
+    enum Engine {
+        ENGINE_EVAL = 0,
+        ENGINE_VM
+    };
+
+    // 命令行选项
+    struct Options {
+        Engine engine = ENGINE_EVAL;
+        bool optimize = true;       // 宏展开后执行 AST 优化
+        size_t inlineBudget = Optimizer::DEFAULT_INLINE_BUDGET;    // 可内联函数体的最大节点数, 0 关闭内联
+        bool dumpAst = false;       // 把送入求值/编译的 AST 输出到标准错误
+        Profiler* profiler = nullptr;   // 非空时记录解释器中每个函数的调用耗时(仅树遍历解释器)
+        Tracer* tracer = nullptr;       // 非空时记录各阶段, 每次宏展开和每条顶层语句的耗时
+        bool banner = true;         // 执行前向结果输出写入欢迎横幅
+        std::string astCacheDir;    // 非空时把宏展开后的 AST 缓存到该目录, 同一份源码再次运行时跳过语法分析和宏展开
+        std::string prelude;        // 非空时先执行该文件并冻结结果, 每个脚本的全局环境都以它为外层
+    };
+
     const std::string WELCOME = R"(                         __                          
  /'\_/`\                /\ \                         
 /\      \    ___     ___\ \ \/'\      __   __  __    
@@ -36,42 +66,349 @@ namespace monkey{
            '-----')";
 
 
-    void printParserErrors(std::ofstream& output, std::string errors) {
+    void printParserErrors(std::ostream& output, std::string errors) {
         output << MONKEY_FACE << "\n";
         output << "Woops! We ran into some monkey business here!\n";
         output << "parser errors:\n";
         output << errors;
     }
 
-    // repl
-    void start(std::ifstream& input, std::ofstream& output) {
-        std::string line;
-        std::string program;
-        static Evaluator evaluator;
+    void printCompilerErrors(std::ostream& output, std::string errors) {
+        output << MONKEY_FACE << "\n";
+        output << "Woops! Compilation failed:\n";
+        output << errors;
+    }
+
+    // 一个解释器实例: 持有 AST, 全局环境, 宏环境和虚拟机的全局状态, 多次 run 之间共享(如 REPL 的多行输入).
+    // 实例之间互不共享可变状态, 不同线程上的实例可以同时运行; 同一个实例只能在创建它的线程上使用
+    class Interpreter {
+    public:
+        Interpreter(const Options& options = Options()) : options(options), evaluator(arena),
+            env(std::make_shared<Environment>(nullptr, resolver.globalScope())), macroEnv(std::make_shared<Environment>()),
+            symbolTable(std::make_shared<SymbolTable>()), globals(std::make_shared<std::vector<Value>>(GLOBALS_SIZE)) {
+            evaluator.setTracer(options.tracer);
+            evaluator.setProfiler(options.profiler);
+        }
+
+        // 以已冻结的 base 为底层: 全局环境, 宏环境和符号表以 base 的为下层, 虚拟机的全局变量和常量从 base 复制.
+        // 新的定义(包括与 base 同名的)只进入自己的这一层, base 可以被同一线程上任意多个解释器共用
+        Interpreter(const Options& options, std::shared_ptr<Interpreter> base) : Interpreter(options) {
+            this->base = base;
+            resolver.setOuterScope(base->resolver.globalScope());
+            env = std::make_shared<Environment>(base->env, resolver.globalScope());
+            macroEnv = std::make_shared<Environment>(base->macroEnv);
+            symbolTable = SymbolTable::layered(base->symbolTable);
+            constants = base->constants;
+            constantIndex = base->constantIndex;
+            std::copy(base->globals->begin(), base->globals->begin() + base->symbolTable->numDefinitions, globals->begin());
+            history = base->history;
+        }
+
+        Interpreter(const Interpreter&) = delete;
+        Interpreter& operator=(const Interpreter&) = delete;
+
+        // 执行一个 prelude 文件并冻结, 供之后的解释器作为底层; 失败时把错误写入 errors 并返回空.
+        // 解释器的状态只能在创建它的线程上使用, 所以每个线程各自加载一次
+        static std::shared_ptr<Interpreter> loadPrelude(const std::string& path, Options options, std::ostream& errors) {
+            auto source = Source::open(path);
+            if (source == nullptr) {
+                errors << "cannot open prelude " << path << "\n";
+                return nullptr;
+            }
+            options.profiler = nullptr;
+            options.tracer = nullptr;
+            options.banner = false;
+            auto prelude = std::make_shared<Interpreter>(options);
+            std::ostringstream output;
+            if (!prelude->run(source, output)) {
+                errors << "prelude " << path << " failed:\n" << output.str();
+                return nullptr;
+            }
+            prelude->frozen = true;
+            // 之后的脚本共享 prelude 环境, 不允许通过赋值修改其中的绑定
+            prelude->env->freeze();
+            return prelude;
+        }
+
+        // puts 的输出目标, 为空时使用当前线程的默认目标(标准输出)
+        void setPrintStream(std::ostream* out) {
+            print = out;
+        }
+
+        // 执行一段源码, 结果写入 output; 出现语法, 编译或运行时错误时返回 false
+        bool run(std::shared_ptr<Source> source, std::ostream& output) {
+            if (frozen) {
+                output << "ERROR: cannot run code in a frozen prelude\n";
+                return false;
+            }
+            // AST 节点的生命周期与全局环境一致: 环境中的函数对象仍引用着函数体, 节点中的字面量又指向源码缓冲区
+            sources.push_back(source);
+            std::ostream* savedPrint = printStream();
+            if (print != nullptr) {
+                printStream() = print;
+            }
+            Outcome outcome = execute(source, arena, output, nullptr);
+            printStream() = savedPrint;
+            history = AstCache::hash(source->text(), history);
+            return finish(outcome, output);
+        }
+
+        // 流式执行: 从 in 中分段读取, 每次只解析, 展开并执行一条顶层语句, 执行完即释放它的 AST.
+        // 宏(以及字节码引擎中的全局变量)必须先定义后使用; 遇到语法错误, 运行时错误或顶层 return 时停止读取.
+        // 输出与 run 一致, 但出错前已执行的语句的副作用(如 puts)已经发生
+        bool runStream(std::istream& in, std::ostream& output) {
+            if (frozen) {
+                output << "ERROR: cannot run code in a frozen prelude\n";
+                return false;
+            }
+            std::ostream* savedPrint = printStream();
+            if (print != nullptr) {
+                printStream() = print;
+            }
+            StatementReader reader(in);
+            std::string text;
+            StatementReader::Position at;
+            Outcome last;
+            last.ok = true;
+            while (reader.next(text, at)) {
+                auto source = Source::fromString(std::move(text));
+                auto nodes = std::make_unique<Arena>();
+                last = execute(source, *nodes, output, &at);
+                if (last.keepsAst) {
+                    sources.push_back(source);
+                    arenas.push_back(std::move(nodes));
+                }
+                if (!last.ok || last.returned || last.result.is(ObjectKind::ERROR)) {
+                    break;
+                }
+            }
+            printStream() = savedPrint;
+            if (last.ok) {
+                showBanner(output);
+            }
+            return finish(last, output);
+        }
+
+    private:
+        // 一次执行的结果
+        struct Outcome {
+            bool ok = false;        // 没有语法或编译错误(错误已写入输出); 运行时错误是 result 中的 Error
+            Value result;           // 最后一条语句的值, 为空时不输出
+            bool returned = false;  // 执行到了顶层 return
+            bool keepsAst = false;  // 运行时的值可能引用这次的 AST(仅流式执行时计算)
+        };
 
-        while (getline(input, line)) {
-            program += line;
-            program += "\n";
+        bool finish(const Outcome& outcome, std::ostream& output) {
+            if (!outcome.ok) {
+                return false;
+            }
+            if (!outcome.result.isEmpty()) {
+                output << outcome.result.inspect() << "\n" << std::endl;
+            }
+            return !outcome.result.is(ObjectKind::ERROR);
         }
-        
-        std::shared_ptr<Lexer> lexer = std::make_shared<Lexer>(program);
-        std::shared_ptr<Parser> parser = std::make_shared<Parser>(lexer);
-        
-        auto program_ast = parser->parseProgram();
-        if (parser->getErrors().size() != 0) {
-            printParserErrors(output, parser->getErrors());
-            return;
+
+        void showBanner(std::ostream& output) {
+            if (options.banner && !bannerShown) {
+                output << WELCOME << "\n" << std::endl;
+                bannerShown = true;
+            }
+        }
+
+        // nodes 为这段源码的 AST 所在的区域; at 非空表示流式执行中的一段, 按它调整行列号, 不使用 AST 缓存
+        Outcome execute(const std::shared_ptr<Source>& source, Arena& nodes, std::ostream& output, const StatementReader::Position* at) {
+            CallerScope scope(&evaluator);
+            Tracer* tracer = options.tracer;
+            Outcome outcome;
+            bool useCache = !options.astCacheDir.empty() && at == nullptr;
+            Node* expanded = nullptr;
+            Program* macros = nullptr;
+            if (useCache) {
+                TraceSpan span(tracer, "phase", "loadAstCache");
+                std::shared_ptr<Source> file;
+                expanded = AstCache(options.astCacheDir, history).load(source->text(), nodes, file, macros);
+                if (file != nullptr) {
+                    sources.push_back(file);
+                }
+            }
+            if (expanded != nullptr) {
+                showBanner(output);
+                // 之后的输入(或以本实例为 prelude 的脚本)仍可能调用这段源码中定义的宏
+                evaluator.defineMacros(macros, macroEnv);
+            } else {
+                expanded = parseAndExpand(source, nodes, output, macros, at);
+                if (expanded == nullptr) {
+                    return outcome;
+                }
+                if (useCache) {
+                    TraceSpan span(tracer, "phase", "storeAstCache");
+                    AstCache(options.astCacheDir, history).store(source->text(), static_cast<Program*>(expanded), macros);
+                }
+            }
+            if (options.optimize) {
+                TraceSpan span(tracer, "phase", "optimize");
+                Optimizer optimizer(nodes, options.inlineBudget);
+                optimizer.optimize(static_cast<Program*>(expanded));
+                if (options.dumpAst) {
+                    std::cerr << "// optimized: inlined=" << optimizer.inlinedCount() << " folded=" << optimizer.foldedCount() << " pruned=" << optimizer.prunedCount() << std::endl;
+                }
+            }
+            if (options.dumpAst) {
+                std::cerr << expanded->String() << std::endl;
+            }
+            if (at != nullptr) {
+                outcome.keepsAst = referencedAtRuntime(expanded, macros);
+            }
+            if (options.engine == ENGINE_VM) {
+                runVM(expanded, output, outcome);
+                return outcome;
+            }
+            {
+                TraceSpan span(tracer, "phase", "resolve");
+                resolver.resolve(static_cast<Program*>(expanded));
+            }
+            {
+                TraceSpan span(tracer, "phase", "eval");
+                ProfileScope scope(options.profiler, nullptr);
+                outcome.result = evaluator.evalProgram(static_cast<Program*>(expanded), env, &outcome.returned);
+            }
+            outcome.ok = true;
+            return outcome;
         }
-        
-        output << WELCOME << "\n" << std::endl;
-        static std::shared_ptr<Environment> env = std::make_shared<Environment>();
-        static std::shared_ptr<Environment> macroEnv = std::make_shared<Environment>();
-        evaluator.defineMacros(program_ast, macroEnv);
-        auto expanded = evaluator.expandMacros(program_ast, macroEnv);
-        auto evaluated = evaluator.eval(expanded, env);
-        if (evaluated != nullptr) {
-            output << evaluated->inspect() << "\n" << std::endl;
+
+        // 词法分析, 语法分析和宏定义/展开, 宏定义语句收集到 macros 中; 有语法错误时输出错误并返回空
+        Node* parseAndExpand(const std::shared_ptr<Source>& source, Arena& nodes, std::ostream& output, Program*& macros, const StatementReader::Position* at) {
+            Tracer* tracer = options.tracer;
+            int line = at != nullptr ? at->line : 1;
+            int column = at != nullptr ? at->column : 1;
+            if (tracer != nullptr) {
+                // 语法分析按需从词法分析器取 token, 为了单独计时, 追踪时先额外完整扫描一遍
+                TraceSpan span(tracer, "phase", "lex");
+                Lexer lexer(source->text(), line, column);
+                while (lexer.nextToken().getType() != TokenType::EOF) {
+                }
+            }
+
+            std::shared_ptr<Lexer> lexer = std::make_shared<Lexer>(source->text(), line, column);
+            std::shared_ptr<Parser> parser = std::make_shared<Parser>(lexer, nodes);
+            
+            Program* program_ast = nullptr;
+            {
+                TraceSpan span(tracer, "phase", "parse");
+                program_ast = parser->parseProgram();
+            }
+            if (parser->getErrors().size() != 0) {
+                printParserErrors(output, parser->getErrors());
+                return nullptr;
+            }
+            
+            showBanner(output);
+            macros = nodes.make<Program>();
+            for (auto stmt : program_ast->statements) {
+                if (evaluator.isMacroDefinition(stmt)) {
+                    macros->statements.push_back(stmt);
+                }
+            }
+            {
+                TraceSpan span(tracer, "phase", "defineMacros");
+                evaluator.defineMacros(program_ast, macroEnv);
+            }
+            TraceSpan span(tracer, "phase", "expandMacros");
+            return evaluator.expandMacros(program_ast, macroEnv);
+        }
+
+        // 执行后运行时的值是否还可能引用这段 AST: 宏定义, quote 的结果和(树遍历解释器的)函数都直接持有节点
+        bool referencedAtRuntime(Node* program, Program* macros) {
+            bool referenced = !macros->statements.empty();
+            modify(program, [&](Node* node) {
+                if (node != nullptr) {
+                    if (node->kind == NodeKind::FUNCTION_LITERAL) {
+                        referenced = referenced || options.engine == ENGINE_EVAL;
+                    } else if (node->kind == NodeKind::CALL_EXPRESSION && static_cast<CallExpression*>(node)->function->TokenLiteral() == "quote") {
+                        referenced = true;
+                    }
+                }
+                return node;
+            });
+            return referenced;
         }
+
+        // 字节码引擎: 宏展开后的 AST -> 字节码 -> 虚拟机
+        void runVM(Node* program, std::ostream& output, Outcome& outcome) {
+            // 常量池在编译器, 虚拟机和解释器之间移交而不复制, 流式执行时每条语句的开销不随常量个数增长
+            Compiler compiler(symbolTable, std::move(constants), std::move(constantIndex));
+            bool compiled = false;
+            {
+                TraceSpan span(options.tracer, "phase", "compile");
+                compiled = compiler.compile(program);
+            }
+            auto bytecode = compiler.takeBytecode();
+            constantIndex = compiler.takeConstantIndex();
+            if (!compiled) {
+                constants = std::move(bytecode.constants);
+                printCompilerErrors(output, compiler.getErrors());
+                return;
+            }
+
+            VM machine(std::move(bytecode), globals);
+            if (symbolTable->base != nullptr) {
+                machine.setReadOnlyGlobals(symbolTable->base->numDefinitions);
+            }
+            CallerScope scope(&machine);
+            std::shared_ptr<Object> err;
+            {
+                TraceSpan span(options.tracer, "phase", "run");
+                err = machine.run();
+            }
+            constants = machine.takeConstants();
+            outcome.ok = true;
+            if (err != nullptr) {
+                outcome.result = err;
+                return;
+            }
+            outcome.returned = machine.returnedFromMain();
+            // 与解释器一致: 只有最后一条语句产生值时才输出, let/赋值/循环不产生值
+            auto& statements = static_cast<Program*>(program)->statements;
+            if (statements.empty() || (statements.back()->kind != NodeKind::EXPRESSION_STATEMENT && statements.back()->kind != NodeKind::RETURN_STATEMENT)) {
+                return;
+            }
+            outcome.result = machine.lastPoppedStackElem();
+        }
+
+        Options options;
+        std::ostream* print = nullptr;
+        bool frozen = false;
+        bool bannerShown = false;
+        uint64_t history = 0;   // 已执行源码的串联哈希, 作为 AST 缓存的 seed
+        // 声明顺序即析构的逆序: 环境和常量先于 AST 释放, AST 先于源码缓冲区释放, 最后才是 prelude
+        std::shared_ptr<Interpreter> base;
+        std::vector<std::shared_ptr<Source>> sources;
+        Arena arena;
+        std::vector<std::unique_ptr<Arena>> arenas;    // 流式执行中被运行时值引用而保留下来的语句
+        Evaluator evaluator;
+        Resolver resolver;
+        std::shared_ptr<Environment> env;
+        std::shared_ptr<Environment> macroEnv;
+        std::shared_ptr<SymbolTable> symbolTable;
+        std::vector<Value> constants;
+        ConstantIndex constantIndex;
+        std::shared_ptr<std::vector<Value>> globals;
+    };
+
+    // 以给定选项新建一个解释器执行一段源码, prelude 非空时以它为底层
+    bool start(std::shared_ptr<Source> source, std::ostream& output, const Options& options = Options(), std::shared_ptr<Interpreter> prelude = nullptr) {
+        if (prelude != nullptr) {
+            Interpreter interpreter(options, prelude);
+            return interpreter.run(source, output);
+        }
+        Interpreter interpreter(options);
+        return interpreter.run(source, output);
+    }
+
+    // 同 start, 但从 in 中流式读取并逐条执行顶层语句
+    bool startStream(std::istream& in, std::ostream& output, const Options& options = Options(), std::shared_ptr<Interpreter> prelude = nullptr) {
+        auto interpreter = prelude != nullptr ? std::make_unique<Interpreter>(options, prelude) : std::make_unique<Interpreter>(options);
+        return interpreter->runStream(in, output);
     }
 
 }; // namespace monkey
\ No newline at end of file
@@ -0,0 +1,1087 @@
+// 回归测试: 把程序分别交给树遍历解释器和字节码虚拟机执行, 比较 puts 的输出和最后的结果.
+// 用法: monkey_tests (由 ctest 调用), 有失败时返回 1
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../repl.h"
+#include "../batch/batch.h"
+#include "../bench/workloads.h"
+
+namespace {
+    using namespace monkey;
+
+    int failures = 0;
+
+    const char* engineName(Engine engine) {
+        return engine == ENGINE_VM ? "vm" : "eval";
+    }
+
+    std::string trim(const std::string& s) {
+        size_t end = s.find_last_not_of(" \t\r\n");
+        return end == std::string::npos ? "" : s.substr(0, end + 1);
+    }
+
+    // 执行 code, 返回 puts 的输出与结果(去掉末尾空白)
+    std::string run(const std::string& code, Engine engine, std::shared_ptr<Interpreter> prelude = nullptr, bool optimize = true) {
+        Options options;
+        options.engine = engine;
+        options.banner = false;
+        options.optimize = optimize;
+        auto interpreter = prelude != nullptr ? std::make_shared<Interpreter>(options, prelude) : std::make_shared<Interpreter>(options);
+        std::ostringstream out;
+        interpreter->setPrintStream(&out);
+        interpreter->run(Source::fromString(code), out);
+        return trim(out.str());
+    }
+
+    // 同 run, 但用 --stream 的方式逐条语句执行
+    std::string runStreamed(const std::string& code, Engine engine) {
+        Options options;
+        options.engine = engine;
+        options.banner = false;
+        Interpreter interpreter(options);
+        std::ostringstream out;
+        interpreter.setPrintStream(&out);
+        std::istringstream in(code);
+        interpreter.runStream(in, out);
+        return trim(out.str());
+    }
+
+    // 在同一个解释器上依次执行多段源码(与 REPL 的多行输入相同), 返回每段的输出, 以空行分隔
+    std::string runSession(const std::vector<std::string>& codes, Engine engine) {
+        Options options;
+        options.engine = engine;
+        options.banner = false;
+        Interpreter interpreter(options);
+        std::string result;
+        for (auto& code : codes) {
+            std::ostringstream out;
+            interpreter.setPrintStream(&out);
+            interpreter.run(Source::fromString(code), out);
+            result += (result.empty() ? "" : "\n") + trim(out.str());
+        }
+        return result;
+    }
+
+    void check(const std::string& name, Engine engine, const std::string& got, const std::string& want) {
+        if (got != want) {
+            failures++;
+            std::cerr << "FAIL " << name << " [" << engineName(engine) << "]\n  want: " << want << "\n  got:  " << got << std::endl;
+        }
+    }
+
+    void expect(const std::string& name, Engine engine, const std::string& code, const std::string& want) {
+        check(name, engine, run(code, engine), want);
+    }
+
+    void expectBoth(const std::string& name, const std::string& code, const std::string& want) {
+        expect(name, ENGINE_EVAL, code, want);
+        expect(name, ENGINE_VM, code, want);
+    }
+
+    std::string lastLine(const std::string& s) {
+        return s.substr(s.find_last_of('\n') + 1);
+    }
+
+    // 开启和关闭 AST 优化时两种引擎的结果都为 want
+    void expectOptimized(const std::string& name, const std::string& code, const std::string& want) {
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            check(name + " (optimized)", engine, run(code, engine, nullptr, true), want);
+            check(name + " (not optimized)", engine, run(code, engine, nullptr, false), want);
+        }
+    }
+
+    // 优化 code, 返回被内联的调用点个数
+    size_t inlinedCalls(const std::string& code, size_t budget = Optimizer::DEFAULT_INLINE_BUDGET) {
+        Arena nodes;
+        Parser parser(std::make_shared<Lexer>(code), nodes);
+        Program* program = parser.parseProgram();
+        Optimizer optimizer(nodes, budget);
+        optimizer.optimize(program);
+        return optimizer.inlinedCount();
+    }
+
+    // 虚拟机拒绝编译 code, 报告的最后一条错误为 message
+    void expectCompileError(const std::string& name, const std::string& code, const std::string& message) {
+        check(name, ENGINE_VM, lastLine(run(code, ENGINE_VM)), message);
+    }
+
+    // 先把 prelude 写入临时文件加载, 再在它之上执行 code
+    std::string runWithPrelude(const std::string& prelude, const std::string& code, Engine engine) {
+        auto path = (std::filesystem::temp_directory_path() / "monkey_tests_prelude.txt").string();
+        std::ofstream(path) << prelude;
+        Options options;
+        options.engine = engine;
+        std::ostringstream errors;
+        auto base = Interpreter::loadPrelude(path, options, errors);
+        std::filesystem::remove(path);
+        if (base == nullptr) {
+            return "prelude failed: " + trim(errors.str());
+        }
+        return run(code, engine, base);
+    }
+
+    void expectWithPrelude(const std::string& name, const std::string& prelude, const std::string& code, const std::string& want) {
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            check(name, engine, runWithPrelude(prelude, code, engine), want);
+        }
+    }
+
+    // 两种引擎对同一组程序给出相同的输出和结果
+    void testEngineAgreement() {
+        const std::vector<std::pair<std::string, std::string>> cases = {
+            {"1 + 2 * 3 - 4 / 2", "5"},
+            {"-(5 - 10) * 2", "10"},
+            {"[1 < 2, 2 > 1, 1 == 1, 1 != 1, !true, !!5]", "[true, true, true, false, false, true]"},
+            {"if (1 > 2) { 10 } else { 20 }", "20"},
+            {"if (false) { 10 }", "null"},
+            {"let x = 5; let y = x * 2; [x, y]", "[5, 10]"},
+            {"\"mon\" + \"key\"", "monkey"},
+            {"let a = [1, 2 * 2, 3 + 3]; [a[0], a[2], a[3], len(a), first(a), last(a), rest(a), push(a, 7)]",
+                "[1, 6, null, 3, 1, 6, [4, 6], [1, 4, 6, 7]]"},
+            {"let h = {\"one\": 1, 2: \"two\", true: 3}; [h[\"one\"], h[2], h[true], h[\"none\"]]", "[1, two, 3, null]"},
+            {"let add = fn(a, b) { a + b }; let apply = fn(f, x, y) { f(x, y) }; apply(add, 3, 4)", "7"},
+            {"let adder = fn(x) { fn(y) { x + y } }; let addTwo = adder(2); addTwo(40)", "42"},
+            {"let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(15)", "610"},
+            {"let f = fn(n) { if (n > 3) { return n * 10; } n }; [f(1), f(5)]", "[1, 50]"},
+            {"puts(\"hello\", 1, [2]); let g = fn() { puts(\"side\"); 1 }; g() + g()", "hello\n1\n[2]\nside\nside\n2"},
+            {"let m = macro(a, b) { quote(unquote(b) - unquote(a)) }; m(2, 10)", "8"},
+            {"let unless = macro(c, t, e) { quote(if (!(unquote(c))) { unquote(t) } else { unquote(e) }) }; unless(10 > 5, \"no\", \"yes\")", "yes"},
+            {"reduce(filter(map([1, 2, 3, 4, 5, 6], fn(x) { x * x }), fn(x) { x / 2 * 2 == x }), 0, fn(acc, x) { acc + x })", "56"},
+            {"sort([5, 3, 9, 1], fn(a, b) { a > b })", "[9, 5, 3, 1]"},
+            {"fn(x) { x }(5)", "5"},
+            {"5 + true", "ERROR: type mismatch: INTEGER + BOOLEAN"},
+            {"-true", "ERROR: unknown operator: -BOOLEAN"},
+            {"\"a\" - \"b\"", "ERROR: unknown operator: STRING - STRING"},
+            {"len(1)", "ERROR: argument to `len` not supported, got INTEGER"},
+        };
+        for (auto& c : cases) {
+            expectBoth("engines: " + c.first, c.first, c.second);
+        }
+    }
+
+    // 每种节点都经由 NodeKind 分派求值; quote 输出的 AST 文本与改用 NodeKind 之前相同
+    void testNodeDispatch() {
+        expectBoth("dispatch: statements and expressions",
+            "let k = fn(n) { let t = 0; for (x in [1, 2]) { t = t + x }; while (n > 0) { n = n - 1; t = t + 1 };"
+            " return {\"t\": [t, !false, -n, \"s\", if (t > 8) { 1 } else { 2 }]}[\"t\"]; }; k(3)",
+            "[6, true, 0, s, 2]");
+        expectBoth("dispatch: macro literal", "let m = macro(x) { quote(unquote(x) * 2) }; m(4)", "8");
+        expect("dispatch: quoted node text", ENGINE_EVAL,
+            "quote(fn(x, y) { let z = x; return [z, {\"k\": !y}[-1], if (x < y) { x } else { y }]; })",
+            "QUOTE(fn(x, y)let z = x;return [z, ({k: (!y)}[(-1)]), if(x < y) xelse y];)");
+    }
+
+    // 尾调用不占用新的调用帧: 递归深度远超非尾递归的上限(求值器约 2000 层, 虚拟机 65536 帧)
+    void testTailCalls() {
+        const std::string defs =
+            "let count = fn(n, acc) { if (n == 0) { acc } else { count(n - 1, acc + 1) } };"
+            "let isEven = fn(n) { if (n == 0) { true } else { isOdd(n - 1) } };"
+            "let isOdd = fn(n) { if (n == 0) { false } else { isEven(n - 1) } };"
+            "let loop = fn(n) { if (n == 0) { return \"done\"; } return loop(n - 1); };";
+        expectBoth("tail calls: self, mutual and through return", defs + "[count(20000, 0), isEven(20001), loop(20000)]", "[20000, false, done]");
+        expect("tail calls: beyond the vm frame limit", ENGINE_VM, defs + "count(100000, 0)", "100000");
+        expectBoth("tail calls: builtin in tail position", "let f = fn(a) { len(a) }; f([1, 2])", "2");
+        expectBoth("tail calls: call in argument position is not a tail call",
+            "let f = fn(n) { if (n == 0) { 0 } else { 1 + f(n - 1) } }; let g = fn(n) { f(f(n)) }; g(100)", "100");
+    }
+
+    // 词法地址: 遮蔽, 多层闭包, 先使用后定义的全局变量, 块内的 let 属于所在函数, 宏展开引入的名字
+    void testLexicalAddressing() {
+        expectBoth("scope: parameter shadows a global", "let x = 1; let f = fn(x) { let g = fn() { x * 10 }; g() }; [f(2), x]", "[20, 1]");
+        expectBoth("scope: global defined after the function", "let f = fn() { later + 1 }; let later = 41; f()", "42");
+        expectBoth("scope: three levels of closures",
+            "let a = 1; let f = fn() { let b = 2; fn() { let c = 3; fn() { a + b + c } } }; f()()()", "6");
+        expectBoth("scope: let inside a block belongs to the function", "let f = fn(n) { if (n > 0) { let y = n * 2; } y }; f(3)", "6");
+        expectBoth("scope: let refers to the outer binding on its right side", "let x = 10; let f = fn() { let x = x + 1; x }; [f(), x]", "[11, 10]");
+        expectBoth("scope: function built by a macro", "let m = macro(v) { quote(fn(q) { q + unquote(v) }) }; let k = m(1); k(5)", "6");
+    }
+
+    // 整数, 布尔值和 null 以立即数存放: 取值范围, 相等比较和作为 hash 键时区分类型
+    void testImmediateValues() {
+        expectBoth("immediates: integer range", "[9223372036854775807, -9223372036854775807 - 1, -0]", "[9223372036854775807, -9223372036854775808, 0]");
+        expectBoth("immediates: equality across types",
+            "[1 == true, true == true, (1 < 2) == true, 0 == false, 1 != true, \"1\" == 1]",
+            "[false, true, true, false, true, false]");
+        expectBoth("immediates: null", "let n = if (false) { 1 }; [n, !n, n == if (false) { 2 }]", "[null, true, true]");
+        expectBoth("immediates: integer and boolean keys are distinct", "let h = {1: \"i\", true: \"b\"}; [h[1], h[true]]", "[i, b]");
+    }
+
+    // push/rest 得到的数组共享缓冲区, 每次分配都回收时共享的元素也不能被误判为垃圾
+    void testSharedArrayBuffers() {
+        Heap::instance().setThreshold(1);
+        expectBoth("gc: closure kept alive only through a shared array buffer",
+            "let mk = fn() { let x = 5; fn(y) { x + y } };"
+            "let setup = fn() { let f = mk(); let a = [f]; let b = push(a, 0); let keep = fn() { [a, b] }; f };"
+            "map([1, 2, 3], setup())",
+            "[6, 7, 8]");
+        expectBoth("gc: rest views of one buffer",
+            "let mk = fn(x) { fn() { x } };"
+            "let a = [mk(1), mk(2), mk(3)];"
+            "let b = rest(a); let c = rest(b); let d = push(a, mk(4));"
+            "[a[0](), b[0](), c[0](), d[3](), len(d)]",
+            "[1, 2, 3, 4, 4]");
+        Heap::instance().setThreshold(10000);
+    }
+
+    // 字符串不可变: 拼接得到新串而原串不变; 多次拼接的结果与字面量相等, 可以作为 hash 键
+    void testStrings() {
+        expectBoth("strings: concatenation leaves operands unchanged",
+            "let a = \"x\"; let b = a + \"y\"; let c = a + \"z\"; [a, b, c, b == \"xy\", \"\" + \"\" == \"\"]",
+            "[x, xy, xz, true, true]");
+        expectBoth("strings: concatenation on both sides", "let s = \"\"; for (x in [1, 2, 3]) { s = \"<\" + s + \">\" }; s", "<<<>>>");
+        expectBoth("strings: long chain of concatenations",
+            "let s = \"\"; let i = 0; while (i < 20000) { s = s + \"ab\"; i = i + 1 }; [len(s), s == s + \"\", {s: 1}[s]]",
+            "[40000, true, 1]");
+    }
+
+    // AST 节点分配在区域中: 之后的输入仍会调用之前定义的函数和宏, 它们的 AST 要一直保留
+    void testAstLifetime() {
+        const std::vector<std::string> session = {
+            "let twice = fn(f, x) { f(f(x)) }; let swap = macro(a, b) { quote([unquote(b), unquote(a)]) };",
+            "let junk = map([1, 2, 3, 4, 5, 6, 7, 8], fn(x) { [x, \"s\" + \"t\"] }); len(junk)",
+            "[twice(fn(x) { x * 3 }, 2), swap(1, 2)]",
+        };
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            check("ast: definitions from earlier input", engine, runSession(session, engine), "8\n[18, [2, 1]]");
+        }
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            check("ast: streamed definitions", engine,
+                runStreamed("let twice = fn(f, x) { f(f(x)) };\nlet swap = macro(a, b) { quote([unquote(b), unquote(a)]) };\n"
+                    "let y = 1;\n[twice(fn(x) { x * 3 }, 2), swap(1, 2)]", engine),
+                "[18, [2, 1]]");
+        }
+        check("ast: streamed quote", ENGINE_EVAL, runStreamed("let q = quote(1 + 2);\nlet y = 1;\nq", ENGINE_EVAL), "QUOTE((1 + 2))");
+    }
+
+    // 词法分析直接引用源码缓冲区: 记号紧贴缓冲区末尾, CRLF 换行和制表符, 未闭合的字符串, 非法字符
+    void testLexer() {
+        expectBoth("lexer: identifier at the end of the source", "let abc = 5; abc", "5");
+        expectBoth("lexer: integer at the end of the source", "12345", "12345");
+        expectBoth("lexer: string at the end of the source", "\"tail\"", "tail");
+        expectBoth("lexer: CRLF and tabs", "let a = 1;\r\nlet b = 2;\r\n\ta + b\r\n", "3");
+        expectBoth("lexer: unterminated string runs to the end", "\"unterminated", "unterminated");
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            check("lexer: illegal character", engine, lastLine(run("let x = 1 @ 2", engine)), "1.no prefix parse function for ILLEGAL found");
+        }
+    }
+
+    // 环回收: 函数与环境(虚拟机中闭包与 cell)之间的引用环在回收时释放; 超过堆上限时报错
+    void testCycleCollection() {
+        auto& heap = Heap::instance();
+        const std::string cycles = "let mk = fn() { let c = 0; let h = fn() { c }; c = h; 1 }; let i = 0; while (i < 200) { i = i + mk() }; i";
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            size_t freed = heap.getStats().freed;
+            check("gc: cycles", engine, run(cycles, engine), "200");
+            heap.collect();
+            check("gc: cycles are freed", engine, heap.getStats().freed - freed >= 200 ? "yes" : "no", "yes");
+            check("gc: nothing left alive", engine, std::to_string(heap.getStats().live), "0");
+        }
+        heap.setThreshold(1);
+        heap.setLimit(10);
+        const std::string live = "let a = map([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12], fn(x) { [x] }); let f = fn() { 1 }; f(); len(a)";
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            std::string got = run(live, engine);
+            check("gc: heap limit", engine, got.substr(0, got.find(':', 7)), "ERROR: heap limit exceeded");
+        }
+        heap.setLimit(0);
+        heap.setThreshold(10000);
+    }
+
+    // 错误信息中的类型名与改用 ObjectKind 之前相同
+    void testTypeNames() {
+        const std::vector<std::pair<std::string, std::string>> cases = {
+            {"len({})", "ERROR: argument to `len` not supported, got HASH_TABLE"},
+            {"len(len)", "ERROR: argument to `len` not supported, got BUILTIN"},
+            {"first(1)", "ERROR: argument to `first` must be ARRAY, got INTEGER"},
+            {"rest(\"a\")", "ERROR: argument to `rest` must be ARRAY, got STRING"},
+            {"-\"a\"", "ERROR: unknown operator: -STRING"},
+            {"[1] + [2]", "ERROR: unknown operator: ARRAY + ARRAY"},
+            {"{} + {}", "ERROR: unknown operator: HASH_TABLE + HASH_TABLE"},
+            {"true + true", "ERROR: unknown operator: BOOLEAN + BOOLEAN"},
+            {"\"a\" + 1", "ERROR: type mismatch: STRING + INTEGER"},
+            {"5()", "ERROR: not a function: INTEGER"},
+            {"[1][true]", "ERROR: index operator not supported: ARRAY"},
+        };
+        for (auto& c : cases) {
+            expectBoth("type names: " + c.first, c.first, c.second);
+        }
+        // 虚拟机中的函数是闭包
+        expect("type names: function", ENGINE_EVAL, "fn() { 1 } + 1", "ERROR: type mismatch: FUNCTION + INTEGER");
+        expect("type names: function", ENGINE_VM, "fn() { 1 } + 1", "ERROR: type mismatch: CLOSURE + INTEGER");
+    }
+
+    // push 和 rest 共享数组的缓冲区, 但每个数组的值互不影响
+    void testArraySharing() {
+        expectBoth("arrays: pushes onto the same array",
+            "let a = [1]; let b = push(a, 2); let c = push(a, 3); let d = push(b, 4); let e = push(b, 5); [a, b, c, d, e]",
+            "[[1], [1, 2], [1, 3], [1, 2, 4], [1, 2, 5]]");
+        expectBoth("arrays: rest views",
+            "let a = [1, 2, 3, 4]; let r = rest(a); let rr = rest(r); let p = push(r, 9); [a, r, rr, p, rest([]), rest([1])]",
+            "[[1, 2, 3, 4], [2, 3, 4], [3, 4], [2, 3, 4, 9], null, []]");
+        expectBoth("arrays: built by repeated push",
+            "let build = fn(n, acc) { if (n == 0) { acc } else { build(n - 1, push(acc, n)) } }; let big = build(5000, []); [len(big), big[0], big[4999], len(rest(big))]",
+            "[5000, 5000, 1, 4999]");
+    }
+
+    // 调用路径: 实参和局部变量超过内联容量(4 个)时转到堆上, 实参从左到右求值
+    void testCalls() {
+        expectBoth("calls: more arguments than the inline capacity",
+            "let f = fn(a, b, c, d, e, f, g, h, i) { [a, b, c, d, e, f, g, h, i] }; f(1, 2, 3, 4, 5, 6, 7, 8, 9)",
+            "[1, 2, 3, 4, 5, 6, 7, 8, 9]");
+        expectBoth("calls: argument order",
+            "let p = fn(x) { puts(x); x }; let f = fn(a, b, c) { a * 100 + b * 10 + c }; f(p(1), p(2), p(3))",
+            "1\n2\n3\n123");
+        expectBoth("calls: recursion with many locals",
+            "let f = fn(a, b, c, d, e, g) { let h = a + b; let i = c + d; let j = e + g; let k = h + i + j;"
+            " if (a == 0) { k } else { f(a - 1, b, c, d, e, g) + 1 } }; f(50, 1, 2, 3, 4, 5)",
+            "65");
+        expectBoth("calls: function values in arrays and hashes",
+            "let fs = [fn(x) { x + 1 }, fn(x) { x * 2 }]; let h = {\"f\": fs[1]}; [fs[0](1), h[\"f\"](5)]",
+            "[2, 10]");
+    }
+
+    // 常量折叠和删除死分支不改变结果; 结果无定义的运算(除以 0)不折叠, 运行时照常报错
+    void testOptimizer() {
+        expectOptimized("optimizer: integer folding", "2 * 3 + 4 - 10 / 5", "8");
+        expectOptimized("optimizer: string folding", "\"a\" + \"b\" + \"c\"", "abc");
+        expectOptimized("optimizer: prefix and comparison folding", "[!true, !(1 < 2), 1 == 1, \"a\" == \"a\", -(-9223372036854775807 - 1)]",
+            "[false, false, true, true, -9223372036854775808]");
+        expectOptimized("optimizer: division by zero", "1 / 0", "ERROR: division by zero");
+        expectOptimized("optimizer: division by zero in an uncalled function", "let f = fn() { 5 / 0 }; 1", "1");
+        expectOptimized("optimizer: constant condition", "let x = 2; if (1 < 2) { x } else { 0 }", "2");
+        // 死分支被删除后, 虚拟机不再编译其中未定义的名字
+        expectBoth("optimizer: dead branch", "[if (true) { 1 } else { undefinedName }, if (false) { undefinedName }]", "[1, null]");
+    }
+
+    // 小函数在调用点内联; 递归, 被重新赋值或超出预算的函数不内联. 内联不改变结果和实参的求值
+    void testInlining() {
+        auto expectInlined = [](const std::string& name, size_t got, size_t want) {
+            if (got != want) {
+                failures++;
+                std::cerr << "FAIL " << name << "\n  want: " << want << " inlined calls\n  got:  " << got << std::endl;
+            }
+        };
+        expectInlined("inliner: small function", inlinedCalls("let add = fn(a, b) { a + b }; add(1, 2)"), 1);
+        expectInlined("inliner: budget 0", inlinedCalls("let add = fn(a, b) { a + b }; add(1, 2)", 0), 0);
+        expectInlined("inliner: body over budget", inlinedCalls("let add = fn(a, b) { a + b + a + b }; add(1, 2)", 3), 0);
+        expectInlined("inliner: recursive function", inlinedCalls("let f = fn(n) { if (n < 1) { 0 } else { f(n - 1) } }; f(3)"), 0);
+        expectInlined("inliner: reassigned function", inlinedCalls("let add = fn(a, b) { a + b }; add = fn(a, b) { a * b }; add(2, 3)"), 0);
+        expectInlined("inliner: escaping closure", inlinedCalls("let mk = fn(x) { fn() { x } }; mk(3)()"), 0);
+        expectInlined("inliner: call inside a function", inlinedCalls("let g = fn(a) { a }; let h = fn() { g(7) }; h()"), 2);
+
+        expectOptimized("inliner: result", "let add = fn(a, b) { a + b }; add(1, 2)", "3");
+        expectOptimized("inliner: reassigned function result", "let add = fn(a, b) { a + b }; add = fn(a, b) { a * b }; add(2, 3)", "6");
+        expectOptimized("inliner: loop", "let sq = fn(x) { x * x }; let sum = 0; let i = 0; while (i < 4) { sum = sum + sq(i); i = i + 1 }; sum", "14");
+        // 实参按从左到右的顺序各求值一次, 即使参数在函数体中的出现顺序不同或出现在不执行的分支中
+        expectOptimized("inliner: argument order",
+            "let log = \"\"; let t = fn(s) { log = log + s; 1 }; let sub = fn(a, b) { b - a }; [sub(t(\"a\"), t(\"b\")), log]", "[0, ab]");
+        expectOptimized("inliner: argument in untaken branch",
+            "let k = fn(a, b) { if (a) { b } else { 0 } }; let log = \"\"; let t = fn(s) { log = log + s; 1 }; [k(false, t(\"x\")), log]", "[0, x]");
+    }
+
+    // 基准测试的负载在两种引擎上都能执行完, 结果正确
+    void testBenchWorkloads() {
+        const std::map<std::string, std::string> want = {
+            {"fib", "6765"},
+            {"map_reduce", "2666466670000"},
+            {"hash_lookup", "9990000"},
+            {"string_build", "40100"},
+            {"macros", "1102750"},
+            {"deep_recursion", "20000"},
+        };
+        for (auto& w : workloads()) {
+            auto it = want.find(w.name);
+            expectBoth("bench: " + w.name, w.source, it != want.end() ? it->second : "(no expected result)");
+        }
+    }
+
+    // 分析器按函数统计调用次数(含递归和尾调用), 折叠栈中尾调用不加深调用栈
+    void testProfiler() {
+        Profiler profiler;
+        Options options;
+        options.banner = false;
+        options.optimize = false;
+        options.profiler = &profiler;
+        Interpreter interpreter(options);
+        std::ostringstream out;
+        interpreter.setPrintStream(&out);
+        interpreter.run(Source::fromString(
+            "let sq = fn(x) { x * x };\n"
+            "let sum = fn(n) { if (n == 0) { 0 } else { sq(n) + sum(n - 1) } };\n"
+            "let loop = fn(n) { if (n == 0) { 0 } else { loop(n - 1) } };\n"
+            "[sum(5), loop(2000)]"), out);
+        check("profiler: result", ENGINE_EVAL, trim(out.str()), "[55, 0]");
+
+        // 报告每行为 "调用次数 包含时间 独占时间 函数名@行:列"
+        std::ostringstream report;
+        profiler.printReport(report);
+        std::map<std::string, std::string> calls;
+        std::istringstream lines(report.str());
+        std::string line;
+        std::getline(lines, line);
+        while (std::getline(lines, line)) {
+            std::istringstream fields(line);
+            std::string count, inclusive, exclusive, label;
+            fields >> count >> inclusive >> exclusive >> label;
+            calls[label] = count;
+        }
+        std::string got;
+        for (auto& entry : calls) {
+            got += entry.first + "=" + entry.second + " ";
+        }
+        check("profiler: call counts", ENGINE_EVAL, got, "<program>=1 loop@3:12=2001 sq@1:10=5 sum@2:11=6 ");
+
+        std::ostringstream folded;
+        profiler.writeCollapsed(folded);
+        check("profiler: tail calls stay one frame deep", ENGINE_EVAL,
+            folded.str().find("<program>;loop@3:12 ") != std::string::npos && folded.str().find("loop@3:12;loop") == std::string::npos ? "yes" : "no", "yes");
+    }
+
+    // 追踪记录各阶段, 每次宏展开(附调用处的位置)和每条顶层语句, 按结束的先后排列
+    void testTrace() {
+        const std::string code = "let twice = macro(x) { quote(unquote(x) + unquote(x)) };\nlet x = twice(2);\nputs(x)";
+        const std::string want[] = {
+            "phase:lex phase:parse phase:defineMacros macro:twice@2:9 phase:expandMacros phase:optimize phase:resolve "
+            "statement:let x@2:1 statement:ExpressionStatement@3:1 phase:eval ",
+            "phase:lex phase:parse phase:defineMacros macro:twice@2:9 phase:expandMacros phase:optimize phase:compile phase:run ",
+        };
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            Tracer tracer;
+            Options options;
+            options.engine = engine;
+            options.banner = false;
+            options.tracer = &tracer;
+            Interpreter interpreter(options);
+            std::ostringstream out;
+            interpreter.setPrintStream(&out);
+            interpreter.run(Source::fromString(code), out);
+            check("trace: result", engine, trim(out.str()), "4");
+
+            // 每行一个事件, 取出类别, 名字和位置
+            std::ostringstream json;
+            tracer.write(json);
+            std::istringstream lines(json.str());
+            std::string line, got;
+            auto field = [&](const std::string& key) {
+                size_t at = line.find("\"" + key + "\": ");
+                if (at == std::string::npos) {
+                    return std::string();
+                }
+                at += key.size() + 4;
+                size_t end = line[at] == '"' ? line.find('"', at + 1) + 1 : line.find_first_of(",}", at);
+                return line.substr(at, end - at);
+            };
+            while (std::getline(lines, line)) {
+                if (line.find("\"ph\": \"X\"") == std::string::npos) {
+                    continue;
+                }
+                auto name = field("name"), category = field("cat");
+                got += category.substr(1, category.size() - 2) + ":" + name.substr(1, name.size() - 2);
+                if (!field("line").empty()) {
+                    got += "@" + field("line") + ":" + field("column");
+                }
+                got += " ";
+            }
+            check("trace: events", engine, got, want[engine == ENGINE_VM]);
+            // 最后一个事件之后没有逗号
+            std::string text = trim(json.str());
+            check("trace: json", engine, text.substr(0, 42) + " ... " + text.substr(text.size() - 4),
+                "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [ ... }\n]}");
+        }
+    }
+
+    // 分配统计: 关闭时 memstats() 报错; 打开后按类型计数, 脚本结束并回收引用环后运行时对象全部释放.
+    // 统计打开后不能再关闭, 所以这组测试放在最后
+    void testAllocStats() {
+        expectBoth("memstats: disabled", "memstats()",
+            "ERROR: memstats is unavailable: allocation tracking is off (run with --alloc-stats)");
+
+        AllocStats::enable();
+        expectBoth("memstats: counts arrays",
+            "let n = 2; let a = [n]; let before = memstats()[\"object\"][\"ARRAY\"];"
+            "let b = [[n], [n]]; let after = memstats()[\"object\"][\"ARRAY\"];"
+            "[after[\"allocated\"] - before[\"allocated\"], after[\"live\"] - before[\"live\"], after[\"peak\"] < after[\"live\"]]",
+            "[3, 3, false]");
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            AllocStats::reset();
+            run("let n = 2; let b = [[n], [n]]; let f = fn(x) { [x] }; f(1); len(b)", engine);
+            // 顶层函数与全局环境构成引用环, 由环回收器释放
+            Heap::instance().collect();
+            auto& arrays = AllocStats::get(AllocStats::OBJECT, static_cast<int>(ObjectKind::ARRAY));
+            check("memstats: arrays are freed", engine,
+                std::to_string(arrays.allocated) + " allocated, " + std::to_string(arrays.live) + " live", "4 allocated, 0 live");
+            check("memstats: environments are freed", engine,
+                std::to_string(AllocStats::get(AllocStats::ENVIRONMENT, 0).live) + " live", "0 live");
+        }
+    }
+
+    // 批量运行: 脚本互相隔离, 输出按输入顺序排列, 与工作线程数无关; 清单中的相对路径相对于清单所在目录
+    void testBatchRunner() {
+        namespace fs = std::filesystem;
+        fs::path dir = fs::temp_directory_path() / "monkey_tests_batch";
+        fs::remove_all(dir);
+        fs::create_directories(dir);
+        const std::vector<std::pair<std::string, std::string>> scripts = {
+            {"a.txt", "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; let x = 1; puts(fib(18))"},
+            {"b.txt", "x"},
+            {"c.txt", "let y = ;"},
+            {"d.txt", "let x = 2; puts(x)"},
+        };
+        for (auto& script : scripts) {
+            std::ofstream((dir / script.first).string()) << script.second;
+        }
+        std::ofstream((dir / "manifest").string()) << "# scripts\n\nd.txt\n  a.txt  \n";
+
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            Options options;
+            options.engine = engine;
+            // 目录中的文件按名字排序, 清单本身排在最后, 不执行
+            std::vector<std::string> paths;
+            std::string error;
+            bool collected = BatchRunner::collect(dir.string(), paths, error);
+            check("batch: directory", engine, collected ? std::to_string(paths.size()) + " files" : error, "5 files");
+            paths.pop_back();
+            std::string want;
+            for (size_t jobs : {1, 4}) {
+                std::ostringstream out;
+                size_t failed = BatchRunner(options, jobs).run(paths, out);
+                // 每个脚本一段, 取出各段的最后一行
+                std::string got;
+                std::istringstream lines(out.str());
+                std::string line, last;
+                while (std::getline(lines, line)) {
+                    if (line.compare(0, 4, "==> ") == 0) {
+                        got += last + (last.empty() ? "" : " | ") + fs::path(line.substr(4, line.size() - 8)).filename().string() + ": ";
+                        last = "";
+                    } else if (!trim(line).empty()) {
+                        last = trim(line);
+                    }
+                }
+                got += last + " | " + std::to_string(failed) + " failed";
+                if (want.empty()) {
+                    want = got;
+                }
+                check("batch: output with " + std::to_string(jobs) + " jobs", engine, got, want);
+            }
+            check("batch: isolated scripts", engine, want,
+                std::string("a.txt: 2584 | b.txt: ") + (engine == ENGINE_VM ? "" : "ERROR: ") + "identifier not found: x | "
+                "c.txt: 1.no prefix parse function for SEMICOLON found | d.txt: 2 | 2 failed");
+
+            std::vector<std::string> listed;
+            collected = BatchRunner::collect((dir / "manifest").string(), listed, error);
+            std::string got;
+            for (auto& path : listed) {
+                got += fs::path(path).lexically_relative(dir).string() + " ";
+            }
+            check("batch: manifest", engine, collected ? got : error, "d.txt a.txt ");
+            std::ostringstream out;
+            size_t failed = BatchRunner(options, 2).run(listed, out);
+            check("batch: manifest scripts", engine, std::to_string(failed) + " failed, " + out.str(),
+                "0 failed, ==> " + listed[0] + " <==\n2\n==> " + listed[1] + " <==\n2584\n");
+        }
+        fs::remove_all(dir);
+    }
+
+    // 并行版本的高阶内置函数与顺序版本结果相同(数组足够大, 确实分段并行执行); 回调中的错误照常返回
+    void testParallelBuiltins() {
+        const std::string setup =
+            "let mod = fn(x, m) { x - x / m * m }; let a = []; let i = 0; while (i < 2000) { a = push(a, mod(i * 7919, 2003)); i = i + 1; };";
+        const std::pair<std::string, std::string> same[] = {
+            {"pmap(a, fn(x) { x * x })", "map(a, fn(x) { x * x })"},
+            {"pfilter(a, fn(x) { mod(x, 3) == 0 })", "filter(a, fn(x) { mod(x, 3) == 0 })"},
+            {"preduce(a, 0, fn(x, y) { x + y })", "reduce(a, 0, fn(x, y) { x + y })"},
+            {"psort(a)", "sort(a)"},
+            {"psort(a, fn(x, y) { x > y })", "sort(a, fn(x, y) { x > y })"},
+            {"pmap(a, fn(x) { {\"v\": [x, \"s\"]} })", "map(a, fn(x) { {\"v\": [x, \"s\"]} })"},
+            {"let k = 10; pmap(a, fn(x) { x + k })", "let k = 10; map(a, fn(x) { x + k })"},
+        };
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            for (auto& pair : same) {
+                check("parallel: " + pair.first, engine, run(setup + pair.first, engine), run(setup + pair.second, engine));
+            }
+        }
+        expectBoth("parallel: reduce result", setup + "preduce(a, 0, fn(x, y) { x + y })", "2004445");
+        expectBoth("parallel: error in a callback",
+            setup + "pmap(a, fn(x) { if (x == 1500) { x + \"s\" } else { x } })", "ERROR: type mismatch: INTEGER + STRING");
+        expectBoth("parallel: wrong callback arity", setup + "preduce(a, 0, fn(x) { x })", "ERROR: wrong number of arguments: want=1, got=2");
+        expectBoth("parallel: callback is not a function", setup + "pmap(a, 1)", "ERROR: argument to `pmap` must be FUNCTION, got INTEGER");
+        expectBoth("parallel: small array", "psort([3, 1, 2])", "[1, 2, 3]");
+    }
+
+    // AST 缓存: 各类节点序列化后能原样重建; 源码, seed 不符或文件损坏时不命中, 解释器退回重新分析
+    void testAstCache() {
+        namespace fs = std::filesystem;
+        fs::path dir = fs::temp_directory_path() / "monkey_tests_ast_cache";
+        fs::remove_all(dir);
+        const std::string code =
+            "let unless = macro(c, a, b) { quote(if (!(unquote(c))) { unquote(a) } else { unquote(b) }) };\n"
+            "let f = fn(x, y) { if (x < y) { return [x, -y, \"s\\\"t\"]; } else { x * y } };\n"
+            "let h = {\"k\": true, 1: false}; let n = 0; while (n < 3) { n = n + 1 };\n"
+            "for (v in [1, 2]) { puts(v) }; puts(unless(n == 3, 1, f(1, 2)[1]), h[\"k\"], quote(n + 1))";
+
+        Arena nodes;
+        Parser parser(std::make_shared<Lexer>(code), nodes);
+        Program* program = parser.parseProgram();
+        Program* macros = nodes.make<Program>();
+        macros->statements.push_back(program->statements[0]);
+        AstCache cache(dir.string(), 42);
+        check("ast cache: store", ENGINE_EVAL, cache.store(code, program, macros) ? "stored" : "failed", "stored");
+        {
+            Arena loaded;
+            std::shared_ptr<Source> file;
+            Program* loadedMacros = nullptr;
+            Program* hit = cache.load(code, loaded, file, loadedMacros);
+            check("ast cache: round trip", ENGINE_EVAL, hit != nullptr ? hit->String() : "miss", program->String());
+            check("ast cache: macros", ENGINE_EVAL, loadedMacros != nullptr ? loadedMacros->String() : "miss", macros->String());
+            check("ast cache: other seed", ENGINE_EVAL, AstCache(dir.string(), 7).load(code, loaded, file, loadedMacros) == nullptr ? "miss" : "hit", "miss");
+            check("ast cache: other source", ENGINE_EVAL, cache.load(code + " ", loaded, file, loadedMacros) == nullptr ? "miss" : "hit", "miss");
+        }
+
+        // 截断在任意位置的文件都不命中
+        std::string path = cache.pathFor(code);
+        std::string bytes;
+        {
+            std::ifstream in(path, std::ios::binary);
+            std::ostringstream content;
+            content << in.rdbuf();
+            bytes = content.str();
+        }
+        int hits = 0;
+        for (size_t size = 0; size < bytes.size(); ++size) {
+            std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), size);
+            Arena loaded;
+            std::shared_ptr<Source> file;
+            Program* loadedMacros = nullptr;
+            hits += cache.load(code, loaded, file, loadedMacros) != nullptr;
+        }
+        check("ast cache: truncated files", ENGINE_EVAL, std::to_string(hits) + " hits", "0 hits");
+        fs::remove_all(dir);
+
+        // 解释器: 第二次运行命中缓存, 缓存损坏时重新分析, 结果都相同
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            Options options;
+            options.engine = engine;
+            options.banner = false;
+            options.astCacheDir = dir.string();
+            // 返回输出; 没有命中缓存, 重新做了语法分析时加上 "(parsed)"
+            auto runCached = [&](const std::string& source) {
+                Tracer tracer;
+                Options traced = options;
+                traced.tracer = &tracer;
+                Interpreter interpreter(traced);
+                std::ostringstream out;
+                interpreter.setPrintStream(&out);
+                interpreter.run(Source::fromString(source), out);
+                std::ostringstream events;
+                tracer.write(events);
+                return trim(out.str()) + (events.str().find("\"name\": \"parse\"") != std::string::npos ? " (parsed)" : "");
+            };
+            const std::string script = "let twice = macro(x) { quote(unquote(x) + unquote(x)) }; let f = fn(x) { twice(x) }; puts(f(3)); f(4)";
+            check("ast cache: miss", engine, runCached(script), "6\n8 (parsed)");
+            size_t files = std::distance(fs::directory_iterator(dir), fs::directory_iterator());
+            check("ast cache: file written", engine, std::to_string(files) + " files", "1 files");
+            check("ast cache: hit", engine, runCached(script), "6\n8");
+            for (auto& entry : fs::directory_iterator(dir)) {
+                std::ofstream(entry.path().string(), std::ios::binary | std::ios::trunc) << "MKAS garbage";
+            }
+            check("ast cache: corrupted file", engine, runCached(script), "6\n8 (parsed)");
+            check("ast cache: rewritten after corruption", engine, runCached(script), "6\n8");
+            fs::remove_all(dir);
+        }
+    }
+
+    // 流式执行: 逐条语句执行, 输出与整体执行相同; 出错时之前语句的输出保留, 之后的语句不再执行
+    void testStreaming() {
+        // 字符串和花括号中的 ';' 不切分语句
+        std::istringstream in("let a = \"x;y\";\nlet f = fn() { 1; 2 };\n  [a, f()]\n");
+        StatementReader reader(in);
+        std::string text, got;
+        StatementReader::Position at;
+        while (reader.next(text, at)) {
+            got += std::to_string(at.line) + ":" + std::to_string(at.column) + " " + text + "|";
+        }
+        check("stream: statements", ENGINE_EVAL, got, "1:1 let a = \"x;y\";|1:15 \nlet f = fn() { 1; 2 };|2:23 \n  [a, f()]\n|");
+
+        const std::string programs[] = {
+            "let a = \"x;y\"; let f = fn() { 1; 2 }; puts(a); [a, f()]",
+            "puts(1) puts(2); puts(3)",
+            "let m = macro(x) { quote(unquote(x) * 2) }; puts(m(4)); let y = m(1); y",
+            "puts(1); return 5; puts(2);",
+            "puts(1); 1 + true; puts(2);",
+        };
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            for (auto& code : programs) {
+                check("stream: same as whole input: " + code, engine, runStreamed(code, engine), run(code, engine));
+            }
+            check("stream: parse error after output", engine, runStreamed("puts(1); let = 2; puts(3);", engine).substr(0, 2), "1\n");
+            check("stream: parse error stops the stream", engine, lastLine(runStreamed("puts(1); let = 2; puts(3);", engine)),
+                "2.no prefix parse function for ASSIGN found");
+            check("stream: macro used before its definition", engine, lastLine(runStreamed("puts(n(1)); let n = macro(x) { x };", engine)),
+                engine == ENGINE_VM ? "identifier not found: n" : "ERROR: identifier not found: n");
+            // 跨越读入块边界的长语句
+            std::string big(StatementReader::CHUNK_SIZE * 2, 'a');
+            check("stream: statement across chunks", engine, runStreamed("let s = \"" + big + "\"; puts(len(s)); len(s + \";\")", engine),
+                std::to_string(big.size()) + "\n" + std::to_string(big.size() + 1));
+        }
+    }
+
+    // 标识符只能由字母组成: 0 -> va, 1 -> vb, ..., 26 -> vaa
+    std::string identifier(int i) {
+        std::string name;
+        for (++i; i > 0; i = (i - 1) / 26) {
+            name.insert(name.begin(), static_cast<char>('a' + (i - 1) % 26));
+        }
+        return "v" + name;
+    }
+
+    // hash 表: 按插入顺序输出, 重复的键以后出现的为准, 多次扩容后仍能找到每个键
+    void testHashTables() {
+        expectBoth("hash: insertion order", "{\"b\": 1, \"a\": 2, 3: 4, false: 5}", "{b : 1, a : 2, 3 : 4, false : 5}");
+        expectBoth("hash: duplicate key", "let h = {\"a\": 1, \"a\": 2}; [h, h[\"a\"]]", "[{a : 2}, 2]");
+        expectBoth("hash: missing key", "{\"a\": 1}[\"b\"]", "null");
+        expectBoth("hash: key built at runtime", "let h = {\"ab\": 1}; h[\"a\" + \"b\"]", "1");
+        expectBoth("hash: nested", "{1: {2: [3]}}[1][2][0]", "3");
+        expectBoth("hash: unusable key", "{[1]: 2}", "ERROR: unusable as hash key: ARRAY");
+        const int n = 300;
+        std::string code = "let h = {";
+        for (int i = 0; i < n; ++i) {
+            code += (i > 0 ? ", \"" : "\"") + identifier(i) + "\": " + std::to_string(i);
+        }
+        code += "}; [h[\"" + identifier(0) + "\"], h[\"" + identifier(n / 2) + "\"], h[\"" + identifier(n - 1) + "\"], h[\"" + identifier(n) + "\"]]";
+        expectBoth("hash: many keys", code, "[0, " + std::to_string(n / 2) + ", " + std::to_string(n - 1) + ", null]");
+    }
+
+    // 大量全局变量: 环境的槽位按倍数增长, 定义 n 个变量的总开销为线性
+    void testManyGlobals() {
+        const int n = 50000;
+        std::string code;
+        for (int i = 0; i < n; ++i) {
+            code += "let " + identifier(i) + " = " + std::to_string(i) + ";\n";
+        }
+        code += "[" + identifier(0) + ", " + identifier(n - 1) + "]";
+        expectBoth("globals: many top-level lets", code, "[0, " + std::to_string(n - 1) + "]");
+    }
+
+    // 操作数放不下时虚拟机报编译错误, 而不是截断后读错常量, 变量或跳转目标
+    void testBytecodeLimits() {
+        const int n = 70000;
+        std::string repeated = "let s = 0;\n";
+        std::string distinct = "let s = 0;\n";
+        std::string globals;
+        for (int i = 0; i < n; ++i) {
+            repeated += "s = s + 4;\n";
+            distinct += "s = s + " + std::to_string(i) + ";\n";
+            globals += "let " + identifier(i) + " = 4;\n";
+        }
+        repeated += "s";
+        distinct += "s";
+        globals += identifier(n - 1);
+        // 相同的常量只占常量池的一项, 流式执行也不会逐条语句累积
+        expectBoth("limits: repeated constant", repeated, "280000");
+        check("limits: repeated constant, streamed", ENGINE_VM, runStreamed(repeated, ENGINE_VM), "280000");
+
+        expect("limits: too many constants", ENGINE_EVAL, distinct, "2449965000");
+        expectCompileError("limits: too many constants", distinct, "operand of OpConstant out of range: 65536 (limit 65535)");
+        expect("limits: too many globals", ENGINE_EVAL, globals, "4");
+        expectCompileError("limits: too many globals", globals, "operand of OpSetGlobal out of range: 65536 (limit 65535)");
+
+        std::string body;
+        for (int i = 0; i < 30000; ++i) {
+            body += "1; ";
+        }
+        const std::string longJump = "if (true) { " + body + "5 } else { 7 }";
+        expect("limits: jump past 64KB", ENGINE_EVAL, longJump, "5");
+        expectCompileError("limits: jump past 64KB", longJump, "operand of OpJumpNotTruthy out of range: 120010 (limit 65535)");
+    }
+
+    // 最后一条语句没有值(puts, 空函数体)时两种引擎都不输出结果
+    void testNoValueResult() {
+        expectBoth("no value: puts at the end", "let x = 1; puts(x)", "1");
+        expectBoth("no value: function returning puts", "let f = fn(x) { puts(x) }; let g = fn() { f(2) }; g()", "2");
+        expectBoth("no value: empty function body", "let f = fn() {}; f()", "");
+        expectBoth("no value: value after puts", "puts(1); 5", "1\n5");
+        expectBoth("no value: null is still printed", "if (false) { 1 }", "null");
+    }
+
+    // 整数运算: 加减乘和取负按补码回绕, 除以 0 和 INT64_MIN / -1 报错; 常量折叠与运行时结果相同
+    void testIntegerArithmetic() {
+        const std::vector<std::pair<std::string, std::string>> cases = {
+            {"5 / 0", "ERROR: division by zero"},
+            {"let z = 0; 5 / z", "ERROR: division by zero"},
+            {"let m = -9223372036854775807 - 1; m / -1", "ERROR: integer overflow: -9223372036854775808 / -1"},
+            {"(-9223372036854775807 - 1) / -1", "ERROR: integer overflow: -9223372036854775808 / -1"},
+            {"let m = -9223372036854775807 - 1; [m - 1, -m, m * -1, 9223372036854775807 + 1]",
+                "[9223372036854775807, -9223372036854775808, -9223372036854775808, -9223372036854775808]"},
+            {"[7 / 2, -7 / 2]", "[3, -3]"},
+        };
+        for (auto& c : cases) {
+            for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+                check("integers: " + c.first, engine, run(c.first, engine), c.second);
+                check("integers (no optimize): " + c.first, engine, run(c.first, engine, nullptr, false), c.second);
+            }
+        }
+    }
+
+    // 宏展开深入普通调用的实参, 但 quote 的实参和宏调用的实参保持源码形式
+    void testMacroExpansionInCalls() {
+        const std::string twice = "let twice = macro(x) { quote(unquote(x) + unquote(x)) };";
+        expectBoth("macros: expanded inside call arguments", twice + "puts(twice(5))", "10");
+        expect("macros: quote arguments are not expanded", ENGINE_EVAL, twice + "quote(twice(5))", "QUOTE(twice(5))");
+        expectBoth("macros: macro arguments are passed unexpanded",
+            twice + "let show = macro(x) { puts(x); quote(1) }; show(twice(5))",
+            "QUOTE(twice(5))\n1");
+        expectBoth("macros: macro calls in the expansion are expanded", twice + "twice(twice(1))", "4");
+        expectBoth("macros: macro call passed to a macro",
+            twice + "let unless = macro(c, a, b) { quote(if (!(unquote(c))) { unquote(a) } else { unquote(b) }) }; unless(false, twice(3), 0)",
+            "6");
+        expect("macros: unquote inside call arguments is left alone", ENGINE_EVAL,
+            "let x = 3; quote(f(unquote(x)))", "QUOTE(f(unquote(x)))");
+        expectBoth("macros: inlined helpers still see call arguments",
+            "let add = fn(a, b) { a + b }; add(len([1, 2]), add(1, 2))", "5");
+    }
+
+    // 实参个数不符时两种引擎报同样的错误, 包括尾调用. 多余的实参也是错误(解释器以前会忽略它们, 与虚拟机不一致)
+    void testArity() {
+        expectBoth("arity: too few arguments",
+            "let f = fn(a, b) { b }; puts(f(1));",
+            "ERROR: wrong number of arguments: want=2, got=1");
+        expectBoth("arity: too many arguments",
+            "let f = fn(a) { a }; f(1, 2)",
+            "ERROR: wrong number of arguments: want=1, got=2");
+        expectBoth("arity: tail call",
+            "let g = fn(a, b) { a + b }; let h = fn(x) { g(x) }; h(1)",
+            "ERROR: wrong number of arguments: want=2, got=1");
+        expectBoth("arity: extra arguments in a tail call",
+            "let g = fn(a) { a }; let h = fn(x) { g(x, x) }; h(1)",
+            "ERROR: wrong number of arguments: want=1, got=2");
+        expectBoth("arity: builtin callback with extra parameters",
+            "map([1, 2], fn(x, y) { x })",
+            "ERROR: wrong number of arguments: want=2, got=1");
+    }
+
+    // 脚本中的 let 遮蔽 prelude 中的同名绑定, prelude 的函数仍看到自己的那一个
+    void testPreludeLayering() {
+        expectWithPrelude("prelude: script let shadows a prelude binding",
+            "let x = 1; let getx = fn() { x };",
+            "let x = 5; [x, getx()]",
+            "[5, 1]");
+        expectWithPrelude("prelude: script functions see the shadowing binding",
+            "let x = 1; let getx = fn() { x };",
+            "let x = 5; let mine = fn() { x }; let x = 6; [mine(), getx()]",
+            "[6, 1]");
+    }
+
+    // prelude 中的函数和宏可在脚本中使用; 同一个 prelude 上的脚本互不可见; prelude 出错时加载失败
+    void testPrelude() {
+        const std::string prelude = "let twice = macro(x) { quote(unquote(x) + unquote(x)) }; let sq = fn(x) { x * x }; puts(\"loading\");";
+        expectWithPrelude("prelude: functions and macros", prelude, "twice(sq(3))", "18");
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            auto path = (std::filesystem::temp_directory_path() / "monkey_tests_prelude.txt").string();
+            std::ofstream(path) << prelude;
+            Options options;
+            options.engine = engine;
+            std::ostringstream errors;
+            auto base = Interpreter::loadPrelude(path, options, errors);
+            std::filesystem::remove(path);
+            if (base == nullptr) {
+                check("prelude: load", engine, trim(errors.str()), "");
+                continue;
+            }
+            check("prelude: first script", engine, run("let q = 1; let sq = 5; puts(q); sq", engine, base), "1\n5");
+            check("prelude: second script", engine, lastLine(run("sq(2) + q", engine, base)), engine == ENGINE_VM ? "identifier not found: q" : "ERROR: identifier not found: q");
+            check("prelude: prelude is unchanged", engine, run("sq(2)", engine, base), "4");
+        }
+        for (Engine engine : {ENGINE_EVAL, ENGINE_VM}) {
+            check("prelude: parse error", engine, lastLine(runWithPrelude("let a = ;", "1", engine)), "1.no prefix parse function for SEMICOLON found");
+            check("prelude: runtime error", engine, lastLine(runWithPrelude("let a = 1 + true;", "1", engine)), "ERROR: type mismatch: INTEGER + BOOLEAN");
+        }
+        Options options;
+        std::ostringstream errors;
+        check("prelude: missing file", ENGINE_EVAL, Interpreter::loadPrelude("monkey_tests_missing.txt", options, errors) == nullptr ? trim(errors.str()) : "loaded",
+            "cannot open prelude monkey_tests_missing.txt");
+    }
+
+    // prelude 的绑定对脚本只读: 虚拟机在编译期拒绝脚本中的赋值, 在运行期拒绝 prelude 函数中的赋值
+    void testPreludeReadOnly() {
+        const std::string prelude = "let x = 1; let getx = fn() { x }; let bump = fn() { x = x + 1; x };";
+        const std::string assign = "x = 2; getx()";
+        check("prelude: script assigns a prelude binding", ENGINE_EVAL, runWithPrelude(prelude, assign, ENGINE_EVAL),
+            "ERROR: cannot assign to read-only binding: x");
+        check("prelude: script assigns a prelude binding", ENGINE_VM, lastLine(runWithPrelude(prelude, assign, ENGINE_VM)),
+            "cannot assign to read-only binding: x");
+        check("prelude: prelude function assigns its binding", ENGINE_EVAL, runWithPrelude(prelude, "bump()", ENGINE_EVAL),
+            "ERROR: cannot assign to read-only binding: x");
+        check("prelude: prelude function assigns its binding", ENGINE_VM, runWithPrelude(prelude, "bump()", ENGINE_VM),
+            "ERROR: cannot assign to read-only binding: global #0");
+        expectWithPrelude("prelude: shadowing binding is assignable", prelude, "let x = 5; x = 6; [x, getx()]", "[6, 1]");
+    }
+
+    // while/for-in 与赋值: 循环是语句, 没有值; 代码块不引入作用域, 循环变量在循环后仍可见; 只能给已有的绑定赋值
+    void testLoops() {
+        expectBoth("loops: while", "let i = 0; let s = 0; while (i < 10) { s = s + i; i = i + 1 }; s", "45");
+        expectBoth("loops: nested for-in", "let s = 0; for (x in [1, 2, 3]) { for (y in [10, 20]) { s = s + x * y } }; s", "180");
+        expectBoth("loops: empty array", "let n = 0; for (x in []) { n = n + 1 }; n", "0");
+        expectBoth("loops: for-in over an integer", "for (x in 5) { 1 }", "ERROR: cannot iterate over INTEGER");
+        expectBoth("loops: for-in over a string", "for (x in \"abc\") { 1 }", "ERROR: cannot iterate over STRING");
+        expectBoth("loops: statement has no value", "for (x in [1, 2]) { x }", "");
+        expectBoth("loops: return from inside a loop",
+            "let f = fn() { let i = 0; while (true) { if (i == 5) { return i * 10 }; i = i + 1 } }; f()", "50");
+        expectBoth("loops: loop variable after the loop", "let f = fn() { for (x in [1, 2]) { 1 }; x }; f()", "2");
+        expectBoth("loops: let in the body rebinds the outer name", "let i = 0; while (i < 3) { let i = 10 }; i", "10");
+        expectBoth("loops: million iterations", "let i = 0; while (i < 1000000) { i = i + 1 }; i", "1000000");
+        expectBoth("loops: large array",
+            "let a = []; let i = 0; while (i < 100000) { a = push(a, i); i = i + 1 }; let s = 0; for (x in a) { s = s + x }; s",
+            "4999950000");
+        expectBoth("assign: global from a function", "let x = 1; let f = fn() { x = x + 1 }; f(); f(); x", "3");
+        expect("assign: undefined name", ENGINE_EVAL, "y = 1", "ERROR: identifier not found: y");
+        expectCompileError("assign: undefined name", "y = 1", "identifier not found: y");
+    }
+
+    // 闭包与定义处共享被捕获变量的绑定: 虚拟机把之后还会被写入的变量放在 cell 中, 结果与求值器相同
+    void testLoopCapture() {
+        expectBoth("loop capture: top-level loop variable is a global",
+            "let fs = []; for (x in [1, 2, 3]) { fs = push(fs, fn() { x }); }; [fs[0](), fs[2]()]",
+            "[3, 3]");
+        expectBoth("loop capture: for-in variable",
+            "let f = fn() { let fs = []; for (x in [1, 2, 3]) { fs = push(fs, fn() { x }); }; [fs[0](), fs[2]()] }; f()",
+            "[3, 3]");
+        expectBoth("loop capture: let inside while",
+            "let f = fn() { let fs = []; let i = 0; while (i < 3) { let y = i; fs = push(fs, fn() { y }); i = i + 1; }; [fs[0](), fs[2]()] }; f()",
+            "[2, 2]");
+        expectBoth("loop capture: let after capture",
+            "let f = fn() { let x = 1; let g = fn() { x }; let x = 2; g() }; f()",
+            "2");
+        expectBoth("loop capture: capture after the loop",
+            "let f = fn(a) { let acc = 0; for (x in a) { acc = acc + x }; map(a, fn(y) { y + acc }) }; f([1, 2])",
+            "[4, 5]");
+        expectBoth("capture: closures share a counter",
+            "let counter = fn() { let n = 0; [fn() { n = n + 1; n }, fn() { n }] }; let c = counter(); c[0](); c[0](); [c[1](), c[0]()]",
+            "[2, 3]");
+        expectBoth("capture: closure assigns a parameter",
+            "let f = fn(p) { let g = fn() { p = p * 2 }; g(); g(); p }; f(3)",
+            "12");
+        expectBoth("capture: assignment two functions down",
+            "let f = fn() { let n = 0; let a = fn() { let b = fn() { n = n + 10 }; b() }; a(); a(); n }; f()",
+            "20");
+        expectBoth("capture: function assigns its own name",
+            "let o = fn() { let f = fn() { f = 5; 1 }; let r = f(); [r, f] }; o()",
+            "[1, 5]");
+        Heap::instance().setThreshold(1);
+        expectBoth("capture: cycle through a captured variable is collected",
+            "let f = fn() { let c = 0; let h = fn() { c }; c = h; 1 }; let s = 0; for (x in [1, 2, 3, 4, 5]) { s = s + f() }; s",
+            "5");
+        Heap::instance().setThreshold(10000);
+    }
+
+    // 并行内置函数的回调修改外层绑定时结果与顺序执行相同, 与线程数无关(main 中设置了 4 个线程)
+    void testParallelAssignment() {
+        const std::string setup =
+            "let a = []; let i = 0; while (i < 1000) { a = push(a, i); i = i + 1; };"
+            "let count = 0; let inc = fn() { count = count + 1 };";
+        expectBoth("parallel: pmap callback assigns a global",
+            setup + "let r = pmap(a, fn(x) { count = count + 1; x * 2 }); [count, r[999]]",
+            "[1000, 1998]");
+        expectBoth("parallel: pfilter callback calls a function that assigns a global",
+            setup + "let r = pfilter(a, fn(x) { inc(); x / 2 * 2 == x }); [count, len(r)]",
+            "[1000, 500]");
+        expectBoth("parallel: preduce callback assigns a global",
+            setup + "let r = preduce(a, 0, fn(acc, x) { count = count + 1; acc + x }); [count, r]",
+            "[1000, 499500]");
+        expectBoth("parallel: callback assigns a captured local",
+            setup + "let f = fn() { let n = 0; pmap(a, fn(x) { n = n + 1; x }); n }; f()",
+            "1000");
+        expectBoth("parallel: callback assigns its own locals",
+            setup + "let r = pmap(a, fn(x) { let y = x; y = y + 1; y }); [count, r[999]]",
+            "[0, 1000]");
+    }
+
+    // 后加入的内置函数可被用户绑定遮蔽, 已有脚本中同名的函数不受影响; 最初的内置函数仍然优先
+    void testBuiltinShadowing() {
+        expectBoth("shadowing: user map",
+            "let map = fn(f, arr) { let out = []; for (x in arr) { out = push(out, f(x)) }; out }; map(fn(x) { x * 2 }, [1])",
+            "[2]");
+        expectBoth("shadowing: user sort called before its definition",
+            "let g = fn() { sort([3, 1]) }; let sort = fn(arr) { \"mine\" }; g()",
+            "mine");
+        expectBoth("shadowing: local binding is assignable",
+            "let f = fn() { let filter = 1; filter = filter + 1; filter }; [f(), filter([1, 2], fn(x) { x > 1 })]",
+            "[2, [2]]");
+        expectBoth("shadowing: builtin used when unbound", "sort([3, 1, 2])", "[1, 2, 3]");
+        expect("shadowing: unbound builtin is not assignable", ENGINE_EVAL, "map = 1", "ERROR: cannot assign to builtin: map");
+        expectCompileError("shadowing: unbound builtin is not assignable", "map = 1", "cannot assign to builtin: map");
+        expectBoth("shadowing: original builtins take precedence", "let len = fn(x) { 99 }; len([1])", "1");
+    }
+
+    // 非尾递归的深度: 虚拟机的栈和调用帧按需增长, 至少与求值器一样深
+    void testRecursionDepth() {
+        const std::string count = "let f = fn(n) { if (n == 0) { 0 } else { 1 + f(n - 1) } }; ";
+        expectBoth("recursion: depth 2000", count + "f(2000)", "2000");
+        expect("recursion: vm depth 50000", ENGINE_VM, count + "f(50000)", "50000");
+        expect("recursion: vm frame limit", ENGINE_VM, count + "f(100000)", "ERROR: stack overflow");
+        const std::string nested = "let g = fn(n) { if (n == 0) { 0 } else { reduce(map([n], fn(x) { g(x - 1) }), 1, fn(a, b) { a + b }) } }; ";
+        expectBoth("recursion: through builtin callbacks", nested + "g(300)", "300");
+        expect("recursion: vm nested builtin callbacks", ENGINE_VM, nested + "g(5000)", "ERROR: stack overflow");
+    }
+
+    // 虚拟机的限制: 宏展开之后剩下的 quote 调用(运行时构造 AST)只有求值器支持
+    void testVmLimitations() {
+        expect("limitation: quote", ENGINE_EVAL, "quote(1 + 2)", "QUOTE((1 + 2))");
+        expectCompileError("limitation: quote", "quote(1 + 2)", "quote is not supported by the vm engine");
+    }
+} // namespace
+
+int main() {
+    WorkStealingPool::setThreads(4);
+    testEngineAgreement();
+    testNodeDispatch();
+    testTailCalls();
+    testLexicalAddressing();
+    testImmediateValues();
+    testHashTables();
+    testStrings();
+    testAstLifetime();
+    testLexer();
+    testCycleCollection();
+    testTypeNames();
+    testArraySharing();
+    testCalls();
+    testOptimizer();
+    testInlining();
+    testBenchWorkloads();
+    testProfiler();
+    testTrace();
+    testBatchRunner();
+    testParallelBuiltins();
+    testAstCache();
+    testStreaming();
+    testSharedArrayBuffers();
+    testNoValueResult();
+    testIntegerArithmetic();
+    testMacroExpansionInCalls();
+    testArity();
+    testManyGlobals();
+    testBytecodeLimits();
+    testPrelude();
+    testPreludeLayering();
+    testPreludeReadOnly();
+    testLoops();
+    testLoopCapture();
+    testParallelAssignment();
+    testBuiltinShadowing();
+    testRecursionDepth();
+    testVmLimitations();
+    testAllocStats();
+    if (failures > 0) {
+        std::cerr << failures << " failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all tests passed" << std::endl;
+    return 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 
@@ -50,10 +51,13 @@ namespace monkey {
         IF,     // keyword if
         ELSE,   // keyword else
         RETURN, // keyword return
-        MACRO // keyword macro
+        MACRO, // keyword macro
+        WHILE,  // keyword while
+        FOR,    // keyword for
+        IN      // keyword in
     };
     
-    std::vector<std::string> TokenTypeString = {
+    const std::vector<std::string> TokenTypeString = {
         "ILLEGAL",
         "EOF",
         "IDENT",
@@ -85,26 +89,37 @@ namespace monkey {
         "IF",
         "ELSE",
         "RETURN",
-        "MACRO"
+        "MACRO",
+        "WHILE",
+        "FOR",
+        "IN"
     };
 
+    // token 的字面量是源码缓冲区中的片段(或静态字符串), 不拥有内存.
+    // line/column 为 token 在源码中的起始位置(从 1 开始), 0 表示不是从源码中读出的(如宏展开或优化生成的节点)
     class Token {
     public:
-        Token() {}
-        Token(TokenType type, std::string literal) : type(type), literal(literal) {}
+        Token() : type(TokenType::ILLEGAL) {}
+        Token(TokenType type, std::string_view literal) : type(type), literal(literal) {}
+        Token(TokenType type, std::string_view literal, int line, int column) : type(type), literal(literal), line(line), column(column) {}
 
         TokenType getType() { return type; }
         std::string getTypeString() { return TokenTypeString[type]; }
-        std::string getLiteral() { return literal; }
+        std::string getLiteral() { return std::string(literal); }
+        std::string_view getLiteralView() { return literal; }
+        int getLine() const { return line; }
+        int getColumn() const { return column; }
 
     private:
         TokenType type;
-        std::string literal;
+        std::string_view literal;
+        int line = 0;
+        int column = 0;
     };
 
 
     // keywords maps: keywords -> TokenType
-    static std::map<std::string, TokenType> keywords = {
+    static const std::pair<std::string_view, TokenType> keywords[] = {
         {"fn", TokenType::FUNCTION},
         {"let", TokenType::LET},
         {"true", TokenType::TRUE},
@@ -112,13 +127,18 @@ namespace monkey {
         {"if", TokenType::IF},
         {"else", TokenType::ELSE},
         {"return", TokenType::RETURN},
-        {"macro", TokenType::MACRO}
+        {"macro", TokenType::MACRO},
+        {"while", TokenType::WHILE},
+        {"for", TokenType::FOR},
+        {"in", TokenType::IN}
     };
     
     // lookupIdent checks the keywords table to see whether the given
-    TokenType lookupIdent(std::string ident) {
-        if (keywords.find(ident) != keywords.end()) {
-            return keywords[ident];
+    TokenType lookupIdent(std::string_view ident) {
+        for (auto& keyword : keywords) {
+            if (keyword.first == ident) {
+                return keyword.second;
+            }
         }
         return TokenType::IDENT;
     }
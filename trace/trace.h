@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <cstdio>
+
+namespace monkey {
+    // 阶段追踪: 把词法分析, 语法分析, 宏定义/展开, 优化, 求值等阶段以及每次宏展开, 每条顶层语句记录为
+    // Chrome trace-event 格式的区间事件("ph": "X"), 可在 chrome://tracing 或 Perfetto 中查看.
+    // 事件先缓存在内存中, 结束时一次性写出, 记录一个事件只需两次读时钟和一次 push_back.
+    class Tracer {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        Tracer() : origin(Clock::now()) {
+            events.reserve(1024);
+        }
+
+        // 记录一个已结束的区间; line 为 0 时不输出源码位置
+        void complete(std::string_view name, const char* category, Clock::time_point start, Clock::time_point end, int line = 0, int column = 0) {
+            events.push_back(Event{std::string(name), category, micros(start), micros(end) - micros(start), line, column});
+        }
+
+        void write(std::ostream& out) const {
+            out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+            char number[64];
+            for (size_t i = 0; i < events.size(); ++i) {
+                auto& e = events[i];
+                out << "{\"name\": \"";
+                writeEscaped(out, e.name);
+                out << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1";
+                std::snprintf(number, sizeof(number), ", \"ts\": %.3f, \"dur\": %.3f", e.ts, e.dur);
+                out << number;
+                if (e.line > 0) {
+                    out << ", \"args\": {\"line\": " << e.line << ", \"column\": " << e.column << "}";
+                }
+                out << "}" << (i + 1 < events.size() ? "," : "") << "\n";
+            }
+            out << "]}" << std::endl;
+        }
+
+    private:
+        struct Event {
+            std::string name;
+            const char* category;
+            double ts;      // 相对追踪开始的微秒数
+            double dur;
+            int line;
+            int column;
+        };
+
+        double micros(Clock::time_point t) const {
+            return std::chrono::duration<double, std::micro>(t - origin).count();
+        }
+
+        static void writeEscaped(std::ostream& out, const std::string& s) {
+            for (char c : s) {
+                if (c == '"' || c == '\\') {
+                    out << '\\' << c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    out << ' ';
+                } else {
+                    out << c;
+                }
+            }
+        }
+
+        Clock::time_point origin;
+        std::vector<Event> events;
+    };
+
+    // 作用域守卫: 析构时把整个作用域记录为一个事件; 追踪器为空时什么也不做.
+    // name 须在守卫析构前保持有效
+    class TraceSpan {
+    public:
+        TraceSpan(Tracer* tracer, const char* category, std::string_view name, int line = 0, int column = 0)
+            : tracer(tracer), category(category), name(name), line(line), column(column) {
+            if (tracer != nullptr) {
+                start = Tracer::Clock::now();
+            }
+        }
+
+        ~TraceSpan() {
+            if (tracer != nullptr) {
+                tracer->complete(name, category, start, Tracer::Clock::now(), line, column);
+            }
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        Tracer* tracer;
+        const char* category;
+        std::string_view name;
+        int line;
+        int column;
+        Tracer::Clock::time_point start;
+    };
+} // namespace monkey
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <memory>
+
+#include "../code/code.h"
+#include "../object/object.h"
+
+namespace monkey {
+    // 调用帧: 正在执行的闭包, 指令指针以及该帧在栈上的基址
+    struct Frame {
+        std::shared_ptr<Closure> cl;
+        int ip;
+        int basePointer;
+
+        Frame() : ip(-1), basePointer(0) {}
+        Frame(std::shared_ptr<Closure> cl, int basePointer) : cl(cl), ip(-1), basePointer(basePointer) {}
+
+        Instructions& instructions() {
+            return cl->fn->instructions;
+        }
+    };
+} // namespace monkey
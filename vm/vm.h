@@ -0,0 +1,621 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "../code/code.h"
+#include "../object/object.h"
+#include "../compiler/compiler.h"
+#include "../evaluator/builtins.h"
+#include "frame.h"
+
+namespace monkey {
+    const int STACK_SIZE = 1 << 20;
+    const int GLOBALS_SIZE = 65536;
+    const int MAX_FRAMES = 1 << 16;
+    // 栈和调用帧开始时只使用这么多, 需要时倍增到上限. 容量按上限预留, 增长时元素不会搬动,
+    // 内置函数拿到的指向栈上实参的 ValueSpan 在回调用户函数之后仍然有效
+    const int INITIAL_STACK_SIZE = 2048;
+    const int INITIAL_FRAMES = 1024;
+    // 内置函数回调用户函数时在 C++ 栈上嵌套执行, 嵌套层数单独限制
+    const int MAX_NESTED_CALLS = 1024;
+
+    // 基于栈的字节码虚拟机
+    class VM : public Caller {
+    public:
+        VM(Bytecode bytecode) : VM(std::move(bytecode), std::make_shared<std::vector<Value>>(GLOBALS_SIZE)) {}
+
+        // 沿用已有的全局变量表(多次运行共享全局状态)
+        VM(Bytecode bytecode, std::shared_ptr<std::vector<Value>> globals) : constants(std::move(bytecode.constants)), globals(globals), sp(0), framesIndex(1) {
+            stack.reserve(STACK_SIZE);
+            stack.resize(INITIAL_STACK_SIZE);
+            frames.reserve(MAX_FRAMES);
+            frames.resize(INITIAL_FRAMES);
+            auto mainFn = std::make_shared<CompiledFunction>(bytecode.instructions, 0, 0);
+            auto mainClosure = std::make_shared<Closure>(mainFn, std::vector<Value>());
+            frames[0] = Frame(mainClosure, 0);
+        }
+
+        // 执行字节码, 出错时返回 Error 对象, 否则返回 nullptr
+        std::shared_ptr<Object> run() {
+            return execute(0);
+        }
+
+        // 内置函数(如 map)回调用户函数的入口: 在当前栈顶之上调用 fn, 执行到它返回为止
+        Value call(const Value& fn, ValueSpan args) override {
+            int savedSp = sp;
+            int savedFrames = framesIndex;
+            if (nestedCalls >= MAX_NESTED_CALLS || !reserveStack(sp + 1 + static_cast<int>(args.size()))) {
+                return std::make_shared<Error>("stack overflow");
+            }
+            stack[sp++] = fn;
+            for (auto& arg : args) {
+                stack[sp++] = arg;
+            }
+            auto err = executeCall(static_cast<int>(args.size()));
+            if (err == nullptr && framesIndex > savedFrames) {
+                nestedCalls++;
+                err = execute(savedFrames);
+                nestedCalls--;
+            }
+            Value result = err != nullptr ? Value(err) : stack[sp - 1];
+            sp = savedSp;
+            framesIndex = savedFrames;
+            return result;
+        }
+
+        // 工作线程上的虚拟机: 常量和已定义的全局变量为拷贝, 没有主程序
+        std::unique_ptr<Caller> fork(Transfer& transfer) override {
+            Bytecode bytecode;
+            for (auto& c : constants) {
+                bytecode.constants.push_back(transfer.copy(c));
+            }
+            auto copied = std::make_shared<std::vector<Value>>(GLOBALS_SIZE);
+            size_t used = globals->size();
+            while (used > 0 && (*globals)[used - 1].isEmpty()) {
+                --used;
+            }
+            for (size_t i = 0; i < used; ++i) {
+                (*copied)[i] = transfer.copy((*globals)[i]);
+            }
+            auto vm = std::make_unique<VM>(bytecode, copied);
+            vm->setReadOnlyGlobals(readOnlyGlobals);
+            vm->copiedGlobals = true;
+            return vm;
+        }
+
+        // 下标小于 count 的全局变量(prelude 的绑定)只读, prelude 中的函数也不能再修改它们
+        void setReadOnlyGlobals(int count) {
+            readOnlyGlobals = count;
+        }
+
+    private:
+        // 执行到调用帧数回落到 exitDepth 为止; exitDepth 为 0 时执行完整个程序
+        std::shared_ptr<Object> execute(int exitDepth) {
+            while (true) {
+                Frame& frame = currentFrame();
+                Instructions& ins = frame.instructions();
+                if (frame.ip >= static_cast<int>(ins.size()) - 1) {
+                    break;
+                }
+                int ip = ++frame.ip;
+                auto op = static_cast<Opcode>(ins[ip]);
+                std::shared_ptr<Object> err;
+
+                switch (op) {
+                    case OpConstant: {
+                        int constIndex = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        err = push(constants[constIndex]);
+                        break;
+                    }
+                    case OpPop:
+                        pop();
+                        break;
+                    case OpAdd:
+                    case OpSub:
+                    case OpMul:
+                    case OpDiv:
+                    case OpEqual:
+                    case OpNotEqual:
+                    case OpGreaterThan:
+                    case OpLessThan:
+                        err = executeBinaryOperation(op);
+                        break;
+                    case OpTrue:
+                        err = push(Value::fromBool(true));
+                        break;
+                    case OpFalse:
+                        err = push(Value::fromBool(false));
+                        break;
+                    case OpNull:
+                        err = push(Value::null());
+                        break;
+                    case OpBang:
+                        err = executeBangOperator();
+                        break;
+                    case OpMinus:
+                        err = executeMinusOperator();
+                        break;
+                    case OpJump: {
+                        int pos = readUint16(ins, ip + 1);
+                        frame.ip = pos - 1;
+                        break;
+                    }
+                    case OpJumpNotTruthy: {
+                        int pos = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        auto condition = pop();
+                        if (!isTruthy(condition)) {
+                            frame.ip = pos - 1;
+                        }
+                        break;
+                    }
+                    case OpIterNext: {
+                        int pos = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        auto index = pop();
+                        auto iterable = pop();
+                        if (!iterable.is(ObjectKind::ARRAY)) {
+                            return std::make_shared<Error>("cannot iterate over " + iterable.type());
+                        }
+                        auto array = iterable.as<Array>();
+                        if (index.asInt() < static_cast<int64_t>(array->size())) {
+                            err = push((*array)[index.asInt()]);
+                        } else {
+                            frame.ip = pos - 1;
+                        }
+                        break;
+                    }
+                    case OpSetGlobal: {
+                        int globalIndex = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        if (globalIndex < readOnlyGlobals) {
+                            return std::make_shared<Error>("cannot assign to read-only binding: global #" + std::to_string(globalIndex));
+                        }
+                        if (copiedGlobals) {
+                            wroteCopiedBinding() = true;
+                            return std::make_shared<Error>("cannot assign to global in a parallel callback: global #" + std::to_string(globalIndex));
+                        }
+                        (*globals)[globalIndex] = pop();
+                        break;
+                    }
+                    case OpGetGlobal: {
+                        int globalIndex = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        auto& value = (*globals)[globalIndex];
+                        if (value.isEmpty()) {
+                            return std::make_shared<Error>("identifier not found: global #" + std::to_string(globalIndex));
+                        }
+                        err = push(value);
+                        break;
+                    }
+                    case OpSetLocal: {
+                        int localIndex = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        stack[frame.basePointer + localIndex] = pop();
+                        break;
+                    }
+                    case OpGetLocal: {
+                        int localIndex = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        err = push(stack[frame.basePointer + localIndex]);
+                        break;
+                    }
+                    case OpGetBuiltin: {
+                        int builtinIdx = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        err = push(builtinList[builtinIdx]);
+                        break;
+                    }
+                    case OpGetFree: {
+                        int freeIndex = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        err = push(frame.cl->free[freeIndex]);
+                        break;
+                    }
+                    case OpCurrentClosure:
+                        err = push(frame.cl);
+                        break;
+                    case OpMakeCell: {
+                        int localIndex = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        // 参数的槽位中是实参; 其余局部变量的槽位还没有写入, 可能残留之前调用的值
+                        auto& slot = stack[frame.basePointer + localIndex];
+                        slot = std::make_shared<Cell>(localIndex < frame.cl->fn->numParameters ? std::move(slot) : Value());
+                        break;
+                    }
+                    case OpGetCell: {
+                        Value cell = pop();
+                        auto& value = cell.as<Cell>()->value;
+                        if (value.isEmpty()) {
+                            return std::make_shared<Error>("identifier not found: captured variable");
+                        }
+                        err = push(value);
+                        break;
+                    }
+                    case OpSetCell: {
+                        Value cell = pop();
+                        if (cell.as<Cell>()->copied) {
+                            wroteCopiedBinding() = true;
+                            return std::make_shared<Error>("cannot assign to captured variable in a parallel callback");
+                        }
+                        cell.as<Cell>()->value = pop();
+                        break;
+                    }
+                    case OpArray: {
+                        int numElements = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        std::vector<Value> elements(stack.begin() + (sp - numElements), stack.begin() + sp);
+                        sp -= numElements;
+                        err = push(std::make_shared<Array>(elements));
+                        break;
+                    }
+                    case OpHash: {
+                        int numElements = readUint16(ins, ip + 1);
+                        frame.ip += 2;
+                        Value hash = buildHash(sp - numElements, sp, err);
+                        if (err != nullptr) {
+                            return err;
+                        }
+                        sp -= numElements;
+                        err = push(hash);
+                        break;
+                    }
+                    case OpIndex: {
+                        auto index = pop();
+                        auto left = pop();
+                        err = executeIndexExpression(left, index);
+                        break;
+                    }
+                    case OpCall: {
+                        int numArgs = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        err = collectGarbage();
+                        if (err == nullptr) {
+                            err = executeCall(numArgs);
+                        }
+                        break;
+                    }
+                    case OpTailCall: {
+                        int numArgs = readUint8(ins, ip + 1);
+                        frame.ip += 1;
+                        err = collectGarbage();
+                        if (err == nullptr) {
+                            err = executeTailCall(numArgs);
+                        }
+                        break;
+                    }
+                    case OpReturnValue: {
+                        auto returnValue = pop();
+                        // 顶层 return 直接结束程序
+                        if (framesIndex == 1) {
+                            lastPopped = returnValue;
+                            returnedMain = true;
+                            return nullptr;
+                        }
+                        bool noValue = lastPoppedNoValue;
+                        Frame& returning = popFrame();
+                        sp = returning.basePointer - 1;
+                        err = push(noValue ? Value() : std::move(returnValue));
+                        if (framesIndex == exitDepth) {
+                            return err;
+                        }
+                        break;
+                    }
+                    case OpReturn: {
+                        if (framesIndex == 1) {
+                            return nullptr;
+                        }
+                        Frame& returning = popFrame();
+                        sp = returning.basePointer - 1;
+                        err = push(Value());
+                        if (framesIndex == exitDepth) {
+                            return err;
+                        }
+                        break;
+                    }
+                    case OpClosure: {
+                        int constIndex = readUint16(ins, ip + 1);
+                        int numFree = readUint8(ins, ip + 3);
+                        frame.ip += 3;
+                        err = pushClosure(constIndex, numFree);
+                        break;
+                    }
+                    default:
+                        return std::make_shared<Error>("unknown opcode: " + std::to_string(op));
+                }
+
+                if (err != nullptr) {
+                    return err;
+                }
+            }
+            return nullptr;
+        }
+
+    public:
+        // 最近一次被弹出的栈顶元素, 即最后一个表达式语句的值; 它来自没有返回值的调用时为 EMPTY, 与解释器一样不输出
+        Value lastPoppedStackElem() {
+            return lastPoppedNoValue ? Value() : lastPopped;
+        }
+
+        // 运行结束后取回常量池, 留给下一次编译继续追加
+        std::vector<Value> takeConstants() {
+            return std::move(constants);
+        }
+
+        // 是否因顶层 return 结束
+        bool returnedFromMain() const {
+            return returnedMain;
+        }
+
+    private:
+        Frame& currentFrame() {
+            return frames[framesIndex - 1];
+        }
+
+        bool pushFrame(const Frame& f) {
+            if (framesIndex >= static_cast<int>(frames.size())) {
+                if (framesIndex >= MAX_FRAMES) {
+                    return false;
+                }
+                frames.resize(std::min(frames.size() * 2, static_cast<size_t>(MAX_FRAMES)));
+            }
+            frames[framesIndex++] = f;
+            return true;
+        }
+
+        Frame& popFrame() {
+            return frames[--framesIndex];
+        }
+
+        // 保证栈至少有 size 个槽位, 超过上限时返回 false
+        bool reserveStack(int size) {
+            if (size <= static_cast<int>(stack.size())) {
+                return true;
+            }
+            if (size > STACK_SIZE) {
+                return false;
+            }
+            stack.resize(std::min(std::max(static_cast<size_t>(size), stack.size() * 2), static_cast<size_t>(STACK_SIZE)));
+            return true;
+        }
+
+        std::shared_ptr<Object> push(Value obj) {
+            if (sp >= static_cast<int>(stack.size()) && !reserveStack(sp + 1)) {
+                return std::make_shared<Error>("stack overflow");
+            }
+            // 内置函数和没有返回值的函数以 EMPTY 表示没有值, 入栈时视作 null, 并记下它的位置
+            if (obj.isEmpty()) {
+                obj = Value::null();
+                noValueSlot = sp;
+            } else if (sp == noValueSlot) {
+                noValueSlot = -1;
+            }
+            stack[sp++] = std::move(obj);
+            return nullptr;
+        }
+
+        Value pop() {
+            lastPopped = stack[--sp];
+            lastPoppedNoValue = sp == noValueSlot;
+            return lastPopped;
+        }
+
+        bool isTruthy(const Value& obj) {
+            return !obj.isNull() && !(obj.isBool() && !obj.asBool());
+        }
+
+        std::shared_ptr<Object> executeBinaryOperation(Opcode op) {
+            auto right = pop();
+            auto left = pop();
+            if (left.isInt() && right.isInt()) {
+                return executeIntegerOperation(op, left.asInt(), right.asInt());
+            }
+            if (left.is(ObjectKind::STRING) && right.is(ObjectKind::STRING)) {
+                return executeStringOperation(op, left, right);
+            } else if (op == OpEqual) {
+                return push(Value::fromBool(left.identical(right)));
+            } else if (op == OpNotEqual) {
+                return push(Value::fromBool(!left.identical(right)));
+            } else if (left.kind() != right.kind()) {
+                return std::make_shared<Error>("type mismatch: " + left.type() + " " + operatorString(op) + " " + right.type());
+            }
+            return std::make_shared<Error>("unknown operator: " + left.type() + " " + operatorString(op) + " " + right.type());
+        }
+
+        std::shared_ptr<Object> executeIntegerOperation(Opcode op, int64_t leftVal, int64_t rightVal) {
+            switch (op) {
+                case OpAdd:
+                    return push(Value::fromInt(wrappingAdd(leftVal, rightVal)));
+                case OpSub:
+                    return push(Value::fromInt(wrappingSub(leftVal, rightVal)));
+                case OpMul:
+                    return push(Value::fromInt(wrappingMul(leftVal, rightVal)));
+                case OpDiv: {
+                    std::string error = divisionError(leftVal, rightVal);
+                    if (!error.empty()) {
+                        return std::make_shared<Error>(error);
+                    }
+                    return push(Value::fromInt(leftVal / rightVal));
+                }
+                case OpEqual:
+                    return push(Value::fromBool(leftVal == rightVal));
+                case OpNotEqual:
+                    return push(Value::fromBool(leftVal != rightVal));
+                case OpGreaterThan:
+                    return push(Value::fromBool(leftVal > rightVal));
+                case OpLessThan:
+                    return push(Value::fromBool(leftVal < rightVal));
+                default:
+                    return std::make_shared<Error>("unknown operator: INTEGER " + operatorString(op) + " INTEGER");
+            }
+        }
+
+        std::shared_ptr<Object> executeStringOperation(Opcode op, const Value& left, const Value& right) {
+            auto leftVal = left.as<Strin>();
+            auto rightVal = right.as<Strin>();
+            switch (op) {
+                case OpAdd:
+                    return push(Strin::concat(*leftVal, *rightVal));
+                case OpEqual:
+                    return push(Value::fromBool(leftVal->equals(rightVal)));
+                case OpNotEqual:
+                    return push(Value::fromBool(!leftVal->equals(rightVal)));
+                default:
+                    return std::make_shared<Error>("unknown operator: STRING " + operatorString(op) + " STRING");
+            }
+        }
+
+        std::string operatorString(Opcode op) {
+            switch (op) {
+                case OpAdd: return "+";
+                case OpSub: return "-";
+                case OpMul: return "*";
+                case OpDiv: return "/";
+                case OpEqual: return "==";
+                case OpNotEqual: return "!=";
+                case OpGreaterThan: return ">";
+                case OpLessThan: return "<";
+                default: return definitions.at(op).name;
+            }
+        }
+
+        std::shared_ptr<Object> executeBangOperator() {
+            auto operand = pop();
+            return push(Value::fromBool(!isTruthy(operand)));
+        }
+
+        std::shared_ptr<Object> executeMinusOperator() {
+            auto operand = pop();
+            if (!operand.isInt()) {
+                return std::make_shared<Error>("unknown operator: -" + operand.type());
+            }
+            return push(Value::fromInt(wrappingNeg(operand.asInt())));
+        }
+
+        Value buildHash(int startIndex, int endIndex, std::shared_ptr<Object>& err) {
+            auto hash = std::make_shared<HashTable>();
+            for (int i = startIndex; i < endIndex; i += 2) {
+                auto& key = stack[i];
+                if (!hash->set(key, stack[i + 1])) {
+                    err = std::make_shared<Error>("unusable as hash key: " + key.type());
+                    return Value();
+                }
+            }
+            return hash;
+        }
+
+        std::shared_ptr<Object> executeIndexExpression(const Value& left, const Value& index) {
+            if (left.is(ObjectKind::ARRAY) && index.isInt()) {
+                auto array = left.as<Array>();
+                auto idx = index.asInt();
+                if (idx < 0 || idx >= static_cast<int64_t>(array->size())) {
+                    return push(Value::null());
+                }
+                return push((*array)[idx]);
+            } else if (left.is(ObjectKind::HASH_TABLE)) {
+                bool hashable;
+                auto value = left.as<HashTable>()->get(index, hashable);
+                if (!hashable) {
+                    return std::make_shared<Error>("unusable as hash key: " + index.type());
+                }
+                if (value == nullptr) {
+                    return push(Value::null());
+                }
+                return push(*value);
+            }
+            return std::make_shared<Error>("index operator not supported: " + left.type());
+        }
+
+        // 安全点: 所有运行时对象都由栈, 帧或全局表中的 shared_ptr 持有
+        std::shared_ptr<Object> collectGarbage() {
+            auto& heap = Heap::instance();
+            if (!heap.collectIfNeeded()) {
+                return std::make_shared<Error>("heap limit exceeded: live=" + std::to_string(heap.getStats().live) + ", limit=" + std::to_string(heap.getLimit()));
+            }
+            return nullptr;
+        }
+
+        std::shared_ptr<Object> executeCall(int numArgs) {
+            auto callee = stack[sp - 1 - numArgs];
+            auto kind = callee.kind();
+            if (kind == ObjectKind::CLOSURE) {
+                auto cl = std::static_pointer_cast<Closure>(callee.obj());
+                if (numArgs != cl->fn->numParameters) {
+                    return std::make_shared<Error>("wrong number of arguments: want=" + std::to_string(cl->fn->numParameters) + ", got=" + std::to_string(numArgs));
+                }
+                int basePointer = sp - numArgs;
+                if (!reserveStack(basePointer + cl->fn->numLocals) || !pushFrame(Frame(cl, basePointer))) {
+                    return std::make_shared<Error>("stack overflow");
+                }
+                sp = basePointer + cl->fn->numLocals;
+                return nullptr;
+            } else if (kind == ObjectKind::BUILTIN) {
+                auto builtin = callee.as<Builtin>();
+                auto result = builtin->fn(ValueSpan(stack.data() + (sp - numArgs), numArgs));
+                sp = sp - numArgs - 1;
+                if (result.is(ObjectKind::ERROR)) {
+                    return result.obj();
+                }
+                return push(result);
+            }
+            return std::make_shared<Error>("not a function: " + callee.type());
+        }
+
+        // 尾调用: 把被调函数和实参挪到当前帧的位置, 用新闭包替换当前帧, 帧栈深度不变
+        std::shared_ptr<Object> executeTailCall(int numArgs) {
+            auto& callee = stack[sp - 1 - numArgs];
+            if (!callee.is(ObjectKind::CLOSURE)) {
+                return executeCall(numArgs);
+            }
+            auto cl = std::static_pointer_cast<Closure>(callee.obj());
+            if (numArgs != cl->fn->numParameters) {
+                return std::make_shared<Error>("wrong number of arguments: want=" + std::to_string(cl->fn->numParameters) + ", got=" + std::to_string(numArgs));
+            }
+            Frame& frame = currentFrame();
+            int basePointer = frame.basePointer;
+            int from = sp - 1 - numArgs;
+            for (int i = 0; i <= numArgs; ++i) {
+                stack[basePointer - 1 + i] = stack[from + i];
+            }
+            if (!reserveStack(basePointer + cl->fn->numLocals)) {
+                return std::make_shared<Error>("stack overflow");
+            }
+            frame = Frame(cl, basePointer);
+            sp = basePointer + cl->fn->numLocals;
+            return nullptr;
+        }
+
+        std::shared_ptr<Object> pushClosure(int constIndex, int numFree) {
+            auto& constant = constants[constIndex];
+            if (!constant.is(ObjectKind::COMPILED_FUNCTION)) {
+                return std::make_shared<Error>("not a function: " + constant.type());
+            }
+            auto fn = std::static_pointer_cast<CompiledFunction>(constant.obj());
+            std::vector<Value> free(stack.begin() + (sp - numFree), stack.begin() + sp);
+            sp -= numFree;
+            return push(std::make_shared<Closure>(fn, free));
+        }
+
+    private:
+        std::vector<Value> constants;
+        std::shared_ptr<std::vector<Value>> globals;
+        int readOnlyGlobals = 0;
+        bool copiedGlobals = false; // 工作线程上的副本: 全局变量是拷贝, 写入对原线程不可见
+
+        std::vector<Value> stack;
+        int sp;     // 指向下一个空闲槽位, 栈顶为 stack[sp-1]
+        Value lastPopped;
+        int noValueSlot = -1;           // 栈上由 EMPTY 转换来的 null 所在的位置
+        bool lastPoppedNoValue = false;
+        bool returnedMain = false;
+
+        std::vector<Frame> frames;
+        int framesIndex;
+        int nestedCalls = 0;
+    };
+} // namespace monkey